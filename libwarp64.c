@@ -0,0 +1,413 @@
+/*
+ * libwarp64.c
+ * ===========
+ *
+ * Implementation of libwarp64.h
+ *
+ * See the header for further information.
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+#include "libwarp64.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "warp64k.h"
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * The transform context declared in the header.
+ */
+struct WARP64_CTX_TAG {
+
+  /*
+   * The key pattern applied to the data.  When descrambling, this is
+   * built from the inverted key.
+   */
+  WARP64K_KEY kk;
+
+  /*
+   * The normalized key, as given to warp64_init().
+   */
+  int32_t key;
+
+  /*
+   * The transform mode.
+   */
+  int mode;
+
+  /*
+   * The stream offset.
+   */
+  int64_t off;
+
+};
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * Makes sure the kernel is selected exactly once.
+ */
+static pthread_once_t m_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The base-64 digits.
+ */
+static const char m_digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*
+ * Public function implementations
+ * ===============================
+ *
+ * See the header for specifications.
+ */
+
+/*
+ * warp64_derive function.
+ */
+int32_t warp64_derive(const char *pKey) {
+  int status = 1;
+  size_t slen = 0;
+  int32_t mixed = 0;
+  int32_t acc = 0;
+  int d = 0;
+  int i = 0;
+  char ext[3];
+  char b64[4];
+  uint8_t cbc[3];
+
+  /* Initialize arrays */
+  memset(ext, 0, 3);
+  memset(b64, 0, 4);
+  memset(cbc, 0, 3);
+
+  /* Check parameter */
+  if (pKey == NULL) {
+    abort();
+  }
+
+  /* Determine length of original key string, excluding terminating
+   * nul, and fail if empty */
+  slen = strlen(pKey);
+  if (slen < 1) {
+    status = 0;
+  }
+
+  /* Determine the three extension characters that will be used if
+   * padding is necessary */
+  if (status) {
+    if (slen == 1) {
+      ext[0] = pKey[0];
+      ext[1] = pKey[0];
+      ext[2] = pKey[0];
+
+    } else if (slen == 2) {
+      ext[0] = pKey[0];
+      ext[1] = pKey[1];
+      ext[2] = pKey[0];
+
+    } else {
+      ext[0] = pKey[0];
+      ext[1] = pKey[1];
+      ext[2] = pKey[2];
+    }
+  }
+
+  /* Keep updating the result until we have processed all of the key */
+  if (status) {
+    mixed = 0;
+    while (slen > 0) {
+      /* Fill b64 buffer with four base-64 characters and update slen as
+       * well as pKey, using extension characters if necessary */
+      if (slen == 1) {
+        b64[0] = pKey[0];
+        b64[1] = ext[0];
+        b64[2] = ext[1];
+        b64[3] = ext[2];
+        slen--;
+        pKey++;
+
+      } else if (slen == 2) {
+        memcpy(b64, pKey, 2);
+        b64[2] = ext[0];
+        b64[3] = ext[1];
+        slen -= 2;
+        pKey += 2;
+
+      } else if (slen == 3) {
+        memcpy(b64, pKey, 3);
+        b64[3] = ext[0];
+        slen -= 3;
+        pKey += 3;
+
+      } else {
+        memcpy(b64, pKey, 4);
+        slen -= 4;
+        pKey += 4;
+      }
+
+      /* Decode the four base-64 characters into a packed integer */
+      acc = 0;
+      for(i = 0; i < 4; i++) {
+        d = warp64_digit(b64[i]);
+        if (d < 0) {
+          status = 0;
+          break;
+        }
+        acc = (acc << 6) | ((int32_t) d);
+      }
+      if (!status) {
+        break;
+      }
+
+      /* XOR in the new segment into the mixed key */
+      mixed = mixed ^ acc;
+    }
+  }
+
+  /* Unpack the mixed key and replace zero components */
+  if (status) {
+    cbc[0] = (uint8_t) ((mixed >> 16) & 0xff);
+    cbc[1] = (uint8_t) ((mixed >>  8) & 0xff);
+    cbc[2] = (uint8_t) ( mixed        & 0xff);
+
+    if (cbc[0] == 0) {
+      cbc[0] = (uint8_t) 1;
+    }
+    if (cbc[1] == 0) {
+      cbc[1] = (uint8_t) 2;
+    }
+    if (cbc[2] == 0) {
+      cbc[2] = (uint8_t) 4;
+    }
+
+    mixed =   (((int32_t) cbc[0]) << 16)
+            + (((int32_t) cbc[1]) <<  8)
+            + ( (int32_t) cbc[2]       );
+  }
+
+  /* If failure, set result to -1 */
+  if (!status) {
+    mixed = -1;
+  }
+
+  return mixed;
+}
+
+/*
+ * warp64_digit function.
+ */
+int warp64_digit(int c) {
+  int result = 0;
+
+  if ((c >= 'A') && (c <= 'Z')) {
+    result = c - 'A';
+
+  } else if ((c >= 'a') && (c <= 'z')) {
+    result = (c - 'a') + 26;
+
+  } else if ((c >= '0') && (c <= '9')) {
+    result = (c - '0') + 52;
+
+  } else if (c == '+') {
+    result = 62;
+
+  } else if (c == '/') {
+    result = 63;
+
+  } else {
+    result = -1;
+  }
+
+  return result;
+}
+
+/*
+ * warp64_encode function.
+ */
+void warp64_encode(int32_t key, char *pBuf) {
+  int i = 0;
+
+  if ((key < 0) || (key > 0xffffffL) || (pBuf == NULL)) {
+    abort();
+  }
+
+  for(i = 0; i < WARP64_KEYSTR; i++) {
+    pBuf[i] = m_digits[(key >> (6 * (WARP64_KEYSTR - 1 - i))) & 0x3f];
+  }
+  pBuf[WARP64_KEYSTR] = (char) 0;
+}
+
+/*
+ * warp64_recover function.
+ */
+int32_t warp64_recover(int64_t off, const uint8_t *pTrailer) {
+  int32_t tk = 0;
+  int z = 0;
+  int i = 0;
+
+  if ((off < 0) || (pTrailer == NULL)) {
+    abort();
+  }
+
+  /* Figure out the index of the key octet used for the first byte of
+   * the trailer, and pack the re-ordered trailer bytes */
+  z = (int) (3 - (off % 3));
+  for(i = 0; i < 3; i++) {
+    tk = (tk << 8) | ((int32_t) pTrailer[(z + i) % 3]);
+  }
+
+  return tk;
+}
+
+/*
+ * warp64_invert function.
+ */
+int32_t warp64_invert(int32_t key) {
+  int32_t result = 0;
+  int i = 0;
+  int b = 0;
+
+  if ((key < 0) || (key > 0xffffffL)) {
+    abort();
+  }
+
+  for(i = 2; i >= 0; i--) {
+    b = (int) ((key >> (i * 8)) & 0xff);
+    result = (result << 8) | ((int32_t) ((256 - b) % 256));
+  }
+
+  return result;
+}
+
+/*
+ * warp64_init function.
+ */
+WARP64_CTX *warp64_init(int32_t key, int mode) {
+  WARP64_CTX *pc = NULL;
+
+  if ((key < 0) || (key > 0xffffffL)) {
+    abort();
+  }
+  if ((mode != WARP64_SCRAMBLE) && (mode != WARP64_DESCRAMBLE)) {
+    abort();
+  }
+
+  if (pthread_once(&m_once, &warp64k_init)) {
+    abort();
+  }
+
+  pc = (WARP64_CTX *) calloc(1, sizeof(WARP64_CTX));
+  if (pc == NULL) {
+    return NULL;
+  }
+
+  pc->key = key;
+  pc->mode = mode;
+  pc->off = 0;
+  if (mode == WARP64_DESCRAMBLE) {
+    warp64k_key(&(pc->kk), warp64_invert(key));
+  } else {
+    warp64k_key(&(pc->kk), key);
+  }
+
+  return pc;
+}
+
+/*
+ * warp64_update function.
+ */
+void warp64_update(
+          WARP64_CTX * pc,
+    const uint8_t    * pIn,
+          uint8_t    * pOut,
+          size_t       len) {
+
+  if (pc == NULL) {
+    abort();
+  }
+
+  warp64_update_at(pc, pc->off, pIn, pOut, len);
+  pc->off += (int64_t) len;
+}
+
+/*
+ * warp64_update_at function.
+ */
+void warp64_update_at(
+    const WARP64_CTX * pc,
+          int64_t      off,
+    const uint8_t    * pIn,
+          uint8_t    * pOut,
+          size_t       len) {
+
+  if ((pc == NULL) || (off < 0)) {
+    abort();
+  }
+  if (len < 1) {
+    return;
+  }
+
+  warp64k_run(&(pc->kk), (int) (off % 3), pIn, pOut, len);
+}
+
+/*
+ * warp64_offset function.
+ */
+int64_t warp64_offset(const WARP64_CTX *pc) {
+  if (pc == NULL) {
+    abort();
+  }
+  return pc->off;
+}
+
+/*
+ * warp64_seek function.
+ */
+void warp64_seek(WARP64_CTX *pc, int64_t off) {
+  if ((pc == NULL) || (off < 0)) {
+    abort();
+  }
+  pc->off = off;
+}
+
+/*
+ * warp64_final function.
+ */
+int warp64_final(WARP64_CTX *pc, uint8_t *pTrailer) {
+  int result = WARP64_OK;
+
+  if (pc == NULL) {
+    abort();
+  }
+
+  /* The trailer is three zero bytes, scrambled at the end of the
+   * data; when descrambling, the trailer in the stream must therefore
+   * recover to the key */
+  if (pTrailer != NULL) {
+    if (pc->mode == WARP64_SCRAMBLE) {
+      warp64k_run(&(pc->kk), (int) (pc->off % 3), NULL,
+                  pTrailer, WARP64_TRAILER);
+    } else {
+      if (warp64_recover(pc->off, pTrailer) != pc->key) {
+        result = WARP64_ERR_KEY;
+      }
+    }
+  }
+
+  memset(pc, 0, sizeof(WARP64_CTX));
+  free(pc);
+
+  return result;
+}
@@ -0,0 +1,302 @@
+#ifndef LIBWARP64_H_INCLUDED
+#define LIBWARP64_H_INCLUDED
+
+/*
+ * libwarp64.h
+ * ===========
+ *
+ * Embeddable streaming interface to the Warp64 transform.
+ *
+ * This module lets a program scramble and descramble Warp64 data in
+ * its own buffers, without going through the warp64 program and temp
+ * files.  A transform is started with warp64_init(), fed any number of
+ * buffers with warp64_update(), and finished with warp64_final().  The
+ * context keeps track of the byte offset in the stream, so buffers of
+ * any size may be passed and the key phase carries over from one call
+ * to the next.  Buffers may be transformed in place by passing the same
+ * pointer for input and output.
+ *
+ * A scrambled stream is the scrambled data followed by a three-byte
+ * trailer.  When scrambling, warp64_final() writes the trailer, which
+ * the caller appends to the output.  When descrambling, the caller
+ * passes everything except the last three bytes to warp64_update(),
+ * and then passes the last three bytes to warp64_final(), which checks
+ * them against the key.  A caller that doesn't know where its stream
+ * ends must hold back the last three bytes it has seen itself.
+ *
+ * Keys are handled in their normalized form, which is three octets
+ * packed into the 24 least significant bits of an integer, with the
+ * third octet in the least significant bits.  Use warp64_derive() to
+ * get the normalized key for a key string.  The same normalized key is
+ * used for both scrambling and descrambling.
+ *
+ * A context may be used by one thread at a time, except that
+ * warp64_update_at() doesn't change the context, so it may be called
+ * on the same context from several threads at once.  That is how a
+ * large file can be processed in windows by a pool of threads.
+ *
+ * The transform is performed by the fastest kernel in warp64k.c that
+ * the processor supports, which is selected the first time a context
+ * is created.  That module must be compiled and linked in, along with
+ * the POSIX threads library.
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The transform modes for warp64_init().
+ */
+#define WARP64_SCRAMBLE   (0)
+#define WARP64_DESCRAMBLE (1)
+
+/*
+ * The number of bytes in the trailer of a scrambled stream.
+ */
+#define WARP64_TRAILER (3)
+
+/*
+ * The number of characters of a key string returned by
+ * warp64_encode(), not including the terminating nul.
+ */
+#define WARP64_KEYSTR (4)
+
+/*
+ * The maximum number of characters in a key string that the Warp64
+ * tools accept, so that a key one of them takes is taken by all of
+ * them.  warp64_derive() itself works on key strings of any length.
+ */
+#define WARP64_KEYMAX (255)
+
+/*
+ * Result codes of warp64_final().
+ */
+#define WARP64_OK      (0)
+#define WARP64_ERR_KEY (1)
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * A transform context.
+ *
+ * The structure is private to this module.
+ */
+typedef struct WARP64_CTX_TAG WARP64_CTX;
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Derive the normalized key for a key string.
+ *
+ * The key string is one or more base-64 characters, from the set
+ * A-Z a-z 0-9 + / with no padding.
+ *
+ * Parameters:
+ *
+ *   pKey - the nul-terminated key string
+ *
+ * Return:
+ *
+ *   the normalized key, or -1 if the key is empty or has characters
+ *   that are not base-64
+ */
+int32_t warp64_derive(const char *pKey);
+
+/*
+ * Decode a character of a key string.
+ *
+ * Parameters:
+ *
+ *   c - the character code
+ *
+ * Return:
+ *
+ *   the base-64 value of the character, or -1 if it isn't one of
+ *   A-Z a-z 0-9 + /
+ */
+int warp64_digit(int c);
+
+/*
+ * Encode a normalized key as a key string.
+ *
+ * The key string is written as exactly WARP64_KEYSTR base-64 characters
+ * followed by a terminating nul, and warp64_derive() on it gives the
+ * same normalized key back.
+ *
+ * Parameters:
+ *
+ *   key - the normalized key
+ *
+ *   pBuf - receives the key string, with room for WARP64_KEYSTR + 1
+ *   characters
+ */
+void warp64_encode(int32_t key, char *pBuf);
+
+/*
+ * Recover the normalized key from the trailer of a scrambled stream.
+ *
+ * This is the key recovery procedure.  Any key string that derives the
+ * returned key will descramble the stream.
+ *
+ * Parameters:
+ *
+ *   off - the byte offset of the first trailer byte in the stream,
+ *   which is the length of the stream minus three
+ *
+ *   pTrailer - the three trailer bytes
+ *
+ * Return:
+ *
+ *   the normalized key
+ */
+int32_t warp64_recover(int64_t off, const uint8_t *pTrailer);
+
+/*
+ * Invert a packed key, so that a transform with the inverted key undoes
+ * a transform with the original one.
+ *
+ * Each component byte b is replaced by (256 - b) MOD 256.  This is the
+ * key a descrambling context applies.
+ *
+ * Parameters:
+ *
+ *   key - the packed key, in range [0, 0xffffff]
+ *
+ * Return:
+ *
+ *   the inverted packed key
+ */
+int32_t warp64_invert(int32_t key);
+
+/*
+ * Start a transform.
+ *
+ * The stream offset of the new context is zero.
+ *
+ * Parameters:
+ *
+ *   key - the normalized key, in range [0, 0xffffff]
+ *
+ *   mode - WARP64_SCRAMBLE or WARP64_DESCRAMBLE
+ *
+ * Return:
+ *
+ *   the new context, or NULL if out of memory
+ */
+WARP64_CTX *warp64_init(int32_t key, int mode);
+
+/*
+ * Transform bytes at the stream offset and advance the offset.
+ *
+ * pIn and pOut may be equal, in which case the buffer is transformed in
+ * place, but they must not otherwise overlap.  pIn may be NULL, in
+ * which case len zero bytes are transformed.
+ *
+ * Parameters:
+ *
+ *   pc - the context
+ *
+ *   pIn - the input bytes, or NULL
+ *
+ *   pOut - receives the output bytes
+ *
+ *   len - the number of bytes
+ */
+void warp64_update(
+          WARP64_CTX * pc,
+    const uint8_t    * pIn,
+          uint8_t    * pOut,
+          size_t       len);
+
+/*
+ * Transform bytes at a given stream offset.
+ *
+ * This is the same as warp64_update(), except that the bytes are at
+ * byte offset off of the stream, and the stream offset of the context
+ * is neither used nor changed.
+ *
+ * Parameters:
+ *
+ *   pc - the context
+ *
+ *   off - the stream offset of the first byte
+ *
+ *   pIn - the input bytes, or NULL
+ *
+ *   pOut - receives the output bytes
+ *
+ *   len - the number of bytes
+ */
+void warp64_update_at(
+    const WARP64_CTX * pc,
+          int64_t      off,
+    const uint8_t    * pIn,
+          uint8_t    * pOut,
+          size_t       len);
+
+/*
+ * Return the stream offset of a context.
+ *
+ * Parameters:
+ *
+ *   pc - the context
+ *
+ * Return:
+ *
+ *   the number of bytes transformed so far by warp64_update(), or the
+ *   offset last set with warp64_seek()
+ */
+int64_t warp64_offset(const WARP64_CTX *pc);
+
+/*
+ * Set the stream offset of a context.
+ *
+ * Parameters:
+ *
+ *   pc - the context
+ *
+ *   off - the new stream offset, zero or greater
+ */
+void warp64_seek(WARP64_CTX *pc, int64_t off);
+
+/*
+ * Finish a transform and release the context.
+ *
+ * When scrambling, the trailer that follows the bytes transformed so
+ * far is written to pTrailer.  When descrambling, pTrailer holds the
+ * last three bytes of the scrambled stream, which must come right
+ * after the bytes transformed so far, and they are checked against the
+ * key.
+ *
+ * pTrailer may be NULL to abandon the transform, in which case the
+ * context is just released.
+ *
+ * The context is released in every case and may not be used again.
+ *
+ * Parameters:
+ *
+ *   pc - the context
+ *
+ *   pTrailer - the three trailer bytes, or NULL
+ *
+ * Return:
+ *
+ *   WARP64_OK, or WARP64_ERR_KEY if descrambling and the trailer
+ *   doesn't match the key
+ */
+int warp64_final(WARP64_CTX *pc, uint8_t *pTrailer);
+
+#endif
@@ -6,8 +6,16 @@
  * 
  * Syntax:
  * 
- *   ./warp64 -s input.binary
- *   ./warp64 -d input.binary.warp64
+ *   ./warp64 [options] -s input.binary
+ *   ./warp64 [options] -d input.binary.warp64
+ *   ./warp64 [options] -s|-d - < input > output
+ *   ./warp64 [options] -s --append input.binary
+ *   ./warp64 [options] -s|-d --sink url input|-
+ *   ./warp64 [options] -s|-d path1 path2 ...
+ *   ./warp64 [options] -c path1.warp64 path2.warp64 ...
+ *   ./warp64 [options] -k path1.warp64 path2.warp64 ...
+ *   ./warp64 [options] -s --pack archive.warp64 path1 path2 ...
+ *   ./warp64 [options] -d|-c --pack archive.warp64 [name1 name2 ...]
  * 
  * -s is scrambling mode.  The scrambled file will be written to a path
  * that is the same as the input path, except with ".warp64" suffixed.
@@ -16,17 +24,308 @@
  * ".warp64".  The output path is the same as the input path, except
  * that ".warp64" is dropped from the end of it.
  * 
+ * -c is key verification mode.  Each input path must end with ".warp64".
+ * Only the trailer of each file is read, and it is checked against the
+ * key, without creating any output file.  A line is printed to standard
+ * output for each file, in the order the files were listed, which is
+ * "match", "mismatch" or "error" followed by a space and the path.  The
+ * exit status is only zero if every file matches.  -r walks directory
+ * trees for scrambled files, as in batch mode.  The trailers are read
+ * by a pool of threads, each with one read in flight, so -j sets the
+ * I/O depth; the default with -c is CHECK_DEPTH.
+ * 
+ * -k is re-key mode.  Each input path must end with ".warp64".  The
+ * current key is checked against the trailer of the file, and the file
+ * is then scrambled with a new key in a single pass, without ever
+ * writing the descrambled data anywhere.  Both descrambling with the
+ * old key and scrambling with the new key are additions in each key
+ * phase, so the pass adds the difference of the keys, and that also
+ * turns the old trailer into the new one.  The re-keyed file is written
+ * next to the original with a ".w64k" suffix and then renamed over the
+ * original, so an interrupted run leaves the original untouched.  With
+ * -i the file is instead re-keyed in place under a journal, and can be
+ * recovered with --finish or --rollback like any other in-place run.
+ * Several paths and -r work as in batch mode.  Both keys are read from
+ * the console, or with --key-file and --new-key-file.
+ * 
  * For both scrambling and descrambling, the output file path must NOT
  * exist yet or the program will fail.  For both scrambling and
  * descrambling, if the operation is successful, the input file will be
- * deleted at the end of the operation.
+ * deleted at the end of the operation.  --append, described below, is
+ * the exception to both.
  * 
  * The scrambling key will be requested and then read from the console,
  * so that it is not stored in the console history.
  * 
+ * The following options are supported:
+ * 
+ *   -j [count] processes memory-mapped windows on [count] worker
+ *   threads.  A count of zero uses one thread per online processor.
+ *   The default is one thread.
+ * 
+ *   --pin cpu pins each worker thread to its own processor, and
+ *   --pin node pins each worker thread to the processors of a NUMA
+ *   node, distributing threads round-robin across nodes.  Pinning is
+ *   only supported on Linux.
+ * 
+ *   -w [bytes] sets the window size, which is rounded up to a whole
+ *   number of pages.  -w auto, the default, picks a window for each
+ *   file instead: a single thread maps the whole file as one window,
+ *   and several threads split it into four windows per thread, so that
+ *   large files take only a few mappings.  Automatic windows are whole
+ *   huge pages, at least 4 MiB, and at most what fits in a quarter of
+ *   the free memory across the threads, up to 16 GiB on 64-bit systems.
+ *   They only grow past 4 MiB with the mmap backend and without
+ *   --nocache, --direct or rolling writeback, which all work best with
+ *   small windows.  -w accepts up to 64 GiB on 64-bit systems and 1 GiB
+ *   on 32-bit systems.  In-place runs always use 4 MiB windows, because
+ *   the journal layout depends on it.
+ * 
+ *   --hugepages backs windows with huge pages, so that a large window
+ *   costs a few TLB entries instead of one per page.  The buffers of
+ *   the pread and uring backends come from the reserved huge pages of
+ *   the system if there are any, and otherwise from transparent huge
+ *   pages.  The mmap backend asks for transparent huge pages on its
+ *   mappings, which the system only provides where the filesystem
+ *   caches files in huge pages.  Fixed window sizes should then be a
+ *   multiple of 2 MiB.
+ * 
+ *   -b mmap|pread|uring selects how windows are read and written.
+ *   mmap, the default, maps the windows of both files.  pread reads
+ *   each window into a buffer and writes it back with pwrite, which
+ *   avoids page faults and TLB shootdowns on filesystems where mapping
+ *   is slow, such as network filesystems.  uring keeps several chunk
+ *   reads and writes of each window in flight with io_uring, which is
+ *   only supported on Linux.  In-place runs and streaming have their
+ *   own I/O and ignore -b.
+ * 
+ *   --nocache writes back each finished window and drops it from the
+ *   page cache of both files, so that a bulk run does not push the
+ *   working set of everything else on the machine out of the cache.
+ *   --direct opens both files with O_DIRECT to bypass the page cache
+ *   entirely.  Each worker thread then transfers through its own
+ *   aligned buffers, and the output file is truncated to its proper
+ *   length at the end because the last window is written padded.
+ *   --direct uses the pread backend unless -b uring is given, and it
+ *   fails on filesystems that don't support O_DIRECT.  Like -b, these
+ *   options don't apply to in-place runs or streaming.
+ * 
+ *   --sparse makes sparse files, such as virtual machine images, cheap
+ *   to process.  Holes in the input file are found with SEEK_DATA and
+ *   SEEK_HOLE and are never read; the key pattern that zero bytes
+ *   scramble to is written for them directly.  Output blocks that come
+ *   out all zero, which is what holes descramble to, are punched out of
+ *   the output file, so a descrambled image keeps its sparse size.
+ *   Like --nocache, this doesn't apply to in-place runs or streaming,
+ *   and it is only supported on Linux.
+ * 
+ *   While a window is transformed, the input window after it is read
+ *   ahead into the page cache, so a single thread keeps the disk busy
+ *   instead of waiting for it one window at a time.  The mmap backend
+ *   also maps each input window with all its pages at once and
+ *   prefaults each output window for writing, which saves a page fault
+ *   for every page.  --no-prefetch turns this off, which may help when
+ *   many threads read from a slow random-access device.
+ * 
+ *   --sync none|final|rolling sets how output files are flushed to
+ *   disk.  With final, the default, each output file and its directory
+ *   entry are flushed with fdatasync() before the input file is
+ *   removed, so a crash can't lose both.  rolling also starts writeback
+ *   of each window as soon as it is finished, while later windows are
+ *   computed, and waits for the writeback of the window before it, so
+ *   dirty memory stays at about two windows per thread and the final
+ *   flush is short instead of a long stall.  none leaves everything to
+ *   the system, which is fastest but may lose data on a crash.  In-place
+ *   runs always flush each window, and streaming doesn't flush.
+ * 
+ *   --crc computes the CRC32C of the plaintext while scrambling and
+ *   writes it to a checksum file next to the scrambled file, with a
+ *   ".crc32c" suffix.  Whenever a scrambled file with a checksum file
+ *   is descrambled, the plaintext is checksummed as it is written and
+ *   checked against it; on a mismatch, the output is removed and the
+ *   scrambled file is kept.  The checksum file is removed along with
+ *   the scrambled file when it succeeds.  With -d, --crc makes a
+ *   missing checksum file an error.  The checksum is computed inside
+ *   the transform pass, a block at a time while the block is in the
+ *   cache, with the CRC32 instructions of SSE 4.2 or ARMv8 where
+ *   available, so the check reads nothing extra.  When streaming, the
+ *   CRC32C is printed to standard error instead.  --crc can't be
+ *   combined with -i, -k or -c; in-place runs neither write nor check
+ *   checksum files, and re-keying leaves them valid, since the
+ *   plaintext doesn't change.
+ * 
+ *   -i transforms the input file in place instead of writing a new
+ *   file, so no extra disk space is needed.  The trailer is appended
+ *   or dropped and the file is then renamed to the output path.  A
+ *   journal with a ".w64j" suffix is kept next to the input file while
+ *   the run is in progress.  If the run is interrupted, run the same
+ *   command again with --finish to complete it or --rollback to
+ *   restore the original file; the key is not needed for recovery.
+ *   -i can't be combined with -j.
+ * 
+ *   --checkpoint [count] keeps a checkpoint of a single file run next to
+ *   the output file, with a ".w64c" suffix.  Every [count] windows, the
+ *   output file is flushed and the checkpoint is updated with the offset
+ *   below which every window is finished, along with the CRC32C of the
+ *   plaintext so far when there is one.  If the run fails or is
+ *   interrupted, the partial output and the checkpoint are kept, and
+ *   running the same command again with --resume continues from the
+ *   checkpoint instead of starting over.  The checkpoint records the
+ *   length, inode and modification time of the input file, and a
+ *   resumed run checks them, as well as the output just before the
+ *   checkpoint against the key it is given, so that it can only
+ *   continue the same run.  --resume keeps checkpointing, every 64
+ *   windows unless --checkpoint is given, and always uses the window
+ *   size of the checkpoint.  Windows don't grow automatically with
+ *   checkpoints, so -w sets the granularity, 4 MiB by default.  The
+ *   checkpoint is removed when the run succeeds.  Both options work on
+ *   a single file with -s, -d or -k, and can't be combined with -c,
+ *   -i, -z, --pack or streaming.
+ * 
+ *   --append scrambles only what was added to a growing input file,
+ *   such as a log, since its scrambled file was last brought up to
+ *   date, so the cost is that of the new data instead of the whole
+ *   file.  The key phase of each byte only depends on its offset, so
+ *   the new bytes are scrambled on their own, starting over the old
+ *   trailer, and followed by a new one.  The first run creates the
+ *   scrambled file, and later runs check its trailer against the key
+ *   before anything else.  The last 4 KiB before the old end are then
+ *   checked against the input, so an input that was rotated or replaced
+ *   is refused; scramble it again from scratch instead.  The input is
+ *   read up to the length it had when the run started, and it is kept.
+ *   A checksum file is continued over the new data; with --crc, the
+ *   first run creates one and later runs require it.  If a run fails,
+ *   the scrambled file gets its old end back.  The scrambled file is
+ *   flushed as with --sync final unless --sync none is given.  --append
+ *   works on a single file with -s, and can't be combined with -i, -j,
+ *   -z, --pack, --sink, --checkpoint, --resume or streaming.
+ * 
+ *   An input path of "-" streams from standard input to standard
+ *   output instead of working on files.  The key is then read from the
+ *   controlling terminal.  When descrambling a stream, the last three
+ *   bytes are held back until end of input so that the trailer can be
+ *   checked and dropped; if the trailer is wrong, the output already
+ *   written must be discarded, and the program fails.  Streaming can't
+ *   be combined with -i or -j.
+ * 
+ *   -z compresses the data with zstd before it is scrambled, and
+ *   decompresses it after it is descrambled, for data such as raw
+ *   multimedia that scrambling alone only lightly disguises.  The file
+ *   or stream goes through the streaming pipeline, without any
+ *   intermediate file: a reader thread reads ahead while the previous
+ *   chunk is compressed on -j worker threads, and the compressed bytes
+ *   are scrambled and written as they come out.  The scrambled data
+ *   is a standard zstd frame with a content checksum, so descrambling
+ *   without -z gives a file that the zstd tool can decompress.  -z must
+ *   be given when descrambling too; a wrong key then fails on the
+ *   first chunk instead of only at the trailer.  --zlevel [n] sets the
+ *   compression level, from 1 to 19; the default is that of zstd.  -z
+ *   works on a single file or a stream, can't be combined with -i, -k,
+ *   -c or --splice, and ignores -b and the other window options.  It
+ *   is only available when the program is built with WARP64_ZSTD
+ *   defined and linked with libzstd.
+ * 
+ *   --splice writes streamed output with vmsplice() when standard
+ *   output is a pipe, avoiding a copy into the pipe.  Only use this
+ *   when the program on the other end of the pipe reads it with plain
+ *   reads, because pages handed to the pipe are reused once the pipe
+ *   has drained, and a reader using splice() or tee() might still be
+ *   referring to them.
+ * 
+ *   --sink [url] sends the output of a single file or stream over the
+ *   network instead of writing it to a file, so a scrambled copy never
+ *   touches the local disk.  tcp://host:port sends it over a TCP
+ *   connection as it is.  http://host[:port][/path] sends it as the
+ *   body of a chunked HTTP PUT request, and the run only succeeds if
+ *   the response has a 2xx status; there is no TLS, so HTTPS needs a
+ *   local proxy.  IPv6 addresses go in brackets.  The input goes
+ *   through the streaming pipeline, so each chunk is sent while the
+ *   next one is read and transformed, and the trailer is the end of
+ *   what is sent.  A scrambled file is checked against the key before
+ *   anything is sent.  The input file is kept, and if the run fails,
+ *   the connection is reset so that the other end can't mistake what
+ *   it got for all of it.  --sink works with -s and -d, with -z and
+ *   --crc as when streaming, and can't be combined with -c, -k, -i,
+ *   --pack, --splice, --checkpoint or --resume.
+ * 
+ *   Several input paths, or -r, select batch mode.  The key is read
+ *   once and used for every file.  With -r, directories are walked
+ *   recursively for files matching the mode: when scrambling, files
+ *   that already have the .warp64 suffix are skipped, and when
+ *   descrambling, only files with the suffix are picked up.  Symbolic
+ *   links found while walking are not followed.  The files are shared
+ *   by the -j worker threads, with each large file split into windows
+ *   and small files grouped together.  A failing file does not stop
+ *   the others; the failed files are listed at the end, and the exit
+ *   status is only zero if every file succeeded.  Batch mode can be
+ *   combined with -i, in which case files are processed one at a time.
+ * 
+ *   --pack [path] packs many files into a single scrambled archive
+ *   instead, which saves the create, trailer, flush and remove of each
+ *   file when there are very many small ones.  With -s, the paths are
+ *   listed as in batch mode, -r included, and the files are written
+ *   back to back to the archive in large sequential blocks, followed by
+ *   an index and a footer that are scrambled along with them.  The
+ *   index records the offset, length and key phase of each member under
+ *   its path, without any leading "/".  The archive must have the
+ *   .warp64 suffix and must not exist yet, and the packed files are
+ *   removed once it is complete.  With -d, the members are extracted
+ *   below the current directory under their names, which must not exist
+ *   yet.  An archive whose index has a name that could not have been
+ *   stored, such as one with a leading "/" or a "." or ".." component,
+ *   is refused as damaged, and members are never created through a
+ *   directory that is a symbolic link.  Any paths given are member
+ *   names, or directories of members, and only those members are read
+ *   from the archive, which is then kept.  Without names, every member
+ *   is extracted and the archive is removed.  With -c, the members are
+ *   listed on standard output, each as its length followed by a space
+ *   and its name.  The archive is an ordinary scrambled file, so
+ *   descrambling it without --pack gives the plain container.  --pack
+ *   can't be combined with -k, -i, -z or --crc, and ignores -j, -b and
+ *   the window options.
+ * 
+ *   --key-file [path] reads the key from the first line of a file
+ *   instead of the console, so that runs can be scripted.  With -k,
+ *   this is the current key, and --new-key-file [path] reads the new
+ *   key in the same way.
+ * 
+ *   --stats prints a report of the run to standard error when it is
+ *   done, and --stats-json [path] writes the same report to a file as
+ *   a JSON object.  The report has the wall time of the run, the bytes
+ *   and windows processed, the time spent in each phase with its
+ *   throughput, the minor and major page faults and the peak resident
+ *   set size.  The phases are setup, which opens the files, checks the
+ *   trailer and creates and sizes the output; io, which is everything
+ *   the backend does to a window except transforming it; transform;
+ *   and finish, which truncates, closes and removes files.  Phase times
+ *   are summed over the worker threads, so with -j they can add up to
+ *   more than the wall time.  With the mmap backend, page faults are
+ *   taken while transforming, so their cost counts as transform time.
+ *   When streaming or working in place, file setup is part of io.  The
+ *   wall time starts after the key has been read.  The JSON report
+ *   also has the largest window that a file job used, which is zero
+ *   when nothing went through window jobs.
+ * 
+ * The transform itself is performed through libwarp64.c, which runs the
+ * kernels in warp64k.c, and window I/O by the backends in warp64io.c,
+ * so those modules must be compiled and linked in:
+ * 
+ *   cc -D_FILE_OFFSET_BITS=64 -O2 -pthread -o warp64 warp64.c
+ *     libwarp64.c warp64k.c warp64io.c
+ * 
+ * To build with -z support, add -DWARP64_ZSTD and -lzstd.
+ * 
  * Must compile with _FILE_OFFSET_BITS=64
  */
 
+/* Linux extensions, needed for CPU affinity */
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -34,12 +333,35 @@
 #include <string.h>
 
 /* POSIX headers */
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/* Compression with -z, only when built with WARP64_ZSTD */
+#ifdef WARP64_ZSTD
+#include <zstd.h>
+#endif
+
+/* Warp64 headers */
+#include "libwarp64.h"
+#include "warp64k.h"
+#include "warp64io.h"
+
 /*
  * Check 64-bit file mode
  * ======================
@@ -61,7 +383,7 @@
 /*
  * The maximum length of the scrambling key that can be read.
  */
-#define MAX_KEY_LENGTH (255)
+#define MAX_KEY_LENGTH (WARP64_KEYMAX)
 
 /*
  * The suffix used for scrambled files.
@@ -75,1114 +397,10282 @@
  * the entrypoint and stored in m_winsize.
  * 
  * m_winsize is the actual memory-mapped window size.  WINDOW_TARGET is
- * only used near the start of the entrypoint for computing m_winsize.
+ * only used in the entrypoint for computing m_winsize, and it can be
+ * overridden with the -w option.  With automatic window sizes, this is
+ * the smallest window a file job gets.
  */
 #define WINDOW_TARGET (4194304L)
 
 /*
- * Data types
- * ==========
+ * The largest window size that may be requested with -w, and the
+ * largest window that automatic sizing picks.  Windows of both files of
+ * every thread must fit in the address space, so 32-bit systems get
+ * much smaller limits.
  */
+#if (SIZE_MAX > 0xffffffffUL) && (LONG_MAX > 0x7fffffffL)
+#define WINDOW_MAX (68719476736L)
+#define WINDOW_AUTO_MAX (17179869184L)
+#else
+#define WINDOW_MAX (1073741824L)
+#define WINDOW_AUTO_MAX (67108864L)
+#endif
 
 /*
- * Stores a nul-terminated scrambling key.
+ * With automatic window sizes and several threads, the number of
+ * windows each thread gets from a file, so that the threads still
+ * balance when some windows are slower than others.
  */
-typedef struct {
+#define WINDOW_SPLIT (4)
 
-  /*
-   * Buffer holding the scrambling key that was read.
-   * 
-   * The key must be nul-terminated.
-   */
-  char kbuf[MAX_KEY_LENGTH + 1];
+/*
+ * The maximum number of worker threads.
+ */
+#define MAX_THREADS (1024)
 
-} KEY_BUFFER;
+/*
+ * Thread pinning modes, for m_pin.
+ */
+#define PIN_NONE (0)
+#define PIN_CPU  (1)
+#define PIN_NODE (2)
 
 /*
- * Local data
- * ==========
+ * The --sync policies.
  */
+#define SYNC_NONE    (0)
+#define SYNC_FINAL   (1)
+#define SYNC_ROLLING (2)
 
 /*
- * The name of the executable module, for use in diagnostic messages.
+ * The suffix of the journal kept next to a file during an in-place run.
+ */
+#define JOURNAL_SUFFIX ".w64j"
+
+/*
+ * The suffix of the temporary file a re-key run writes next to a file
+ * before renaming it over the original.
+ */
+#define REKEY_SUFFIX ".w64k"
+
+/*
+ * The suffix of the checksum file that --crc writes next to a scrambled
+ * file, which holds the CRC32C of the plaintext.
+ */
+#define CRC_SUFFIX ".crc32c"
+
+/*
+ * Journal layout.
  * 
- * This is set at the start of the entrypoint.
+ * The journal starts with two header slots of JOURNAL_SLOT bytes each,
+ * each holding a JOURNAL record that begins with JOURNAL_MAGIC and ends
+ * with a hash of the record.  The two pre-image areas of m_winsize
+ * bytes each follow at JOURNAL_DATA.
  */
-static const char *pModule = NULL;
+#define JOURNAL_MAGIC "W64JRNL1"
+#define JOURNAL_SLOT (128)
+#define JOURNAL_DATA (256)
 
 /*
- * The window size to use for memory mapping.
+ * Journal phases.
  * 
- * Set near the start of the entrypoint.
+ * JPHASE_RUN means windows are still being transformed.  JPHASE_SIZE
+ * means all windows are transformed and flushed, and only the length
+ * change, rename, and journal removal are left.
  */
-static size_t m_winsize = 0;
+#define JPHASE_RUN  (1)
+#define JPHASE_SIZE (2)
 
 /*
- * Local functions
- * ===============
+ * The suffix of the checkpoint kept next to the output file of a run
+ * with --checkpoint or --resume.
  */
+#define CKPT_SUFFIX ".w64c"
 
-/* Prototypes */
-static int decode64(int c);
-static int readKey(KEY_BUFFER *kb);
-static int32_t deriveKey(const char *pKey);
+/*
+ * Checkpoint layout.
+ * 
+ * The checkpoint file holds two slots of CKPT_SLOT bytes, each holding
+ * a CHECKPOINT record that begins with CKPT_MAGIC and ends with a hash
+ * of the record.  Records alternate between the slots, as in the
+ * journal.
+ */
+#define CKPT_MAGIC "W64CKPT1"
+#define CKPT_SLOT (128)
 
-static int process64(
-    int     fIn,
-    int     fOut,
-    int32_t key,
-    int     trailer,
-    int64_t olen);
+/*
+ * The number of windows between checkpoints when --resume is given
+ * without --checkpoint.
+ */
+#define CKPT_WINDOWS (64)
 
-static int warp64(
-    const char * pInputPath,
-    const char * pOutputPath,
-          int    descramble,
-    const char * pKey);
+/*
+ * The number of output bytes just before the checkpointed offset that
+ * are checked against the input when a run is resumed.
+ */
+#define CKPT_PROBE (4096)
 
 /*
- * Given a character code c, return the decoded base-64 value.
- * 
- * Parameters:
- * 
- *   c - the character code
- * 
- * Return:
+ * The number of bytes before the end of an existing scrambled file that
+ * are checked against the input when more input is appended to it.
+ */
+#define APPEND_PROBE (4096)
+
+/*
+ * The maximum number of small files a batch worker claims at once.
+ */
+#define BATCH_FILES (64)
+
+/*
+ * The default number of trailer reads in flight with -c.
+ */
+#define CHECK_DEPTH (16)
+
+/*
+ * The input path that selects streaming from standard input to standard
+ * output.
+ */
+#define STREAM_PATH "-"
+
+/*
+ * The number of bytes read from standard input at a time in streaming
+ * mode.
+ */
+#define STREAM_CHUNK (1048576L)
+
+/*
+ * The minimum number of chunk buffers in streaming mode.
+ */
+#define STREAM_SLOTS (4)
+
+/*
+ * The number of bytes reserved in front of each chunk buffer, used for
+ * the bytes held back from the previous chunk when descrambling.  This
+ * is also the alignment of chunk buffers.
+ */
+#define STREAM_PREFIX (4096)
+
+/*
+ * The magic string at the start of the footer of a pack made with
+ * --pack.
+ */
+#define PACK_MAGIC "W64PACK1"
+
+/*
+ * The size of the footer of a pack, which is the magic string followed
+ * by the offset and length of the index, the number of members and the
+ * FNV-1a hash of the index, as 64-bit big-endian integers.
+ */
+#define PACK_FOOTER (40)
+
+/*
+ * The size of the fixed part of an index entry of a pack, which is the
+ * offset, length and name length of the member as 64-bit big-endian
+ * integers and the key phase of its first byte, before the name.
+ */
+#define PACK_ENTRY (25)
+
+/*
+ * The size of the blocks a pack is written and read in.
+ */
+#define PACK_BLOCK (8388608L)
+
+/*
+ * The longest member name a pack stores.
+ */
+#define PACK_NAME_MAX (4096)
+
+/*
+ * The kinds of --sink.
+ */
+#define SINK_TCP  (1)
+#define SINK_HTTP (2)
+
+/*
+ * The longest URL --sink accepts.
+ */
+#define SINK_URL_MAX (2048)
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * Stores a nul-terminated scrambling key.
+ */
+typedef struct {
+
+  /*
+   * Buffer holding the scrambling key that was read.
+   * 
+   * The key must be nul-terminated.
+   */
+  char kbuf[MAX_KEY_LENGTH + 1];
+
+} KEY_BUFFER;
+
+/*
+ * A checkpoint record of a file job.
  * 
- *   the base-64 value, or -1 if the given character code wasn't for a
- *   base-64 digit
+ * The output bytes [0, done) have been transformed and flushed.  The
+ * record describes the job and the input file it was made for, so that
+ * a resumed run can only continue the run that wrote it.  No key is
+ * stored; a resumed run checks the key it is given against the output
+ * instead.
  */
-static int decode64(int c) {
-  int result = 0;
+typedef struct {
   
-  if ((c >= 'A') && (c <= 'Z')) {
-    result = c - 'A';
-    
-  } else if ((c >= 'a') && (c <= 'z')) {
-    result = (c - 'a') + 26;
-    
-  } else if ((c >= '0') && (c <= '9')) {
-    result = (c - '0') + 52;
-    
-  } else if (c == '+') {
-    result = 62;
-    
-  } else if (c == '/') {
-    result = 63;
-    
-  } else {
-    result = -1;
-  }
+  /*
+   * Sequence number, incremented on each write.
+   */
+  int64_t seq;
   
-  return result;
-}
+  /*
+   * Non-zero if the job descrambles, non-zero if it re-keys, and the
+   * WARP64IO_CRC_ mode that checksums its plaintext.
+   */
+  int descramble;
+  int rekey;
+  int crc_mode;
+  
+  /*
+   * The input and output lengths and the window size of the job.
+   */
+  int64_t ilen;
+  int64_t olen;
+  int64_t winsize;
+  
+  /*
+   * The number of output bytes transformed and flushed, which is always
+   * a whole number of windows.
+   */
+  int64_t done;
+  
+  /*
+   * The bare CRC register of the plaintext of the windows below done,
+   * if the job checksums the plaintext.
+   */
+  uint32_t crc;
+  
+  /*
+   * The size, inode number and modification time of the input file.
+   */
+  int64_t in_size;
+  int64_t in_ino;
+  int64_t in_mtime;
+  
+} CHECKPOINT;
 
 /*
- * Read the scrambling key from standard input, suppressing echo so that
- * the key is not displayed.
- * 
- * Error messages are printed if failure.  This function will check that
- * each character read decodes with decode64(), and that at least one
- * and at most MAX_KEY_LENGTH characters are read.
- * 
- * Parameters:
- * 
- *   kb - the buffer that will hold the key
+ * The checkpoint state of a running file job.
  * 
- * Return:
- * 
- *   non-zero if successful, zero if error
+ * Windows may finish out of order on several threads, so each finished
+ * window is marked, and the checkpoint only ever covers the windows up
+ * to the first one that isn't finished yet.
  */
-static int readKey(KEY_BUFFER *kb) {
-  int status = 1;
-  int console_changed = 0;
-  int chars_read = 0;
-  int c = 0;
-  int i = 0;
-  struct termios old_attr;
-  struct termios new_attr;
+typedef struct {
   
-  /* Initialize local structures */
-  memset(&old_attr, 0, sizeof(struct termios));
-  memset(&new_attr, 0, sizeof(struct termios));
+  /*
+   * The checkpoint file, and the record last written to it.
+   */
+  int fd;
+  CHECKPOINT rec;
   
-  /* Check parameter */
-  if (kb == NULL) {
-    abort();
-  }
+  /*
+   * The number of windows between checkpoints.
+   */
+  int64_t every;
   
-  /* Clear return structure */
-  memset(kb, 0, sizeof(KEY_BUFFER));
+  /*
+   * For each window, non-zero once it is finished, and its CRC register
+   * if the job checksums the plaintext.
+   */
+  uint8_t *pDone;
+  uint32_t *pCrc;
   
-  /* Get the input attributes */
-  if (tcgetattr(STDIN_FILENO, &old_attr)) {
-    status = 0;
-    fprintf(stderr, "%s: Failed to get console input attributes!\n",
-              pModule);
-    fprintf(stderr, "%s: Make sure input is not redirected.\n",
-              pModule);
-  }
+  /*
+   * The number of windows from the start that are finished, and the
+   * CRC register of their plaintext.
+   */
+  int64_t next;
+  uint32_t crc;
   
-  /* Copy input attributes to new attributes and disable local mode ECHO
-   * in new attributes to stop character echo */
-  if (status) {
-    memcpy(&new_attr, &old_attr, sizeof(struct termios));
-    if (new_attr.c_lflag & ECHO) {
-      new_attr.c_lflag ^= ECHO;
-    }
-  }
+  /*
+   * Lock protecting everything above, which is held while a checkpoint
+   * is written.
+   */
+  pthread_mutex_t lock;
   
-  /* Update console input immediately to disable echo and then set the
-   * console_changed flag */
-  if (status) {
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &new_attr)) {
-      status = 0;
-      fprintf(stderr, "%s: Failed to set console input attributes!\n",
-                pModule);
-      fprintf(stderr, "%s: Make sure input is not redirected.\n",
-              pModule);
-    } else {
-      console_changed = 1;
-    }
-  }
+} CHECKPOINT_RUN;
+
+/*
+ * Shared state for processing all the windows of a file.
+ * 
+ * Windows are claimed in order by worker threads.  Each window is
+ * independent, because the key phase of a window only depends on the
+ * byte offset of the window.
+ */
+typedef struct {
   
-  /* Read characters from console */
-  while (status) {
-    /* Read a character */
-    c = getchar();
-    
-    /* If we got EOF, handle that */
-    if (c == EOF) {
-      if (feof(stdin)) {
-        /* We reached end of input, so we can leave the loop */
-        break;
-        
-      } else {
-        /* There was an input error */
-        status = 0;
-        fprintf(stderr, "%s: I/O error reading key!\n", pModule);
-      }
+  /*
+   * The input and output file descriptors.
+   */
+  int fIn;
+  int fOut;
+  
+  /*
+   * The transform context.  Windows are transformed at their offsets
+   * with warp64_update_at(), so the context is shared by all workers.
+   * 
+   * own_pc is set if the job set up the context itself and releases it
+   * at the end, and clear if it belongs to the batch the job is in.
+   */
+  WARP64_CTX *pc;
+  int own_pc;
+  
+  /*
+   * The number of bytes of input and output.
+   * 
+   * ilen may be less than olen, in which case the bytes of output
+   * beyond the input are transformed as zero bytes (for the trailer).
+   */
+  int64_t ilen;
+  int64_t olen;
+  
+  /*
+   * The window size of this job, and the total number of windows.
+   */
+  int64_t winsize;
+  int64_t nwin;
+  
+  /*
+   * Set if the file is small enough to go through warp64io_small() as
+   * a single window, in which case the output file doesn't get its
+   * length up front.
+   */
+  int small;
+  
+  /*
+   * Lock protecting next and failed.
+   */
+  pthread_mutex_t lock;
+  
+  /*
+   * The index of the next window to claim.
+   */
+  int64_t next;
+  
+  /*
+   * Set if any window failed, so that the other workers stop.
+   */
+  int failed;
+  
+  /*
+   * Set if this is a re-key run, in which case the output replaces the
+   * input at the end instead of the input being removed.
+   */
+  int replace;
+  
+  /*
+   * The WARP64IO_CRC_ mode that checksums the plaintext of each window,
+   * and the length of the plaintext.
+   * 
+   * crc is the bare CRC register of the whole plaintext so far.  Each
+   * window adds its register, shifted to the end of the plaintext, so
+   * the windows may finish in any order.  It is protected by lock.
+   */
+  int crc_mode;
+  int64_t crc_len;
+  uint32_t crc;
+  
+  /*
+   * Set if the plaintext has a checksum file to check against when
+   * descrambling, and the CRC32C it holds.
+   */
+  int crc_check;
+  uint32_t crc_want;
+  
+  /*
+   * The index of the first window to process, which is only non-zero
+   * when a run is resumed from a checkpoint.
+   */
+  int64_t first;
+  
+  /*
+   * The checkpoint state, or NULL if the job keeps no checkpoint.
+   *
+   * keep is set if the job failed after its checkpoint was written, in
+   * which case fileEnd() leaves the output file for a resumed run.
+   */
+  CHECKPOINT_RUN *pck;
+  int keep;
+  
+} WINDOW_JOB;
+
+/*
+ * Parameters passed to a worker thread.
+ */
+typedef struct {
+  
+  /*
+   * The shared job.
+   */
+  WINDOW_JOB *pj;
+  
+  /*
+   * The index of this worker, used for pinning.
+   */
+  int index;
+  
+} WORKER_ARG;
+
+/*
+ * A journal record for an in-place run.
+ * 
+ * The bytes [0, done) of the file have been transformed with key and
+ * flushed.  If pre_len is non-zero, the window at pre_off may have been
+ * partially transformed, and its original bytes are stored in the
+ * pre-image area pre_area of the journal.
+ */
+typedef struct {
+  
+  /*
+   * Sequence number, incremented on each write.
+   */
+  int64_t seq;
+  
+  /*
+   * The packed key being applied to the file.
+   */
+  int32_t key;
+  
+  /*
+   * One of the JPHASE_ constants.
+   */
+  int phase;
+  
+  /*
+   * Non-zero if the file is renamed at the end of the run.
+   */
+  int rename;
+  
+  /*
+   * Non-zero if this run is a rollback of an earlier run.
+   */
+  int reverse;
+  
+  /*
+   * The number of bytes from the start of the file to transform.
+   */
+  int64_t clen;
+  
+  /*
+   * The number of bytes already transformed.
+   */
+  int64_t done;
+  
+  /*
+   * The length of the file before the run started.
+   */
+  int64_t orig_len;
+  
+  /*
+   * The length of the file at the end of the run.
+   */
+  int64_t final_len;
+  
+  /*
+   * The offset and length of the window in progress, and which
+   * pre-image area holds its original bytes.
+   */
+  int64_t pre_off;
+  int64_t pre_len;
+  int pre_area;
+  
+} JOURNAL;
+
+/*
+ * Shared state between the reader thread and the writer in streaming
+ * mode.
+ * 
+ * The chunk buffers form a ring.  The reader fills slots starting at
+ * head, and the writer consumes them starting at tail, so slots are
+ * always handed back and forth in order.  Everything from head onwards
+ * is protected by lock.
+ */
+typedef struct {
+  
+  /*
+   * The input file descriptor.
+   */
+  int fIn;
+  
+  /*
+   * The number of slots, the slot buffers, and the number of data bytes
+   * in each slot.  The data of a slot starts STREAM_PREFIX bytes into
+   * its buffer.
+   */
+  int nslot;
+  uint8_t **ppSlot;
+  size_t *pLen;
+  
+  /*
+   * For each retired slot, the value of written after the slot was
+   * written out.
+   */
+  int64_t *pAt;
+  
+  /*
+   * Non-zero if output is written with vmsplice(), and the capacity of
+   * the output pipe in bytes.
+   */
+  int splice;
+  int64_t pipecap;
+  
+  /*
+   * Lock and condition for the fields below.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  
+  /*
+   * The next slot the reader fills and the next one the writer
+   * consumes.
+   */
+  int head;
+  int tail;
+  
+  /*
+   * The number of slots the reader may fill, the number of filled slots
+   * waiting for the writer, and the number of written slots that are
+   * not yet safe to reuse, starting at slot rel.
+   */
+  int avail;
+  int filled;
+  int retired;
+  int rel;
+  
+  /*
+   * The total number of bytes written so far.
+   */
+  int64_t written;
+  
+  /*
+   * Set by the reader at end of input or on read error.
+   */
+  int eof;
+  int err;
+  
+  /*
+   * Set by the writer to ask the reader to stop.
+   */
+  int stop;
+  
+} STREAM_STATE;
+
+/*
+ * A file in a batch run.
+ */
+typedef struct {
+  
+  /*
+   * The dynamically allocated input and output paths.  pOut is NULL if
+   * the input path was rejected while listing.
+   */
+  char *pIn;
+  char *pOut;
+  
+  /*
+   * The size of the input file when it was listed, or -1 if it was
+   * rejected while listing.
+   */
+  int64_t size;
+  
+  /*
+   * Set if the file failed.  Only the worker that handles the file
+   * writes this.
+   */
+  int failed;
+  
+  /*
+   * With -c, set if the trailer of the file matches the key.
+   */
+  int match;
+  
+} BATCH_FILE;
+
+/*
+ * An open large file of a batch run whose windows are shared between
+ * the batch workers.
+ */
+typedef struct BATCH_SHARED_TAG {
+  
+  /*
+   * The file job.  Only the nwin and failed fields are used to share
+   * the windows, and they are protected by the batch lock.
+   */
+  WINDOW_JOB job;
+  
+  /*
+   * The index of the file in the batch.
+   */
+  int64_t file;
+  
+  /*
+   * The number of windows being processed right now.
+   */
+  int active;
+  
+  /*
+   * Non-zero while the file is in the queue of the batch, which is as
+   * long as it has windows left to claim and none has failed.
+   */
+  int queued;
+  
+  /*
+   * The next file in the queue.
+   */
+  struct BATCH_SHARED_TAG *pNext;
+  
+} BATCH_SHARED;
+
+/*
+ * Shared state of a batch run.
+ */
+typedef struct {
+  
+  /*
+   * The list of files, the number of files, and the capacity of the
+   * list.
+   */
+  BATCH_FILE *pFiles;
+  int64_t nfile;
+  int64_t cap;
+  
+  /*
+   * Non-zero if descrambling, and the normalized scrambling key.
+   */
+  int descramble;
+  int32_t key;
+  
+  /*
+   * When re-keying, the new normalized scrambling key, else -1.
+   * descramble is set for a re-key, because the files are scrambled.
+   */
+  int32_t newkey;
+  
+  /*
+   * The transform context that all the file jobs of the batch share,
+   * or NULL if the files are not processed with file jobs.
+   */
+  WARP64_CTX *pc;
+  
+  /*
+   * Lock and condition protecting the fields below.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  
+  /*
+   * The index of the next file to claim.
+   */
+  int64_t next;
+  
+  /*
+   * The number of large files being opened right now.
+   */
+  int opening;
+  
+  /*
+   * The queue of open large files that have windows left to claim.
+   */
+  BATCH_SHARED *pHead;
+  
+} BATCH;
+
+/*
+ * Parameters passed to a batch worker thread.
+ */
+typedef struct {
+  
+  /*
+   * The batch.
+   */
+  BATCH *pb;
+  
+  /*
+   * The index of this worker, used for pinning.
+   */
+  int index;
+  
+} BATCH_ARG;
+
+/*
+ * Counters for the --stats report.
+ * 
+ * Times are in seconds and summed over threads.
+ */
+typedef struct {
+  
+  /*
+   * The time spent in each phase.
+   */
+  double setup_sec;
+  double io_sec;
+  double xform_sec;
+  double finish_sec;
+  
+  /*
+   * The number of files completed, and the number of windows and
+   * output bytes processed.
+   */
+  int64_t files;
+  int64_t windows;
+  int64_t bytes;
+  
+  /*
+   * The largest window size that a job used, which is zero if the run
+   * had no window jobs.  This is the maximum over the counters added
+   * rather than a sum.
+   */
+  int64_t window;
+  
+} RUN_STATS;
+
+/*
+ * The compression stage of a stream with -z.
+ * 
+ * When scrambling, the plaintext is fed to the compressor, and each
+ * block of compressed bytes that comes out is scrambled and written.
+ * When descrambling, the descrambled bytes are fed to the decompressor,
+ * and each block of plaintext that comes out is written.
+ */
+typedef struct {
+  
+  /*
+   * Non-zero if descrambling.
+   */
+  int descramble;
+  
+  /*
+   * The compression context when scrambling, and the decompression
+   * context when descrambling.
+   */
+#ifdef WARP64_ZSTD
+  ZSTD_CCtx *pcz;
+  ZSTD_DCtx *pdz;
+#endif
+  
+  /*
+   * The output buffer of STREAM_CHUNK bytes.
+   */
+  uint8_t *pBuf;
+  
+  /*
+   * When descrambling, the last hint returned by the decompressor,
+   * which is zero when the input ended at the end of a frame.
+   */
+  size_t left;
+  
+  /*
+   * The output file, the transform context that scrambles compressed
+   * bytes, the CRC register that a descrambled plaintext is added to
+   * with --crc, and the statistics that get the transform time.
+   */
+  int fOut;
+  WARP64_CTX *pc;
+  uint32_t *pCrc;
+  RUN_STATS *prs;
+  
+} ZSTAGE;
+
+/*
+ * The output of a pack being written.
+ * 
+ * Everything written to a pack, members and index alike, is gathered
+ * in a block buffer, which is scrambled and written sequentially each
+ * time it fills up.
+ */
+typedef struct {
+  
+  /*
+   * The archive file, and the path it was created at.
+   */
+  int fd;
+  const char *pPath;
+  
+  /*
+   * The scrambling context, which follows the position in the archive.
+   */
+  WARP64_CTX *pc;
+  
+  /*
+   * The block buffer of PACK_BLOCK bytes, and the number of bytes in
+   * it.
+   */
+  uint8_t *pBuf;
+  size_t used;
+  
+  /*
+   * The archive offset of the start of the block buffer.
+   */
+  int64_t off;
+  
+  /*
+   * Set if writing the archive failed.
+   */
+  int failed;
+  
+  /*
+   * Statistics of the pack.
+   */
+  RUN_STATS rs;
+  
+} PACK_OUT;
+
+/*
+ * A member of a pack.
+ */
+typedef struct {
+  
+  /*
+   * The dynamically allocated name of the member.
+   */
+  char *pName;
+  
+  /*
+   * The offset and length of the member data in the archive.
+   */
+  int64_t off;
+  int64_t len;
+  
+  /*
+   * When extracting, set if the member was asked for, and set if it
+   * failed.
+   */
+  int wanted;
+  int failed;
+  
+} PACK_MEMBER;
+
+/*
+ * The index of a pack.
+ */
+typedef struct {
+  
+  /*
+   * The members, the number of members, and the capacity of the list.
+   */
+  PACK_MEMBER *pm;
+  int64_t count;
+  int64_t cap;
+  
+  /*
+   * The offset of the index in the archive, which is also where the
+   * member data ends.
+   */
+  int64_t ioff;
+  
+} PACK_INDEX;
+
+/*
+ * An open --sink that output is sent to instead of being written to a
+ * file.
+ * 
+ * A TCP sink is the connected socket itself.  An HTTP sink is a pipe
+ * into a sender thread, which sends whatever comes out of the pipe as
+ * the chunks of a chunked PUT request and then reads the response.
+ */
+typedef struct {
+  
+  /*
+   * One of the SINK_ constants.
+   */
+  int kind;
+  
+  /*
+   * The URL, for messages.
+   */
+  const char *pUrl;
+  
+  /*
+   * The connected socket.
+   */
+  int sock;
+  
+  /*
+   * The descriptor output is written to, which is the socket of a TCP
+   * sink and the write end of the pipe of an HTTP sink.
+   */
+  int fd;
+  
+  /*
+   * The read end of the pipe of an HTTP sink, and the sender thread,
+   * if it was started.
+   */
+  int fPipe;
+  pthread_t sender;
+  int started;
+  
+  /*
+   * Set by the sender thread if sending failed, and the status code of
+   * the response, or zero if there was none.
+   */
+  int failed;
+  int code;
+  
+} SINK;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The name of the executable module, for use in diagnostic messages.
+ * 
+ * This is set at the start of the entrypoint.
+ */
+static const char *pModule = NULL;
+
+/*
+ * The window size to use for memory mapping.
+ * 
+ * Set near the start of the entrypoint.  With automatic window sizes,
+ * this is the smallest window of a file job, and jobWindow() picks the
+ * window of each job between this and m_winmax.
+ */
+static size_t m_winsize = 0;
+
+/*
+ * Non-zero if window sizes are picked for each file, which is the
+ * default unless -w gives a size, and the largest window of any job,
+ * which is also the window size the I/O backends are set up with.
+ * 
+ * Set in the entrypoint.
+ */
+static int m_winauto = 1;
+static size_t m_winmax = 0;
+
+/*
+ * Set with --hugepages to back windows with huge pages.
+ */
+static int m_huge = 0;
+
+/*
+ * The number of worker threads used to process windows.
+ * 
+ * Set from the -j option in the entrypoint.
+ */
+static int m_threads = 1;
+
+/*
+ * The thread pinning mode, one of the PIN_ constants.
+ * 
+ * Set from the --pin option in the entrypoint.
+ */
+static int m_pin = PIN_NONE;
+
+/*
+ * The I/O backend used for windows, one of the WARP64IO_ constants.
+ * 
+ * Set from the -b option in the entrypoint.
+ */
+static int m_backend = WARP64IO_MMAP;
+
+/*
+ * The WARP64IO_ flags used for windows.
+ * 
+ * Set from the --nocache, --direct, --sparse and --no-prefetch options in
+ * the entrypoint.  Prefetching is on unless --no-prefetch is given.
+ */
+static int m_ioflags = WARP64IO_PREFETCH;
+
+/*
+ * The SYNC_ policy for output files.
+ * 
+ * Set in the entrypoint.
+ */
+static int m_sync = SYNC_FINAL;
+
+/*
+ * Set with --crc to write the CRC32C of the plaintext to a checksum
+ * file when scrambling, or to print it when streaming.
+ */
+static int m_crc = 0;
+
+/*
+ * The number of windows between checkpoints of a file job, or zero if
+ * no checkpoint is kept.
+ * 
+ * Set from the --checkpoint and --resume options in the entrypoint.
+ */
+static int64_t m_ckpt = 0;
+
+/*
+ * Set with -z to compress before scrambling and decompress after
+ * descrambling, and the compression level, zero for the default level
+ * of the compressor.
+ */
+static int m_zstd = 0;
+static int m_zlevel = 0;
+
+/*
+ * Non-zero if statistics are collected, and non-zero if they are
+ * printed to standard error when done.
+ * 
+ * Set from the --stats and --stats-json options in the entrypoint.
+ */
+static int m_stats = 0;
+static int m_stats_text = 0;
+
+/*
+ * The path to write the JSON statistics report to, or NULL.
+ * 
+ * Set from the --stats-json option in the entrypoint.
+ */
+static const char *m_pStatsJson = NULL;
+
+/*
+ * The statistics collected so far, protected by m_stats_lock, and the
+ * time at which the run started.
+ */
+static RUN_STATS m_run;
+static pthread_mutex_t m_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static double m_stats_start = 0.0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int readKey(KEY_BUFFER *kb, FILE *pIn, int console);
+static int32_t deriveKey(const char *pKey);
+static int parseCount(const char *pStr, long lo, long hi, long *pv);
+static int32_t rekeyDelta(int32_t oldkey, int32_t newkey);
+static int verifyTrailer(
+    int          fd,
+    const char * pPath,
+    int32_t      key,
+    int64_t      clen);
+
+#ifdef __linux__
+static int readCpuList(const char *pPath, cpu_set_t *pcs);
+#endif
+static void pinThread(int index);
+
+static double nowSec(void);
+static void statsAdd(const RUN_STATS *pd);
+static double statsRate(int64_t bytes, double sec);
+static int statsReport(int ok);
+
+static int processWindow(WINDOW_JOB *pj, int64_t w, WARP64IO *pio);
+static int ioBegin(WARP64IO *pio);
+static void ioEnd(WARP64IO *pio);
+static void *processWorker(void *pArg);
+
+static int process64(WINDOW_JOB *pj);
+static int setDirect(int fd);
+static uint32_t crcFinish(uint32_t reg, int64_t len);
+static char *crcPath(const char *pPath);
+static int crcRead(const char *pPath, int *pFound, uint32_t *pCrc);
+static int crcWrite(const char *pPath, const char *pName, uint32_t crc);
+static WARP64_CTX *jobContext(int descramble, int32_t key, int32_t newkey);
+static int64_t jobWindow(int64_t olen);
+static size_t autoWindowMax(void);
+static int fileBegin(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int          descramble,
+          int32_t      key,
+          int32_t      newkey,
+          WARP64_CTX * pc,
+          int          resume);
+static int fileEnd(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int          ok);
+
+static char *ckptPath(const char *pPath);
+static int ckptWrite(int fd, CHECKPOINT *pr);
+static int ckptRead(int fd, CHECKPOINT *pr);
+static int ckptAdvance(WINDOW_JOB *pj, int64_t w, uint32_t crc);
+static int ckptProbe(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int64_t      done);
+static int ckptBegin(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int          descramble,
+          int          rekey,
+          int          resume);
+static void ckptEnd(WINDOW_JOB *pj, const char *pOutputPath);
+
+static int warp64(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    descramble,
+    const char * pKey,
+    const char * pNewKey,
+          int    resume);
+static int warp64Append(
+    const char * pInputPath,
+    const char * pOutputPath,
+    const char * pKey);
+
+static int readFully(int fd, uint8_t *pBuf, size_t len, int64_t off);
+static int writeFully(
+    int             fd,
+    const uint8_t * pBuf,
+    size_t          len,
+    int64_t         off);
+static int syncDir(const char *pPath);
+static int renameNew(const char *pFrom, const char *pTo);
+static uint64_t fnv64(const uint8_t *p, size_t len);
+static void packU64(uint8_t *p, uint64_t v);
+static uint64_t unpackU64(const uint8_t *p);
+
+static char *journalPath(const char *pPath);
+static int journalWrite(int fj, JOURNAL *pj);
+static int journalRead(int fj, JOURNAL *pj);
+static int inplaceRun(
+          int           fd,
+          int           fj,
+          JOURNAL     * pj,
+    const char        * pFrom,
+    const char        * pTo,
+    const char        * pJournal);
+static int inplaceStart(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    descramble,
+    const char * pKey,
+    const char * pNewKey);
+static int inplaceRecover(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    rollback);
+
+static int writeSeq(int fd, const uint8_t *pBuf, size_t len);
+static int spliceSeq(int fd, const uint8_t *pBuf, size_t len);
+static void *streamReader(void *pArg);
+static void streamRelease(STREAM_STATE *ps);
+static int zBegin(
+    ZSTAGE     * pz,
+    int          descramble,
+    int          fOut,
+    WARP64_CTX * pc,
+    uint32_t   * pCrc,
+    RUN_STATS  * prs);
+#ifdef WARP64_ZSTD
+static int zEmit(ZSTAGE *pz, size_t len);
+#endif
+static int zPush(ZSTAGE *pz, const uint8_t *pIn, size_t len, int end);
+static void zEnd(ZSTAGE *pz);
+static int warp64Stream(
+          int        fIn,
+          int        fOut,
+          int        descramble,
+    const char     * pKey,
+          int        splice,
+          uint32_t * pCrc);
+static int warp64Pipe(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    descramble,
+    const char * pKey);
+
+static char *outputPath(const char *pInputPath, int descramble, int rekey);
+static void batchAdd(BATCH *pb, const char *pPath, int64_t size);
+static void batchWalk(
+          BATCH * pb,
+    const char  * pPath,
+          int     recursive,
+          int     top);
+static int batchFile(BATCH *pb, BATCH_FILE *pf, WARP64IO *pio);
+static void *batchWorker(void *pArg);
+static int warp64Batch(
+          char ** ppPath,
+          int     npath,
+          int     recursive,
+          int     descramble,
+          int     inplace,
+    const char  * pKey,
+    const char  * pNewKey);
+
+static int checkFile(BATCH *pb, BATCH_FILE *pf);
+static void *checkWorker(void *pArg);
+static int warp64Check(
+          char ** ppPath,
+          int     npath,
+          int     recursive,
+    const char  * pKey);
+
+static const char *packName(const char *pPath);
+static void packAdd(
+          PACK_INDEX * px,
+    const char       * pName,
+          int64_t      off,
+          int64_t      len);
+static void packRelease(PACK_INDEX *px);
+static void packFlush(PACK_OUT *po);
+static void packPut(PACK_OUT *po, const uint8_t *p, size_t len);
+static int packFile(PACK_OUT *po, const char *pPath, int64_t *pLen);
+static int warp64Pack(
+          char ** ppPath,
+          int     npath,
+          int     recursive,
+    const char  * pArchive,
+    const char  * pKey);
+static int packOpen(
+          int          fd,
+    const char       * pArchive,
+          int32_t      key,
+    const WARP64_CTX * pc,
+          PACK_INDEX * px);
+static int packMakeDirs(const char *pName, const char **ppLeaf);
+static int packExtract(
+          int           fd,
+    const WARP64_CTX  * pc,
+    const PACK_MEMBER * pm,
+          uint8_t     * pBuf,
+          RUN_STATS   * prs);
+static int warp64Unpack(
+          char ** ppName,
+          int     nname,
+    const char  * pArchive,
+          int     list,
+    const char  * pKey);
+
+static int sinkConnect(const char *pHost, const char *pPort);
+static void *sinkSender(void *pArg);
+static int sinkOpen(SINK *ps, const char *pUrl);
+static int sinkClose(SINK *ps, int ok);
+static int warp64Sink(
+    const char * pInputPath,
+    const char * pUrl,
+          int    descramble,
+    const char * pKey);
+
+/*
+ * Read the scrambling key from a console, suppressing echo so that the
+ * key is not displayed.
+ * 
+ * The console is normally standard input.  When standard input carries
+ * data in streaming mode, the controlling terminal is used instead.  If
+ * console is zero, the key is read from the first line of a key file
+ * and echo is not touched.
+ * 
+ * Error messages are printed if failure.  This function will check that
+ * each character read decodes with warp64_digit(), and that at least
+ * one and at most MAX_KEY_LENGTH characters are read.
+ * 
+ * Parameters:
+ * 
+ *   kb - the buffer that will hold the key
+ * 
+ *   pIn - the console or key file to read from
+ * 
+ *   console - non-zero if pIn is a console, zero if it is a key file
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int readKey(KEY_BUFFER *kb, FILE *pIn, int console) {
+  int status = 1;
+  int console_changed = 0;
+  int chars_read = 0;
+  int c = 0;
+  int i = 0;
+  struct termios old_attr;
+  struct termios new_attr;
+  
+  /* Initialize local structures */
+  memset(&old_attr, 0, sizeof(struct termios));
+  memset(&new_attr, 0, sizeof(struct termios));
+  
+  /* Check parameter */
+  if ((kb == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  
+  /* Clear return structure */
+  memset(kb, 0, sizeof(KEY_BUFFER));
+  
+  /* Get the input attributes, unless reading from a key file */
+  if (status && console) {
+    if (tcgetattr(fileno(pIn), &old_attr)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to get console input attributes!\n",
+                pModule);
+      fprintf(stderr, "%s: Make sure input is not redirected.\n",
+                pModule);
+    }
+  }
+  
+  /* Copy input attributes to new attributes and disable local mode ECHO
+   * in new attributes to stop character echo */
+  if (status && console) {
+    memcpy(&new_attr, &old_attr, sizeof(struct termios));
+    if (new_attr.c_lflag & ECHO) {
+      new_attr.c_lflag ^= ECHO;
+    }
+  }
+  
+  /* Update console input immediately to disable echo and then set the
+   * console_changed flag */
+  if (status && console) {
+    if (tcsetattr(fileno(pIn), TCSANOW, &new_attr)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to set console input attributes!\n",
+                pModule);
+      fprintf(stderr, "%s: Make sure input is not redirected.\n",
+              pModule);
+    } else {
+      console_changed = 1;
+    }
+  }
+  
+  /* Read characters from console */
+  while (status) {
+    /* Read a character */
+    c = getc(pIn);
+    
+    /* If we got EOF, handle that */
+    if (c == EOF) {
+      if (feof(pIn)) {
+        /* We reached end of input, so we can leave the loop */
+        break;
+        
+      } else {
+        /* There was an input error */
+        status = 0;
+        fprintf(stderr, "%s: I/O error reading key!\n", pModule);
+      }
+    }
+  
+    /* If we got line break, leave the loop */
+    if (status && (c == '\n')) {
+      break;
+    }
+  
+    /* If we exceeded the buffer, silently set characters read to -1 */
+    if (status && (chars_read >= MAX_KEY_LENGTH)) {
+      chars_read = -1;
+    }
+    
+    /* If current character is nul or greater than 128, set it to 128
+     * (which is also an invalid character) */
+    if (status && ((c < 0) || (c > 128))) {
+      c = 128;
+    }
+    
+    /* Provided that buffer hasn't overflown, add current character to
+     * buffer and increment chars_read */
+    if (status && (chars_read >= 0)) {
+      (kb->kbuf)[chars_read] = (char) c;
+      chars_read++;
+    }
+  }
+  
+  /* If we didn't read any characters or we read too many, then report
+   * errors */
+  if (status && (chars_read == 0)) {
+    status = 0;
+    fprintf(stderr, "%s: Key may not be empty!\n", pModule);
+    
+  } else if (status && (chars_read < 0)) {
+    status = 0;
+    fprintf(stderr, "%s: Key may have at most %d characters!\n",
+                pModule, MAX_KEY_LENGTH);
+  }
+  
+  /* Check that each character is a base-64 character */
+  if (status) {
+    for(i = 0; i < chars_read; i++) {
+      if (warp64_digit((kb->kbuf)[i]) < 0) {
+        status = 0;
+        fprintf(stderr, "%s: Key may only include A-Z a-z 0-9 + /\n",
+                  pModule);
+        break;
+      }
+    }
+  }
+  
+  /* If console input attributes were changed, change them back */
+  if (console_changed) {
+    if (tcsetattr(fileno(pIn), TCSANOW, &old_attr)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to reset console input attributes!\n",
+              pModule);
+    } else {
+      console_changed = 0;
+    }
+  }
+  
+  /* If failure, reset return buffer */
+  if (!status) {
+    memset(kb, 0, sizeof(KEY_BUFFER));
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Given a scrambling key of one or more base-64 characters, derive the
+ * normalized scrambling key with warp64_derive() and return it.
+ * 
+ * The three octets of the normalized scrambling key are stored in the
+ * 24 least significant bits of the returned integer value, with the
+ * third octet being the least significant eight bits of the integer
+ * value.
+ * 
+ * Error messages are printed if necessary.
+ * 
+ * Parameters:
+ * 
+ *   pKey - the base-64 characters for the key
+ * 
+ * Return:
+ * 
+ *   the normalized key octets, or -1 if error
+ */
+static int32_t deriveKey(const char *pKey) {
+  int32_t key = 0;
+  
+  /* Check parameter */
+  if (pKey == NULL) {
+    abort();
+  }
+  
+  /* Derive the key, reporting why it failed if it did */
+  key = warp64_derive(pKey);
+  if (key < 0) {
+    if (strlen(pKey) < 1) {
+      fprintf(stderr, "%s: Scrambling key may not be empty!\n", pModule);
+    } else {
+      fprintf(stderr, "%s: Scrambling key has bad characters!\n",
+              pModule);
+    }
+  }
+  
+  return key;
+}
+
+/*
+ * Compute the packed key that re-keys scrambled data from one key to
+ * another.
+ * 
+ * Descrambling with the old key and scrambling with the new key are
+ * both additions in each key phase, so together they are the single
+ * addition of the new component minus the old component, MOD 256.  The
+ * trailer is the scrambled zero bytes, so the same addition turns the
+ * trailer for the old key into the trailer for the new key.
+ * 
+ * Components of the result may be zero, where both keys agree.
+ * 
+ * Parameters:
+ * 
+ *   oldkey - the normalized key the data is scrambled with
+ * 
+ *   newkey - the normalized key to scramble the data with instead
+ * 
+ * Return:
+ * 
+ *   the packed re-key transform
+ */
+static int32_t rekeyDelta(int32_t oldkey, int32_t newkey) {
+  int32_t result = 0;
+  int i = 0;
+  int a = 0;
+  int b = 0;
+  
+  for(i = 2; i >= 0; i--) {
+    a = (int) ((oldkey >> (i * 8)) & 0xff);
+    b = (int) ((newkey >> (i * 8)) & 0xff);
+    result = (result << 8) | ((int32_t) ((256 + b - a) % 256));
+  }
+  
+  return result;
+}
+
+/*
+ * Check the trailer of a scrambled file against a normalized scrambling
+ * key.
+ * 
+ * clen is the content length of the scrambled file, which is three
+ * less than the file length.  The three trailer bytes are read from
+ * that offset and re-ordered according to their key phase, and the
+ * result must match the normalized key exactly.
+ * 
+ * The file position is not changed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the scrambled file
+ * 
+ *   pPath - the path of the scrambled file, for error messages
+ * 
+ *   key - the normalized scrambling key
+ * 
+ *   clen - the content length of the scrambled file
+ * 
+ * Return:
+ * 
+ *   non-zero if the key is correct, zero if error or wrong key
+ */
+static int verifyTrailer(
+    int          fd,
+    const char * pPath,
+    int32_t      key,
+    int64_t      clen) {
+  
+  int status = 1;
+  uint8_t trailer[3];
+  
+  /* Initialize structures */
+  memset(trailer, 0, 3);
+  
+  /* Check parameters */
+  if ((fd < 0) || (pPath == NULL) || (clen < 0)) {
+    abort();
+  }
+  
+  /* Read the last three bytes into trailer */
+  if (pread(fd, trailer, 3, (off_t) clen) != 3) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to read trailer in '%s'!\n",
+          pModule, pPath);
+  }
+  
+  /* Verify that the trailer recovers the provided scrambling key */
+  if (status) {
+    if (warp64_recover(clen, trailer) != key) {
+      status = 0;
+      fprintf(stderr, "%s: Incorrect scrambling key!\n", pModule);
+    }
+  }
+  
+  return status;
+}
+
+/*
+ * Parse a decimal integer parameter and check that it is in a given
+ * range.
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the string to parse
+ * 
+ *   lo - the minimum value
+ * 
+ *   hi - the maximum value
+ * 
+ *   pv - receives the parsed value
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the string is not a decimal integer
+ *   in range
+ */
+static int parseCount(const char *pStr, long lo, long hi, long *pv) {
+  int status = 1;
+  long v = 0;
+  
+  /* Check parameters */
+  if ((pStr == NULL) || (pv == NULL) || (lo > hi)) {
+    abort();
+  }
+  
+  /* Must have at least one digit */
+  if (*pStr == 0) {
+    status = 0;
+  }
+  
+  /* Parse digits, checking the upper bound as we go so that we can't
+   * overflow */
+  for( ; status && (*pStr != 0); pStr++) {
+    if ((*pStr < '0') || (*pStr > '9')) {
+      status = 0;
+      break;
+    }
+    v = (v * 10) + ((long) (*pStr - '0'));
+    if (v > hi) {
+      status = 0;
+    }
+  }
+  
+  /* Check the lower bound */
+  if (status && (v < lo)) {
+    status = 0;
+  }
+  
+  /* Write the result */
+  if (status) {
+    *pv = v;
+  }
+  
+  return status;
+}
+
+#ifdef __linux__
+
+/*
+ * Read a Linux sysfs CPU list file, such as the cpulist of a NUMA node,
+ * into a CPU set.
+ * 
+ * The file contains comma-separated decimal CPU numbers and ranges, for
+ * example "0-3,8-11".
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the CPU list file
+ * 
+ *   pcs - the CPU set to fill
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file could not be read or it
+ *   did not list any processors
+ */
+static int readCpuList(const char *pPath, cpu_set_t *pcs) {
+  int status = 1;
+  int count = 0;
+  long a = 0;
+  long b = 0;
+  long c = 0;
+  FILE *fh = NULL;
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (pcs == NULL)) {
+    abort();
+  }
+  
+  /* Clear the set */
+  CPU_ZERO(pcs);
+  
+  /* Open the list */
+  fh = fopen(pPath, "r");
+  if (fh == NULL) {
+    status = 0;
+  }
+  
+  /* Read each number or range and add it to the set */
+  while (status) {
+    if (fscanf(fh, "%ld", &a) != 1) {
+      break;
+    }
+    b = a;
+    c = fgetc(fh);
+    if (c == '-') {
+      if (fscanf(fh, "%ld", &b) != 1) {
+        status = 0;
+        break;
+      }
+      c = fgetc(fh);
+    }
+    
+    for( ; (a <= b) && (a < CPU_SETSIZE); a++) {
+      if (a >= 0) {
+        CPU_SET((int) a, pcs);
+        count++;
+      }
+    }
+    
+    if (c != ',') {
+      break;
+    }
+  }
+  
+  /* Close the list */
+  if (fh != NULL) {
+    fclose(fh);
+    fh = NULL;
+  }
+  
+  /* Must have found at least one processor */
+  if (status && (count < 1)) {
+    status = 0;
+  }
+  
+  return status;
+}
+
+#endif
+
+/*
+ * Pin the calling thread according to m_pin.
+ * 
+ * For PIN_CPU, the thread is pinned to the processor that has the given
+ * index (modulo the processor count) among the processors the process
+ * is allowed to run on.  For PIN_NODE, the thread is pinned to all the
+ * processors of the NUMA node that has the given index (modulo the node
+ * count).
+ * 
+ * Failing to pin is not fatal, so only a warning is printed.
+ * 
+ * Parameters:
+ * 
+ *   index - the index of the worker thread
+ */
+static void pinThread(int index) {
+#ifdef __linux__
+  int status = 1;
+  int count = 0;
+  int target = 0;
+  int i = 0;
+  int n = 0;
+  
+  cpu_set_t avail;
+  cpu_set_t cs;
+  
+  DIR *pd = NULL;
+  struct dirent *pe = NULL;
+  char node_path[64];
+  
+  /* Check parameter */
+  if (index < 0) {
+    abort();
+  }
+  
+  /* Initialize structures */
+  CPU_ZERO(&avail);
+  CPU_ZERO(&cs);
+  memset(node_path, 0, sizeof(node_path));
+  
+  if (m_pin == PIN_CPU) {
+    /* Get the processors we are allowed to run on */
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &avail)) {
+      status = 0;
+    }
+    
+    /* Choose the processor for this index */
+    if (status) {
+      count = CPU_COUNT(&avail);
+      if (count < 1) {
+        status = 0;
+      }
+    }
+    if (status) {
+      target = index % count;
+      for(i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &avail)) {
+          if (target == 0) {
+            CPU_SET(i, &cs);
+            break;
+          }
+          target--;
+        }
+      }
+    }
+    
+  } else if (m_pin == PIN_NODE) {
+    /* Count the NUMA nodes */
+    pd = opendir("/sys/devices/system/node");
+    if (pd == NULL) {
+      status = 0;
+    }
+    if (status) {
+      for(pe = readdir(pd); pe != NULL; pe = readdir(pd)) {
+        if ((strncmp(pe->d_name, "node", 4) == 0) &&
+              (pe->d_name[4] >= '0') && (pe->d_name[4] <= '9')) {
+          count++;
+        }
+      }
+      if (count < 1) {
+        status = 0;
+      }
+    }
+    
+    /* Find the node for this index; node numbers may be sparse, so we
+     * probe upwards until we find the target-th existing node */
+    if (status) {
+      target = index % count;
+      for(n = 0; n < CPU_SETSIZE; n++) {
+        sprintf(node_path, "/sys/devices/system/node/node%d/cpulist", n);
+        if (access(node_path, R_OK) == 0) {
+          if (target == 0) {
+            break;
+          }
+          target--;
+        }
+      }
+      if (!readCpuList(node_path, &cs)) {
+        status = 0;
+      }
+    }
+    
+    if (pd != NULL) {
+      closedir(pd);
+      pd = NULL;
+    }
+    
+  } else {
+    /* Not pinning */
+    return;
+  }
+  
+  /* Apply the affinity */
+  if (status) {
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cs)) {
+      status = 0;
+    }
+  }
+  
+  if (!status) {
+    fprintf(stderr, "%s: Failed to pin worker thread %d!\n",
+            pModule, index);
+  }
+  
+#else
+  /* Pinning is rejected on other platforms in the entrypoint */
+  (void) index;
+  if (m_pin != PIN_NONE) {
+    abort();
+  }
+#endif
+}
+
+/*
+ * Return a monotonic timestamp in seconds.
+ * 
+ * Return:
+ * 
+ *   the timestamp
+ */
+static double nowSec(void) {
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    abort();
+  }
+  return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1.0e9);
+}
+
+/*
+ * Add counters to the statistics of the run.
+ * 
+ * This may be called from any thread.  It does nothing unless
+ * statistics are being collected.
+ * 
+ * Parameters:
+ * 
+ *   pd - the counters to add
+ */
+static void statsAdd(const RUN_STATS *pd) {
+  if (pd == NULL) {
+    abort();
+  }
+  if (!m_stats) {
+    return;
+  }
+  
+  if (pthread_mutex_lock(&m_stats_lock)) {
+    abort();
+  }
+  m_run.setup_sec += pd->setup_sec;
+  m_run.io_sec += pd->io_sec;
+  m_run.xform_sec += pd->xform_sec;
+  m_run.finish_sec += pd->finish_sec;
+  m_run.files += pd->files;
+  m_run.windows += pd->windows;
+  m_run.bytes += pd->bytes;
+  if (pd->window > m_run.window) {
+    m_run.window = pd->window;
+  }
+  if (pthread_mutex_unlock(&m_stats_lock)) {
+    abort();
+  }
+}
+
+/*
+ * Compute a throughput in megabytes per second.
+ * 
+ * Parameters:
+ * 
+ *   bytes - the number of bytes
+ * 
+ *   sec - the time in seconds
+ * 
+ * Return:
+ * 
+ *   the throughput, or zero if there was no measurable time
+ */
+static double statsRate(int64_t bytes, double sec) {
+  if (sec <= 0.0) {
+    return 0.0;
+  }
+  return (((double) bytes) / sec) / 1.0e6;
+}
+
+/*
+ * Print and write the statistics report at the end of the run.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   ok - non-zero if the run succeeded
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the JSON report couldn't be written
+ */
+static int statsReport(int ok) {
+  int status = 1;
+  double wall = 0.0;
+  FILE *pOut = NULL;
+  struct rusage ru;
+  
+  memset(&ru, 0, sizeof(struct rusage));
+  
+  wall = nowSec() - m_stats_start;
+  if (getrusage(RUSAGE_SELF, &ru)) {
+    memset(&ru, 0, sizeof(struct rusage));
+  }
+  
+  if (m_stats_text) {
+    fprintf(stderr, "%s: stats: %lld bytes, %lld windows, %lld files\n",
+            pModule, (long long) m_run.bytes, (long long) m_run.windows,
+            (long long) m_run.files);
+    fprintf(stderr, "%s: stats: wall      %.6f s, %.1f MB/s\n",
+            pModule, wall, statsRate(m_run.bytes, wall));
+    fprintf(stderr, "%s: stats: setup     %.6f s\n",
+            pModule, m_run.setup_sec);
+    fprintf(stderr, "%s: stats: io        %.6f s, %.1f MB/s\n",
+            pModule, m_run.io_sec, statsRate(m_run.bytes, m_run.io_sec));
+    fprintf(stderr, "%s: stats: transform %.6f s, %.1f MB/s\n",
+            pModule, m_run.xform_sec,
+            statsRate(m_run.bytes, m_run.xform_sec));
+    fprintf(stderr, "%s: stats: finish    %.6f s\n",
+            pModule, m_run.finish_sec);
+    fprintf(stderr,
+            "%s: stats: %ld minor faults, %ld major faults, "
+            "peak RSS %ld KiB\n",
+            pModule, (long) ru.ru_minflt, (long) ru.ru_majflt,
+            (long) ru.ru_maxrss);
+  }
+  
+  if (m_pStatsJson != NULL) {
+    pOut = fopen(m_pStatsJson, "w");
+    if (pOut == NULL) {
+      status = 0;
+    }
+    if (status) {
+      fprintf(pOut,
+        "{\"ok\":%s,\"backend\":\"%s\",\"kernel\":\"%s\","
+        "\"threads\":%d,\"window\":%lld,"
+        "\"bytes\":%lld,\"windows\":%lld,\"files\":%lld,"
+        "\"wall_sec\":%.6f,\"wall_mbps\":%.3f,"
+        "\"phases\":{"
+        "\"setup\":{\"sec\":%.6f},"
+        "\"io\":{\"sec\":%.6f,\"mbps\":%.3f},"
+        "\"transform\":{\"sec\":%.6f,\"mbps\":%.3f},"
+        "\"finish\":{\"sec\":%.6f}},"
+        "\"minor_faults\":%ld,\"major_faults\":%ld,"
+        "\"peak_rss_kib\":%ld}\n",
+        ok ? "true" : "false",
+        warp64io_name(m_backend),
+        warp64k_name(warp64k_current()),
+        m_threads, (long long) m_run.window,
+        (long long) m_run.bytes, (long long) m_run.windows,
+        (long long) m_run.files,
+        wall, statsRate(m_run.bytes, wall),
+        m_run.setup_sec,
+        m_run.io_sec, statsRate(m_run.bytes, m_run.io_sec),
+        m_run.xform_sec, statsRate(m_run.bytes, m_run.xform_sec),
+        m_run.finish_sec,
+        (long) ru.ru_minflt, (long) ru.ru_majflt, (long) ru.ru_maxrss);
+      if (ferror(pOut)) {
+        status = 0;
+      }
+    }
+    if (pOut != NULL) {
+      if (fclose(pOut)) {
+        status = 0;
+      }
+      pOut = NULL;
+    }
+    if (!status) {
+      fprintf(stderr, "%s: Failed to write stats to '%s'!\n",
+              pModule, m_pStatsJson);
+    }
+  }
+  
+  return status;
+}
+
+/*
+ * Transform a single window of a job with the selected I/O backend.
+ * 
+ * The window is w times the window size of the job into the output.  It
+ * is the minimum of that size and the remaining output bytes, and it
+ * includes the trailer bytes if they fall within it.  The single window of a
+ * small job goes through warp64io_small() instead of the backend.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ *   w - the window index
+ * 
+ *   pio - the I/O backend state of the calling thread
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int processWindow(WINDOW_JOB *pj, int64_t w, WARP64IO *pio) {
+  int status = 1;
+  int result = 0;
+  
+  int64_t base = 0;
+  int64_t ws = 0;
+  int64_t wsi = 0;
+  int64_t pend = 0;
+  uint32_t crc = 0;
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pio == NULL)) {
+    abort();
+  }
+  if ((w < 0) || (w >= pj->nwin)) {
+    abort();
+  }
+  
+  /* Determine the offset of the window */
+  base = w * pj->winsize;
+  
+  /* Determine the size of the output window; this is the minimum of the
+   * window size and the remaining bytes */
+  ws = pj->winsize;
+  if (pj->olen - base < ws) {
+    ws = pj->olen - base;
+  }
+  
+  /* Determine the size of the input window; this is the minimum of the
+   * output window and the remaining input count; it might be zero */
+  wsi = ws;
+  if (pj->ilen - base < wsi) {
+    wsi = pj->ilen - base;
+  }
+  if (wsi < 0) {
+    wsi = 0;
+  }
+  
+  /* Transform the window; the window starts at key phase base MOD 3,
+   * and any bytes beyond the input window are transformed as zero bytes
+   * (for the trailer) */
+  if (pj->small) {
+    result = warp64io_small(pio, pj->fIn, pj->fOut, pj->pc,
+                            (size_t) ws, (size_t) wsi,
+                            pj->crc_mode, &crc);
+  } else {
+    result = warp64io_window(pio, pj->fIn, pj->fOut, pj->pc,
+                              base, (size_t) ws, (size_t) wsi,
+                              pj->crc_mode, &crc);
+  }
+  if (result != WARP64IO_OK) {
+    status = 0;
+    fprintf(stderr, "%s: %s!\n", pModule, warp64io_errstr(result));
+  }
+  
+  /* Add the checksum of the plaintext of the window, shifting it from
+   * the end of the window to the end of the plaintext; a window that
+   * only holds trailer has no plaintext and ends at the plaintext */
+  if (status && (pj->crc_mode != WARP64IO_CRC_NONE)) {
+    pend = base + ws;
+    if (pj->crc_mode == WARP64IO_CRC_INPUT) {
+      pend = base + wsi;
+    }
+    if (pend > pj->crc_len) {
+      pend = pj->crc_len;
+    }
+    crc = warp64k_crc_shift(crc, pj->crc_len - pend);
+    if (pthread_mutex_lock(&(pj->lock))) {
+      abort();
+    }
+    pj->crc ^= crc;
+    if (pthread_mutex_unlock(&(pj->lock))) {
+      abort();
+    }
+  }
+  
+  /* Record the finished window in the checkpoint */
+  if (status && (pj->pck != NULL)) {
+    if (!ckptAdvance(pj, w, crc)) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Set up the I/O backend state of a thread that processes windows.
+ * 
+ * Error messages are printed.  ioEnd() must be called on the state
+ * afterwards whether or not this succeeds.
+ * 
+ * Parameters:
+ * 
+ *   pio - the state to set up
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int ioBegin(WARP64IO *pio) {
+  int result = 0;
+  int flags = 0;
+  
+  if (pio == NULL) {
+    abort();
+  }
+  
+  flags = m_ioflags;
+  if (m_stats) {
+    flags |= WARP64IO_STATS;
+  }
+  if (m_sync == SYNC_ROLLING) {
+    flags |= WARP64IO_ROLLING;
+  }
+  if (m_huge) {
+    flags |= WARP64IO_HUGE;
+  }
+  result = warp64io_begin(pio, m_backend, m_winmax, flags);
+  if (result != WARP64IO_OK) {
+    fprintf(stderr, "%s: %s!\n", pModule, warp64io_errstr(result));
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Release the I/O backend state of a thread that processes windows,
+ * adding its counters to the statistics of the run.
+ * 
+ * Parameters:
+ * 
+ *   pio - the state to release
+ */
+static void ioEnd(WARP64IO *pio) {
+  RUN_STATS rs;
+  
+  memset(&rs, 0, sizeof(RUN_STATS));
+  
+  if (pio == NULL) {
+    abort();
+  }
+  
+  rs.io_sec = pio->io_sec;
+  rs.xform_sec = pio->xform_sec;
+  rs.windows = pio->windows;
+  rs.bytes = pio->bytes;
+  statsAdd(&rs);
+  
+  warp64io_end(pio);
+}
+
+/*
+ * Worker thread function for processing the windows of a job.
+ * 
+ * The worker pins itself according to m_pin and then keeps claiming
+ * and processing windows until there are none left or some window
+ * failed.
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to a WORKER_ARG
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *processWorker(void *pArg) {
+  WORKER_ARG *pa = NULL;
+  WINDOW_JOB *pj = NULL;
+  int64_t w = 0;
+  WARP64IO io;
+  
+  /* Initialize structures */
+  memset(&io, 0, sizeof(WARP64IO));
+  
+  /* Get the parameters */
+  if (pArg == NULL) {
+    abort();
+  }
+  pa = (WORKER_ARG *) pArg;
+  pj = pa->pj;
+  
+  /* Pin the thread if requested */
+  pinThread(pa->index);
+  
+  /* Set up the I/O backend, stopping the job if that fails */
+  if (!ioBegin(&io)) {
+    if (pthread_mutex_lock(&(pj->lock))) {
+      abort();
+    }
+    pj->failed = 1;
+    if (pthread_mutex_unlock(&(pj->lock))) {
+      abort();
+    }
+  }
+  
+  /* Keep processing windows */
+  for(;;) {
+    /* Claim the next window, unless we are done or something failed */
+    if (pthread_mutex_lock(&(pj->lock))) {
+      abort();
+    }
+    w = -1;
+    if ((!(pj->failed)) && (pj->next < pj->nwin)) {
+      w = pj->next;
+      (pj->next)++;
+    }
+    if (pthread_mutex_unlock(&(pj->lock))) {
+      abort();
+    }
+    if (w < 0) {
+      break;
+    }
+    
+    /* Process the window, flagging failure if necessary */
+    if (!processWindow(pj, w, &io)) {
+      if (pthread_mutex_lock(&(pj->lock))) {
+        abort();
+      }
+      pj->failed = 1;
+      if (pthread_mutex_unlock(&(pj->lock))) {
+        abort();
+      }
+      break;
+    }
+  }
+  
+  ioEnd(&io);
+  return NULL;
+}
+
+/*
+ * Perform Warp64 scrambling or descrambling of a job prepared by
+ * fileBegin().
+ * 
+ * The windows are distributed across m_threads worker threads.  If
+ * there is only one thread or only one window, everything is processed
+ * on the calling thread.  Processing starts at the first window of the
+ * job, so a resumed job skips the windows its checkpoint covers, and a
+ * job with a checkpoint updates it as windows finish.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int process64(WINDOW_JOB *pj) {
+  
+  int status = 1;
+  int tc = 0;
+  int started = 0;
+  int i = 0;
+  int64_t w = 0;
+  
+  WORKER_ARG *pArgs = NULL;
+  pthread_t *pThreads = NULL;
+  WARP64IO io;
+  
+  /* Initialize structures */
+  memset(&io, 0, sizeof(WARP64IO));
+  
+  /* Check parameters */
+  if (pj == NULL) {
+    abort();
+  }
+  if ((pj->fIn < 0) || (pj->fOut < 0)) {
+    abort();
+  }
+  
+  /* Reset the shared state */
+  pj->next = pj->first;
+  pj->failed = 0;
+  
+  /* Determine how many threads to use */
+  tc = m_threads;
+  if (pj->nwin - pj->first < (int64_t) tc) {
+    tc = (int) (pj->nwin - pj->first);
+  }
+  
+  if (tc <= 1) {
+    /* Single thread, so process everything on the calling thread */
+    pinThread(0);
+    if (!ioBegin(&io)) {
+      status = 0;
+    }
+    for(w = pj->first; status && (w < pj->nwin); w++) {
+      if (!processWindow(pj, w, &io)) {
+        status = 0;
+      }
+    }
+    ioEnd(&io);
+    
+  } else {
+    /* Allocate thread state */
+    pArgs = (WORKER_ARG *) calloc((size_t) tc, sizeof(WORKER_ARG));
+    pThreads = (pthread_t *) calloc((size_t) tc, sizeof(pthread_t));
+    if ((pArgs == NULL) || (pThreads == NULL)) {
+      abort();
+    }
+    
+    /* Start the workers */
+    for(i = 0; i < tc; i++) {
+      pArgs[i].pj = pj;
+      pArgs[i].index = i;
+      if (pthread_create(&(pThreads[i]), NULL,
+                          &processWorker, &(pArgs[i]))) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to start worker thread!\n",
+                pModule);
+        
+        /* Stop the workers that were already started */
+        if (pthread_mutex_lock(&(pj->lock))) {
+          abort();
+        }
+        pj->failed = 1;
+        if (pthread_mutex_unlock(&(pj->lock))) {
+          abort();
+        }
+        break;
+      }
+      started++;
+    }
+    
+    /* Wait for the workers to finish */
+    for(i = 0; i < started; i++) {
+      if (pthread_join(pThreads[i], NULL)) {
+        abort();
+      }
+    }
+    
+    /* Check whether any window failed */
+    if (pj->failed) {
+      status = 0;
+    }
+    
+    free(pArgs);
+    pArgs = NULL;
+    free(pThreads);
+    pThreads = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Turn on direct I/O for an open file.
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the file descriptor
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if not supported or error
+ */
+static int setDirect(int fd) {
+#ifdef O_DIRECT
+  int flags = 0;
+  
+  flags = fcntl(fd, F_GETFL);
+  if (flags < 0) {
+    return 0;
+  }
+  if (fcntl(fd, F_SETFL, flags | O_DIRECT)) {
+    return 0;
+  }
+  return 1;
+#else
+  (void) fd;
+  return 0;
+#endif
+}
+
+/*
+ * Turn the bare CRC register of a whole plaintext into its standard
+ * CRC32C.
+ * 
+ * The windows are checksummed from a register of zero, so the initial
+ * inversion of the standard CRC32C is added in here by shifting it over
+ * the whole length, along with the final inversion.
+ * 
+ * Parameters:
+ * 
+ *   reg - the bare CRC register of the plaintext
+ * 
+ *   len - the length of the plaintext in bytes
+ * 
+ * Return:
+ * 
+ *   the CRC32C of the plaintext
+ */
+static uint32_t crcFinish(uint32_t reg, int64_t len) {
+  return reg ^ warp64k_crc_shift(UINT32_C(0xffffffff), len) ^
+          UINT32_C(0xffffffff);
+}
+
+/*
+ * Get the checksum file path for a given scrambled file path.
+ * 
+ * The returned string must be released with free().
+ * 
+ * Parameters:
+ * 
+ *   pPath - the scrambled file path
+ * 
+ * Return:
+ * 
+ *   a newly allocated checksum file path
+ */
+static char *crcPath(const char *pPath) {
+  char *pResult = NULL;
+  
+  if (pPath == NULL) {
+    abort();
+  }
+  
+  pResult = (char *) calloc(strlen(pPath) + strlen(CRC_SUFFIX) + 1, 1);
+  if (pResult == NULL) {
+    abort();
+  }
+  strcpy(pResult, pPath);
+  strcat(pResult, CRC_SUFFIX);
+  
+  return pResult;
+}
+
+/*
+ * Read the checksum file of a scrambled file, if it has one.
+ * 
+ * The checksum file holds a line with the CRC32C as eight hexadecimal
+ * digits, followed by whitespace and the name of the plaintext file,
+ * which is ignored.  If there is no checksum file, this succeeds with
+ * *pFound cleared.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the scrambled file path
+ * 
+ *   pFound - set if the checksum file exists, cleared if not
+ * 
+ *   pCrc - receives the CRC32C if the checksum file exists
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the checksum file exists but can't
+ *   be read
+ */
+static int crcRead(const char *pPath, int *pFound, uint32_t *pCrc) {
+  int status = 1;
+  int i = 0;
+  int c = 0;
+  uint32_t v = 0;
+  char *pCrcPath = NULL;
+  FILE *pf = NULL;
+  char buf[16];
+  
+  /* Initialize structures */
+  memset(buf, 0, sizeof(buf));
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (pFound == NULL) || (pCrc == NULL)) {
+    abort();
+  }
+  *pFound = 0;
+  
+  /* Open the checksum file; it not being there is fine */
+  pCrcPath = crcPath(pPath);
+  pf = fopen(pCrcPath, "rb");
+  if (pf == NULL) {
+    if (errno != ENOENT) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s'!\n", pModule, pCrcPath);
+    }
+  }
+  
+  /* Read the eight digits and the character after them */
+  if (pf != NULL) {
+    *pFound = 1;
+    if (fread(buf, 1, 9, pf) < 8) {
+      status = 0;
+    }
+    for(i = 0; status && (i < 8); i++) {
+      c = (unsigned char) buf[i];
+      if ((c >= '0') && (c <= '9')) {
+        v = (v << 4) | ((uint32_t) (c - '0'));
+      } else if ((c >= 'a') && (c <= 'f')) {
+        v = (v << 4) | ((uint32_t) (c - 'a' + 10));
+      } else if ((c >= 'A') && (c <= 'F')) {
+        v = (v << 4) | ((uint32_t) (c - 'A' + 10));
+      } else {
+        status = 0;
+      }
+    }
+    if (status && (buf[8] != '\0') && (buf[8] != ' ') &&
+        (buf[8] != '\t') && (buf[8] != '\n')) {
+      status = 0;
+    }
+    if (!status) {
+      fprintf(stderr, "%s: Invalid checksum file '%s'!\n",
+              pModule, pCrcPath);
+    }
+    fclose(pf);
+    pf = NULL;
+  }
+  
+  if (status && *pFound) {
+    *pCrc = v;
+  }
+  
+  free(pCrcPath);
+  pCrcPath = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Write the checksum file of a scrambled file.
+ * 
+ * Any existing checksum file is replaced.  Unless the sync policy is
+ * SYNC_NONE, the file is flushed before it is closed.  The directory
+ * entry is left for the caller to flush along with the scrambled file.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the scrambled file path
+ * 
+ *   pName - the plaintext file path, whose last component is recorded
+ *   after the checksum
+ * 
+ *   crc - the CRC32C of the plaintext
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int crcWrite(const char *pPath, const char *pName, uint32_t crc) {
+  int status = 1;
+  int fd = -1;
+  int opened = 0;
+  char *pCrcPath = NULL;
+  const char *pBase = NULL;
+  char *pLine = NULL;
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (pName == NULL)) {
+    abort();
+  }
+  
+  /* Format the line */
+  pBase = strrchr(pName, '/');
+  if (pBase != NULL) {
+    pBase++;
+  } else {
+    pBase = pName;
+  }
+  pLine = (char *) calloc(strlen(pBase) + 16, 1);
+  if (pLine == NULL) {
+    abort();
+  }
+  sprintf(pLine, "%08lx  %s\n", (unsigned long) crc, pBase);
+  
+  /* Write it out */
+  pCrcPath = crcPath(pPath);
+  fd = open(pCrcPath, O_WRONLY | O_CREAT | O_TRUNC,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    status = 0;
+  } else {
+    opened = 1;
+  }
+  if (status) {
+    if (!writeFully(fd, (const uint8_t *) pLine, strlen(pLine), 0)) {
+      status = 0;
+    }
+  }
+  if (status && (m_sync != SYNC_NONE)) {
+    if (fdatasync(fd)) {
+      status = 0;
+    }
+  }
+  if (fd >= 0) {
+    if (close(fd)) {
+      status = 0;
+    }
+    fd = -1;
+  }
+  if (!status) {
+    fprintf(stderr, "%s: Failed to write '%s'!\n", pModule, pCrcPath);
+    if (opened) {
+      unlink(pCrcPath);
+    }
+  }
+  
+  free(pCrcPath);
+  pCrcPath = NULL;
+  free(pLine);
+  pLine = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Set up the transform context of a file job.
+ * 
+ * key is the normalized scrambling key, even when descrambling, in
+ * which case the context gets the inverted key.  If newkey is not -1,
+ * this is a re-key run, descramble must be set, and the context applies
+ * the difference of the keys.
+ * 
+ * Parameters:
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   key - the normalized scrambling key
+ * 
+ *   newkey - the new normalized scrambling key, or -1
+ * 
+ * Return:
+ * 
+ *   the new context, to be released with warp64_final()
+ */
+static WARP64_CTX *jobContext(int descramble, int32_t key, int32_t newkey) {
+  WARP64_CTX *pc = NULL;
+  
+  if ((key < 0) || (key > 0xffffffL)) {
+    abort();
+  }
+  if ((newkey < -1) || (newkey > 0xffffffL) ||
+      ((newkey >= 0) && (!descramble))) {
+    abort();
+  }
+  
+  if (newkey >= 0) {
+    pc = warp64_init(rekeyDelta(key, newkey), WARP64_SCRAMBLE);
+  } else {
+    pc = warp64_init(key,
+              descramble ? WARP64_DESCRAMBLE : WARP64_SCRAMBLE);
+  }
+  if (pc == NULL) {
+    abort();
+  }
+  return pc;
+}
+
+/*
+ * Pick the window size of a file job.
+ * 
+ * With a fixed window size, that is the size.  Otherwise, a single
+ * thread gets the whole file as one window, and several threads get
+ * WINDOW_SPLIT windows each, so that large files take few mappings.
+ * The window is rounded up to a whole number of huge pages and kept
+ * between m_winsize and m_winmax.
+ * 
+ * Parameters:
+ * 
+ *   olen - the length of the output file
+ * 
+ * Return:
+ * 
+ *   the window size in bytes
+ */
+static int64_t jobWindow(int64_t olen) {
+  int64_t ws = 0;
+  
+  if (olen < 0) {
+    abort();
+  }
+  
+  if ((!m_winauto) || (m_winmax <= m_winsize)) {
+    return (int64_t) m_winsize;
+  }
+  
+  ws = olen;
+  if (m_threads > 1) {
+    ws = olen / (((int64_t) m_threads) * WINDOW_SPLIT);
+  }
+  
+  if (ws >= (int64_t) m_winmax) {
+    return (int64_t) m_winmax;
+  }
+  ws = ((ws + WARP64IO_HUGEPAGE - 1) / WARP64IO_HUGEPAGE) *
+          WARP64IO_HUGEPAGE;
+  if (ws < (int64_t) m_winsize) {
+    ws = (int64_t) m_winsize;
+  }
+  if (ws > (int64_t) m_winmax) {
+    ws = (int64_t) m_winmax;
+  }
+  return ws;
+}
+
+/*
+ * Work out the largest window that automatic sizing may pick.
+ * 
+ * Only the mmap backend gets larger windows.  The pread backend and
+ * direct I/O hold a buffer of the largest window for every thread, and
+ * the uring backend splits windows into chunks anyway, so they keep
+ * m_winsize, as do --nocache and rolling writeback, which work window
+ * by window.  Otherwise, each thread has an input and an output window
+ * in the cache at any time, so the windows of all the threads get at
+ * most a quarter of the free memory, up to WINDOW_AUTO_MAX.  The result
+ * is a whole number of huge pages, and never less than m_winsize.
+ * 
+ * Return:
+ * 
+ *   the largest window size in bytes
+ */
+static size_t autoWindowMax(void) {
+  long pages = 0;
+  long psz = 0;
+  int64_t wmax = WINDOW_AUTO_MAX;
+  int64_t avail = 0;
+  
+  if ((m_backend != WARP64IO_MMAP) ||
+      (m_ioflags & (WARP64IO_NOCACHE | WARP64IO_DIRECT)) ||
+      (m_sync == SYNC_ROLLING)) {
+    return m_winsize;
+  }
+  
+#ifdef _SC_AVPHYS_PAGES
+  pages = sysconf(_SC_AVPHYS_PAGES);
+#endif
+  psz = sysconf(_SC_PAGESIZE);
+  if ((pages < 1) || (psz < 1)) {
+    return m_winsize;
+  }
+  
+  avail = ((int64_t) pages) * ((int64_t) psz);
+  avail = avail / (4 * ((int64_t) m_threads));
+  if (avail < wmax) {
+    wmax = avail;
+  }
+  wmax = (wmax / WARP64IO_HUGEPAGE) * WARP64IO_HUGEPAGE;
+  if (wmax < (int64_t) m_winsize) {
+    return m_winsize;
+  }
+  return (size_t) wmax;
+}
+
+/*
+ * Open the input and output files of a file job and get the job ready
+ * for processWindow() or process64().
+ * 
+ * key is the normalized scrambling key, even when descrambling.  When
+ * descrambling, the trailer is checked with it and the job is then set
+ * up with the inverted key.
+ * 
+ * If newkey is not -1, this is a re-key run, and descramble must be
+ * set.  The trailer is checked with key as usual, but the whole file,
+ * trailer included, is then transformed to newkey into an output of
+ * the same length, which fileEnd() renames over the input.
+ * 
+ * With --crc, a scrambling job checksums its input.  A descrambling job
+ * checksums its output whenever the input has a checksum file, and
+ * fileEnd() then checks the result against it; with --crc, the
+ * checksum file is required.
+ * 
+ * The output file must not exist yet.  It is created and expanded to
+ * its final length, unless the job is small, in which case the single
+ * write of warp64io_small() gives it its length.  A small job costs an
+ * open, an fstat, a read and a write per file on top of finishing it,
+ * so that it isn't dominated by system calls when there are many tiny
+ * files.
+ * 
+ * pc is the transform context to use, which must match the mode and
+ * keys, or NULL to set one up with jobContext().  A batch passes its
+ * shared context, so that there is no allocation per file.
+ * 
+ * If resume is set, the run continues from a checkpoint, so the output
+ * file must exist instead.  It is opened as it is, and it is left in
+ * place if this function fails.
+ * 
+ * If this function succeeds, fileEnd() must be called on the job
+ * afterwards.  If it fails, everything has already been cleaned up and
+ * fileEnd() must not be called.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job to initialize
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path to the output file
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   key - the normalized scrambling key
+ * 
+ *   newkey - the new normalized scrambling key, or -1
+ * 
+ *   pc - the transform context to share, or NULL
+ * 
+ *   resume - non-zero if the output file is that of an interrupted run
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int fileBegin(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int          descramble,
+          int32_t      key,
+          int32_t      newkey,
+          WARP64_CTX * pc,
+          int          resume) {
+  
+  int status = 1;
+  
+  int64_t ctlen = 0;
+  int64_t olen = 0;
+  
+  uint8_t dummy = 0;
+  struct stat st;
+  
+  int new_file = 0;
+  int expand = 0;
+  int fIn = -1;
+  int fOut = -1;
+  
+  double t0 = 0.0;
+  RUN_STATS rs;
+  
+  memset(&rs, 0, sizeof(RUN_STATS));
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pInputPath == NULL) || (pOutputPath == NULL)) {
+    abort();
+  }
+  if ((key < 0) || (key > 0xffffffL)) {
+    abort();
+  }
+  if ((newkey < -1) || (newkey > 0xffffffL) ||
+      ((newkey >= 0) && (!descramble))) {
+    abort();
+  }
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  
+  /* Clear the job */
+  memset(pj, 0, sizeof(WINDOW_JOB));
+  pj->fIn = -1;
+  pj->fOut = -1;
+  
+  /* Open the input file for reading */
+  if (status) {
+    fIn = open(pInputPath, O_RDONLY);
+    if (fIn < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pInputPath);
+    }
+  }
+  
+  /* Get the length of the input file; all input is read at explicit
+   * offsets, so the file position doesn't matter, and seeking to the
+   * end is only needed for devices, whose length fstat() doesn't
+   * give */
+  if (status) {
+    if (fstat(fIn, &st)) {
+      status = 0;
+    } else if (S_ISREG(st.st_mode)) {
+      ctlen = (int64_t) st.st_size;
+    } else {
+      ctlen = (int64_t) lseek(fIn, 0, SEEK_END);
+      if (ctlen < 0) {
+        status = 0;
+      }
+    }
+    if (!status) {
+      fprintf(stderr, "%s: Failed to get length of '%s'!\n",
+              pModule, pInputPath);
+    }
+  }
+  
+  /* If this is descrambling mode, then input file length must be at
+   * least three and then content length is three less than input file;
+   * else, leave content length equal to input file length */
+  if (status && descramble) {
+    if (ctlen < 3) {
+      status = 0;
+      fprintf(stderr, "%s: Missing trailer in '%s'!\n",
+              pModule, pInputPath);
+    }
+    if (status) {
+      ctlen = ctlen - 3;
+    }
+  }
+  
+  /* If this is descrambling mode, then read the last three bytes and
+   * verify the descrambled trailer bytes are zero to check the key */
+  if (status && descramble) {
+    if (!verifyTrailer(fIn, pInputPath, key, ctlen)) {
+      status = 0;
+    }
+  }
+  
+  /* When descrambling, look for a checksum file of the plaintext, which
+   * is then checked against the plaintext as it is written; with --crc,
+   * there must be one */
+  if (status && descramble && (newkey < 0)) {
+    if (!crcRead(pInputPath, &(pj->crc_check), &(pj->crc_want))) {
+      status = 0;
+    }
+    if (status && m_crc && (!(pj->crc_check))) {
+      status = 0;
+      fprintf(stderr, "%s: No checksum file for '%s'!\n",
+              pModule, pInputPath);
+    }
+  }
+  
+  /* A resumed run picks up the output file that the interrupted run
+   * left behind */
+  if (status && resume) {
+    fOut = open(pOutputPath, O_RDWR);
+    if (fOut < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  
+  /* Open the output file for writing; do not allow existing files to be
+   * overwritten; set new_file flag if successfully created a new 
+   * file */
+  if (status && (!resume)) {
+    fOut = open(pOutputPath, O_RDWR | O_CREAT | O_EXCL,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fOut < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create '%s'!\n",
+              pModule, pOutputPath);
+      fprintf(stderr, "%s: Check that '%s' does not exist.\n",
+              pModule, pOutputPath);
+    }
+
+    if (status) {
+      new_file = 1;
+    }
+  }
+  
+  /* Compute length of output file based on content length; a re-key
+   * keeps the trailer, so it has the length of a scrambled file */
+  if (status && descramble && (newkey < 0)) {
+    olen = ctlen;
+    
+  } else if (status) {
+    if (ctlen <= INT64_MAX - 3) {
+      olen = ctlen + 3;
+    } else {
+      status = 0;
+      fprintf(stderr, "%s: Output file length overflow!\n", pModule);
+    }
+  }
+  
+  /* A file of at most one small window is read, transformed and
+   * written in one go, except where direct or sparse I/O needs the
+   * backend */
+  if (status) {
+    pj->winsize = jobWindow(olen);
+    if ((olen > 0) && (olen <= WARP64IO_SMALL) &&
+        (olen <= pj->winsize) &&
+        (!(m_ioflags & (WARP64IO_DIRECT | WARP64IO_SPARSE)))) {
+      pj->small = 1;
+    }
+  }
+  
+  /* Expand the output file to the proper length if non-empty, unless
+   * the single write of a small file does that; the output file of a
+   * resumed run already has its length, and a resumed job is never
+   * small, because it has been checkpointed */
+  if (resume) {
+    pj->small = 0;
+    expand = 0;
+  } else {
+    expand = !(pj->small);
+  }
+  if (status && (olen > 1) && expand) {
+    if (lseek(fOut, (off_t) (olen - 1), SEEK_SET) != olen - 1) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to set output length!\n", pModule);
+    }
+  }
+  if (status && (olen > 0) && expand) {
+    if (write(fOut, &dummy, 1) != 1) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to set output length!\n", pModule);
+    }
+  }
+  if (status && (olen > 0) && expand) {
+    if (lseek(fOut, 0, SEEK_SET) != 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to set output length!\n", pModule);
+    }
+  }
+  
+  /* Switch both files to direct I/O if requested, now that the output
+   * file has its length */
+  if (status && (m_ioflags & WARP64IO_DIRECT)) {
+    if (!setDirect(fIn) || !setDirect(fOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Direct I/O is not supported for '%s'!\n",
+              pModule, pInputPath);
+    }
+  }
+  
+  /* Set up the job; remaining input is same as output byte count,
+   * except when scrambling, in which case input is three less than
+   * output because of the trailer; a re-key applies the difference of
+   * the keys to everything */
+  if (status) {
+    pj->fIn = fIn;
+    pj->fOut = fOut;
+    if (pc != NULL) {
+      pj->pc = pc;
+      pj->own_pc = 0;
+    } else {
+      pj->pc = jobContext(descramble, key, newkey);
+      pj->own_pc = 1;
+    }
+    if (newkey >= 0) {
+      pj->replace = 1;
+    }
+    pj->olen = olen;
+    pj->ilen = olen;
+    if (!descramble) {
+      pj->ilen = olen - 3;
+    }
+    pj->nwin = olen / pj->winsize;
+    if ((olen % pj->winsize) != 0) {
+      (pj->nwin)++;
+    }
+    pj->next = 0;
+    pj->failed = 0;
+    if (pthread_mutex_init(&(pj->lock), NULL)) {
+      abort();
+    }
+    
+    /* The plaintext is the input when scrambling and the output when
+     * descrambling; a re-key never sees it */
+    pj->crc = 0;
+    if (pj->crc_check) {
+      pj->crc_mode = WARP64IO_CRC_OUTPUT;
+      pj->crc_len = olen;
+    } else if (m_crc && (!descramble)) {
+      pj->crc_mode = WARP64IO_CRC_INPUT;
+      pj->crc_len = pj->ilen;
+    } else {
+      pj->crc_mode = WARP64IO_CRC_NONE;
+    }
+  }
+  
+  /* If there was a failure, close the files and remove the output file
+   * if we created it */
+  if (!status) {
+    if (fIn >= 0) {
+      close(fIn);
+      fIn = -1;
+    }
+    if (fOut >= 0) {
+      close(fOut);
+      fOut = -1;
+    }
+    if (new_file) {
+      if (unlink(pOutputPath)) {
+        fprintf(stderr, "%s: Failed to clean up output file!\n",
+                pModule);
+      }
+    }
+  }
+  
+  if (m_stats) {
+    rs.setup_sec = nowSec() - t0;
+    statsAdd(&rs);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Finish a file job that was started with fileBegin().
+ * 
+ * With direct I/O, the padded writes of the last window may have left
+ * the output file too long, so it is first truncated to its proper
+ * length.  A descrambled plaintext is checked against its checksum
+ * file, if there is one.  Unless the sync policy is SYNC_NONE, the
+ * output file and its directory entry are then flushed, so that the
+ * input file is only removed once the output is durable.  Both files
+ * are then closed.  A scrambling job with --crc writes the checksum
+ * file of the output.  If the job succeeded, the input file is then
+ * removed, or replaced by the output file for a re-key run, and the
+ * checksum file of a descrambled input is removed along with it.
+ * Otherwise, the output file and any checksum file written for it are
+ * removed instead, unless the job keeps them for a resumed run.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path to the output file
+ * 
+ *   ok - non-zero if the job was processed successfully
+ * 
+ * Return:
+ * 
+ *   non-zero if the job succeeded, zero if it failed
+ */
+static int fileEnd(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int          ok) {
+  
+  int renamed = 0;
+  int crc_written = 0;
+  char *pCrcPath = NULL;
+  double t0 = 0.0;
+  RUN_STATS rs;
+  
+  memset(&rs, 0, sizeof(RUN_STATS));
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pInputPath == NULL) || (pOutputPath == NULL)) {
+    abort();
+  }
+  if ((pj->fIn < 0) || (pj->fOut < 0)) {
+    abort();
+  }
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  
+  /* Drop the padding of direct writes */
+  if (ok && (m_ioflags & WARP64IO_DIRECT)) {
+    if (ftruncate(pj->fOut, (off_t) pj->olen)) {
+      ok = 0;
+      fprintf(stderr, "%s: Failed to set output length!\n", pModule);
+    }
+  }
+  
+  /* Check the plaintext against its checksum file */
+  if (ok && pj->crc_check) {
+    if (crcFinish(pj->crc, pj->crc_len) != pj->crc_want) {
+      ok = 0;
+      fprintf(stderr, "%s: Checksum mismatch for '%s'!\n",
+              pModule, pInputPath);
+    }
+  }
+  
+  /* Flush the output before anything happens to the input */
+  if (ok && (m_sync != SYNC_NONE)) {
+    if (fdatasync(pj->fOut)) {
+      ok = 0;
+      fprintf(stderr, "%s: Failed to flush '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  
+  /* Close open file handles */
+  if (close(pj->fIn)) {
+    fprintf(stderr, "%s: Failed to close input file!\n", pModule);
+  }
+  pj->fIn = -1;
+  
+  if (close(pj->fOut)) {
+    fprintf(stderr, "%s: Failed to close output file!\n", pModule);
+  }
+  pj->fOut = -1;
+  
+  /* Release the job; the trailer was written or checked along with the
+   * windows, so the context has nothing left to do */
+  if (pthread_mutex_destroy(&(pj->lock))) {
+    abort();
+  }
+  if (pj->own_pc) {
+    warp64_final(pj->pc, NULL);
+  }
+  pj->pc = NULL;
+  
+  /* A re-key run replaces the input with the output in one step, so
+   * the file is never missing */
+  if (ok && pj->replace) {
+    if (rename(pOutputPath, pInputPath)) {
+      ok = 0;
+      fprintf(stderr, "%s: Failed to replace '%s'!\n",
+              pModule, pInputPath);
+    } else {
+      renamed = 1;
+    }
+  }
+  
+  /* Record the checksum of the plaintext next to the scrambled file */
+  if (ok && (pj->crc_mode == WARP64IO_CRC_INPUT)) {
+    if (crcWrite(pOutputPath, pInputPath,
+                  crcFinish(pj->crc, pj->crc_len))) {
+      crc_written = 1;
+    } else {
+      ok = 0;
+    }
+  }
+  
+  /* Make the new directory entries durable before the input is
+   * removed; the checksum file is in the same directory */
+  if (ok && (m_sync != SYNC_NONE)) {
+    if (!syncDir(renamed ? pInputPath : pOutputPath)) {
+      ok = 0;
+    }
+  }
+  
+  /* If there was a failure, remove the output file unless it already
+   * replaced the input or a checkpoint still refers to it; else,
+   * remove the input file unless it was replaced */
+  if ((!ok) && (!renamed) && (!(pj->keep))) {
+    if (unlink(pOutputPath)) {
+      fprintf(stderr, "%s: Failed to clean up output file!\n", pModule);
+    }
+    if (crc_written) {
+      pCrcPath = crcPath(pOutputPath);
+      if (unlink(pCrcPath)) {
+        fprintf(stderr, "%s: Failed to clean up checksum file!\n",
+                pModule);
+      }
+    }
+  } else if (ok && (!(pj->replace))) {
+    if (unlink(pInputPath)) {
+      fprintf(stderr, "%s: Failed to remove input file!\n", pModule);
+    }
+  }
+  
+  /* The checksum file of a descrambled input goes with it */
+  if (ok && pj->crc_check) {
+    pCrcPath = crcPath(pInputPath);
+    if (unlink(pCrcPath)) {
+      fprintf(stderr, "%s: Failed to remove checksum file!\n", pModule);
+    }
+  }
+  if (pCrcPath != NULL) {
+    free(pCrcPath);
+    pCrcPath = NULL;
+  }
+  
+  if (m_stats) {
+    rs.finish_sec = nowSec() - t0;
+    if (ok) {
+      rs.files = 1;
+    }
+    rs.window = pj->winsize;
+    statsAdd(&rs);
+  }
+  
+  return ok;
+}
+
+/*
+ * Get the checkpoint path for a given output path.
+ * 
+ * The returned string must be released with free().
+ * 
+ * Parameters:
+ * 
+ *   pPath - the output path
+ * 
+ * Return:
+ * 
+ *   a newly allocated checkpoint path
+ */
+static char *ckptPath(const char *pPath) {
+  char *pResult = NULL;
+  
+  if (pPath == NULL) {
+    abort();
+  }
+  
+  pResult = (char *) calloc(strlen(pPath) + strlen(CKPT_SUFFIX) + 1, 1);
+  if (pResult == NULL) {
+    abort();
+  }
+  strcpy(pResult, pPath);
+  strcat(pResult, CKPT_SUFFIX);
+  
+  return pResult;
+}
+
+/*
+ * Write a checkpoint record and flush it to disk.
+ * 
+ * The sequence number of the record is incremented first, and records
+ * alternate between the two slots, so that a torn write leaves the
+ * previous record intact.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the checkpoint file
+ * 
+ *   pr - the record to write
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int ckptWrite(int fd, CHECKPOINT *pr) {
+  int status = 1;
+  uint8_t buf[CKPT_SLOT];
+  
+  /* Check parameters */
+  if ((fd < 0) || (pr == NULL)) {
+    abort();
+  }
+  
+  /* Serialize the record */
+  (pr->seq)++;
+  memset(buf, 0, CKPT_SLOT);
+  memcpy(buf, CKPT_MAGIC, 8);
+  packU64(&(buf[  8]), (uint64_t) pr->seq);
+  packU64(&(buf[ 16]), (uint64_t) pr->descramble);
+  packU64(&(buf[ 24]), (uint64_t) pr->rekey);
+  packU64(&(buf[ 32]), (uint64_t) pr->crc_mode);
+  packU64(&(buf[ 40]), (uint64_t) pr->ilen);
+  packU64(&(buf[ 48]), (uint64_t) pr->olen);
+  packU64(&(buf[ 56]), (uint64_t) pr->winsize);
+  packU64(&(buf[ 64]), (uint64_t) pr->done);
+  packU64(&(buf[ 72]), (uint64_t) pr->crc);
+  packU64(&(buf[ 80]), (uint64_t) pr->in_size);
+  packU64(&(buf[ 88]), (uint64_t) pr->in_ino);
+  packU64(&(buf[ 96]), (uint64_t) pr->in_mtime);
+  packU64(&(buf[104]), fnv64(buf, 104));
+  
+  /* Write it to the slot for this sequence number and flush */
+  if (!writeFully(fd, buf, CKPT_SLOT,
+                  (int64_t) ((pr->seq % 2) * CKPT_SLOT))) {
+    status = 0;
+  }
+  if (status) {
+    if (fdatasync(fd)) {
+      status = 0;
+    }
+  }
+  
+  if (!status) {
+    fprintf(stderr, "%s: Failed to write checkpoint!\n", pModule);
+  }
+  
+  return status;
+}
+
+/*
+ * Read the latest valid checkpoint record.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the checkpoint file
+ * 
+ *   pr - receives the record
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error or no valid record
+ */
+static int ckptRead(int fd, CHECKPOINT *pr) {
+  int found = 0;
+  int i = 0;
+  uint8_t buf[CKPT_SLOT];
+  CHECKPOINT cr;
+  
+  /* Check parameters */
+  if ((fd < 0) || (pr == NULL)) {
+    abort();
+  }
+  
+  /* Check both slots and keep the valid one with the highest sequence
+   * number */
+  memset(pr, 0, sizeof(CHECKPOINT));
+  for(i = 0; i < 2; i++) {
+    if (!readFully(fd, buf, CKPT_SLOT, (int64_t) (i * CKPT_SLOT))) {
+      continue;
+    }
+    if (memcmp(buf, CKPT_MAGIC, 8) != 0) {
+      continue;
+    }
+    if (unpackU64(&(buf[104])) != fnv64(buf, 104)) {
+      continue;
+    }
+  
+    memset(&cr, 0, sizeof(CHECKPOINT));
+    cr.seq        = (int64_t)  unpackU64(&(buf[  8]));
+    cr.descramble = (int)      unpackU64(&(buf[ 16]));
+    cr.rekey      = (int)      unpackU64(&(buf[ 24]));
+    cr.crc_mode   = (int)      unpackU64(&(buf[ 32]));
+    cr.ilen       = (int64_t)  unpackU64(&(buf[ 40]));
+    cr.olen       = (int64_t)  unpackU64(&(buf[ 48]));
+    cr.winsize    = (int64_t)  unpackU64(&(buf[ 56]));
+    cr.done       = (int64_t)  unpackU64(&(buf[ 64]));
+    cr.crc        = (uint32_t) unpackU64(&(buf[ 72]));
+    cr.in_size    = (int64_t)  unpackU64(&(buf[ 80]));
+    cr.in_ino     = (int64_t)  unpackU64(&(buf[ 88]));
+    cr.in_mtime   = (int64_t)  unpackU64(&(buf[ 96]));
+  
+    if ((!found) || (cr.seq > pr->seq)) {
+      memcpy(pr, &cr, sizeof(CHECKPOINT));
+      found = 1;
+    }
+  }
+  
+  /* Sanity-check the record; a checkpoint always leaves at least one
+   * window to do */
+  if (found) {
+    if ((pr->ilen < 0) || (pr->olen < pr->ilen) ||
+        (pr->winsize < 1) || (pr->winsize > WINDOW_MAX) ||
+        (pr->done < 0) || (pr->done >= pr->olen) ||
+        ((pr->done % pr->winsize) != 0)) {
+      found = 0;
+    }
+  }
+  
+  if (!found) {
+    fprintf(stderr, "%s: Checkpoint is damaged!\n", pModule);
+  }
+  
+  return found;
+}
+
+/*
+ * Record a finished window of a job that keeps a checkpoint.
+ * 
+ * Once every window before the first unfinished one adds up to at least
+ * the checkpoint interval beyond the last checkpoint, the output file is
+ * flushed and a new checkpoint is written for them.  The last windows
+ * are not checkpointed, since the job finishes right after them.  The
+ * checkpoint lock is held while flushing, so the other workers wait
+ * for it when they finish a window in the meantime.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ *   w - the index of the finished window
+ * 
+ *   crc - the CRC register of the plaintext of the window, if the job
+ *   checksums the plaintext
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int ckptAdvance(WINDOW_JOB *pj, int64_t w, uint32_t crc) {
+  int status = 1;
+  CHECKPOINT_RUN *pk = NULL;
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pj->pck == NULL)) {
+    abort();
+  }
+  if ((w < 0) || (w >= pj->nwin)) {
+    abort();
+  }
+  pk = pj->pck;
+  
+  if (pthread_mutex_lock(&(pk->lock))) {
+    abort();
+  }
+  
+  /* Mark the window and extend the finished windows at the start */
+  pk->pDone[w] = 1;
+  if (pk->pCrc != NULL) {
+    pk->pCrc[w] = crc;
+  }
+  while ((pk->next < pj->nwin) && pk->pDone[pk->next]) {
+    if (pk->pCrc != NULL) {
+      pk->crc ^= pk->pCrc[pk->next];
+    }
+    (pk->next)++;
+  }
+  
+  /* Flush the windows before the checkpoint that covers them */
+  if ((pk->next < pj->nwin) &&
+      (pk->next - pk->rec.done / pj->winsize >= pk->every)) {
+    if (fdatasync(pj->fOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to flush output file!\n", pModule);
+    }
+    if (status) {
+      pk->rec.done = pk->next * pj->winsize;
+      pk->rec.crc = pk->crc;
+      if (!ckptWrite(pk->fd, &(pk->rec))) {
+        status = 0;
+      }
+    }
+  }
+  
+  if (pthread_mutex_unlock(&(pk->lock))) {
+    abort();
+  }
+  
+  return status;
+}
+
+/*
+ * Check that the output of a resumed job really is the transformed
+ * input just before the checkpointed offset.
+ * 
+ * Up to CKPT_PROBE bytes of input are transformed with the context of
+ * the job and compared against the output file.  This catches a wrong
+ * key when scrambling, which has no trailer to check it against, as
+ * well as an output file that was replaced or changed.  The files are
+ * opened again, because the descriptors of the job may be set up for
+ * direct I/O.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path to the output file
+ * 
+ *   done - the checkpointed offset
+ * 
+ * Return:
+ * 
+ *   non-zero if the output matches, zero if not or error
+ */
+static int ckptProbe(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int64_t      done) {
+  
+  int status = 1;
+  int fIn = -1;
+  int fOut = -1;
+  int64_t off = 0;
+  int64_t len = 0;
+  int64_t n = 0;
+  uint8_t *pBuf = NULL;
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pInputPath == NULL) || (pOutputPath == NULL)) {
+    abort();
+  }
+  if ((done < 0) || (done > pj->olen)) {
+    abort();
+  }
+  
+  /* Work out the probe; input bytes beyond the input are zero */
+  len = CKPT_PROBE;
+  if (done < len) {
+    len = done;
+  }
+  if (len < 1) {
+    return 1;
+  }
+  off = done - len;
+  n = pj->ilen - off;
+  if (n > len) {
+    n = len;
+  }
+  
+  /* The buffer holds the input, its transform and the output */
+  pBuf = (uint8_t *) calloc((size_t) (3 * len), 1);
+  if (pBuf == NULL) {
+    abort();
+  }
+  
+  /* Read the input and the output */
+  fIn = open(pInputPath, O_RDONLY);
+  fOut = open(pOutputPath, O_RDONLY);
+  if ((fIn < 0) || (fOut < 0)) {
+    status = 0;
+  }
+  if (status && (n > 0)) {
+    if (!readFully(fIn, pBuf, (size_t) n, off)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (!readFully(fOut, &(pBuf[2 * len]), (size_t) len, off)) {
+      status = 0;
+    }
+  }
+  if (!status) {
+    fprintf(stderr, "%s: Failed to read '%s' to resume it!\n",
+            pModule, pInputPath);
+  }
+  
+  /* Compare */
+  if (status) {
+    warp64_update_at(pj->pc, off, pBuf, &(pBuf[len]), (size_t) len);
+    if (memcmp(&(pBuf[len]), &(pBuf[2 * len]), (size_t) len) != 0) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' doesn't match its checkpoint!\n",
+              pModule, pOutputPath);
+      fprintf(stderr, "%s: Check the key, or remove '%s' to start over.\n",
+              pModule, pOutputPath);
+    }
+  }
+  
+  /* Clean up */
+  if (fIn >= 0) {
+    close(fIn);
+    fIn = -1;
+  }
+  if (fOut >= 0) {
+    close(fOut);
+    fOut = -1;
+  }
+  free(pBuf);
+  pBuf = NULL;
+  
+  return status;
+}
+
+/*
+ * Set up the checkpoint of a job prepared by fileBegin().
+ * 
+ * Nothing is done unless checkpoints were requested, and a job of a
+ * single window isn't checkpointed either, since there would be nothing
+ * to resume.  A new run creates the checkpoint file next to the output
+ * and writes a first record for it.  A resumed run reads the record,
+ * checks that it was made by the same kind of job for the same input
+ * file, and that the output matches the input just before the
+ * checkpointed offset, and then sets up the job to continue from there
+ * with the window size of the checkpoint.
+ * 
+ * If this function succeeds and the job has a checkpoint, ckptEnd()
+ * must be called on the job after fileEnd().  If it fails, everything
+ * it set up has been released, and a checkpoint file it created has
+ * been removed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path to the output file
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   rekey - non-zero if this is a re-key run
+ * 
+ *   resume - non-zero to continue from an existing checkpoint
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int ckptBegin(
+          WINDOW_JOB * pj,
+    const char       * pInputPath,
+    const char       * pOutputPath,
+          int          descramble,
+          int          rekey,
+          int          resume) {
+  
+  int status = 1;
+  int fd = -1;
+  int created = 0;
+  int64_t w = 0;
+  char *pPath = NULL;
+  CHECKPOINT_RUN *pk = NULL;
+  CHECKPOINT cr;
+  CHECKPOINT old;
+  struct stat st;
+  
+  memset(&cr, 0, sizeof(CHECKPOINT));
+  memset(&old, 0, sizeof(CHECKPOINT));
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pInputPath == NULL) || (pOutputPath == NULL)) {
+    abort();
+  }
+  if ((pj->fIn < 0) || (pj->fOut < 0) || (pj->pck != NULL)) {
+    abort();
+  }
+  
+  /* Only jobs of several windows are checkpointed */
+  if ((m_ckpt < 1) || ((!resume) && (pj->nwin < 2))) {
+    return 1;
+  }
+  
+  /* Describe the job and its input */
+  if (fstat(pj->fIn, &st)) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to stat '%s'\n", pModule, pInputPath);
+  }
+  if (status) {
+    cr.descramble = descramble;
+    cr.rekey = rekey;
+    cr.crc_mode = pj->crc_mode;
+    cr.ilen = pj->ilen;
+    cr.olen = pj->olen;
+    cr.winsize = pj->winsize;
+    cr.in_size = (int64_t) st.st_size;
+    cr.in_ino = (int64_t) st.st_ino;
+    cr.in_mtime = (int64_t) st.st_mtime;
+  }
+  
+  /* Open the checkpoint file; a new run replaces any stale checkpoint,
+   * whose output is gone, since fileBegin() just created the output */
+  pPath = ckptPath(pOutputPath);
+  if (status && resume) {
+    fd = open(pPath, O_RDWR);
+    if (fd < 0) {
+      status = 0;
+      fprintf(stderr, "%s: No checkpoint for '%s'!\n",
+              pModule, pOutputPath);
+    }
+  } else if (status) {
+    fd = open(pPath, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create '%s'!\n", pModule, pPath);
+    } else {
+      created = 1;
+    }
+  }
+  
+  /* A resumed run only continues the run that wrote the checkpoint,
+   * on the same input file, with its progress, window size and
+   * checksum */
+  if (status && resume) {
+    if (!ckptRead(fd, &old)) {
+      status = 0;
+    }
+  }
+  if (status && resume) {
+    if ((old.descramble != cr.descramble) || (old.rekey != cr.rekey) ||
+        (old.crc_mode != cr.crc_mode) ||
+        (old.ilen != cr.ilen) || (old.olen != cr.olen) ||
+        (old.in_size != cr.in_size) || (old.in_ino != cr.in_ino) ||
+        (old.in_mtime != cr.in_mtime)) {
+      status = 0;
+      fprintf(stderr, "%s: Checkpoint of '%s' is from another run!\n",
+              pModule, pOutputPath);
+    }
+  }
+  if (status && resume) {
+    memcpy(&cr, &old, sizeof(CHECKPOINT));
+    pj->winsize = cr.winsize;
+    pj->nwin = pj->olen / pj->winsize;
+    if ((pj->olen % pj->winsize) != 0) {
+      (pj->nwin)++;
+    }
+    if ((size_t) cr.winsize > m_winmax) {
+      m_winmax = (size_t) cr.winsize;
+    }
+  }
+  
+  /* The output of the interrupted run must still be there in full */
+  if (status && resume) {
+    if (fstat(pj->fOut, &st)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to stat '%s'\n", pModule, pOutputPath);
+    } else if ((int64_t) st.st_size < pj->olen) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' is shorter than its checkpoint!\n",
+              pModule, pOutputPath);
+    }
+  }
+  if (status && resume) {
+    if (!ckptProbe(pj, pInputPath, pOutputPath, cr.done)) {
+      status = 0;
+    }
+  }
+  
+  /* A new checkpoint is durable, directory entry included, before any
+   * window relies on it */
+  if (status && (!resume)) {
+    if (!ckptWrite(fd, &cr)) {
+      status = 0;
+    }
+  }
+  if (status && (!resume)) {
+    if (!syncDir(pOutputPath)) {
+      status = 0;
+    }
+  }
+  
+  /* Set up the checkpoint state, with the checkpointed windows already
+   * finished */
+  if (status) {
+    pk = (CHECKPOINT_RUN *) calloc(1, sizeof(CHECKPOINT_RUN));
+    if (pk == NULL) {
+      abort();
+    }
+    pk->pDone = (uint8_t *) calloc((size_t) pj->nwin, 1);
+    if (pk->pDone == NULL) {
+      abort();
+    }
+    if (pj->crc_mode != WARP64IO_CRC_NONE) {
+      pk->pCrc = (uint32_t *) calloc((size_t) pj->nwin, sizeof(uint32_t));
+      if (pk->pCrc == NULL) {
+        abort();
+      }
+    }
+    if (pthread_mutex_init(&(pk->lock), NULL)) {
+      abort();
+    }
+    pk->fd = fd;
+    fd = -1;
+    memcpy(&(pk->rec), &cr, sizeof(CHECKPOINT));
+    pk->every = m_ckpt;
+    pk->next = cr.done / pj->winsize;
+    pk->crc = cr.crc;
+    for(w = 0; w < pk->next; w++) {
+      pk->pDone[w] = 1;
+    }
+  
+    pj->pck = pk;
+    pj->first = pk->next;
+    pj->crc = cr.crc;
+  }
+  
+  /* Clean up on failure */
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  if ((!status) && created) {
+    if (unlink(pPath)) {
+      fprintf(stderr, "%s: Failed to clean up checkpoint file!\n",
+              pModule);
+    }
+  }
+  free(pPath);
+  pPath = NULL;
+  
+  return status;
+}
+
+/*
+ * Release the checkpoint of a job after fileEnd().
+ * 
+ * The checkpoint file is removed along with the output file, which
+ * fileEnd() keeps if the job failed after the checkpoint was written.
+ * In that case, both are left for a resumed run.  Nothing is done if
+ * the job keeps no checkpoint.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pj - the job
+ * 
+ *   pOutputPath - path to the output file
+ */
+static void ckptEnd(WINDOW_JOB *pj, const char *pOutputPath) {
+  char *pPath = NULL;
+  CHECKPOINT_RUN *pk = NULL;
+  
+  /* Check parameters */
+  if ((pj == NULL) || (pOutputPath == NULL)) {
+    abort();
+  }
+  if (pj->pck == NULL) {
+    return;
+  }
+  pk = pj->pck;
+  
+  /* Release the state */
+  if (close(pk->fd)) {
+    fprintf(stderr, "%s: Failed to close checkpoint file!\n", pModule);
+  }
+  pk->fd = -1;
+  if (pthread_mutex_destroy(&(pk->lock))) {
+    abort();
+  }
+  free(pk->pDone);
+  pk->pDone = NULL;
+  if (pk->pCrc != NULL) {
+    free(pk->pCrc);
+    pk->pCrc = NULL;
+  }
+  free(pk);
+  pk = NULL;
+  pj->pck = NULL;
+  
+  /* Keep the checkpoint or remove it along with the output */
+  if (pj->keep) {
+    fprintf(stderr, "%s: Progress is kept in '%s'.\n",
+            pModule, pOutputPath);
+    fprintf(stderr, "%s: Run again with --resume to continue.\n",
+            pModule);
+  } else {
+    pPath = ckptPath(pOutputPath);
+    if (unlink(pPath)) {
+      fprintf(stderr, "%s: Failed to remove checkpoint file!\n",
+              pModule);
+    }
+    free(pPath);
+    pPath = NULL;
+  }
+}
+
+/*
+ * Perform the main program given all the necessary parameters.
+ * 
+ * Parameters:
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path to the output file
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   pKey - the scrambling key
+ * 
+ *   pNewKey - when re-keying, the new scrambling key, else NULL; the
+ *   output path is then the temporary file that replaces the input
+ * 
+ *   resume - non-zero to continue an interrupted run from its
+ *   checkpoint
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int warp64(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    descramble,
+    const char * pKey,
+    const char * pNewKey,
+          int    resume) {
+  
+  int status = 1;
+  int32_t key = 0;
+  int32_t newkey = -1;
+  WINDOW_JOB job;
+  
+  /* Initialize structures */
+  memset(&job, 0, sizeof(WINDOW_JOB));
+  
+  /* Check parameters */
+  if ((pInputPath == NULL) || (pOutputPath == NULL) || (pKey == NULL)) {
+    abort();
+  }
+  
+  /* Derive the normalized keys */
+  key = deriveKey(pKey);
+  if (key < 0) {
+    status = 0;
+  }
+  if (status && (pNewKey != NULL)) {
+    newkey = deriveKey(pNewKey);
+    if (newkey < 0) {
+      status = 0;
+    }
+  }
+  
+  /* Open the files and process them; the output of a failed run is
+   * kept whenever a checkpoint refers to it, which a resumed run's
+   * output always does */
+  if (status) {
+    if (!fileBegin(&job, pInputPath, pOutputPath, descramble,
+                    key, newkey, NULL, resume)) {
+      status = 0;
+    }
+    if (status) {
+      job.keep = resume;
+      if (!ckptBegin(&job, pInputPath, pOutputPath, descramble,
+                      (newkey >= 0), resume)) {
+        status = 0;
+      }
+      if (status) {
+        if (!process64(&job)) {
+          status = 0;
+        }
+        job.keep = 0;
+        if ((!status) && (job.pck != NULL)) {
+          job.keep = 1;
+        }
+      }
+      if (!fileEnd(&job, pInputPath, pOutputPath, status)) {
+        status = 0;
+      }
+      ckptEnd(&job, pOutputPath);
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Scramble the input that was added to a file since it was last
+ * scrambled, and append it to the scrambled file.
+ * 
+ * The key phase of each byte depends only on its offset, so the bytes
+ * that come after the old end can be scrambled on their own.  If the
+ * scrambled file doesn't exist yet, it is created, and the whole input
+ * is new.  Otherwise, its trailer is checked against the key first,
+ * which gives the old length.  Up to
+ * APPEND_PROBE of the input bytes just before that are then scrambled
+ * and compared against the scrambled file, so that an input that was
+ * rotated, truncated or replaced is refused instead of being appended
+ * to the wrong prefix.  The new input is read up to the length the
+ * file had when the run started, scrambled in chunks starting at the
+ * old end, over the old trailer, and followed by a new trailer.  A
+ * checksum file is continued over the new plaintext, and with --crc
+ * there must be one, unless the scrambled file is new, in which case
+ * --crc creates it.
+ * 
+ * Unless the sync policy is SYNC_NONE, the scrambled file is flushed
+ * before the checksum file is rewritten.  If the run fails after it has
+ * written anything, the scrambled file is cut back to its old length
+ * and gets its old trailer back, or removed if it was created.  The
+ * input file is always kept, since it is expected to go on growing.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path to the scrambled file
+ * 
+ *   pKey - the scrambling key
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int warp64Append(
+    const char * pInputPath,
+    const char * pOutputPath,
+    const char * pKey) {
+  
+  int status = 1;
+  int fIn = -1;
+  int fOut = -1;
+  int written = 0;
+  int new_file = 0;
+  int crc_found = 0;
+  int32_t key = 0;
+  int64_t ilen = 0;
+  int64_t clen = 0;
+  int64_t off = 0;
+  int64_t len = 0;
+  uint32_t crc = 0;
+  uint8_t *pBuf = NULL;
+  WARP64_CTX *pc = NULL;
+  uint8_t old_trailer[3];
+  uint8_t trailer[3];
+  struct stat st;
+  double t0 = 0.0;
+  double t1 = 0.0;
+  RUN_STATS rs;
+  
+  /* Initialize structures */
+  memset(old_trailer, 0, 3);
+  memset(trailer, 0, 3);
+  memset(&st, 0, sizeof(struct stat));
+  memset(&rs, 0, sizeof(RUN_STATS));
+  
+  /* Check parameters */
+  if ((pInputPath == NULL) || (pOutputPath == NULL) || (pKey == NULL)) {
+    abort();
+  }
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  
+  /* Derive the normalized key */
+  key = deriveKey(pKey);
+  if (key < 0) {
+    status = 0;
+  }
+  
+  /* Open both files; the input length is taken now, so that whatever
+   * is added while the run goes on is left for the next one */
+  if (status) {
+    fIn = open(pInputPath, O_RDONLY);
+    if (fIn < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pInputPath);
+    }
+  }
+  if (status) {
+    if (fstat(fIn, &st)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to get length of '%s'!\n",
+              pModule, pInputPath);
+    } else {
+      ilen = (int64_t) st.st_size;
+    }
+  }
+  if (status) {
+    fOut = open(pOutputPath, O_RDWR);
+    if ((fOut < 0) && (errno == ENOENT)) {
+      fOut = open(pOutputPath, O_RDWR | O_CREAT | O_EXCL,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+      if (fOut >= 0) {
+        new_file = 1;
+      }
+    }
+    if (fOut < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  if (status && (!new_file)) {
+    if (fstat(fOut, &st)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to get length of '%s'!\n",
+              pModule, pOutputPath);
+    } else {
+      clen = ((int64_t) st.st_size) - 3;
+    }
+  }
+  
+  /* The trailer of the scrambled file checks the key and gives the
+   * length of the input it was made from, which the input can't have
+   * shrunk below */
+  if (status && (clen < 0)) {
+    status = 0;
+    fprintf(stderr, "%s: Missing trailer in '%s'!\n",
+            pModule, pOutputPath);
+  }
+  if (status && (!new_file)) {
+    if (!verifyTrailer(fOut, pOutputPath, key, clen)) {
+      status = 0;
+    }
+  }
+  if (status && (!new_file)) {
+    if (!readFully(fOut, old_trailer, 3, clen)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read trailer in '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  if (status && (ilen < clen)) {
+    status = 0;
+    fprintf(stderr, "%s: '%s' is shorter than '%s'!\n",
+            pModule, pInputPath, pOutputPath);
+    fprintf(stderr, "%s: Scramble it again if it was rotated.\n",
+            pModule);
+  }
+  
+  /* Continue the checksum of the plaintext if there is one; the
+   * checksum of a new file starts from that of nothing */
+  if (status && new_file) {
+    crc_found = m_crc;
+    crc = 0;
+  } else if (status) {
+    if (!crcRead(pOutputPath, &crc_found, &crc)) {
+      status = 0;
+    }
+    if (status && m_crc && (!crc_found)) {
+      status = 0;
+      fprintf(stderr, "%s: No checksum file for '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  
+  /* Set up the transform and the chunk buffer, which also holds the
+   * probe twice over */
+  if (status) {
+    pc = warp64_init(key, WARP64_SCRAMBLE);
+    if (pc == NULL) {
+      abort();
+    }
+    pBuf = (uint8_t *) malloc((size_t) STREAM_CHUNK);
+    if (pBuf == NULL) {
+      abort();
+    }
+  }
+  
+  /* Check that the input really continues what was scrambled */
+  if (status && (clen > 0)) {
+    len = APPEND_PROBE;
+    if (clen < len) {
+      len = clen;
+    }
+    off = clen - len;
+    if ((!readFully(fIn, pBuf, (size_t) len, off)) ||
+        (!readFully(fOut, &(pBuf[len]), (size_t) len, off))) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s' to append to it!\n",
+              pModule, pOutputPath);
+    }
+    if (status) {
+      warp64_update_at(pc, off, pBuf, pBuf, (size_t) len);
+      if (memcmp(pBuf, &(pBuf[len]), (size_t) len) != 0) {
+        status = 0;
+        fprintf(stderr, "%s: '%s' doesn't continue '%s'!\n",
+                pModule, pInputPath, pOutputPath);
+        fprintf(stderr, "%s: Scramble it again if it was replaced.\n",
+                pModule);
+      }
+    }
+  }
+  
+  /* Scramble the new input a chunk at a time, starting over the old
+   * trailer */
+  for(off = clen; status && (off < ilen); off += len) {
+    len = ilen - off;
+    if (len > STREAM_CHUNK) {
+      len = STREAM_CHUNK;
+    }
+    if (!readFully(fIn, pBuf, (size_t) len, off)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s'!\n", pModule, pInputPath);
+    }
+    if (status) {
+      if (m_stats) {
+        t1 = nowSec();
+      }
+      if (crc_found) {
+        crc = warp64k_crc(crc ^ UINT32_C(0xffffffff), pBuf, (size_t) len)
+                ^ UINT32_C(0xffffffff);
+      }
+      warp64_update_at(pc, off, pBuf, pBuf, (size_t) len);
+      if (m_stats) {
+        rs.xform_sec += nowSec() - t1;
+        rs.bytes += len;
+      }
+      written = 1;
+      if (!writeFully(fOut, pBuf, (size_t) len, off)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to write '%s'!\n",
+                pModule, pOutputPath);
+      }
+    }
+  }
+  
+  /* Write the new trailer and flush */
+  if (new_file) {
+    written = 1;
+  }
+  if (status && written) {
+    warp64_seek(pc, ilen);
+    warp64_final(pc, trailer);
+    pc = NULL;
+    if (!writeFully(fOut, trailer, 3, ilen)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  if (status && written && (m_sync != SYNC_NONE)) {
+    if (fdatasync(fOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to flush '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  
+  /* Rewrite the checksum file for the longer plaintext, and make the
+   * directory entries of new files durable */
+  if (status && written && crc_found) {
+    if (!crcWrite(pOutputPath, pInputPath, crc)) {
+      status = 0;
+    }
+  }
+  if (status && new_file && (m_sync != SYNC_NONE)) {
+    if (!syncDir(pOutputPath)) {
+      status = 0;
+    }
+  }
+  
+  /* A failed run puts the old end of the scrambled file back, or
+   * removes the file it created */
+  if ((!status) && new_file) {
+    if (unlink(pOutputPath)) {
+      fprintf(stderr, "%s: Failed to clean up output file!\n", pModule);
+    }
+  } else if ((!status) && written) {
+    if (ftruncate(fOut, (off_t) (clen + 3)) ||
+        (!writeFully(fOut, old_trailer, 3, clen)) ||
+        ((m_sync != SYNC_NONE) && fdatasync(fOut))) {
+      fprintf(stderr, "%s: Failed to restore '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  
+  /* Clean up */
+  if (pc != NULL) {
+    warp64_final(pc, NULL);
+    pc = NULL;
+  }
+  if (pBuf != NULL) {
+    free(pBuf);
+    pBuf = NULL;
+  }
+  if (fIn >= 0) {
+    close(fIn);
+    fIn = -1;
+  }
+  if (fOut >= 0) {
+    if (close(fOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to close output file!\n", pModule);
+    }
+    fOut = -1;
+  }
+  
+  /* Everything but the transform counts as I/O */
+  if (m_stats) {
+    rs.io_sec = (nowSec() - t0) - rs.xform_sec;
+    if (status) {
+      rs.files = 1;
+    }
+    statsAdd(&rs);
+  }
+  
+  return status;
+}
+
+/*
+ * Read exactly len bytes from a file at a given offset, retrying short
+ * reads.
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the file to read from
+ * 
+ *   pBuf - the buffer to read into
+ * 
+ *   len - the number of bytes to read
+ * 
+ *   off - the file offset to read from
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error or end of file reached
+ */
+static int readFully(int fd, uint8_t *pBuf, size_t len, int64_t off) {
+  ssize_t rv = 0;
+  
+  /* Check parameters */
+  if ((fd < 0) || (pBuf == NULL) || (off < 0)) {
+    abort();
+  }
+  
+  /* Keep reading until done */
+  while (len > 0) {
+    rv = pread(fd, pBuf, len, (off_t) off);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    } else if (rv == 0) {
+      return 0;
+    }
+    pBuf += rv;
+    len -= (size_t) rv;
+    off += (int64_t) rv;
+  }
+  
+  return 1;
+}
+
+/*
+ * Write exactly len bytes to a file at a given offset, retrying short
+ * writes.
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the file to write to
+ * 
+ *   pBuf - the bytes to write
+ * 
+ *   len - the number of bytes to write
+ * 
+ *   off - the file offset to write to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int writeFully(
+    int             fd,
+    const uint8_t * pBuf,
+    size_t          len,
+    int64_t         off) {
+  
+  ssize_t rv = 0;
+  
+  /* Check parameters */
+  if ((fd < 0) || (pBuf == NULL) || (off < 0)) {
+    abort();
+  }
+  
+  /* Keep writing until done */
+  while (len > 0) {
+    rv = pwrite(fd, pBuf, len, (off_t) off);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    } else if (rv == 0) {
+      return 0;
+    }
+    pBuf += rv;
+    len -= (size_t) rv;
+    off += (int64_t) rv;
+  }
+  
+  return 1;
+}
+
+/*
+ * Flush the directory containing a path to disk, so that a created,
+ * renamed, or removed directory entry is durable.
+ * 
+ * Filesystems that do not support synchronizing directories are
+ * silently accepted.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pPath - a path within the directory to flush
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int syncDir(const char *pPath) {
+  int status = 1;
+  int fd = -1;
+  size_t slen = 0;
+  char *pDir = NULL;
+  
+  /* Check parameter */
+  if (pPath == NULL) {
+    abort();
+  }
+  
+  /* Get the directory part of the path, or "." if there is none */
+  slen = strlen(pPath);
+  while ((slen > 0) && (pPath[slen - 1] != '/')) {
+    slen--;
+  }
+  if (slen < 1) {
+    pDir = (char *) calloc(2, 1);
+    if (pDir == NULL) {
+      abort();
+    }
+    pDir[0] = '.';
+  } else {
+    pDir = (char *) calloc(slen + 1, 1);
+    if (pDir == NULL) {
+      abort();
+    }
+    memcpy(pDir, pPath, slen);
+  }
+  
+  /* Open and flush the directory */
+  fd = open(pDir, O_RDONLY);
+  if (fd < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to open directory '%s'!\n",
+            pModule, pDir);
+  }
+  if (status) {
+    if (fsync(fd)) {
+      if ((errno != EINVAL) && (errno != EROFS)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to flush directory '%s'!\n",
+                pModule, pDir);
+      }
+    }
+  }
+  
+  /* Clean up */
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  free(pDir);
+  pDir = NULL;
+  
+  return status;
+}
+
+/*
+ * Rename a file without replacing an existing file at the target path.
+ * 
+ * On Linux this is atomic.  On other platforms, or on filesystems that
+ * do not support atomic no-replace renames, the target is checked
+ * before an ordinary rename.
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   pFrom - the current path
+ * 
+ *   pTo - the new path
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int renameNew(const char *pFrom, const char *pTo) {
+  
+  /* Check parameters */
+  if ((pFrom == NULL) || (pTo == NULL)) {
+    abort();
+  }
+  
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+  if (renameat2(AT_FDCWD, pFrom, AT_FDCWD, pTo, RENAME_NOREPLACE) == 0) {
+    return 1;
+  }
+  if ((errno != EINVAL) && (errno != ENOSYS)) {
+    return 0;
+  }
+#endif
+  
+  if (access(pTo, F_OK) == 0) {
+    return 0;
+  }
+  if (rename(pFrom, pTo)) {
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Compute a 64-bit FNV-1a hash, used to validate journal records.
+ * 
+ * Parameters:
+ * 
+ *   p - the bytes to hash
+ * 
+ *   len - the number of bytes
+ * 
+ * Return:
+ * 
+ *   the hash value
+ */
+static uint64_t fnv64(const uint8_t *p, size_t len) {
+  uint64_t h = UINT64_C(14695981039346656037);
+  size_t i = 0;
+  
+  for(i = 0; i < len; i++) {
+    h = (h ^ ((uint64_t) p[i])) * UINT64_C(1099511628211);
+  }
+  
+  return h;
+}
+
+/*
+ * Store a 64-bit value in big-endian order.
+ * 
+ * Parameters:
+ * 
+ *   p - the eight bytes to write
+ * 
+ *   v - the value
+ */
+static void packU64(uint8_t *p, uint64_t v) {
+  int i = 0;
+  for(i = 7; i >= 0; i--) {
+    p[i] = (uint8_t) (v & 0xff);
+    v >>= 8;
+  }
+}
+
+/*
+ * Load a 64-bit value stored in big-endian order.
+ * 
+ * Parameters:
+ * 
+ *   p - the eight bytes to read
+ * 
+ * Return:
+ * 
+ *   the value
+ */
+static uint64_t unpackU64(const uint8_t *p) {
+  uint64_t v = 0;
+  int i = 0;
+  for(i = 0; i < 8; i++) {
+    v = (v << 8) | ((uint64_t) p[i]);
+  }
+  return v;
+}
+
+/*
+ * Get the journal path for a given input path.
+ * 
+ * The returned string must be released with free().
+ * 
+ * Parameters:
+ * 
+ *   pPath - the input path
+ * 
+ * Return:
+ * 
+ *   a newly allocated journal path
+ */
+static char *journalPath(const char *pPath) {
+  char *pResult = NULL;
+  
+  if (pPath == NULL) {
+    abort();
+  }
+  
+  pResult = (char *) calloc(strlen(pPath) + strlen(JOURNAL_SUFFIX) + 1, 1);
+  if (pResult == NULL) {
+    abort();
+  }
+  strcpy(pResult, pPath);
+  strcat(pResult, JOURNAL_SUFFIX);
+  
+  return pResult;
+}
+
+/*
+ * Write a journal record and flush it to disk.
+ * 
+ * The sequence number of the record is incremented first.  Records
+ * alternate between the two header slots, so that a torn write can
+ * never destroy the last good record.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fj - the journal file
+ * 
+ *   pj - the record to write
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int journalWrite(int fj, JOURNAL *pj) {
+  int status = 1;
+  uint8_t buf[JOURNAL_SLOT];
+  
+  /* Check parameters */
+  if ((fj < 0) || (pj == NULL)) {
+    abort();
+  }
+  
+  /* Serialize the record */
+  (pj->seq)++;
+  memset(buf, 0, JOURNAL_SLOT);
+  memcpy(buf, JOURNAL_MAGIC, 8);
+  packU64(&(buf[  8]), (uint64_t) pj->seq);
+  packU64(&(buf[ 16]), (uint64_t) pj->key);
+  packU64(&(buf[ 24]), (uint64_t) pj->phase);
+  packU64(&(buf[ 32]), (uint64_t) pj->rename);
+  packU64(&(buf[ 40]), (uint64_t) pj->reverse);
+  packU64(&(buf[ 48]), (uint64_t) pj->clen);
+  packU64(&(buf[ 56]), (uint64_t) pj->done);
+  packU64(&(buf[ 64]), (uint64_t) pj->orig_len);
+  packU64(&(buf[ 72]), (uint64_t) pj->final_len);
+  packU64(&(buf[ 80]), (uint64_t) pj->pre_off);
+  packU64(&(buf[ 88]), (uint64_t) pj->pre_len);
+  packU64(&(buf[ 96]), (uint64_t) pj->pre_area);
+  packU64(&(buf[104]), fnv64(buf, 104));
+  
+  /* Write it to the slot for this sequence number and flush */
+  if (!writeFully(fj, buf, JOURNAL_SLOT,
+                  (int64_t) ((pj->seq % 2) * JOURNAL_SLOT))) {
+    status = 0;
+  }
+  if (status) {
+    if (fdatasync(fj)) {
+      status = 0;
+    }
+  }
+  
+  if (!status) {
+    fprintf(stderr, "%s: Failed to write journal!\n", pModule);
+  }
+  
+  return status;
+}
+
+/*
+ * Read the latest valid journal record.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fj - the journal file
+ * 
+ *   pj - receives the record
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error or no valid record
+ */
+static int journalRead(int fj, JOURNAL *pj) {
+  int found = 0;
+  int i = 0;
+  uint8_t buf[JOURNAL_SLOT];
+  JOURNAL jr;
+  
+  /* Check parameters */
+  if ((fj < 0) || (pj == NULL)) {
+    abort();
+  }
+  
+  /* Check both slots and keep the valid one with the highest sequence
+   * number */
+  memset(pj, 0, sizeof(JOURNAL));
+  for(i = 0; i < 2; i++) {
+    if (!readFully(fj, buf, JOURNAL_SLOT, (int64_t) (i * JOURNAL_SLOT))) {
+      continue;
+    }
+    if (memcmp(buf, JOURNAL_MAGIC, 8) != 0) {
+      continue;
+    }
+    if (unpackU64(&(buf[104])) != fnv64(buf, 104)) {
+      continue;
+    }
+    
+    memset(&jr, 0, sizeof(JOURNAL));
+    jr.seq       = (int64_t) unpackU64(&(buf[  8]));
+    jr.key       = (int32_t) unpackU64(&(buf[ 16]));
+    jr.phase     = (int)     unpackU64(&(buf[ 24]));
+    jr.rename    = (int)     unpackU64(&(buf[ 32]));
+    jr.reverse   = (int)     unpackU64(&(buf[ 40]));
+    jr.clen      = (int64_t) unpackU64(&(buf[ 48]));
+    jr.done      = (int64_t) unpackU64(&(buf[ 56]));
+    jr.orig_len  = (int64_t) unpackU64(&(buf[ 64]));
+    jr.final_len = (int64_t) unpackU64(&(buf[ 72]));
+    jr.pre_off   = (int64_t) unpackU64(&(buf[ 80]));
+    jr.pre_len   = (int64_t) unpackU64(&(buf[ 88]));
+    jr.pre_area  = (int)     unpackU64(&(buf[ 96]));
+    
+    if ((!found) || (jr.seq > pj->seq)) {
+      memcpy(pj, &jr, sizeof(JOURNAL));
+      found = 1;
+    }
+  }
+  
+  /* Sanity-check the record */
+  if (found) {
+    if ((pj->clen < 0) || (pj->done < 0) || (pj->done > pj->clen) ||
+        (pj->pre_len < 0) || (pj->pre_len > (int64_t) m_winsize) ||
+        (pj->pre_area < 0) || (pj->pre_area > 1) ||
+        (pj->final_len < 0) || (pj->orig_len < 0) ||
+        ((pj->phase != JPHASE_RUN) && (pj->phase != JPHASE_SIZE))) {
+      found = 0;
+    }
+  }
+  
+  if (!found) {
+    fprintf(stderr, "%s: Journal is damaged!\n", pModule);
+  }
+  
+  return found;
+}
+
+/*
+ * Run an in-place transform described by a journal to completion.
+ * 
+ * Starting at the journal's done offset, each window is first copied
+ * into one of the two pre-image areas of the journal, then the journal
+ * record is updated to point at that pre-image, and only then is the
+ * window transformed in place and flushed.  The areas alternate so the
+ * pre-image of the previous window stays intact until the record that
+ * replaces it is durable.  If the run is interrupted, restoring the
+ * recorded pre-image and continuing from the done offset is therefore
+ * always correct.
+ * 
+ * Once all windows are done, the file is set to its final length, it
+ * is renamed from pFrom to pTo if the journal requests a rename, and
+ * the journal is removed.  If this function fails, the journal is left
+ * in place.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the file being transformed, open for reading and writing
+ * 
+ *   fj - the journal file
+ * 
+ *   pj - the current journal record
+ * 
+ *   pFrom - the current path of the file
+ * 
+ *   pTo - the final path of the file
+ * 
+ *   pJournal - the path of the journal
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int inplaceRun(
+          int           fd,
+          int           fj,
+          JOURNAL     * pj,
+    const char        * pFrom,
+    const char        * pTo,
+    const char        * pJournal) {
+  
+  int status = 1;
+  int64_t base = 0;
+  int64_t ws = 0;
+  uint8_t *pw = NULL;
+  double t0 = 0.0;
+  double t1 = 0.0;
+  struct stat st;
+  WARP64_CTX *pc = NULL;
+  RUN_STATS rs;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  memset(&rs, 0, sizeof(RUN_STATS));
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  
+  /* Check parameters */
+  if ((fd < 0) || (fj < 0) || (pj == NULL) ||
+      (pFrom == NULL) || (pTo == NULL) || (pJournal == NULL)) {
+    abort();
+  }
+  
+  /* Start the transform; the journal holds the key that is applied,
+   * which has already been inverted when descrambling */
+  pc = warp64_init(pj->key, WARP64_SCRAMBLE);
+  if (pc == NULL) {
+    abort();
+  }
+  
+  /* Make sure the file covers the whole transform range; when
+   * scrambling, this appends the zero bytes that become the trailer */
+  if (pj->phase == JPHASE_RUN) {
+    if (fstat(fd, &st)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to stat '%s'!\n", pModule, pFrom);
+    }
+    if (status && (((int64_t) st.st_size) < pj->clen)) {
+      if (ftruncate(fd, (off_t) pj->clen) || fsync(fd)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to extend '%s'!\n", pModule, pFrom);
+      }
+    }
+  }
+  
+  /* Transform each remaining window */
+  while (status && (pj->phase == JPHASE_RUN) && (pj->done < pj->clen)) {
+    /* Determine the window */
+    base = pj->done;
+    ws = pj->clen - base;
+    if (ws > (int64_t) m_winsize) {
+      ws = (int64_t) m_winsize;
+    }
+    
+    /* Map the window for reading and writing */
+    pw = (uint8_t *) mmap(
+                        NULL,
+                        (size_t) ws,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        fd,
+                        (off_t) base);
+    if ((pw == MAP_FAILED) || (pw == NULL)) {
+      pw = NULL;
+      status = 0;
+      fprintf(stderr, "%s: Failed to map window!\n", pModule);
+    }
+    
+    /* Save the pre-image of the window in the other pre-image area and
+     * flush it */
+    if (status) {
+      pj->pre_area = 1 - pj->pre_area;
+      if (!writeFully(fj, pw, (size_t) ws,
+              (int64_t) (JOURNAL_DATA +
+                ((int64_t) pj->pre_area) * ((int64_t) m_winsize)))) {
+        status = 0;
+      }
+      if (status) {
+        if (fdatasync(fj)) {
+          status = 0;
+        }
+      }
+      if (!status) {
+        fprintf(stderr, "%s: Failed to write journal!\n", pModule);
+      }
+    }
+    
+    /* Record that this window is in progress */
+    if (status) {
+      pj->pre_off = base;
+      pj->pre_len = ws;
+      if (!journalWrite(fj, pj)) {
+        status = 0;
+      }
+    }
+    
+    /* Transform the window in place and flush it */
+    if (status) {
+      if (m_stats) {
+        t1 = nowSec();
+      }
+      warp64_update_at(pc, base, pw, pw, (size_t) ws);
+      if (m_stats) {
+        rs.xform_sec += nowSec() - t1;
+        (rs.windows)++;
+        rs.bytes += ws;
+      }
+      if (msync(pw, (size_t) ws, MS_SYNC)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to flush window!\n", pModule);
+      }
+    }
+    
+    /* Unmap the window */
+    if (pw != NULL) {
+      if (munmap(pw, (size_t) ws)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to unmap window!\n", pModule);
+      }
+      pw = NULL;
+    }
+    
+    /* Advance; the next journal record makes this durable */
+    if (status) {
+      pj->done = base + ws;
+    }
+  }
+  
+  /* Record that the transform is complete */
+  if (status && (pj->phase == JPHASE_RUN)) {
+    pj->phase = JPHASE_SIZE;
+    pj->pre_len = 0;
+    if (!journalWrite(fj, pj)) {
+      status = 0;
+    }
+  }
+  
+  /* Set the final length; when descrambling, this drops the trailer */
+  if (status) {
+    if (ftruncate(fd, (off_t) pj->final_len) || fsync(fd)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to set length of '%s'!\n",
+              pModule, pFrom);
+    }
+  }
+  
+  /* Rename the file if requested */
+  if (status && pj->rename) {
+    if (!renameNew(pFrom, pTo)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to rename '%s' to '%s'!\n",
+              pModule, pFrom, pTo);
+      fprintf(stderr, "%s: Check that '%s' does not exist.\n",
+              pModule, pTo);
+    }
+    if (status) {
+      if (!syncDir(pTo)) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Remove the journal */
+  if (status) {
+    if (unlink(pJournal)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to remove journal '%s'!\n",
+              pModule, pJournal);
+    }
+  }
+  if (status) {
+    if (!syncDir(pJournal)) {
+      status = 0;
+    }
+  }
+  
+  warp64_final(pc, NULL);
+  pc = NULL;
+  
+  /* Everything but the transform counts as I/O */
+  if (m_stats) {
+    rs.io_sec = (nowSec() - t0) - rs.xform_sec;
+    if (status) {
+      rs.files = 1;
+    }
+    rs.window = (int64_t) m_winsize;
+    statsAdd(&rs);
+  }
+  
+  return status;
+}
+
+/*
+ * Perform an in-place scramble or descramble.
+ * 
+ * The input file is transformed where it sits, then the trailer is
+ * appended or dropped and the file is renamed from pInputPath to
+ * pOutputPath.  A journal is kept next to the input file for the
+ * duration of the run, so that an interrupted run can be finished or
+ * rolled back with inplaceRecover().
+ * 
+ * A re-key keeps the trailer and the name of the file, so the whole
+ * file is transformed and it is not renamed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path the file will be renamed to, which is not used
+ *   when re-keying
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   pKey - the scrambling key
+ * 
+ *   pNewKey - when re-keying, the new scrambling key, else NULL, in
+ *   which case descramble must be set
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int inplaceStart(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    descramble,
+    const char * pKey,
+    const char * pNewKey) {
+  
+  int status = 1;
+  int created = 0;
+  int started = 0;
+  int32_t key = 0;
+  int32_t newkey = -1;
+  int64_t flen = 0;
+  int fd = -1;
+  int fj = -1;
+  char *pJournal = NULL;
+  struct stat st;
+  JOURNAL j;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  memset(&j, 0, sizeof(JOURNAL));
+  
+  /* Check parameters */
+  if ((pInputPath == NULL) || (pOutputPath == NULL) || (pKey == NULL)) {
+    abort();
+  }
+  if ((pNewKey != NULL) && (!descramble)) {
+    abort();
+  }
+  
+  /* Derive the normalized keys */
+  key = deriveKey(pKey);
+  if (key < 0) {
+    status = 0;
+  }
+  if (status && (pNewKey != NULL)) {
+    newkey = deriveKey(pNewKey);
+    if (newkey < 0) {
+      status = 0;
+    }
+  }
+  
+  /* Output path must not exist yet */
+  if (status && (newkey < 0)) {
+    if (lstat(pOutputPath, &st) == 0) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' already exists!\n", pModule, pOutputPath);
+    }
+  }
+  
+  /* Open the input file for reading and writing */
+  if (status) {
+    fd = open(pInputPath, O_RDWR);
+    if (fd < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s' for writing\n",
+              pModule, pInputPath);
+    }
+  }
+  
+  /* Get the length of the input file */
+  if (status) {
+    if (fstat(fd, &st)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to get length of '%s'!\n",
+              pModule, pInputPath);
+    }
+  }
+  if (status) {
+    flen = (int64_t) st.st_size;
+  }
+  
+  /* When descrambling, check the trailer against the key */
+  if (status && descramble) {
+    if (flen < 3) {
+      status = 0;
+      fprintf(stderr, "%s: Missing trailer in '%s'!\n",
+              pModule, pInputPath);
+    }
+    if (status) {
+      if (!verifyTrailer(fd, pInputPath, key, flen - 3)) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Check for overflow when scrambling */
+  if (status && (!descramble) && (flen > INT64_MAX - 3)) {
+    status = 0;
+    fprintf(stderr, "%s: Output file length overflow!\n", pModule);
+  }
+  
+  /* Create the journal */
+  if (status) {
+    pJournal = journalPath(pInputPath);
+    fj = open(pJournal, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fj < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create journal '%s'!\n",
+              pModule, pJournal);
+    } else {
+      created = 1;
+    }
+  }
+  if (status) {
+    if (!syncDir(pJournal)) {
+      status = 0;
+    }
+  }
+  
+  /* Write the initial journal record */
+  if (status) {
+    j.seq = 0;
+    j.phase = JPHASE_RUN;
+    j.rename = 1;
+    j.reverse = 0;
+    j.done = 0;
+    j.orig_len = flen;
+    j.pre_off = 0;
+    j.pre_len = 0;
+    j.pre_area = 0;
+    if (newkey >= 0) {
+      j.key = rekeyDelta(key, newkey);
+      j.clen = flen;
+      j.final_len = flen;
+      j.rename = 0;
+    } else if (descramble) {
+      j.key = warp64_invert(key);
+      j.clen = flen - 3;
+      j.final_len = flen - 3;
+    } else {
+      j.key = key;
+      j.clen = flen + 3;
+      j.final_len = flen + 3;
+    }
+    if (!journalWrite(fj, &j)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    started = 1;
+  }
+  
+  /* Run the transform */
+  if (status) {
+    if (!inplaceRun(fd, fj, &j, pInputPath, pOutputPath, pJournal)) {
+      status = 0;
+    }
+  }
+  
+  /* Close files */
+  if (fj >= 0) {
+    close(fj);
+    fj = -1;
+  }
+  if (fd >= 0) {
+    if (close(fd)) {
+      fprintf(stderr, "%s: Failed to close '%s'!\n", pModule, pInputPath);
+    }
+    fd = -1;
+  }
+  
+  /* If we failed without starting, remove any journal we created; if we
+   * failed after starting, the journal must stay for recovery */
+  if ((!status) && (!started) && created) {
+    unlink(pJournal);
+  }
+  if ((!status) && started) {
+    fprintf(stderr, "%s: In-place run interrupted!\n", pModule);
+    fprintf(stderr, "%s: Use --finish or --rollback to recover.\n",
+            pModule);
+  }
+  
+  if (pJournal != NULL) {
+    free(pJournal);
+    pJournal = NULL;
+  }
+  
+  return status;
+}
+
+/*
+ * Finish or roll back an interrupted in-place run.
+ * 
+ * The latest journal record is read and any pre-image it points at is
+ * restored.  To finish, the run then simply continues.  To roll back,
+ * the journal is rewritten as a new run that applies the inverse key to
+ * the bytes that were already transformed and restores the original
+ * length without renaming.  A rollback can itself be interrupted and
+ * recovered in the same way.
+ * 
+ * The key is not needed, because the journal records the transform.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pInputPath - path to the input file of the interrupted run
+ * 
+ *   pOutputPath - path the file was being renamed to
+ * 
+ *   rollback - non-zero to roll back, zero to finish
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int inplaceRecover(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    rollback) {
+  
+  int status = 1;
+  int done = 0;
+  int fd = -1;
+  int fj = -1;
+  uint8_t *pBuf = NULL;
+  char *pJournal = NULL;
+  JOURNAL j;
+  
+  /* Initialize structures */
+  memset(&j, 0, sizeof(JOURNAL));
+  
+  /* Check parameters */
+  if ((pInputPath == NULL) || (pOutputPath == NULL)) {
+    abort();
+  }
+  
+  /* Open and read the journal */
+  pJournal = journalPath(pInputPath);
+  fj = open(pJournal, O_RDWR);
+  if (fj < 0) {
+    status = 0;
+    fprintf(stderr, "%s: No interrupted in-place run for '%s'!\n",
+            pModule, pInputPath);
+  }
+  if (status) {
+    if (!journalRead(fj, &j)) {
+      status = 0;
+    }
+  }
+  
+  /* Open the file; if it is gone but the run was already complete and
+   * the file was renamed, only the journal is left to clean up */
+  if (status) {
+    fd = open(pInputPath, O_RDWR);
+    if (fd < 0) {
+      if ((errno == ENOENT) && (j.phase == JPHASE_SIZE) && j.rename &&
+            (access(pOutputPath, F_OK) == 0)) {
+        done = 1;
+      } else {
+        status = 0;
+        fprintf(stderr, "%s: Failed to open '%s' for writing\n",
+                pModule, pInputPath);
+      }
+    }
+  }
+  if (status && done) {
+    if (unlink(pJournal)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to remove journal '%s'!\n",
+              pModule, pJournal);
+    }
+  }
+  
+  /* Restore the pre-image of the window that was in progress */
+  if (status && (!done) && (j.pre_len > 0)) {
+    pBuf = (uint8_t *) malloc((size_t) j.pre_len);
+    if (pBuf == NULL) {
+      abort();
+    }
+    if (!readFully(fj, pBuf, (size_t) j.pre_len,
+            (int64_t) (JOURNAL_DATA +
+              ((int64_t) j.pre_area) * ((int64_t) m_winsize)))) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read journal!\n", pModule);
+    }
+    if (status) {
+      if ((!writeFully(fd, pBuf, (size_t) j.pre_len, j.pre_off)) ||
+            fdatasync(fd)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to restore '%s'!\n",
+                pModule, pInputPath);
+      }
+    }
+    if (status) {
+      j.done = j.pre_off;
+      j.pre_len = 0;
+      if (!journalWrite(fj, &j)) {
+        status = 0;
+      }
+    }
+    free(pBuf);
+    pBuf = NULL;
+  }
+  
+  /* Turn the journal into a rollback run if requested */
+  if (status && (!done) && rollback && (!j.reverse)) {
+    if (j.phase != JPHASE_RUN) {
+      status = 0;
+      fprintf(stderr, "%s: Transform already completed; use --finish\n",
+              pModule);
+    }
+    if (status) {
+      j.key = warp64_invert(j.key);
+      j.clen = j.done;
+      if (j.clen > j.orig_len) {
+        j.clen = j.orig_len;
+      }
+      j.done = 0;
+      j.final_len = j.orig_len;
+      j.rename = 0;
+      j.reverse = 1;
+      if (!journalWrite(fj, &j)) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Continue the run */
+  if (status && (!done)) {
+    if (!inplaceRun(fd, fj, &j, pInputPath, pOutputPath, pJournal)) {
+      status = 0;
+    }
+  }
+  
+  /* Close files */
+  if (fj >= 0) {
+    close(fj);
+    fj = -1;
+  }
+  if (fd >= 0) {
+    if (close(fd)) {
+      fprintf(stderr, "%s: Failed to close '%s'!\n", pModule, pInputPath);
+    }
+    fd = -1;
+  }
+  
+  free(pJournal);
+  pJournal = NULL;
+  
+  return status;
+}
+
+/*
+ * Write exactly len bytes to a file or pipe at its current position,
+ * retrying short writes.
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the file or pipe to write to
+ * 
+ *   pBuf - the bytes to write
+ * 
+ *   len - the number of bytes to write
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int writeSeq(int fd, const uint8_t *pBuf, size_t len) {
+  ssize_t rv = 0;
+  
+  /* Check parameters */
+  if ((fd < 0) || ((pBuf == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  /* Keep writing until done */
+  while (len > 0) {
+    rv = write(fd, pBuf, len);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    } else if (rv == 0) {
+      return 0;
+    }
+    pBuf += rv;
+    len -= (size_t) rv;
+  }
+  
+  return 1;
+}
+
+/*
+ * Write bytes to a pipe with vmsplice(), so that the pipe references
+ * the pages of the buffer instead of copying them.
+ * 
+ * The caller must not modify the buffer until enough further bytes
+ * have gone through the pipe that the pipe can no longer hold any of
+ * these bytes.  See streamRelease().
+ * 
+ * If vmsplice() is not available, this falls back to writeSeq().
+ * 
+ * Error messages are not printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the pipe to write to
+ * 
+ *   pBuf - the bytes to write
+ * 
+ *   len - the number of bytes to write
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int spliceSeq(int fd, const uint8_t *pBuf, size_t len) {
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+  ssize_t rv = 0;
+  struct iovec iov;
+  
+  /* Check parameters */
+  if ((fd < 0) || ((pBuf == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  /* Keep splicing until done */
+  while (len > 0) {
+    iov.iov_base = (void *) pBuf;
+    iov.iov_len = len;
+    rv = vmsplice(fd, &iov, 1, 0);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    } else if (rv == 0) {
+      return 0;
+    }
+    pBuf += rv;
+    len -= (size_t) rv;
+  }
+  
+  return 1;
+#else
+  return writeSeq(fd, pBuf, len);
+#endif
+}
+
+/*
+ * Reader thread function for streaming mode.
+ * 
+ * Fills free slots with full chunks read from the input, in slot order,
+ * until end of input, an error, or until the writer asks it to stop.
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to the STREAM_STATE
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *streamReader(void *pArg) {
+  STREAM_STATE *ps = NULL;
+  int slot = 0;
+  int eof = 0;
+  int err = 0;
+  size_t n = 0;
+  ssize_t rv = 0;
+  uint8_t *pData = NULL;
+  
+  /* Get the parameters */
+  if (pArg == NULL) {
+    abort();
+  }
+  ps = (STREAM_STATE *) pArg;
+  
+  /* Only allow cancellation while blocked reading input, so that the
+   * thread is never cancelled while holding the lock */
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  
+  while ((!eof) && (!err)) {
+    /* Wait for a free slot */
+    if (pthread_mutex_lock(&(ps->lock))) {
+      abort();
+    }
+    while ((ps->avail < 1) && (!(ps->stop))) {
+      if (pthread_cond_wait(&(ps->cond), &(ps->lock))) {
+        abort();
+      }
+    }
+    if (ps->stop) {
+      if (pthread_mutex_unlock(&(ps->lock))) {
+        abort();
+      }
+      break;
+    }
+    slot = ps->head;
+    if (pthread_mutex_unlock(&(ps->lock))) {
+      abort();
+    }
+    
+    /* Fill the slot with a full chunk, unless the input ends first */
+    pData = (ps->ppSlot)[slot] + STREAM_PREFIX;
+    n = 0;
+    while (n < STREAM_CHUNK) {
+      pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+      rv = read(ps->fIn, pData + n, STREAM_CHUNK - n);
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+      if (rv < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        err = 1;
+        break;
+      } else if (rv == 0) {
+        eof = 1;
+        break;
+      }
+      n += (size_t) rv;
+    }
+    
+    /* Hand the slot to the writer */
+    if (pthread_mutex_lock(&(ps->lock))) {
+      abort();
+    }
+    (ps->pLen)[slot] = n;
+    ps->head = (ps->head + 1) % ps->nslot;
+    (ps->avail)--;
+    (ps->filled)++;
+    if (eof) {
+      ps->eof = 1;
+    }
+    if (err) {
+      ps->err = 1;
+    }
+    if (pthread_cond_broadcast(&(ps->cond))) {
+      abort();
+    }
+    if (pthread_mutex_unlock(&(ps->lock))) {
+      abort();
+    }
+  }
+  
+  return NULL;
+}
+
+/*
+ * Return slots that the writer has finished with to the reader.
+ * 
+ * Without vmsplice(), a slot can be reused as soon as it was written.
+ * With vmsplice(), the pipe may still reference the pages of a slot
+ * after the call returns.  The pipe holds at most pipecap bytes,
+ * though, so once pipecap further bytes have been spliced after the
+ * last byte of a slot, the reader of the pipe must have consumed the
+ * whole slot and it is safe to reuse.
+ * 
+ * Must be called with the lock held.
+ * 
+ * Parameters:
+ * 
+ *   ps - the stream state
+ */
+static void streamRelease(STREAM_STATE *ps) {
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    abort();
+  }
+  
+  /* Release retired slots in order once they are safe */
+  while (ps->retired > 0) {
+    if (ps->splice && (ps->written - (ps->pAt)[ps->rel] < ps->pipecap)) {
+      break;
+    }
+    ps->rel = (ps->rel + 1) % ps->nslot;
+    (ps->retired)--;
+    (ps->avail)++;
+  }
+}
+
+/*
+ * Set up the compression stage of a stream.
+ * 
+ * When scrambling, the compressor runs at level m_zlevel with a content
+ * checksum, and with m_threads worker threads if there is more than
+ * one, so that compression overlaps with reading, scrambling and
+ * writing.  Decompression always runs on the calling thread.
+ * 
+ * zEnd() must be called on the stage afterwards whether or not this
+ * succeeds.  This must only be called in builds with WARP64_ZSTD.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pz - the stage to set up
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   fOut - the output file
+ * 
+ *   pc - the transform context, which scrambles the compressed bytes
+ * 
+ *   pCrc - the CRC register that a descrambled plaintext is added to,
+ *   or NULL
+ * 
+ *   prs - the statistics that get the transform time
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int zBegin(
+    ZSTAGE     * pz,
+    int          descramble,
+    int          fOut,
+    WARP64_CTX * pc,
+    uint32_t   * pCrc,
+    RUN_STATS  * prs) {
+#ifdef WARP64_ZSTD
+  int status = 1;
+  size_t rv = 0;
+  
+  /* Check parameters */
+  if ((pz == NULL) || (fOut < 0) || (pc == NULL) || (prs == NULL)) {
+    abort();
+  }
+  
+  /* Initialize the stage */
+  memset(pz, 0, sizeof(ZSTAGE));
+  pz->descramble = descramble;
+  pz->fOut = fOut;
+  pz->pc = pc;
+  pz->pCrc = pCrc;
+  pz->prs = prs;
+  pz->pBuf = (uint8_t *) malloc(STREAM_CHUNK);
+  if (pz->pBuf == NULL) {
+    abort();
+  }
+  
+  /* Create the context */
+  if (descramble) {
+    pz->pdz = ZSTD_createDCtx();
+    if (pz->pdz == NULL) {
+      abort();
+    }
+    
+  } else {
+    pz->pcz = ZSTD_createCCtx();
+    if (pz->pcz == NULL) {
+      abort();
+    }
+    rv = ZSTD_CCtx_setParameter(pz->pcz,
+            ZSTD_c_compressionLevel, m_zlevel);
+    if (!ZSTD_isError(rv)) {
+      rv = ZSTD_CCtx_setParameter(pz->pcz, ZSTD_c_checksumFlag, 1);
+    }
+    if (ZSTD_isError(rv)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to set up compression: %s!\n",
+              pModule, ZSTD_getErrorName(rv));
+    }
+    
+    /* A library built without threads refuses workers, in which case
+     * it just compresses on the calling thread */
+    if (status && (m_threads > 1)) {
+      ZSTD_CCtx_setParameter(pz->pcz, ZSTD_c_nbWorkers, m_threads);
+    }
+  }
+  
+  /* Return status */
+  return status;
+#else
+  (void) pz;
+  (void) descramble;
+  (void) fOut;
+  (void) pc;
+  (void) pCrc;
+  (void) prs;
+  abort();
+#endif
+}
+
+#ifdef WARP64_ZSTD
+/*
+ * Pass len bytes that came out of the codec of a stream stage on to the
+ * output.
+ * 
+ * When scrambling, these are compressed bytes, which are scrambled in
+ * place first.  When descrambling, they are plaintext, which is added
+ * to the CRC register if there is one.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pz - the stage
+ * 
+ *   len - the number of bytes at the start of the output buffer
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int zEmit(ZSTAGE *pz, size_t len) {
+  double t0 = 0.0;
+  
+  /* Check parameters */
+  if ((pz == NULL) || (len > STREAM_CHUNK)) {
+    abort();
+  }
+  
+  if (len < 1) {
+    return 1;
+  }
+  
+  /* Scramble compressed bytes, or checksum plaintext */
+  if (!(pz->descramble)) {
+    if (m_stats) {
+      t0 = nowSec();
+    }
+    warp64_update(pz->pc, pz->pBuf, pz->pBuf, len);
+    if (m_stats) {
+      pz->prs->xform_sec += nowSec() - t0;
+    }
+  } else if (pz->pCrc != NULL) {
+    *(pz->pCrc) = warp64k_crc(*(pz->pCrc), pz->pBuf, len);
+  }
+  
+  /* Write the bytes */
+  if (!writeSeq(pz->fOut, pz->pBuf, len)) {
+    fprintf(stderr, "%s: Failed to write output!\n", pModule);
+    return 0;
+  }
+  return 1;
+}
+#endif
+
+/*
+ * Feed bytes through the codec of a stream stage.
+ * 
+ * When scrambling, len bytes of plaintext are compressed, and with end
+ * set, the compressed frame is then finished, which must be done once
+ * at end of input.  When descrambling, len descrambled bytes are
+ * decompressed, and end is ignored.  Whatever comes out of the codec
+ * is passed to zEmit().
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pz - the stage
+ * 
+ *   pIn - the bytes, or NULL if len is zero
+ * 
+ *   len - the number of bytes
+ * 
+ *   end - non-zero to finish the compressed frame after the bytes
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int zPush(ZSTAGE *pz, const uint8_t *pIn, size_t len, int end) {
+#ifdef WARP64_ZSTD
+  int status = 1;
+  int done = 0;
+  size_t rv = 0;
+  ZSTD_inBuffer zi;
+  ZSTD_outBuffer zo;
+  
+  /* Initialize structures */
+  memset(&zi, 0, sizeof(ZSTD_inBuffer));
+  memset(&zo, 0, sizeof(ZSTD_outBuffer));
+  
+  /* Check parameters */
+  if ((pz == NULL) || ((pIn == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  zi.src = pIn;
+  zi.size = len;
+  zi.pos = 0;
+  
+  while (status && (!done)) {
+    zo.dst = pz->pBuf;
+    zo.size = STREAM_CHUNK;
+    zo.pos = 0;
+    
+    /* When compressing, keep going until all the input was taken, or
+     * until the frame is finished; when decompressing, also keep going
+     * while the output buffer comes back full, since the decompressor
+     * may have more output for the input it already took */
+    if (!(pz->descramble)) {
+      rv = ZSTD_compressStream2(pz->pcz, &zo, &zi,
+                                end ? ZSTD_e_end : ZSTD_e_continue);
+      if (ZSTD_isError(rv)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to compress: %s!\n",
+                pModule, ZSTD_getErrorName(rv));
+      }
+      if (status) {
+        if (end) {
+          done = (rv == 0);
+        } else {
+          done = (zi.pos >= zi.size);
+        }
+      }
+      
+    } else {
+      rv = ZSTD_decompressStream(pz->pdz, &zo, &zi);
+      if (ZSTD_isError(rv)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to decompress: %s!\n",
+                pModule, ZSTD_getErrorName(rv));
+        fprintf(stderr, "%s: Check the key and that the data was "
+                "scrambled with -z.\n", pModule);
+      }
+      if (status) {
+        pz->left = rv;
+        done = ((zi.pos >= zi.size) && (zo.pos < zo.size));
+      }
+    }
+    
+    /* Pass on whatever came out */
+    if (status) {
+      if (!zEmit(pz, zo.pos)) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Return status */
+  return status;
+#else
+  (void) pz;
+  (void) pIn;
+  (void) len;
+  (void) end;
+  abort();
+#endif
+}
+
+/*
+ * Release a stream stage that was set up with zBegin().
+ * 
+ * Parameters:
+ * 
+ *   pz - the stage
+ */
+static void zEnd(ZSTAGE *pz) {
+  
+  /* Check parameters */
+  if (pz == NULL) {
+    abort();
+  }
+  
+#ifdef WARP64_ZSTD
+  if (pz->pcz != NULL) {
+    ZSTD_freeCCtx(pz->pcz);
+    pz->pcz = NULL;
+  }
+  if (pz->pdz != NULL) {
+    ZSTD_freeDCtx(pz->pdz);
+    pz->pdz = NULL;
+  }
+#endif
+  if (pz->pBuf != NULL) {
+    free(pz->pBuf);
+    pz->pBuf = NULL;
+  }
+}
+
+/*
+ * Perform Warp64 scrambling or descrambling of a stream, normally from
+ * standard input to standard output.
+ * 
+ * Input is read in large chunks on a reader thread while the previous
+ * chunk is transformed and written, and the key phase is carried
+ * across chunk boundaries.  When scrambling, the trailer is written
+ * after the end of input.  When descrambling, the last three bytes are
+ * always held back, so that at end of input they can be checked as the
+ * trailer instead of being written.
+ * 
+ * Since descrambled output is written before the trailer has been
+ * seen, a wrong key when descrambling is only detected at end of input,
+ * after the (garbled) output has been written.  In that case, this
+ * function fails.
+ * 
+ * If splice is non-zero and the output is a pipe, output is written
+ * with vmsplice().  This is only safe if the process reading the pipe
+ * reads the data out of it, rather than using splice() or tee() to keep
+ * references to the pages.
+ * 
+ * With -z, the chunks go through a ZSTAGE.  When scrambling, each chunk
+ * is compressed, and the compressed bytes are scrambled and written as
+ * they come out of the compressor, which works on its own threads.
+ * When descrambling, each chunk is descrambled and decompressed, and
+ * the plaintext is written as it comes out.  At end of input, the
+ * compressed data must end with a whole frame.  splice must be zero,
+ * because the output buffer of the stage is reused right away.
+ * 
+ * If pCrc is not NULL, the CRC32C of the plaintext is computed next to
+ * the transform, or next to the codec with -z, and stored in *pCrc.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fIn - the input file
+ * 
+ *   fOut - the output file
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   pKey - the scrambling key
+ * 
+ *   splice - non-zero to allow vmsplice() output
+ * 
+ *   pCrc - receives the CRC32C of the plaintext, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int warp64Stream(
+          int        fIn,
+          int        fOut,
+          int        descramble,
+    const char     * pKey,
+          int        splice,
+          uint32_t * pCrc) {
+  int status = 1;
+  int started = 0;
+  int slot = 0;
+  int have = 0;
+  int eof = 0;
+  int i = 0;
+  
+  int32_t key = 0;
+  int64_t total = 0;
+  long cap = 0;
+  size_t n = 0;
+  size_t carry = 0;
+  uint32_t crc = UINT32_C(0xffffffff);
+  uint8_t *pData = NULL;
+  uint8_t *pOut = NULL;
+  uint8_t tail[3];
+  double t0 = 0.0;
+  double t1 = 0.0;
+  
+  int zstarted = 0;
+  pthread_t reader;
+  STREAM_STATE ss;
+  ZSTAGE zs;
+  WARP64_CTX *pc = NULL;
+  struct stat st;
+  RUN_STATS rs;
+  
+  /* Initialize structures */
+  memset(tail, 0, 3);
+  memset(&reader, 0, sizeof(pthread_t));
+  memset(&ss, 0, sizeof(STREAM_STATE));
+  memset(&zs, 0, sizeof(ZSTAGE));
+  memset(&st, 0, sizeof(struct stat));
+  memset(&rs, 0, sizeof(RUN_STATS));
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  
+  /* Check parameters */
+  if ((fIn < 0) || (fOut < 0) || (pKey == NULL)) {
+    abort();
+  }
+  if (m_zstd && splice) {
+    abort();
+  }
+  
+  /* Derive the normalized key and start the transform */
+  key = deriveKey(pKey);
+  if (key < 0) {
+    status = 0;
+  }
+  if (status) {
+    pc = warp64_init(key,
+            descramble ? WARP64_DESCRAMBLE : WARP64_SCRAMBLE);
+    if (pc == NULL) {
+      abort();
+    }
+  }
+  
+  /* Set up the compression stage */
+  if (status && m_zstd) {
+    zstarted = 1;
+    if (!zBegin(&zs, descramble, fOut, pc,
+                (descramble && (pCrc != NULL)) ? &crc : NULL, &rs)) {
+      status = 0;
+    }
+  }
+  
+  /* Figure out whether we can splice to output; we need enough slots to
+   * cover the pipe capacity plus one slot being read and one being
+   * written */
+  ss.nslot = STREAM_SLOTS;
+  if (status && splice) {
+#if defined(__linux__) && defined(F_GETPIPE_SZ)
+    if (fstat(fOut, &st) == 0) {
+      if (S_ISFIFO(st.st_mode)) {
+        cap = (long) fcntl(fOut, F_GETPIPE_SZ);
+      }
+    }
+#endif
+    if (cap > 0) {
+      ss.splice = 1;
+      ss.pipecap = (int64_t) cap;
+      if ((cap / STREAM_CHUNK) + 3 > ss.nslot) {
+        ss.nslot = (int) ((cap / STREAM_CHUNK) + 3);
+      }
+    }
+  }
+  
+  /* Allocate the slots; each slot has a page-sized prefix so that the
+   * held-back bytes of the previous chunk can be placed right before the
+   * data of the next chunk */
+  if (status) {
+    ss.fIn = fIn;
+    ss.ppSlot = (uint8_t **) calloc((size_t) ss.nslot, sizeof(uint8_t *));
+    ss.pLen = (size_t *) calloc((size_t) ss.nslot, sizeof(size_t));
+    ss.pAt = (int64_t *) calloc((size_t) ss.nslot, sizeof(int64_t));
+    if ((ss.ppSlot == NULL) || (ss.pLen == NULL) || (ss.pAt == NULL)) {
+      abort();
+    }
+    for(i = 0; i < ss.nslot; i++) {
+      if (posix_memalign((void **) &((ss.ppSlot)[i]), STREAM_PREFIX,
+                          STREAM_PREFIX + STREAM_CHUNK)) {
+        abort();
+      }
+    }
+    ss.avail = ss.nslot;
+    if (pthread_mutex_init(&(ss.lock), NULL) ||
+        pthread_cond_init(&(ss.cond), NULL)) {
+      abort();
+    }
+  }
+  
+  /* Start the reader */
+  if (status) {
+    if (pthread_create(&reader, NULL, &streamReader, &ss)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to start reader thread!\n", pModule);
+    } else {
+      started = 1;
+    }
+  }
+  
+  /* Transform and write each chunk as it arrives */
+  while (status && (!eof)) {
+    /* Wait for a filled slot */
+    if (pthread_mutex_lock(&(ss.lock))) {
+      abort();
+    }
+    while ((ss.filled < 1) && (!(ss.eof)) && (!(ss.err))) {
+      if (pthread_cond_wait(&(ss.cond), &(ss.lock))) {
+        abort();
+      }
+    }
+    have = 0;
+    if (ss.filled > 0) {
+      have = 1;
+      slot = ss.tail;
+      n = (ss.pLen)[slot];
+    } else {
+      if (ss.err) {
+        status = 0;
+      }
+      eof = 1;
+    }
+    if (pthread_mutex_unlock(&(ss.lock))) {
+      abort();
+    }
+    if (!status) {
+      fprintf(stderr, "%s: Failed to read input!\n", pModule);
+      break;
+    }
+    if (!have) {
+      break;
+    }
+    
+    /* When descrambling, put the held-back bytes in front of this chunk
+     * and hold back the last three bytes again, which might be the
+     * trailer */
+    pData = (ss.ppSlot)[slot] + STREAM_PREFIX;
+    total += (int64_t) n;
+    pOut = pData;
+    if (descramble) {
+      pOut = pData - carry;
+      memcpy(pOut, tail, carry);
+      n = n + carry;
+      carry = 3;
+      if (n < carry) {
+        carry = n;
+      }
+      n = n - carry;
+      memcpy(tail, pOut + n, carry);
+    }
+    
+    /* Transform the chunk in place; the context carries the key phase,
+     * and the plaintext is checksummed while the chunk is in the
+     * cache; when compressing, the compressed bytes are transformed
+     * instead as they come out */
+    if (m_stats) {
+      t1 = nowSec();
+    }
+    if ((pCrc != NULL) && (!descramble)) {
+      crc = warp64k_crc(crc, pOut, n);
+    }
+    if (descramble || (!m_zstd)) {
+      warp64_update(pc, pOut, pOut, n);
+    }
+    if ((pCrc != NULL) && descramble && (!m_zstd)) {
+      crc = warp64k_crc(crc, pOut, n);
+    }
+    if (m_stats) {
+      rs.xform_sec += nowSec() - t1;
+      (rs.windows)++;
+    }
+    
+    /* Write the chunk, or pass it through the compression stage, which
+     * writes what comes out */
+    if (m_zstd) {
+      if (!zPush(&zs, pOut, n, 0)) {
+        status = 0;
+      }
+      
+    } else if (n > 0) {
+      if (ss.splice) {
+        if (!spliceSeq(fOut, pOut, n)) {
+          status = 0;
+        }
+      } else {
+        if (!writeSeq(fOut, pOut, n)) {
+          status = 0;
+        }
+      }
+      if (!status) {
+        fprintf(stderr, "%s: Failed to write output!\n", pModule);
+      }
+    }
+    
+    /* Retire the slot and release any slots that are safe to reuse */
+    if (pthread_mutex_lock(&(ss.lock))) {
+      abort();
+    }
+    ss.written += (int64_t) n;
+    (ss.pAt)[slot] = ss.written;
+    ss.tail = (ss.tail + 1) % ss.nslot;
+    (ss.filled)--;
+    (ss.retired)++;
+    streamRelease(&ss);
+    if (!status) {
+      ss.stop = 1;
+    }
+    if (pthread_cond_broadcast(&(ss.cond))) {
+      abort();
+    }
+    if (pthread_mutex_unlock(&(ss.lock))) {
+      abort();
+    }
+  }
+  
+  /* At end of input, finish the compressed frame */
+  if (status && m_zstd && (!descramble)) {
+    if (!zPush(&zs, NULL, 0, 1)) {
+      status = 0;
+    }
+  }
+  
+  /* Then write the trailer when scrambling, or check the held-back
+   * bytes when descrambling */
+  if (status && (!descramble)) {
+    warp64_final(pc, tail);
+    pc = NULL;
+    if (!writeSeq(fOut, tail, 3)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write output!\n", pModule);
+    }
+    
+  } else if (status && descramble) {
+    if (carry < 3) {
+      status = 0;
+      fprintf(stderr, "%s: Missing trailer in input!\n", pModule);
+    } else {
+      if (warp64_final(pc, tail) != WARP64_OK) {
+        status = 0;
+        fprintf(stderr, "%s: Incorrect scrambling key!\n", pModule);
+        fprintf(stderr, "%s: Output written so far is not valid.\n",
+                pModule);
+      }
+      pc = NULL;
+    }
+  }
+  
+  /* The compressed data must not stop in the middle of a frame */
+  if (status && m_zstd && descramble && (zs.left != 0)) {
+    status = 0;
+    fprintf(stderr, "%s: Compressed data is truncated!\n", pModule);
+  }
+  if (zstarted) {
+    zEnd(&zs);
+    zstarted = 0;
+  }
+  
+  if (status && (pCrc != NULL)) {
+    *pCrc = crc ^ UINT32_C(0xffffffff);
+  }
+  
+  /* Stop and wait for the reader; if we failed, the reader might be
+   * blocked reading input, so cancel it */
+  if (started) {
+    if (!status) {
+      pthread_cancel(reader);
+    }
+    if (pthread_mutex_lock(&(ss.lock))) {
+      abort();
+    }
+    ss.stop = 1;
+    if (pthread_cond_broadcast(&(ss.cond))) {
+      abort();
+    }
+    if (pthread_mutex_unlock(&(ss.lock))) {
+      abort();
+    }
+    if (pthread_join(reader, NULL)) {
+      abort();
+    }
+    started = 0;
+  }
+  
+  /* Release the slots */
+  if (ss.ppSlot != NULL) {
+    if (pthread_mutex_destroy(&(ss.lock)) ||
+        pthread_cond_destroy(&(ss.cond))) {
+      abort();
+    }
+    for(i = 0; i < ss.nslot; i++) {
+      free((ss.ppSlot)[i]);
+      (ss.ppSlot)[i] = NULL;
+    }
+    free(ss.ppSlot);
+    ss.ppSlot = NULL;
+    free(ss.pLen);
+    ss.pLen = NULL;
+    free(ss.pAt);
+    ss.pAt = NULL;
+  }
+  
+  /* Release the transform if it wasn't finished */
+  if (pc != NULL) {
+    warp64_final(pc, NULL);
+    pc = NULL;
+  }
+  
+  /* Reading, writing and waiting count as I/O */
+  if (m_stats) {
+    rs.io_sec = (nowSec() - t0) - rs.xform_sec;
+    rs.bytes = total;
+    statsAdd(&rs);
+  }
+  
+  return status;
+}
+
+/*
+ * Perform Warp64 scrambling or descrambling of a file with -z.
+ * 
+ * The size of compressed data isn't known in advance, so the file goes
+ * through the stream pipeline of warp64Stream() instead of windows,
+ * from the input file into a new output file.  When descrambling, the
+ * trailer is checked first, so a wrong key fails before anything is
+ * written.  Checksum files and the sync policy work as for windowed
+ * runs, except that a rolling policy is the same as final: the output
+ * file is flushed with its directory entry before the input file is
+ * removed.  On failure, the output file is removed instead.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pInputPath - path to the input file
+ * 
+ *   pOutputPath - path to the output file, which must not exist yet
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   pKey - the scrambling key
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int warp64Pipe(
+    const char * pInputPath,
+    const char * pOutputPath,
+          int    descramble,
+    const char * pKey) {
+  
+  int status = 1;
+  int fIn = -1;
+  int fOut = -1;
+  int new_file = 0;
+  int crc_check = 0;
+  int crc_written = 0;
+  int32_t key = 0;
+  int64_t ilen = 0;
+  uint32_t crc = 0;
+  uint32_t crc_want = 0;
+  char *pCrcPath = NULL;
+  
+  /* Check parameters */
+  if ((pInputPath == NULL) || (pOutputPath == NULL) || (pKey == NULL)) {
+    abort();
+  }
+  
+  /* Open the input file */
+  fIn = open(pInputPath, O_RDONLY);
+  if (fIn < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pInputPath);
+  }
+  
+  /* When descrambling, check the trailer and look for a checksum file
+   * before anything is written */
+  if (status && descramble) {
+    key = deriveKey(pKey);
+    if (key < 0) {
+      status = 0;
+    }
+    if (status) {
+      ilen = (int64_t) lseek(fIn, 0, SEEK_END);
+      if (ilen < 3) {
+        status = 0;
+        fprintf(stderr, "%s: Missing trailer in '%s'!\n",
+                pModule, pInputPath);
+      }
+    }
+    if (status) {
+      if (!verifyTrailer(fIn, pInputPath, key, ilen - 3)) {
+        status = 0;
+      }
+    }
+    if (status) {
+      if (lseek(fIn, 0, SEEK_SET) != 0) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to rewind '%s'!\n",
+                pModule, pInputPath);
+      }
+    }
+    if (status) {
+      if (!crcRead(pInputPath, &crc_check, &crc_want)) {
+        status = 0;
+      }
+    }
+    if (status && m_crc && (!crc_check)) {
+      status = 0;
+      fprintf(stderr, "%s: No checksum file for '%s'!\n",
+              pModule, pInputPath);
+    }
+  }
+  
+  /* Create the output file; do not allow existing files to be
+   * overwritten */
+  if (status) {
+    fOut = open(pOutputPath, O_WRONLY | O_CREAT | O_EXCL,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fOut < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create '%s'!\n",
+              pModule, pOutputPath);
+      fprintf(stderr, "%s: Check that '%s' does not exist.\n",
+              pModule, pOutputPath);
+    } else {
+      new_file = 1;
+    }
+  }
+  
+  /* Run the stream, checksumming the plaintext if it will be recorded
+   * or checked */
+  if (status) {
+    if (!warp64Stream(fIn, fOut, descramble, pKey, 0,
+                      (m_crc || crc_check) ? &crc : NULL)) {
+      status = 0;
+    }
+  }
+  if (status && crc_check && (crc != crc_want)) {
+    status = 0;
+    fprintf(stderr, "%s: Checksum mismatch for '%s'!\n",
+            pModule, pInputPath);
+  }
+  
+  /* Flush and close the output */
+  if (status && (m_sync != SYNC_NONE)) {
+    if (fdatasync(fOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to flush '%s'!\n",
+              pModule, pOutputPath);
+    }
+  }
+  if (fOut >= 0) {
+    if (close(fOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to close output file!\n", pModule);
+    }
+    fOut = -1;
+  }
+  if (fIn >= 0) {
+    if (close(fIn)) {
+      fprintf(stderr, "%s: Failed to close input file!\n", pModule);
+    }
+    fIn = -1;
+  }
+  
+  /* Record the checksum of the plaintext next to the scrambled file */
+  if (status && m_crc && (!descramble)) {
+    if (crcWrite(pOutputPath, pInputPath, crc)) {
+      crc_written = 1;
+    } else {
+      status = 0;
+    }
+  }
+  
+  /* Make the new directory entries durable before the input is
+   * removed */
+  if (status && (m_sync != SYNC_NONE)) {
+    if (!syncDir(pOutputPath)) {
+      status = 0;
+    }
+  }
+  
+  /* On failure, remove what we created; else, remove the input file
+   * along with its checksum file */
+  if ((!status) && new_file) {
+    if (unlink(pOutputPath)) {
+      fprintf(stderr, "%s: Failed to clean up output file!\n", pModule);
+    }
+    if (crc_written) {
+      pCrcPath = crcPath(pOutputPath);
+      if (unlink(pCrcPath)) {
+        fprintf(stderr, "%s: Failed to clean up checksum file!\n",
+                pModule);
+      }
+    }
+  } else if (status) {
+    if (unlink(pInputPath)) {
+      fprintf(stderr, "%s: Failed to remove input file!\n", pModule);
+    }
+    if (crc_check) {
+      pCrcPath = crcPath(pInputPath);
+      if (unlink(pCrcPath)) {
+        fprintf(stderr, "%s: Failed to remove checksum file!\n",
+                pModule);
+      }
+    }
+  }
+  if (pCrcPath != NULL) {
+    free(pCrcPath);
+    pCrcPath = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Batch processing
+ * ================
+ */
+
+/*
+ * Derive the output path for an input path.
+ * 
+ * When scrambling, the input path must not have the .warp64 suffix and
+ * the output path is the input path with the suffix appended.  When
+ * descrambling, the input path must have the suffix and the output path
+ * is the input path with the suffix dropped.  When re-keying, the input
+ * path must have the suffix and the output path is the temporary file
+ * with REKEY_SUFFIX appended.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pInputPath - the input path
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   rekey - non-zero if re-keying, in which case descramble must be set
+ * 
+ * Return:
+ * 
+ *   the dynamically allocated output path, or NULL if error
+ */
+static char *outputPath(const char *pInputPath, int descramble, int rekey) {
+  int status = 1;
+  size_t slen = 0;
+  size_t suflen = 0;
+  int input_suffixed = 0;
+  char *pOutputPath = NULL;
+  
+  /* Check parameters */
+  if ((pInputPath == NULL) || (rekey && (!descramble))) {
+    abort();
+  }
+  
+  /* Get length of warp64 suffix and of the input path */
+  suflen = strlen(FILE_SUFFIX);
+  slen = strlen(pInputPath);
+  
+  /* Determine whether the input path has a .warp64 suffix */
+  if (slen > suflen) {
+    if (strcmp(&(pInputPath[slen - suflen]), FILE_SUFFIX) == 0) {
+      input_suffixed = 1;
+    }
+  }
+  
+  /* Make sure presence of suffix matches the mode */
+  if (descramble) {
+    if (!input_suffixed) {
+      status = 0;
+      fprintf(stderr, "%s: Input file must have .warp64 suffix!\n",
+              pModule);
+    }
+    
+  } else {
+    if (input_suffixed) {
+      status = 0;
+      fprintf(stderr, "%s: Input file may not have .warp64 suffix!\n",
+              pModule);
+    }
+  }
+  
+  if (status && descramble) {
+    /* We are descrambling, so we need to remove the .warp64 suffix; the
+     * character before the suffix must not be a separator slash */
+    if (pInputPath[slen - suflen - 1] == '/') {
+      status = 0;
+      fprintf(stderr, "%s: Invalid .warp64 suffix position!\n", pModule);
+    }
+    
+    /* Allocate buffer for new path and copy the input path without the
+     * warp64 suffix, or with the temporary suffix added if re-keying */
+    if (status && rekey) {
+      pOutputPath = (char *) calloc(slen + strlen(REKEY_SUFFIX) + 1, 1);
+      if (pOutputPath == NULL) {
+        abort();
+      }
+      strcpy(pOutputPath, pInputPath);
+      strcat(pOutputPath, REKEY_SUFFIX);
+      
+    } else if (status) {
+      pOutputPath = (char *) calloc((slen - suflen) + 1, 1);
+      if (pOutputPath == NULL) {
+        abort();
+      }
+      memcpy(pOutputPath, pInputPath, slen - suflen);
+    }
+    
+  } else if (status) {
+    /* We are scrambling, so we need to add a .warp64 suffix */
+    pOutputPath = (char *) calloc(slen + suflen + 1, 1);
+    if (pOutputPath == NULL) {
+      abort();
+    }
+    strcpy(pOutputPath, pInputPath);
+    strcat(pOutputPath, FILE_SUFFIX);
+  }
+  
+  /* Return output path or NULL */
+  return pOutputPath;
+}
+
+/*
+ * Add a file to a batch.
+ * 
+ * The output path is derived and the file is checked for an interrupted
+ * in-place run.  If either check fails, the file is still added, but it
+ * is added as failed so that it shows up in the failure list.
+ * 
+ * A failed entry is also added when pPath couldn't be used at all, by
+ * passing a size of -1.
+ * 
+ * Parameters:
+ * 
+ *   pb - the batch
+ * 
+ *   pPath - the input path
+ * 
+ *   size - the size of the input file, or -1 to add a failed entry
+ */
+static void batchAdd(BATCH *pb, const char *pPath, int64_t size) {
+  BATCH_FILE *pf = NULL;
+  char *pJournal = NULL;
+  
+  /* Check parameters */
+  if ((pb == NULL) || (pPath == NULL)) {
+    abort();
+  }
+  
+  /* Grow the file list if necessary */
+  if (pb->nfile >= pb->cap) {
+    if (pb->cap < 1) {
+      pb->cap = 64;
+    } else {
+      pb->cap = pb->cap * 2;
+    }
+    pb->pFiles = (BATCH_FILE *) realloc(
+                    pb->pFiles,
+                    ((size_t) pb->cap) * sizeof(BATCH_FILE));
+    if (pb->pFiles == NULL) {
+      abort();
+    }
+  }
+  
+  /* Fill in the new entry */
+  pf = &((pb->pFiles)[pb->nfile]);
+  (pb->nfile)++;
+  memset(pf, 0, sizeof(BATCH_FILE));
+  
+  pf->pIn = (char *) malloc(strlen(pPath) + 1);
+  if (pf->pIn == NULL) {
+    abort();
+  }
+  strcpy(pf->pIn, pPath);
+  pf->size = size;
+  
+  if (size < 0) {
+    pf->failed = 1;
+  }
+  
+  /* Derive the output path */
+  if (!(pf->failed)) {
+    pf->pOut = outputPath(pPath, pb->descramble, (pb->newkey >= 0));
+    if (pf->pOut == NULL) {
+      pf->failed = 1;
+    }
+  }
+  
+  /* Refuse to touch a file that still has an in-place journal */
+  if (!(pf->failed)) {
+    pJournal = journalPath(pPath);
+    if (access(pJournal, F_OK) == 0) {
+      pf->failed = 1;
+      fprintf(stderr, "%s: '%s' has an interrupted in-place run!\n",
+              pModule, pPath);
+    }
+    free(pJournal);
+    pJournal = NULL;
+  }
+}
+
+/*
+ * Add a path to a batch, descending into directories if requested.
+ * 
+ * top is non-zero for paths given on the command line.  Those must be
+ * regular files, or directories if recursive is set, and anything else
+ * is added as a failure.  Entries found while walking a directory are
+ * silently skipped unless they are regular files whose name matches the
+ * mode, so that scrambling skips files that are already scrambled and
+ * descrambling only picks up scrambled files.  Symbolic links found
+ * while walking are never followed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pb - the batch
+ * 
+ *   pPath - the path to add
+ * 
+ *   recursive - non-zero to descend into directories
+ * 
+ *   top - non-zero if pPath was given on the command line
+ */
+static void batchWalk(
+          BATCH * pb,
+    const char  * pPath,
+          int     recursive,
+          int     top) {
+  
+  int rv = 0;
+  int suffixed = 0;
+  size_t slen = 0;
+  size_t suflen = 0;
+  size_t jlen = 0;
+  size_t clen = 0;
+  DIR *pd = NULL;
+  struct dirent *pe = NULL;
+  char *pChild = NULL;
+  struct stat st;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pb == NULL) || (pPath == NULL)) {
+    abort();
+  }
+  
+  /* Get information about the path; command-line paths may be symbolic
+   * links, but links found while walking are not followed */
+  if (top) {
+    rv = stat(pPath, &st);
+  } else {
+    rv = lstat(pPath, &st);
+  }
+  if (rv) {
+    fprintf(stderr, "%s: Failed to stat '%s'\n", pModule, pPath);
+    batchAdd(pb, pPath, -1);
+    return;
+  }
+  
+  if (S_ISDIR(st.st_mode)) {
+    /* Directories are only allowed when recursing */
+    if (!recursive) {
+      fprintf(stderr, "%s: '%s' is a directory; use -r\n",
+              pModule, pPath);
+      batchAdd(pb, pPath, -1);
+      return;
+    }
+    
+    pd = opendir(pPath);
+    if (pd == NULL) {
+      fprintf(stderr, "%s: Failed to open directory '%s'\n",
+              pModule, pPath);
+      batchAdd(pb, pPath, -1);
+      return;
+    }
+    
+    slen = strlen(pPath);
+    for(pe = readdir(pd); pe != NULL; pe = readdir(pd)) {
+      if ((strcmp(pe->d_name, ".") == 0) ||
+            (strcmp(pe->d_name, "..") == 0)) {
+        continue;
+      }
+      
+      pChild = (char *) malloc(slen + strlen(pe->d_name) + 2);
+      if (pChild == NULL) {
+        abort();
+      }
+      strcpy(pChild, pPath);
+      if ((slen < 1) || (pPath[slen - 1] != '/')) {
+        strcat(pChild, "/");
+      }
+      strcat(pChild, pe->d_name);
+      
+      batchWalk(pb, pChild, recursive, 0);
+      
+      free(pChild);
+      pChild = NULL;
+    }
+    
+    closedir(pd);
+    pd = NULL;
+    
+  } else if (S_ISREG(st.st_mode)) {
+    /* Files found while walking are skipped if their name doesn't match
+     * the mode or if they are in-place journals or checksum files */
+    if (!top) {
+      suflen = strlen(FILE_SUFFIX);
+      jlen = strlen(JOURNAL_SUFFIX);
+      clen = strlen(FILE_SUFFIX CRC_SUFFIX);
+      slen = strlen(pPath);
+      if (slen > suflen) {
+        if (strcmp(&(pPath[slen - suflen]), FILE_SUFFIX) == 0) {
+          suffixed = 1;
+        }
+      }
+      if (suffixed != pb->descramble) {
+        return;
+      }
+      if (slen > jlen) {
+        if (strcmp(&(pPath[slen - jlen]), JOURNAL_SUFFIX) == 0) {
+          return;
+        }
+      }
+      if (slen > clen) {
+        if (strcmp(&(pPath[slen - clen]), FILE_SUFFIX CRC_SUFFIX) == 0) {
+          return;
+        }
+      }
+    }
+    batchAdd(pb, pPath, (int64_t) st.st_size);
+    
+  } else if (top) {
+    fprintf(stderr, "%s: '%s' is not a regular file\n", pModule, pPath);
+    batchAdd(pb, pPath, -1);
+  }
+}
+
+/*
+ * Process a small file of a batch completely on the calling thread.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pb - the batch
+ * 
+ *   pf - the file
+ * 
+ *   pio - the I/O backend state of the calling thread
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int batchFile(BATCH *pb, BATCH_FILE *pf, WARP64IO *pio) {
+  int status = 1;
+  int64_t w = 0;
+  WINDOW_JOB job;
+  
+  /* Initialize structures */
+  memset(&job, 0, sizeof(WINDOW_JOB));
+  
+  /* Check parameters */
+  if ((pb == NULL) || (pf == NULL) || (pio == NULL)) {
+    abort();
+  }
+  
+  /* Open the files and process all the windows */
+  if (!fileBegin(&job, pf->pIn, pf->pOut, pb->descramble,
+                  pb->key, pb->newkey, pb->pc, 0)) {
+    status = 0;
+  }
+  if (status) {
+    for(w = 0; w < job.nwin; w++) {
+      if (!processWindow(&job, w, pio)) {
+        status = 0;
+        break;
+      }
+    }
+    if (!fileEnd(&job, pf->pIn, pf->pOut, status)) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Worker thread function for a batch.
+ * 
+ * The worker pins itself according to m_pin and then keeps claiming
+ * work until the batch is exhausted.  Windows of large files that are
+ * already open are claimed first, so that large files are finished as
+ * soon as possible and only a few are open at any time.  Otherwise,
+ * the worker claims the next file in the list.  A large file is opened
+ * and then queued so that all the workers share its windows.  Small
+ * files are claimed in groups of up to BATCH_FILES files or a window's
+ * worth of data, whichever comes first, and each group is processed on
+ * the claiming worker.
+ * 
+ * While another worker is opening a large file and there is nothing
+ * else to claim, the worker waits for that file's windows.  The last
+ * worker to finish a window of a large file closes the file.
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to a BATCH_ARG
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *batchWorker(void *pArg) {
+  BATCH_ARG *pa = NULL;
+  BATCH *pb = NULL;
+  BATCH_SHARED *ps = NULL;
+  BATCH_SHARED *pq = NULL;
+  BATCH_FILE *pf = NULL;
+  
+  int64_t w = 0;
+  int64_t first = 0;
+  int64_t count = 0;
+  int64_t total = 0;
+  int64_t i = 0;
+  int ok = 0;
+  int fin = 0;
+  WARP64IO io;
+  
+  /* Initialize structures */
+  memset(&io, 0, sizeof(WARP64IO));
+  
+  /* Get the parameters */
+  if (pArg == NULL) {
+    abort();
+  }
+  pa = (BATCH_ARG *) pArg;
+  pb = pa->pb;
+  
+  /* Pin the thread if requested */
+  pinThread(pa->index);
+  
+  /* Set up the I/O backend; if that fails, leave the work to the other
+   * workers */
+  if (!ioBegin(&io)) {
+    ioEnd(&io);
+    return NULL;
+  }
+  
+  for(;;) {
+    if (pthread_mutex_lock(&(pb->lock))) {
+      abort();
+    }
+    
+    ps = NULL;
+    count = 0;
+    
+    /* If there is nothing to claim right now but other workers are
+     * still opening large files, wait for their windows */
+    while ((pb->pHead == NULL) && (pb->next >= pb->nfile) &&
+            (pb->opening > 0)) {
+      if (pthread_cond_wait(&(pb->cond), &(pb->lock))) {
+        abort();
+      }
+    }
+    
+    if (pb->pHead != NULL) {
+      /* Claim a window of the first open large file, and take the file
+       * off the queue once all its windows are claimed */
+      ps = pb->pHead;
+      w = ps->job.next;
+      (ps->job.next)++;
+      (ps->active)++;
+      if (ps->job.next >= ps->job.nwin) {
+        pb->pHead = ps->pNext;
+        ps->pNext = NULL;
+        ps->queued = 0;
+      }
+      
+    } else if (pb->next < pb->nfile) {
+      /* Claim either a single large file or a group of small files */
+      first = pb->next;
+      total = 0;
+      while ((pb->next < pb->nfile) && (count < BATCH_FILES)) {
+        pf = &((pb->pFiles)[pb->next]);
+        if (pf->size > (int64_t) m_winsize) {
+          if (count < 1) {
+            count = 1;
+            (pb->next)++;
+            if (!(pf->failed)) {
+              (pb->opening)++;
+            }
+          }
+          break;
+        }
+        if ((count > 0) && (total + pf->size > (int64_t) m_winsize)) {
+          break;
+        }
+        if (pf->size > 0) {
+          total += pf->size;
+        }
+        count++;
+        (pb->next)++;
+      }
+    }
+    
+    if (pthread_mutex_unlock(&(pb->lock))) {
+      abort();
+    }
+    
+    if (ps != NULL) {
+      /* Process the claimed window */
+      ok = processWindow(&(ps->job), w, &io);
+      
+      if (pthread_mutex_lock(&(pb->lock))) {
+        abort();
+      }
+      (ps->active)--;
+      if (!ok) {
+        /* Stop further windows of this file from being claimed */
+        ps->job.failed = 1;
+        if (ps->queued) {
+          if (pb->pHead == ps) {
+            pb->pHead = ps->pNext;
+          } else {
+            for(pq = pb->pHead; pq != NULL; pq = pq->pNext) {
+              if (pq->pNext == ps) {
+                pq->pNext = ps->pNext;
+                break;
+              }
+            }
+          }
+          ps->pNext = NULL;
+          ps->queued = 0;
+        }
+      }
+      fin = 0;
+      if ((!(ps->queued)) && (ps->active < 1)) {
+        fin = 1;
+      }
+      if (pthread_mutex_unlock(&(pb->lock))) {
+        abort();
+      }
+      
+      /* If this was the last window in flight, close the file */
+      if (fin) {
+        pf = &((pb->pFiles)[ps->file]);
+        if (!fileEnd(&(ps->job), pf->pIn, pf->pOut,
+                      !(ps->job.failed))) {
+          pf->failed = 1;
+        }
+        free(ps);
+        ps = NULL;
+      }
+      
+    } else if (count == 1) {
+      /* A single file, which might be large */
+      pf = &((pb->pFiles)[first]);
+      if (pf->failed) {
+        /* Failed while listing */
+        
+      } else if (pf->size <= (int64_t) m_winsize) {
+        if (!batchFile(pb, pf, &io)) {
+          pf->failed = 1;
+        }
+        
+      } else {
+        /* Open the large file and queue it so that the workers share
+         * its windows; if it shrank since it was listed, just process
+         * it here */
+        ps = (BATCH_SHARED *) calloc(1, sizeof(BATCH_SHARED));
+        if (ps == NULL) {
+          abort();
+        }
+        ps->file = first;
+        ok = fileBegin(&(ps->job), pf->pIn, pf->pOut,
+                        pb->descramble, pb->key, pb->newkey, pb->pc,
+                        0);
+        
+        /* Queue the file if it has windows to share, and let waiting
+         * workers know this file is no longer being opened */
+        if (pthread_mutex_lock(&(pb->lock))) {
+          abort();
+        }
+        if (ok && (ps->job.nwin >= 2)) {
+          ps->queued = 1;
+          ps->pNext = NULL;
+          if (pb->pHead == NULL) {
+            pb->pHead = ps;
+          } else {
+            for(pq = pb->pHead; pq->pNext != NULL; pq = pq->pNext);
+            pq->pNext = ps;
+          }
+        }
+        (pb->opening)--;
+        if (pthread_cond_broadcast(&(pb->cond))) {
+          abort();
+        }
+        if (pthread_mutex_unlock(&(pb->lock))) {
+          abort();
+        }
+        
+        if (!ok) {
+          pf->failed = 1;
+          free(ps);
+          
+        } else if (!(ps->queued)) {
+          for(w = 0; w < ps->job.nwin; w++) {
+            if (!processWindow(&(ps->job), w, &io)) {
+              pf->failed = 1;
+              break;
+            }
+          }
+          if (!fileEnd(&(ps->job), pf->pIn, pf->pOut, !(pf->failed))) {
+            pf->failed = 1;
+          }
+          free(ps);
+        }
+        ps = NULL;
+      }
+      
+    } else if (count > 1) {
+      /* A group of small files */
+      for(i = first; i < first + count; i++) {
+        pf = &((pb->pFiles)[i]);
+        if (!(pf->failed)) {
+          if (!batchFile(pb, pf, &io)) {
+            pf->failed = 1;
+          }
+        }
+      }
+      
+    } else {
+      /* Nothing left to claim */
+      break;
+    }
+  }
+  
+  ioEnd(&io);
+  return NULL;
+}
+
+/*
+ * Scramble or descramble many files with one key.
+ * 
+ * Each path in ppPath is either a regular file or, if recursive is
+ * set, a directory tree that is walked for files whose name matches the
+ * mode.  The whole list is built before any file is processed, so
+ * output files are never picked up as input.
+ * 
+ * The files are processed by a shared pool of m_threads workers, see
+ * batchWorker().  If inplace is set, the files are instead transformed
+ * in place one after the other, each with its own journal.
+ * 
+ * Processing continues after a file fails.  At the end, the files that
+ * failed are listed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   ppPath - the paths given on the command line
+ * 
+ *   npath - the number of paths
+ * 
+ *   recursive - non-zero to descend into directories
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   inplace - non-zero to transform the files in place
+ * 
+ *   pKey - the scrambling key
+ * 
+ *   pNewKey - when re-keying, the new scrambling key, else NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if every file was processed successfully, zero if not
+ */
+static int warp64Batch(
+          char ** ppPath,
+          int     npath,
+          int     recursive,
+          int     descramble,
+          int     inplace,
+    const char  * pKey,
+    const char  * pNewKey) {
+  
+  int status = 1;
+  int tc = 0;
+  int started = 0;
+  int i = 0;
+  int64_t f = 0;
+  int64_t nfail = 0;
+  
+  BATCH batch;
+  BATCH_ARG *pArgs = NULL;
+  pthread_t *pThreads = NULL;
+  BATCH_FILE *pf = NULL;
+  
+  /* Initialize structures */
+  memset(&batch, 0, sizeof(BATCH));
+  
+  /* Check parameters */
+  if ((ppPath == NULL) || (npath < 1) || (pKey == NULL)) {
+    abort();
+  }
+  
+  batch.descramble = descramble;
+  batch.newkey = -1;
+  if (pthread_mutex_init(&(batch.lock), NULL)) {
+    abort();
+  }
+  if (pthread_cond_init(&(batch.cond), NULL)) {
+    abort();
+  }
+  
+  /* Derive the normalized keys once for all files */
+  batch.key = deriveKey(pKey);
+  if (batch.key < 0) {
+    status = 0;
+  }
+  if (status && (pNewKey != NULL)) {
+    batch.newkey = deriveKey(pNewKey);
+    if (batch.newkey < 0) {
+      status = 0;
+    }
+  }
+  
+  /* Build the file list */
+  if (status) {
+    for(i = 0; i < npath; i++) {
+      batchWalk(&batch, ppPath[i], recursive, 1);
+    }
+  }
+  
+  if (status && inplace) {
+    /* In-place runs are journaled window by window, so process the
+     * files one at a time */
+    for(f = 0; f < batch.nfile; f++) {
+      pf = &((batch.pFiles)[f]);
+      if (!(pf->failed)) {
+        if (!inplaceStart(pf->pIn, pf->pOut, descramble, pKey, pNewKey)) {
+          pf->failed = 1;
+        }
+      }
+    }
+    batch.next = batch.nfile;
+    
+  } else if (status) {
+    /* All the files share one transform context */
+    batch.pc = jobContext(descramble, batch.key, batch.newkey);
+    
+    /* Determine how many threads to use */
+    tc = m_threads;
+    if (batch.nfile < (int64_t) tc) {
+      tc = (int) batch.nfile;
+    }
+    if (tc < 1) {
+      tc = 1;
+    }
+    
+    pArgs = (BATCH_ARG *) calloc((size_t) tc, sizeof(BATCH_ARG));
+    pThreads = (pthread_t *) calloc((size_t) tc, sizeof(pthread_t));
+    if ((pArgs == NULL) || (pThreads == NULL)) {
+      abort();
+    }
+    for(i = 0; i < tc; i++) {
+      pArgs[i].pb = &batch;
+      pArgs[i].index = i;
+    }
+    
+    if (tc <= 1) {
+      /* Single thread, so process everything on the calling thread */
+      batchWorker(&(pArgs[0]));
+      
+    } else {
+      /* Start the workers; if some fail to start, the workers that did
+       * start still get through the whole list */
+      for(i = 0; i < tc; i++) {
+        if (pthread_create(&(pThreads[i]), NULL,
+                            &batchWorker, &(pArgs[i]))) {
+          fprintf(stderr, "%s: Failed to start worker thread!\n",
+                  pModule);
+          break;
+        }
+        started++;
+      }
+      
+      /* If no worker started at all, do the work here */
+      if (started < 1) {
+        batchWorker(&(pArgs[0]));
+      }
+      
+      /* Wait for the workers to finish */
+      for(i = 0; i < started; i++) {
+        if (pthread_join(pThreads[i], NULL)) {
+          abort();
+        }
+      }
+    }
+    
+    free(pArgs);
+    pArgs = NULL;
+    free(pThreads);
+    pThreads = NULL;
+  }
+  
+  /* Report the failures; files that no worker claimed, because no
+   * worker could set up its I/O backend, count as failed */
+  if (status) {
+    for(f = batch.next; f < batch.nfile; f++) {
+      (batch.pFiles)[f].failed = 1;
+    }
+    for(f = 0; f < batch.nfile; f++) {
+      if ((batch.pFiles)[f].failed) {
+        nfail++;
+      }
+    }
+    if (nfail > 0) {
+      status = 0;
+      fprintf(stderr, "%s: %ld of %ld files failed:\n",
+              pModule, (long) nfail, (long) batch.nfile);
+      for(f = 0; f < batch.nfile; f++) {
+        if ((batch.pFiles)[f].failed) {
+          fprintf(stderr, "  %s\n", (batch.pFiles)[f].pIn);
+        }
+      }
+    }
+  }
+  
+  /* Release the batch */
+  for(f = 0; f < batch.nfile; f++) {
+    free((batch.pFiles)[f].pIn);
+    free((batch.pFiles)[f].pOut);
+  }
+  free(batch.pFiles);
+  batch.pFiles = NULL;
+  if (batch.pc != NULL) {
+    warp64_final(batch.pc, NULL);
+    batch.pc = NULL;
+  }
+  if (pthread_cond_destroy(&(batch.cond))) {
+    abort();
+  }
+  if (pthread_mutex_destroy(&(batch.lock))) {
+    abort();
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Key verification
+ * ================
+ */
+
+/*
+ * Check the trailer of one file of a -c run against the key.
+ * 
+ * The file is opened read-only and only its trailer is read.  The
+ * result is stored in the match field of the file.
+ * 
+ * Error messages are printed.  A mismatch is not an error.
+ * 
+ * Parameters:
+ * 
+ *   pb - the batch
+ * 
+ *   pf - the file
+ * 
+ * Return:
+ * 
+ *   non-zero if the trailer was read, zero if error
+ */
+static int checkFile(BATCH *pb, BATCH_FILE *pf) {
+  int status = 1;
+  int fd = -1;
+  uint8_t trailer[3];
+  
+  /* Initialize structures */
+  memset(trailer, 0, 3);
+  
+  /* Check parameters */
+  if ((pb == NULL) || (pf == NULL)) {
+    abort();
+  }
+  
+  /* The length from the listing is good enough to locate the trailer,
+   * which saves a call per file */
+  if (pf->size < 3) {
+    status = 0;
+    fprintf(stderr, "%s: Missing trailer in '%s'!\n", pModule, pf->pIn);
+  }
+  
+  if (status) {
+    fd = open(pf->pIn, O_RDONLY);
+    if (fd < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pf->pIn);
+    }
+  }
+  
+  if (status) {
+    if (pread(fd, trailer, 3, (off_t) (pf->size - 3)) != 3) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read trailer in '%s'!\n",
+              pModule, pf->pIn);
+    }
+  }
+  
+  if (status) {
+    if (warp64_recover(pf->size - 3, trailer) == pb->key) {
+      pf->match = 1;
+    }
+  }
+  
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  
+  return status;
+}
+
+/*
+ * Worker thread function for a -c run.
+ * 
+ * The worker claims files one at a time until there are none left.
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to a BATCH_ARG
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *checkWorker(void *pArg) {
+  BATCH_ARG *pa = NULL;
+  BATCH *pb = NULL;
+  BATCH_FILE *pf = NULL;
+  int64_t f = 0;
+  
+  if (pArg == NULL) {
+    abort();
+  }
+  pa = (BATCH_ARG *) pArg;
+  pb = pa->pb;
+  
+  for(;;) {
+    /* Claim the next file */
+    if (pthread_mutex_lock(&(pb->lock))) {
+      abort();
+    }
+    f = -1;
+    if (pb->next < pb->nfile) {
+      f = pb->next;
+      (pb->next)++;
+    }
+    if (pthread_mutex_unlock(&(pb->lock))) {
+      abort();
+    }
+    if (f < 0) {
+      break;
+    }
+    
+    /* Check it, unless it was already rejected while listing */
+    pf = &((pb->pFiles)[f]);
+    if (!(pf->failed)) {
+      if (!checkFile(pb, pf)) {
+        pf->failed = 1;
+      }
+    }
+  }
+  
+  return NULL;
+}
+
+/*
+ * Check the trailers of scrambled files against a key.
+ * 
+ * The paths are listed as for a descrambling batch, and then checked
+ * by a pool of m_threads workers.  A result line is printed for each
+ * file once all of them are checked.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   ppPath - the paths given on the command line
+ * 
+ *   npath - the number of paths
+ * 
+ *   recursive - non-zero to descend into directories
+ * 
+ *   pKey - the scrambling key
+ * 
+ * Return:
+ * 
+ *   non-zero if every file matched, zero if not
+ */
+static int warp64Check(
+          char ** ppPath,
+          int     npath,
+          int     recursive,
+    const char  * pKey) {
+  
+  int status = 1;
+  int tc = 0;
+  int started = 0;
+  int i = 0;
+  int64_t f = 0;
+  int64_t nmatch = 0;
+  
+  BATCH batch;
+  BATCH_ARG arg;
+  pthread_t *pThreads = NULL;
+  BATCH_FILE *pf = NULL;
+  
+  /* Initialize structures */
+  memset(&batch, 0, sizeof(BATCH));
+  memset(&arg, 0, sizeof(BATCH_ARG));
+  
+  /* Check parameters */
+  if ((ppPath == NULL) || (npath < 1) || (pKey == NULL)) {
+    abort();
+  }
+  
+  batch.descramble = 1;
+  batch.newkey = -1;
+  if (pthread_mutex_init(&(batch.lock), NULL)) {
+    abort();
+  }
+  if (pthread_cond_init(&(batch.cond), NULL)) {
+    abort();
+  }
+  arg.pb = &batch;
+  
+  /* Derive the normalized key */
+  batch.key = deriveKey(pKey);
+  if (batch.key < 0) {
+    status = 0;
+  }
+  
+  /* Build the file list */
+  if (status) {
+    for(i = 0; i < npath; i++) {
+      batchWalk(&batch, ppPath[i], recursive, 1);
+    }
+  }
+  
+  /* Check the files; workers only share the claim counter, so they all
+   * run the same argument */
+  if (status) {
+    tc = m_threads;
+    if (batch.nfile < (int64_t) tc) {
+      tc = (int) batch.nfile;
+    }
+    if (tc < 1) {
+      tc = 1;
+    }
+    
+    pThreads = (pthread_t *) calloc((size_t) tc, sizeof(pthread_t));
+    if (pThreads == NULL) {
+      abort();
+    }
+    for(i = 0; i < tc; i++) {
+      if (tc <= 1) {
+        break;
+      }
+      if (pthread_create(&(pThreads[i]), NULL, &checkWorker, &arg)) {
+        fprintf(stderr, "%s: Failed to start worker thread!\n", pModule);
+        break;
+      }
+      started++;
+    }
+    if (started < 1) {
+      checkWorker(&arg);
+    }
+    for(i = 0; i < started; i++) {
+      if (pthread_join(pThreads[i], NULL)) {
+        abort();
+      }
+    }
+    free(pThreads);
+    pThreads = NULL;
+  }
+  
+  /* Report the results in listing order */
+  if (status) {
+    for(f = 0; f < batch.nfile; f++) {
+      pf = &((batch.pFiles)[f]);
+      if (pf->failed) {
+        printf("error %s\n", pf->pIn);
+      } else if (pf->match) {
+        printf("match %s\n", pf->pIn);
+        nmatch++;
+      } else {
+        printf("mismatch %s\n", pf->pIn);
+      }
+    }
+    if (fflush(stdout)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write results!\n", pModule);
+    }
+    if (nmatch < batch.nfile) {
+      status = 0;
+      fprintf(stderr, "%s: %ld of %ld files match the key\n",
+              pModule, (long) nmatch, (long) batch.nfile);
+    }
+  }
+  
+  /* Release the batch */
+  for(f = 0; f < batch.nfile; f++) {
+    free((batch.pFiles)[f].pIn);
+    free((batch.pFiles)[f].pOut);
+  }
+  free(batch.pFiles);
+  batch.pFiles = NULL;
+  if (pthread_cond_destroy(&(batch.cond))) {
+    abort();
+  }
+  if (pthread_mutex_destroy(&(batch.lock))) {
+    abort();
+  }
+  
+  return status;
+}
+
+/*
+ * Packing
+ * =======
+ */
+
+/*
+ * Get the name a file is stored under in a pack.
+ * 
+ * The name is the path with any leading separators and "./" components
+ * dropped, so that members always extract below the current directory.
+ * Paths with empty, "." or ".." components after that are refused,
+ * since they could not be extracted safely or would not compare
+ * reliably.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path of the file
+ * 
+ * Return:
+ * 
+ *   the name, which points into pPath, or NULL if the path can't be
+ *   stored
+ */
+static const char *packName(const char *pPath) {
+  const char *pName = NULL;
+  const char *p = NULL;
+  size_t clen = 0;
+  
+  /* Check parameter */
+  if (pPath == NULL) {
+    abort();
+  }
+  
+  /* Drop leading separators and "./" components */
+  pName = pPath;
+  while ((pName[0] == '/') ||
+          ((pName[0] == '.') && (pName[1] == '/'))) {
+    if (pName[0] == '/') {
+      pName++;
+    } else {
+      pName += 2;
+    }
+  }
+  if ((pName[0] == 0) || (strlen(pName) > PACK_NAME_MAX)) {
+    return NULL;
+  }
+  
+  /* Check each component */
+  for(p = pName; ; p += clen + 1) {
+    clen = strcspn(p, "/");
+    if ((clen < 1) ||
+        ((clen == 1) && (p[0] == '.')) ||
+        ((clen == 2) && (p[0] == '.') && (p[1] == '.'))) {
+      return NULL;
+    }
+    if (p[clen] == 0) {
+      break;
+    }
+  }
+  
+  return pName;
+}
+
+/*
+ * Add a member to a pack index.
+ * 
+ * Parameters:
+ * 
+ *   px - the index
+ * 
+ *   pName - the name of the member, which is copied
+ * 
+ *   off - the offset of the member data in the archive
+ * 
+ *   len - the length of the member data
+ */
+static void packAdd(
+          PACK_INDEX * px,
+    const char       * pName,
+          int64_t      off,
+          int64_t      len) {
+  
+  PACK_MEMBER *pm = NULL;
+  
+  /* Check parameters */
+  if ((px == NULL) || (pName == NULL) || (off < 0) || (len < 0)) {
+    abort();
+  }
+  
+  /* Grow the member list if necessary */
+  if (px->count >= px->cap) {
+    if (px->cap < 1) {
+      px->cap = 64;
+    } else {
+      px->cap = px->cap * 2;
+    }
+    px->pm = (PACK_MEMBER *) realloc(
+                px->pm,
+                ((size_t) px->cap) * sizeof(PACK_MEMBER));
+    if (px->pm == NULL) {
+      abort();
+    }
+  }
+  
+  /* Fill in the new entry */
+  pm = &((px->pm)[px->count]);
+  (px->count)++;
+  memset(pm, 0, sizeof(PACK_MEMBER));
+  
+  pm->pName = (char *) malloc(strlen(pName) + 1);
+  if (pm->pName == NULL) {
+    abort();
+  }
+  strcpy(pm->pName, pName);
+  pm->off = off;
+  pm->len = len;
+}
+
+/*
+ * Release the members of a pack index.
+ * 
+ * Parameters:
+ * 
+ *   px - the index
+ */
+static void packRelease(PACK_INDEX *px) {
+  int64_t m = 0;
+  
+  /* Check parameter */
+  if (px == NULL) {
+    abort();
+  }
+  
+  for(m = 0; m < px->count; m++) {
+    free((px->pm)[m].pName);
+  }
+  free(px->pm);
+  memset(px, 0, sizeof(PACK_INDEX));
+}
+
+/*
+ * Scramble the block buffer of a pack and write it to the archive.
+ * 
+ * If the write fails, the failed flag of the output is set and an error
+ * message is printed; later writes are then skipped.
+ * 
+ * Parameters:
+ * 
+ *   po - the pack output
+ */
+static void packFlush(PACK_OUT *po) {
+  double t0 = 0.0;
+  double t1 = 0.0;
+  
+  /* Check parameter */
+  if (po == NULL) {
+    abort();
+  }
+  
+  if ((po->used < 1) || po->failed) {
+    po->off += (int64_t) po->used;
+    po->used = 0;
+    return;
+  }
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  warp64_update(po->pc, po->pBuf, po->pBuf, po->used);
+  if (m_stats) {
+    t1 = nowSec();
+    po->rs.xform_sec += t1 - t0;
+  }
+  
+  if (!writeSeq(po->fd, po->pBuf, po->used)) {
+    po->failed = 1;
+    fprintf(stderr, "%s: Failed to write '%s'!\n", pModule, po->pPath);
+  }
+  if (m_stats) {
+    po->rs.io_sec += nowSec() - t1;
+  }
+  
+  po->rs.windows++;
+  po->rs.bytes += (int64_t) po->used;
+  po->off += (int64_t) po->used;
+  po->used = 0;
+}
+
+/*
+ * Append bytes to a pack.
+ * 
+ * Parameters:
+ * 
+ *   po - the pack output
+ * 
+ *   p - the bytes
+ * 
+ *   len - the number of bytes
+ */
+static void packPut(PACK_OUT *po, const uint8_t *p, size_t len) {
+  size_t n = 0;
+  
+  /* Check parameters */
+  if ((po == NULL) || ((p == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  while (len > 0) {
+    n = ((size_t) PACK_BLOCK) - po->used;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(&((po->pBuf)[po->used]), p, n);
+    po->used += n;
+    p += n;
+    len -= n;
+    if (po->used >= (size_t) PACK_BLOCK) {
+      packFlush(po);
+    }
+  }
+}
+
+/*
+ * Append the contents of a file to a pack.
+ * 
+ * The file is read straight into the free space of the block buffer,
+ * so small files cost one read each and are written out together once
+ * the buffer is full.
+ * 
+ * Error messages are printed.  If reading fails partway, the bytes
+ * already appended stay in the archive as dead space that no index
+ * entry refers to.
+ * 
+ * Parameters:
+ * 
+ *   po - the pack output
+ * 
+ *   pPath - the path of the file
+ * 
+ *   pLen - receives the number of bytes appended
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file couldn't be read
+ */
+static int packFile(PACK_OUT *po, const char *pPath, int64_t *pLen) {
+  int status = 1;
+  int fd = -1;
+  ssize_t rv = 0;
+  double t0 = 0.0;
+  struct stat st;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((po == NULL) || (pPath == NULL) || (pLen == NULL)) {
+    abort();
+  }
+  *pLen = 0;
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  
+  /* Open the file, which must still be a regular file */
+  fd = open(pPath, O_RDONLY);
+  if (fd < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pPath);
+  }
+  if (status) {
+    if (fstat(fd, &st) || (!(S_ISREG(st.st_mode)))) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' is not a regular file\n",
+              pModule, pPath);
+    }
+  }
+  if (status && (st.st_size > (off_t) PACK_BLOCK)) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+  
+  if (m_stats) {
+    po->rs.setup_sec += nowSec() - t0;
+  }
+  
+  /* Read until end of file */
+  while (status && (!(po->failed))) {
+    if (m_stats) {
+      t0 = nowSec();
+    }
+    rv = read(fd, &((po->pBuf)[po->used]),
+              ((size_t) PACK_BLOCK) - po->used);
+    if (m_stats) {
+      po->rs.io_sec += nowSec() - t0;
+    }
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s'!\n", pModule, pPath);
+    } else if (rv == 0) {
+      break;
+    }
+    if (status) {
+      po->used += (size_t) rv;
+      *pLen += (int64_t) rv;
+      if (po->used >= (size_t) PACK_BLOCK) {
+        packFlush(po);
+      }
+    }
+  }
+  
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  
+  return status;
+}
+
+/*
+ * Pack files into a scrambled archive.
+ * 
+ * The paths are listed as for a scrambling batch.  The archive is one
+ * scrambled stream, which could be descrambled as a whole like any
+ * other scrambled file.  Its plaintext is the contents of the members
+ * back to back, then the index, then the footer:
+ * 
+ *   member data, in the order the files were listed
+ *   index entry for each member:
+ *     offset, length and name length, 64-bit big-endian
+ *     key phase of the first byte of the member, one byte
+ *     name, without a terminating nul
+ *   footer, PACK_FOOTER bytes:
+ *     PACK_MAGIC
+ *     index offset, index length, member count and FNV-1a hash of the
+ *     index, 64-bit big-endian
+ * 
+ * and the trailer follows as usual.  A member can then be extracted by
+ * reading the footer and index and descrambling only the member data
+ * at its offset.
+ * 
+ * Everything is gathered in a block buffer of PACK_BLOCK bytes, which
+ * is scrambled and written sequentially, so that the device sees large
+ * writes however small the files are, and there is a single create,
+ * trailer and flush for the whole archive.  The archive must not exist
+ * yet.  Files that fail are left out of the index, and once the archive
+ * is complete and flushed, the files that were packed are removed.  If
+ * the archive itself can't be written, it is removed and the files are
+ * all kept.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   ppPath - the paths given on the command line
+ * 
+ *   npath - the number of paths
+ * 
+ *   recursive - non-zero to descend into directories
+ * 
+ *   pArchive - the path of the archive to create
+ * 
+ *   pKey - the scrambling key
+ * 
+ * Return:
+ * 
+ *   non-zero if every file was packed, zero if not
+ */
+static int warp64Pack(
+          char ** ppPath,
+          int     npath,
+          int     recursive,
+    const char  * pArchive,
+    const char  * pKey) {
+  
+  int status = 1;
+  int i = 0;
+  int64_t f = 0;
+  int64_t m = 0;
+  int64_t nfail = 0;
+  int64_t len = 0;
+  int64_t ioff = 0;
+  size_t ilen = 0;
+  size_t ipos = 0;
+  size_t nlen = 0;
+  uint8_t *pIndex = NULL;
+  const char *pName = NULL;
+  double t0 = 0.0;
+  
+  BATCH batch;
+  PACK_OUT out;
+  PACK_INDEX idx;
+  BATCH_FILE *pf = NULL;
+  uint8_t footer[PACK_FOOTER];
+  uint8_t trailer[WARP64_TRAILER];
+  
+  /* Initialize structures */
+  memset(&batch, 0, sizeof(BATCH));
+  memset(&out, 0, sizeof(PACK_OUT));
+  memset(&idx, 0, sizeof(PACK_INDEX));
+  memset(footer, 0, PACK_FOOTER);
+  memset(trailer, 0, WARP64_TRAILER);
+  out.fd = -1;
+  out.pPath = pArchive;
+  
+  /* Check parameters */
+  if ((ppPath == NULL) || (npath < 1) ||
+      (pArchive == NULL) || (pKey == NULL)) {
+    abort();
+  }
+  
+  batch.descramble = 0;
+  batch.newkey = -1;
+  
+  /* Derive the normalized key */
+  batch.key = deriveKey(pKey);
+  if (batch.key < 0) {
+    status = 0;
+  }
+  
+  /* Build the file list before the archive exists, so that a walk
+   * can't pick it up */
+  if (status) {
+    for(i = 0; i < npath; i++) {
+      batchWalk(&batch, ppPath[i], recursive, 1);
+    }
+  }
+  
+  /* Create the archive */
+  if (status) {
+    if (m_stats) {
+      t0 = nowSec();
+    }
+    out.fd = open(pArchive, O_WRONLY | O_CREAT | O_EXCL,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (out.fd < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pArchive);
+    }
+    if (m_stats) {
+      out.rs.setup_sec += nowSec() - t0;
+    }
+  }
+  if (status) {
+    out.pc = warp64_init(batch.key, WARP64_SCRAMBLE);
+    out.pBuf = (uint8_t *) malloc((size_t) PACK_BLOCK);
+    if ((out.pc == NULL) || (out.pBuf == NULL)) {
+      abort();
+    }
+  }
+  
+  /* Append the members */
+  for(f = 0; status && (f < batch.nfile) && (!(out.failed)); f++) {
+    pf = &((batch.pFiles)[f]);
+    if (pf->failed) {
+      continue;
+    }
+    pName = packName(pf->pIn);
+    if (pName == NULL) {
+      pf->failed = 1;
+      fprintf(stderr, "%s: Can't pack '%s' under its path!\n",
+              pModule, pf->pIn);
+      continue;
+    }
+    
+    if (packFile(&out, pf->pIn, &len)) {
+      packAdd(&idx, pName, out.off + (int64_t) out.used - len, len);
+      out.rs.files++;
+    } else {
+      pf->failed = 1;
+    }
+  }
+  
+  /* Lay out the index, so that it can be hashed, and append it with
+   * the footer */
+  if (status && (!(out.failed))) {
+    ioff = out.off + (int64_t) out.used;
+    for(m = 0; m < idx.count; m++) {
+      ilen += PACK_ENTRY + strlen((idx.pm)[m].pName);
+    }
+    pIndex = (uint8_t *) malloc(ilen + 1);
+    if (pIndex == NULL) {
+      abort();
+    }
+    for(m = 0; m < idx.count; m++) {
+      nlen = strlen((idx.pm)[m].pName);
+      packU64(&(pIndex[ipos]), (uint64_t) (idx.pm)[m].off);
+      packU64(&(pIndex[ipos + 8]), (uint64_t) (idx.pm)[m].len);
+      packU64(&(pIndex[ipos + 16]), (uint64_t) nlen);
+      pIndex[ipos + 24] = (uint8_t) ((idx.pm)[m].off % 3);
+      memcpy(&(pIndex[ipos + PACK_ENTRY]), (idx.pm)[m].pName, nlen);
+      ipos += PACK_ENTRY + nlen;
+    }
+    
+    memcpy(footer, PACK_MAGIC, 8);
+    packU64(&(footer[8]), (uint64_t) ioff);
+    packU64(&(footer[16]), (uint64_t) ilen);
+    packU64(&(footer[24]), (uint64_t) idx.count);
+    packU64(&(footer[32]), fnv64(pIndex, ilen));
+    
+    packPut(&out, pIndex, ilen);
+    packPut(&out, footer, PACK_FOOTER);
+    packFlush(&out);
+    
+    free(pIndex);
+    pIndex = NULL;
+  }
+  if (status && (!(out.failed))) {
+    warp64_final(out.pc, trailer);
+    out.pc = NULL;
+    if (!writeSeq(out.fd, trailer, WARP64_TRAILER)) {
+      out.failed = 1;
+      fprintf(stderr, "%s: Failed to write '%s'!\n", pModule, pArchive);
+    }
+  }
+  if (out.failed) {
+    status = 0;
+  }
+  
+  /* Flush the archive before any file is removed */
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  if (status && (m_sync != SYNC_NONE)) {
+    if (fdatasync(out.fd)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to flush '%s'!\n", pModule, pArchive);
+    }
+    if (status) {
+      if (!syncDir(pArchive)) {
+        status = 0;
+      }
+    }
+  }
+  if (out.fd >= 0) {
+    if (close(out.fd) && status) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to close '%s'!\n", pModule, pArchive);
+    }
+    out.fd = -1;
+    if (!status) {
+      unlink(pArchive);
+    }
+  }
+  
+  /* Remove the files that were packed, and report the others */
+  if (status) {
+    for(f = 0; f < batch.nfile; f++) {
+      pf = &((batch.pFiles)[f]);
+      if (pf->failed) {
+        nfail++;
+      } else if (unlink(pf->pIn)) {
+        fprintf(stderr, "%s: Failed to remove '%s'!\n", pModule, pf->pIn);
+      }
+    }
+    if (nfail > 0) {
+      status = 0;
+      fprintf(stderr, "%s: %ld of %ld files failed:\n",
+              pModule, (long) nfail, (long) batch.nfile);
+      for(f = 0; f < batch.nfile; f++) {
+        if ((batch.pFiles)[f].failed) {
+          fprintf(stderr, "  %s\n", (batch.pFiles)[f].pIn);
+        }
+      }
+    }
+  }
+  if (m_stats) {
+    out.rs.finish_sec += nowSec() - t0;
+    statsAdd(&(out.rs));
+  }
+  
+  /* Release everything */
+  if (out.pc != NULL) {
+    warp64_final(out.pc, NULL);
+    out.pc = NULL;
+  }
+  free(out.pBuf);
+  out.pBuf = NULL;
+  packRelease(&idx);
+  for(f = 0; f < batch.nfile; f++) {
+    free((batch.pFiles)[f].pIn);
+    free((batch.pFiles)[f].pOut);
+  }
+  free(batch.pFiles);
+  batch.pFiles = NULL;
+  
+  return status;
+}
+
+/*
+ * Read the index of a pack.
+ * 
+ * The trailer is checked against the key first, so that a wrong key is
+ * reported as such rather than as a damaged index.  The footer and the
+ * index are then descrambled at their offsets and checked.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the archive, open for reading
+ * 
+ *   pArchive - the path of the archive
+ * 
+ *   key - the normalized scrambling key
+ * 
+ *   pc - a descrambling context for the key
+ * 
+ *   px - receives the index, which must be empty, and must be released
+ *   with packRelease() whether or not this succeeds
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int packOpen(
+          int          fd,
+    const char       * pArchive,
+          int32_t      key,
+    const WARP64_CTX * pc,
+          PACK_INDEX * px) {
+  
+  int status = 1;
+  int damaged = 0;
+  int64_t clen = 0;
+  uint64_t ioff = 0;
+  uint64_t ilen = 0;
+  uint64_t count = 0;
+  uint64_t off = 0;
+  uint64_t len = 0;
+  uint64_t nlen = 0;
+  uint64_t m = 0;
+  size_t pos = 0;
+  uint8_t *pIndex = NULL;
+  
+  struct stat st;
+  uint8_t footer[PACK_FOOTER];
+  char name[PACK_NAME_MAX + 1];
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  memset(footer, 0, PACK_FOOTER);
+  memset(name, 0, PACK_NAME_MAX + 1);
+  
+  /* Check parameters */
+  if ((fd < 0) || (pArchive == NULL) || (pc == NULL) || (px == NULL)) {
+    abort();
+  }
+  
+  /* Get the length of the plaintext and check the key */
+  if (fstat(fd, &st)) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to stat '%s'\n", pModule, pArchive);
+  }
+  if (status && (!(S_ISREG(st.st_mode)))) {
+    status = 0;
+    fprintf(stderr, "%s: '%s' is not a regular file\n",
+            pModule, pArchive);
+  }
+  if (status && (st.st_size < (off_t) (PACK_FOOTER + WARP64_TRAILER))) {
+    status = 0;
+    fprintf(stderr, "%s: '%s' is not a pack!\n", pModule, pArchive);
+  }
+  if (status) {
+    clen = (int64_t) st.st_size - WARP64_TRAILER;
+    if (!verifyTrailer(fd, pArchive, key, clen)) {
+      status = 0;
+    }
+  }
+  
+  /* Read and check the footer */
+  if (status) {
+    clen -= PACK_FOOTER;
+    if (!readFully(fd, footer, PACK_FOOTER, clen)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s'!\n", pModule, pArchive);
+    }
+  }
+  if (status) {
+    warp64_update_at(pc, clen, footer, footer, PACK_FOOTER);
+    if (memcmp(footer, PACK_MAGIC, 8) != 0) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' is not a pack!\n", pModule, pArchive);
+    }
+  }
+  if (status) {
+    ioff = unpackU64(&(footer[8]));
+    ilen = unpackU64(&(footer[16]));
+    count = unpackU64(&(footer[24]));
+    if ((ioff > (uint64_t) clen) || (ilen != ((uint64_t) clen) - ioff) ||
+        (count > ilen / PACK_ENTRY) || (ilen >= (uint64_t) SIZE_MAX)) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' has a damaged pack footer!\n",
+              pModule, pArchive);
+    }
+  }
+  
+  /* Read and check the index */
+  if (status) {
+    pIndex = (uint8_t *) malloc(((size_t) ilen) + 1);
+    if (pIndex == NULL) {
+      abort();
+    }
+    if (!readFully(fd, pIndex, (size_t) ilen, (int64_t) ioff)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s'!\n", pModule, pArchive);
+    }
+  }
+  if (status) {
+    warp64_update_at(pc, (int64_t) ioff, pIndex, pIndex, (size_t) ilen);
+    if (fnv64(pIndex, (size_t) ilen) != unpackU64(&(footer[32]))) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' has a damaged pack index!\n",
+              pModule, pArchive);
     }
+  }
   
-    /* If we got line break, leave the loop */
-    if (status && (c == '\n')) {
+  /* Parse the entries; the hash already matched, so anything out of
+   * place means the pack was made wrongly, but it is still refused
+   * rather than trusted; that includes names that packName() would not
+   * have stored as they are, since they could reach outside the
+   * directory they are extracted to */
+  px->ioff = (int64_t) ioff;
+  for(m = 0; status && (m < count); m++) {
+    damaged = 1;
+    if (((size_t) ilen) - pos < PACK_ENTRY) {
+      status = 0;
+      break;
+    }
+    off = unpackU64(&(pIndex[pos]));
+    len = unpackU64(&(pIndex[pos + 8]));
+    nlen = unpackU64(&(pIndex[pos + 16]));
+    if ((off > ioff) || (len > ioff - off) ||
+        (pIndex[pos + 24] != (uint8_t) (off % 3)) ||
+        (nlen < 1) || (nlen > PACK_NAME_MAX) ||
+        (nlen > ((size_t) ilen) - pos - PACK_ENTRY)) {
+      status = 0;
       break;
     }
+    memcpy(name, &(pIndex[pos + PACK_ENTRY]), (size_t) nlen);
+    name[nlen] = 0;
+    if ((strlen(name) != (size_t) nlen) || (packName(name) != name)) {
+      status = 0;
+      break;
+    }
+    packAdd(px, name, (int64_t) off, (int64_t) len);
+    pos += PACK_ENTRY + (size_t) nlen;
+    damaged = 0;
+  }
+  if (status && (pos != (size_t) ilen)) {
+    status = 0;
+    damaged = 1;
+  }
+  if (damaged) {
+    fprintf(stderr, "%s: '%s' has a damaged pack index!\n",
+            pModule, pArchive);
+  }
   
-    /* If we exceeded the buffer, silently set characters read to -1 */
-    if (status && (chars_read >= MAX_KEY_LENGTH)) {
-      chars_read = -1;
+  free(pIndex);
+  pIndex = NULL;
+  
+  return status;
+}
+
+/*
+ * Create the missing parent directories of a member name and open the
+ * directory the member goes in.
+ * 
+ * Each directory is opened below the one before it, starting from the
+ * current directory, and never through a symbolic link, so that a link
+ * that is already there can't redirect the member elsewhere.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pName - the name of the member
+ * 
+ *   ppLeaf - receives the last component of the name, which points
+ *   into pName
+ * 
+ * Return:
+ * 
+ *   the directory, which must be closed, or -1 if error
+ */
+static int packMakeDirs(const char *pName, const char **ppLeaf) {
+  int status = 1;
+  int dfd = -1;
+  int nfd = -1;
+  char *pDir = NULL;
+  char *pc = NULL;
+  char *p = NULL;
+  
+  /* Check parameters */
+  if ((pName == NULL) || (ppLeaf == NULL)) {
+    abort();
+  }
+  
+  pDir = (char *) malloc(strlen(pName) + 1);
+  if (pDir == NULL) {
+    abort();
+  }
+  strcpy(pDir, pName);
+  
+  dfd = open(".", O_RDONLY | O_DIRECTORY);
+  if (dfd < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to open the current directory\n",
+            pModule);
+  }
+  
+  /* Create and open each parent in turn, from the top down */
+  pc = pDir;
+  p = strchr(pc, '/');
+  while (status && (p != NULL)) {
+    *p = 0;
+    if (mkdirat(dfd, pc, S_IRWXU | S_IRWXG | S_IRWXO) &&
+        (errno != EEXIST)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create directory '%s'\n",
+              pModule, pDir);
+    }
+    if (status) {
+      nfd = openat(dfd, pc, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+      if (nfd < 0) {
+        status = 0;
+        fprintf(stderr, "%s: '%s' is not a directory!\n",
+                pModule, pDir);
+      }
+    }
+    if (status) {
+      close(dfd);
+      dfd = nfd;
+      nfd = -1;
+    }
+    *p = '/';
+    pc = p + 1;
+    p = strchr(pc, '/');
+  }
+  
+  if (status) {
+    *ppLeaf = pName + (pc - pDir);
+  }
+  if ((!status) && (dfd >= 0)) {
+    close(dfd);
+    dfd = -1;
+  }
+  
+  free(pDir);
+  pDir = NULL;
+  
+  return dfd;
+}
+
+/*
+ * Extract one member of a pack to a file of the same name.
+ * 
+ * The file must not exist yet.  Only the member data is read from the
+ * archive, a block at a time, and descrambled at its offset in the
+ * archive.  If anything fails, the partial file is removed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   fd - the archive, open for reading
+ * 
+ *   pc - a descrambling context for the key
+ * 
+ *   pm - the member
+ * 
+ *   pBuf - a buffer of PACK_BLOCK bytes
+ * 
+ *   prs - the statistics to add to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int packExtract(
+          int           fd,
+    const WARP64_CTX  * pc,
+    const PACK_MEMBER * pm,
+          uint8_t     * pBuf,
+          RUN_STATS   * prs) {
+  
+  int status = 1;
+  int dfd = -1;
+  int fOut = -1;
+  int64_t done = 0;
+  size_t n = 0;
+  double t0 = 0.0;
+  double t1 = 0.0;
+  const char *pLeaf = NULL;
+  
+  /* Check parameters */
+  if ((fd < 0) || (pc == NULL) || (pm == NULL) ||
+      (pBuf == NULL) || (prs == NULL)) {
+    abort();
+  }
+  
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  
+  /* Create the file; names were checked when the index was read, and
+   * the directory it goes in was reached without following links */
+  dfd = packMakeDirs(pm->pName, &pLeaf);
+  if (dfd < 0) {
+    status = 0;
+  }
+  if (status) {
+    fOut = openat(dfd, pLeaf, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fOut < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pm->pName);
+    }
+  }
+  
+  if (m_stats) {
+    prs->setup_sec += nowSec() - t0;
+  }
+  
+  /* Copy the member a block at a time */
+  while (status && (done < pm->len)) {
+    n = (size_t) PACK_BLOCK;
+    if ((int64_t) n > pm->len - done) {
+      n = (size_t) (pm->len - done);
     }
     
-    /* If current character is nul or greater than 128, set it to 128
-     * (which is also an invalid character) */
-    if (status && ((c < 0) || (c > 128))) {
-      c = 128;
+    if (m_stats) {
+      t0 = nowSec();
+    }
+    if (!readFully(fd, pBuf, n, pm->off + done)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s' from the pack!\n",
+              pModule, pm->pName);
+    }
+    if (m_stats) {
+      t1 = nowSec();
+      prs->io_sec += t1 - t0;
+    }
+    if (status) {
+      warp64_update_at(pc, pm->off + done, pBuf, pBuf, n);
+      if (m_stats) {
+        t0 = nowSec();
+        prs->xform_sec += t0 - t1;
+      }
+      if (!writeSeq(fOut, pBuf, n)) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to write '%s'!\n",
+                pModule, pm->pName);
+      }
+      if (m_stats) {
+        prs->io_sec += nowSec() - t0;
+      }
+    }
+    if (status) {
+      done += (int64_t) n;
+      prs->windows++;
+      prs->bytes += (int64_t) n;
+    }
+  }
+  
+  /* Flush and close the file, removing it on failure */
+  if (m_stats) {
+    t0 = nowSec();
+  }
+  if (status && (m_sync != SYNC_NONE)) {
+    if (fdatasync(fOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to flush '%s'!\n", pModule, pm->pName);
+    }
+  }
+  if (fOut >= 0) {
+    if (close(fOut) && status) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to close '%s'!\n", pModule, pm->pName);
+    }
+    fOut = -1;
+    if (!status) {
+      unlinkat(dfd, pLeaf, 0);
+    }
+  }
+  if (dfd >= 0) {
+    close(dfd);
+    dfd = -1;
+  }
+  if (m_stats) {
+    prs->finish_sec += nowSec() - t0;
+  }
+  if (status) {
+    prs->files++;
+  }
+  
+  return status;
+}
+
+/*
+ * Extract or list the members of a pack.
+ * 
+ * Each name selects the member of that name, or every member below it
+ * if it names a directory; with no names, every member is selected.
+ * Only the footer, the index and the selected members are read.  The
+ * members are extracted below the current directory, in the order they
+ * were packed, and each must not exist yet.  A failing member does not
+ * stop the others; the failed members are listed at the end.  Once
+ * every member has been extracted and flushed, the archive is removed,
+ * but only when no names were given, since otherwise members are left
+ * in it.
+ * 
+ * When listing, nothing is extracted and a line is printed to standard
+ * output for each member, which is its length followed by a space and
+ * its name.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   ppName - the member names given on the command line
+ * 
+ *   nname - the number of names
+ * 
+ *   pArchive - the path of the archive
+ * 
+ *   list - non-zero to list the members instead of extracting them
+ * 
+ *   pKey - the scrambling key
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int warp64Unpack(
+          char ** ppName,
+          int     nname,
+    const char  * pArchive,
+          int     list,
+    const char  * pKey) {
+  
+  int status = 1;
+  int fd = -1;
+  int i = 0;
+  int found = 0;
+  int32_t key = 0;
+  int64_t m = 0;
+  int64_t nwant = 0;
+  int64_t nfail = 0;
+  size_t nlen = 0;
+  size_t dlen = 0;
+  size_t plen = 0;
+  const char *pName = NULL;
+  const char *pPrev = NULL;
+  WARP64_CTX *pc = NULL;
+  uint8_t *pBuf = NULL;
+  
+  PACK_INDEX idx;
+  PACK_MEMBER *pm = NULL;
+  RUN_STATS rs;
+  
+  /* Initialize structures */
+  memset(&idx, 0, sizeof(PACK_INDEX));
+  memset(&rs, 0, sizeof(RUN_STATS));
+  
+  /* Check parameters */
+  if (((ppName == NULL) && (nname > 0)) || (nname < 0) ||
+      (pArchive == NULL) || (pKey == NULL)) {
+    abort();
+  }
+  
+  /* Derive the normalized key */
+  key = deriveKey(pKey);
+  if (key < 0) {
+    status = 0;
+  }
+  
+  /* Open the archive and read its index */
+  if (status) {
+    fd = open(pArchive, O_RDONLY);
+    if (fd < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pArchive);
+    }
+  }
+  if (status) {
+    pc = warp64_init(key, WARP64_DESCRAMBLE);
+    if (pc == NULL) {
+      abort();
+    }
+    if (!packOpen(fd, pArchive, key, pc, &idx)) {
+      status = 0;
+    }
+  }
+  
+  /* List the members if that is all that was asked */
+  if (status && list) {
+    for(m = 0; m < idx.count; m++) {
+      printf("%ld %s\n", (long) (idx.pm)[m].len, (idx.pm)[m].pName);
+    }
+    if (fflush(stdout)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write results!\n", pModule);
+    }
+  }
+  
+  /* Select the members */
+  for(i = 0; status && (!list) && (i < nname); i++) {
+    pName = packName(ppName[i]);
+    if (pName == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' can't be a member name!\n",
+              pModule, ppName[i]);
+      break;
+    }
+    nlen = strlen(pName);
+    found = 0;
+    for(m = 0; m < idx.count; m++) {
+      pm = &((idx.pm)[m]);
+      if ((strncmp(pm->pName, pName, nlen) == 0) &&
+          ((pm->pName[nlen] == 0) || (pm->pName[nlen] == '/'))) {
+        pm->wanted = 1;
+        found = 1;
+      }
+    }
+    if (!found) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' is not in '%s'!\n",
+              pModule, pName, pArchive);
+    }
+  }
+  if (status && (!list) && (nname < 1)) {
+    for(m = 0; m < idx.count; m++) {
+      (idx.pm)[m].wanted = 1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+  
+  /* Extract them; members of a directory are packed together, so each
+   * directory is flushed once, when the members move on from it */
+  if (status && (!list)) {
+    pBuf = (uint8_t *) malloc((size_t) PACK_BLOCK);
+    if (pBuf == NULL) {
+      abort();
+    }
+  }
+  for(m = 0; status && (!list) && (m < idx.count); m++) {
+    pm = &((idx.pm)[m]);
+    if (!(pm->wanted)) {
+      continue;
+    }
+    nwant++;
+    if (!packExtract(fd, pc, pm, pBuf, &rs)) {
+      pm->failed = 1;
+      nfail++;
+      continue;
     }
     
-    /* Provided that buffer hasn't overflown, add current character to
-     * buffer and increment chars_read */
-    if (status && (chars_read >= 0)) {
-      (kb->kbuf)[chars_read] = (char) c;
-      chars_read++;
+    dlen = strlen(pm->pName);
+    while ((dlen > 0) && (pm->pName[dlen - 1] != '/')) {
+      dlen--;
+    }
+    if ((pPrev != NULL) && (m_sync != SYNC_NONE) &&
+        ((dlen != plen) || (strncmp(pPrev, pm->pName, dlen) != 0))) {
+      if (!syncDir(pPrev)) {
+        status = 0;
+      }
+    }
+    pPrev = pm->pName;
+    plen = dlen;
+  }
+  if (status && (pPrev != NULL) && (m_sync != SYNC_NONE)) {
+    if (!syncDir(pPrev)) {
+      status = 0;
+    }
+  }
+  
+  /* Report the failures, or remove the archive once it has all been
+   * extracted */
+  if (status && (nfail > 0)) {
+    status = 0;
+    fprintf(stderr, "%s: %ld of %ld members failed:\n",
+            pModule, (long) nfail, (long) nwant);
+    for(m = 0; m < idx.count; m++) {
+      if ((idx.pm)[m].failed) {
+        fprintf(stderr, "  %s\n", (idx.pm)[m].pName);
+      }
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  if (status && (!list) && (nname < 1)) {
+    if (unlink(pArchive)) {
+      fprintf(stderr, "%s: Failed to remove '%s'!\n", pModule, pArchive);
+    }
+  }
+  if (m_stats) {
+    statsAdd(&rs);
+  }
+  
+  /* Release everything */
+  if (pc != NULL) {
+    warp64_final(pc, NULL);
+    pc = NULL;
+  }
+  free(pBuf);
+  pBuf = NULL;
+  packRelease(&idx);
+  
+  return status;
+}
+
+/*
+ * Sinks
+ * =====
+ */
+
+/*
+ * Connect a TCP socket to a host and port.
+ * 
+ * Every address the name resolves to is tried in turn.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pHost - the host name or address
+ * 
+ *   pPort - the port number or service name
+ * 
+ * Return:
+ * 
+ *   the connected socket, or -1 if error
+ */
+static int sinkConnect(const char *pHost, const char *pPort) {
+  int sock = -1;
+  int rv = 0;
+  struct addrinfo hints;
+  struct addrinfo *pList = NULL;
+  struct addrinfo *pa = NULL;
+  
+  memset(&hints, 0, sizeof(struct addrinfo));
+  
+  /* Check parameters */
+  if ((pHost == NULL) || (pPort == NULL)) {
+    abort();
+  }
+  
+  /* Resolve the name */
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  rv = getaddrinfo(pHost, pPort, &hints, &pList);
+  if (rv != 0) {
+    fprintf(stderr, "%s: Failed to resolve '%s': %s\n",
+            pModule, pHost, gai_strerror(rv));
+    return -1;
+  }
+  
+  /* Connect to the first address that accepts */
+  for(pa = pList; pa != NULL; pa = pa->ai_next) {
+    sock = socket(pa->ai_family, pa->ai_socktype, pa->ai_protocol);
+    if (sock < 0) {
+      continue;
+    }
+    if (connect(sock, pa->ai_addr, pa->ai_addrlen) == 0) {
+      break;
     }
+    close(sock);
+    sock = -1;
   }
+  freeaddrinfo(pList);
+  pList = NULL;
   
-  /* If we didn't read any characters or we read too many, then report
-   * errors */
-  if (status && (chars_read == 0)) {
-    status = 0;
-    fprintf(stderr, "%s: Key may not be empty!\n", pModule);
-    
-  } else if (status && (chars_read < 0)) {
-    status = 0;
-    fprintf(stderr, "%s: Key may have at most %d characters!\n",
-                pModule, MAX_KEY_LENGTH);
+  if (sock < 0) {
+    fprintf(stderr, "%s: Failed to connect to '%s' port %s!\n",
+            pModule, pHost, pPort);
   }
+  return sock;
+}
+
+/*
+ * Sender thread function of an HTTP sink.
+ * 
+ * Everything read from the pipe is sent as one chunk of the request
+ * body, with the chunk header placed right before the data and the
+ * chunk end right after it, so that each chunk takes a single write.
+ * At end of input, the last chunk is sent and the status line of the
+ * response is read.  If sending fails, the pipe is closed, so that the
+ * stream writing into it fails too instead of blocking.
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to the SINK
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *sinkSender(void *pArg) {
+  SINK *ps = NULL;
+  int failed = 0;
+  int code = 0;
+  size_t hl = 0;
+  size_t got = 0;
+  ssize_t rv = 0;
+  uint8_t *pBuf = NULL;
+  char head[32];
+  char resp[256];
   
-  /* Check that each character is a base-64 character */
-  if (status) {
-    for(i = 0; i < chars_read; i++) {
-      if (decode64((kb->kbuf)[i]) < 0) {
-        status = 0;
-        fprintf(stderr, "%s: Key may only include A-Z a-z 0-9 + /\n",
-                  pModule);
-        break;
+  memset(head, 0, sizeof(head));
+  memset(resp, 0, sizeof(resp));
+  
+  if (pArg == NULL) {
+    abort();
+  }
+  ps = (SINK *) pArg;
+  
+  /* The buffer has room for a chunk header in front of the data and the
+   * chunk end after it */
+  pBuf = (uint8_t *) malloc(sizeof(head) + STREAM_CHUNK + 2);
+  if (pBuf == NULL) {
+    abort();
+  }
+  
+  /* Send each piece of output as a chunk */
+  while (!failed) {
+    rv = read(ps->fPipe, pBuf + sizeof(head), STREAM_CHUNK);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      failed = 1;
+      break;
+    } else if (rv == 0) {
+      break;
+    }
+    sprintf(head, "%lx\r\n", (unsigned long) rv);
+    hl = strlen(head);
+    memcpy(pBuf + sizeof(head) - hl, head, hl);
+    memcpy(pBuf + sizeof(head) + rv, "\r\n", 2);
+    if (!writeSeq(ps->sock, pBuf + sizeof(head) - hl,
+                  hl + (size_t) rv + 2)) {
+      failed = 1;
     }
   }
   
-  /* If console input attributes were changed, change them back */
-  if (console_changed) {
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &old_attr)) {
-      status = 0;
-      fprintf(stderr, "%s: Failed to reset console input attributes!\n",
-              pModule);
+  /* End the body and read the status line of the response */
+  if (!failed) {
+    if (!writeSeq(ps->sock, (const uint8_t *) "0\r\n\r\n", 5)) {
+      failed = 1;
+    }
+  }
+  while ((!failed) && (got < sizeof(resp) - 1) &&
+          (strstr(resp, "\r\n") == NULL)) {
+    rv = read(ps->sock, resp + got, sizeof(resp) - 1 - got);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      failed = 1;
+    } else if (rv == 0) {
+      break;
     } else {
-      console_changed = 0;
+      got += (size_t) rv;
+    }
+  }
+  if (!failed) {
+    if (sscanf(resp, "HTTP/%*d.%*d %d", &code) != 1) {
+      code = 0;
     }
   }
   
-  /* If failure, reset return buffer */
-  if (!status) {
-    memset(kb, 0, sizeof(KEY_BUFFER));
+  /* Stop taking output if sending failed */
+  if (failed) {
+    close(ps->fPipe);
+    ps->fPipe = -1;
   }
   
-  /* Return status */
-  return status;
+  ps->failed = failed;
+  ps->code = code;
+  
+  free(pBuf);
+  pBuf = NULL;
+  return NULL;
 }
 
 /*
- * Given a scrambling key of one or more base-64 characters, derive the
- * normalized scrambling key and return it.
+ * Open a sink for a URL given with --sink.
  * 
- * The three octets of the normalized scrambling key are stored in the
- * 24 least significant bits of the returned integer value, with the
- * third octet being the least significant eight bits of the integer
- * value.
+ * tcp://host:port connects to the port and sends the output over the
+ * connection as it is.  http://host[:port][/path] connects to the host,
+ * port 80 by default, and starts a PUT request for the path with a
+ * chunked body, which a sender thread fills with what is written to the
+ * sink.  IPv6 addresses go in brackets.  There is no TLS, so HTTPS has
+ * to go through a local proxy.
  * 
- * Error messages are printed if necessary.
+ * If this function succeeds, sinkClose() must be called on the sink
+ * afterwards.  If it fails, everything has already been released.
+ * 
+ * Error messages are printed.
  * 
  * Parameters:
  * 
- *   pKey - the base-64 characters for the key
+ *   ps - the sink to open
+ * 
+ *   pUrl - the URL
  * 
  * Return:
  * 
- *   the normalized key octets, or -1 if error
+ *   non-zero if successful, zero if error
  */
-static int32_t deriveKey(const char *pKey) {
+static int sinkOpen(SINK *ps, const char *pUrl) {
   int status = 1;
-  size_t slen = 0;
-  int32_t mixed = 0;
-  int32_t acc = 0;
-  int d = 0;
-  int i = 0;
-  char ext[3];
-  char b64[4];
-  uint8_t cbc[3];
+  int fds[2];
+  size_t hl = 0;
+  const char *pRest = NULL;
+  const char *pHostEnd = NULL;
+  const char *pPath = "/";
+  const char *pPort = NULL;
+  char host[SINK_URL_MAX];
+  char port[SINK_URL_MAX];
+  char *pReq = NULL;
   
-  /* Initialize arrays */
-  memset(ext, 0, 3);
-  memset(b64, 0, 4);
-  memset(cbc, 0, 3);
+  memset(host, 0, sizeof(host));
+  memset(port, 0, sizeof(port));
+  fds[0] = -1;
+  fds[1] = -1;
   
-  /* Check parameter */
-  if (pKey == NULL) {
+  /* Check parameters */
+  if ((ps == NULL) || (pUrl == NULL)) {
     abort();
   }
   
-  /* Determine length of original key string, excluding terminating
-   * nul */
-  slen = strlen(pKey);
+  memset(ps, 0, sizeof(SINK));
+  ps->pUrl = pUrl;
+  ps->sock = -1;
+  ps->fd = -1;
+  ps->fPipe = -1;
   
-  /* Fail if empty string */
-  if (slen < 1) {
+  /* Get the kind of sink */
+  if (strlen(pUrl) >= SINK_URL_MAX) {
+    status = 0;
+    fprintf(stderr, "%s: Sink URL is too long!\n", pModule);
+  } else if (strncmp(pUrl, "tcp://", 6) == 0) {
+    ps->kind = SINK_TCP;
+    pRest = pUrl + 6;
+  } else if (strncmp(pUrl, "http://", 7) == 0) {
+    ps->kind = SINK_HTTP;
+    pRest = pUrl + 7;
+    pPort = "80";
+  } else {
     status = 0;
-    fprintf(stderr, "%s: Scrambling key may not be empty!\n", pModule);
+    fprintf(stderr, "%s: Sink must be a tcp:// or http:// URL!\n",
+            pModule);
   }
   
-  /* Determine the three extension characters that will be used if
-   * padding is necessary */
+  /* Split off the host, which may be a bracketed IPv6 address, then the
+   * port and the path */
   if (status) {
-    if (slen == 1) {
-      ext[0] = pKey[0];
-      ext[1] = pKey[0];
-      ext[2] = pKey[0];
-    
-    } else if (slen == 2) {
-      ext[0] = pKey[0];
-      ext[1] = pKey[1];
-      ext[2] = pKey[0];
-      
-    } else if (slen >= 3) {
-      ext[0] = pKey[0];
-      ext[1] = pKey[1];
-      ext[2] = pKey[2];
-      
+    if (pRest[0] == '[') {
+      pHostEnd = strchr(pRest, ']');
+      if (pHostEnd != NULL) {
+        memcpy(host, pRest + 1, (size_t) (pHostEnd - pRest - 1));
+        pHostEnd++;
+      }
     } else {
-      abort();
+      pHostEnd = pRest + strcspn(pRest, ":/");
+      memcpy(host, pRest, (size_t) (pHostEnd - pRest));
+    }
+    if ((pHostEnd == NULL) || (host[0] == 0)) {
+      status = 0;
+    }
+  }
+  if (status && (pHostEnd[0] == ':')) {
+    hl = strcspn(pHostEnd + 1, "/");
+    memcpy(port, pHostEnd + 1, hl);
+    pPort = port;
+    if (hl < 1) {
+      status = 0;
     }
+    pHostEnd = pHostEnd + 1 + hl;
+  }
+  if (status && (pHostEnd[0] == '/')) {
+    pPath = pHostEnd;
+  } else if (status && (pHostEnd[0] != 0)) {
+    status = 0;
+  }
+  if (status && ((pPort == NULL) ||
+                  ((ps->kind == SINK_TCP) && (pHostEnd[0] != 0)))) {
+    status = 0;
+  }
+  if ((!status) && (ps->kind != 0)) {
+    fprintf(stderr, "%s: Can't parse sink URL '%s'!\n", pModule, pUrl);
   }
   
-  /* Keep updating the result until we have processed all of the key */
+  /* Connect */
   if (status) {
-    mixed = 0;
-    while (slen > 0) {
-      /* Fill b64 buffer with four base-64 characters and update slen as
-       * well as pKey, using extension characters if necessary */
-      if (slen == 1) {
-        /* We have one more character, so use that and three
-         * extensions */
-        b64[0] = pKey[0];
-        b64[1] = ext[0];
-        b64[2] = ext[1];
-        b64[3] = ext[2];
-        slen--;
-        pKey++;
-        
-      } else if (slen == 2) {
-        /* We have two more characters, so use those and two
-         * extensions */
-        memcpy(b64, pKey, 2);
-        b64[2] = ext[0];
-        b64[3] = ext[1];
-        slen -= 2;
-        pKey += 2;
-        
-      } else if (slen == 3) {
-        /* We have three more characters, so use those and one
-         * extension */
-        memcpy(b64, pKey, 3);
-        b64[3] = ext[0];
-        slen -= 3;
-        pKey += 3;
-        
-      } else if (slen >= 4) {
-        /* We have at least four more characters, so just use those */
-        memcpy(b64, pKey, 4);
-        slen -= 4;
-        pKey += 4;
-        
-      } else {
-        abort();
-      }
-      
-      /* Decode the four base-64 characters into a packed integer */
-      acc = 0;
-      for(i = 0; i < 4; i++) {
-        d = decode64(b64[i]);
-        if (d < 0) {
-          status = 0;
-          fprintf(stderr, "%s: Scrambling key has bad characters!\n",
-                  pModule);
-          break;
-        }
-        acc = (acc << 6) | ((int32_t) d);
-      }
-      if (!status) {
-        break;
-      }
-      
-      /* XOR in the new segment into the mixed key */
-      mixed = mixed ^ acc;
+    ps->sock = sinkConnect(host, pPort);
+    if (ps->sock < 0) {
+      status = 0;
     }
   }
   
-  /* Unpack the mixed key into the cbc buffer */
-  if (status) {
-    cbc[0] = (uint8_t) ((mixed >> 16) & 0xff);
-    cbc[1] = (uint8_t) ((mixed >>  8) & 0xff);
-    cbc[2] = (uint8_t) ( mixed        & 0xff);
+  /* A TCP sink is written directly */
+  if (status && (ps->kind == SINK_TCP)) {
+    ps->fd = ps->sock;
   }
   
-  /* Perform replacements to make sure no zero components */
-  if (status) {
-    if (cbc[0] == 0) {
-      cbc[0] = (uint8_t) 1;
-    }
-    if (cbc[1] == 0) {
-      cbc[1] = (uint8_t) 2;
+  /* Send the head of an HTTP request, naming the host as given in the
+   * URL */
+  if (status && (ps->kind == SINK_HTTP)) {
+    hl = strlen(pUrl) + 256;
+    pReq = (char *) malloc(hl);
+    if (pReq == NULL) {
+      abort();
     }
-    if (cbc[2] == 0) {
-      cbc[2] = (uint8_t) 4;
+    snprintf(pReq, hl,
+              "PUT %s HTTP/1.1\r\n"
+              "Host: %.*s\r\n"
+              "Content-Type: application/octet-stream\r\n"
+              "Transfer-Encoding: chunked\r\n"
+              "Connection: close\r\n"
+              "\r\n",
+              pPath, (int) (pHostEnd - (pUrl + 7)), pUrl + 7);
+    if (!writeSeq(ps->sock, (const uint8_t *) pReq, strlen(pReq))) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to send to '%s'!\n", pModule, pUrl);
     }
+    free(pReq);
+    pReq = NULL;
   }
   
-  /* Repack the mixed key with replacements */
-  if (status) {
-    mixed =   (((int32_t) cbc[0]) << 16)
-            + (((int32_t) cbc[1]) <<  8)
-            + ( (int32_t) cbc[2]       );
+  /* Start the sender of an HTTP sink on a pipe, as large as the system
+   * allows up to a stream chunk, so that a chunk of output goes into it
+   * in one write */
+  if (status && (ps->kind == SINK_HTTP)) {
+    if (pipe(fds)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create pipe!\n", pModule);
+    }
+  }
+  if (status && (ps->kind == SINK_HTTP)) {
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+    fcntl(fds[1], F_SETPIPE_SZ, (int) STREAM_CHUNK);
+#endif
+    ps->fPipe = fds[0];
+    ps->fd = fds[1];
+    if (pthread_create(&(ps->sender), NULL, &sinkSender, ps)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to start sender thread!\n", pModule);
+    } else {
+      ps->started = 1;
+    }
   }
   
-  /* If failure, set result to -1 */
+  /* Release everything on failure */
   if (!status) {
-    mixed = -1;
+    if (ps->fPipe >= 0) {
+      close(ps->fPipe);
+      ps->fPipe = -1;
+    }
+    if ((ps->fd >= 0) && (ps->fd != ps->sock)) {
+      close(ps->fd);
+    }
+    ps->fd = -1;
+    if (ps->sock >= 0) {
+      close(ps->sock);
+      ps->sock = -1;
+    }
   }
   
-  /* Return result */
-  return mixed;
+  return status;
 }
 
 /*
- * Use memory-mapping to perform Warp64 scrambling or descrambling.
- * 
- * fIn and fOut are the file descriptors for the input file and the
- * output file, respectively.
- * 
- * key contains the scrambling or descrambling key in the 24 least
- * significant bits.  If you are scrambling, this should be equal to the
- * normalized scrambling key.  If you are descrambling, each component
- * byte should be adjusted to invert the scrambling process.
+ * Finish and close a sink opened with sinkOpen().
  * 
- * trailer is non-zero if the input should be treated as if it had three
- * octets of zero value suffixed to it.  This should be set during
- * scrambling so that the trailer gets written.
- * 
- * olen is the length in bytes of the output file.  For scrambling, this
- * includes the three trailer bytes.  olen must be greater than zero.
- * If trailer is non-zero, olen must be at least three.
+ * A TCP sink shuts down its side of the connection, so the other end
+ * sees the end of the output.  TCP doesn't confirm that the other end
+ * kept anything, so success only means the output was handed to the
+ * connection.  An HTTP sink ends the request and succeeds if the
+ * response has a 2xx status.  If ok is zero, the output is incomplete,
+ * so the connection is reset instead of being ended, and the other end
+ * sees a broken stream or request rather than a short one.
  * 
  * Error messages are printed.
  * 
  * Parameters:
  * 
- *   fIn - the input file descriptor
- * 
- *   fOut - the output file descriptor
- * 
- *   key - the (de)scrambling key
- * 
- *   trailer - non-zero for three extra zero octets after input
+ *   ps - the sink
  * 
- *   olen - the length of output in bytes
+ *   ok - non-zero if all the output was written
  * 
  * Return:
  * 
- *   non-zero if successful, zero if error
+ *   non-zero if the sink took all the output, zero if error
  */
-static int process64(
-    int     fIn,
-    int     fOut,
-    int32_t key,
-    int     trailer,
-    int64_t olen) {
-  
-  int status = 1;
-  int32_t i = 0;
-  int32_t j = 0;
-  int k = 0;
-  
-  int64_t base = 0;
-  int64_t remc = 0;
-  int64_t remi = 0;
-  
-  int32_t ws = 0;
-  int32_t wsi = 0;
-  
-  uint8_t kb[3];
-  uint8_t *pd[3];
-  uint8_t *pwo = NULL;
-  uint8_t *pwi = NULL;
-  
-  /* Initialize arrays */
-  memset(kb, 0, 3);
+static int sinkClose(SINK *ps, int ok) {
+  struct linger lg;
   
-  memset(pd, 0, sizeof(uint8_t *) * 3);
-  pd[0] = NULL;
-  pd[1] = NULL;
-  pd[2] = NULL;
+  memset(&lg, 0, sizeof(struct linger));
   
   /* Check parameters */
-  if ((fIn < 0) || (fOut < 0) || (olen < 1)) {
+  if (ps == NULL) {
     abort();
   }
-  if (trailer && (olen < 3)) {
+  if ((ps->sock < 0) || (ps->fd < 0)) {
     abort();
   }
   
-  /* Unpack key into buffer */
-  kb[0] = (uint8_t) ((key >> 16) & 0xff);
-  kb[1] = (uint8_t) ((key >>  8) & 0xff);
-  kb[2] = (uint8_t) ( key        & 0xff);
+  /* Closing a failed sink resets the connection, and the sender of an
+   * HTTP sink fails before it can end the body */
+  if (!ok) {
+    lg.l_onoff = 1;
+    lg.l_linger = 0;
+    setsockopt(ps->sock, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    if (ps->started) {
+      shutdown(ps->sock, SHUT_RDWR);
+    }
+  }
   
-  /* Allocate and initialize the key dictionaries */
-  for(i = 0; i < 3; i++) {
-    /* Allocate key dictionary */
-    pd[i] = (uint8_t *) calloc(256, 1);
-    if (pd[i] == NULL) {
+  /* End the output; the sender of an HTTP sink then ends the request
+   * and reads the response */
+  if (ps->kind == SINK_TCP) {
+    if (ok && shutdown(ps->sock, SHUT_WR)) {
+      ok = 0;
+      fprintf(stderr, "%s: Failed to send to '%s'!\n",
+              pModule, ps->pUrl);
+    }
+  } else {
+    close(ps->fd);
+  }
+  ps->fd = -1;
+  if (ps->started) {
+    if (pthread_join(ps->sender, NULL)) {
       abort();
     }
-    
-    /* Initialize entries according to the proper key component */
-    for(j = 0; j < 256; j++) {
-      (pd[i])[j] = (uint8_t) ((j + ((int) kb[i])) % 256);
+    ps->started = 0;
+    if (ok && ps->failed) {
+      ok = 0;
+      fprintf(stderr, "%s: Failed to send to '%s'!\n",
+              pModule, ps->pUrl);
+    } else if (ok && ((ps->code < 200) || (ps->code > 299))) {
+      ok = 0;
+      fprintf(stderr, "%s: '%s' answered with status %d!\n",
+              pModule, ps->pUrl, ps->code);
     }
   }
   
-  /* Start at offset zero in output and initialize remaining byte count
-   * to the given size of output */
-  base = 0;
-  remc = olen;
+  /* Release everything */
+  if (ps->fPipe >= 0) {
+    close(ps->fPipe);
+    ps->fPipe = -1;
+  }
+  if (close(ps->sock)) {
+    ok = 0;
+    fprintf(stderr, "%s: Failed to send to '%s'!\n", pModule, ps->pUrl);
+  }
+  ps->sock = -1;
+  
+  return ok;
+}
+
+/*
+ * Perform Warp64 scrambling or descrambling of a file or stream into a
+ * sink.
+ * 
+ * The input goes through the stream pipeline of warp64Stream() into
+ * the sink instead of an output file, so nothing is written locally:
+ * the reader thread reads ahead while a chunk is transformed, and each
+ * transformed chunk is sent while the next one is transformed.  When
+ * scrambling, the trailer is the end of what is sent.  When
+ * descrambling a file, the trailer is checked before anything is sent.
+ * The input file is kept either way.  With --crc, the CRC32C of the
+ * plaintext is printed, as when streaming.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pInputPath - path to the input file, or STREAM_PATH for standard
+ *   input
+ * 
+ *   pUrl - the URL of the sink
+ * 
+ *   descramble - non-zero if descrambling, zero if scrambling
+ * 
+ *   pKey - the scrambling key
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int warp64Sink(
+    const char * pInputPath,
+    const char * pUrl,
+          int    descramble,
+    const char * pKey) {
+  
+  int status = 1;
+  int fIn = -1;
+  int own = 0;
+  int opened = 0;
+  int32_t key = 0;
+  int64_t ilen = 0;
+  uint32_t crc = 0;
+  SINK sk;
+  
+  memset(&sk, 0, sizeof(SINK));
   
-  /* Remaining input is same as remaining output byte count, except when
-   * trailer is active, in which case remaining input is three less than
-   * remaining output */
-  remi = remc;
-  if (trailer) {
-    remi = remi - 3;
+  /* Check parameters */
+  if ((pInputPath == NULL) || (pUrl == NULL) || (pKey == NULL)) {
+    abort();
   }
   
-  /* Keep processing until we have no bytes left */
-  while (status && (remc > 0)) {
-    /* First, determine the size of the current window we are dealing
-     * with; this is the minimum of the window size and the remaining
-     * bytes */
-    ws = (int32_t) m_winsize;
-    if (remc < ws) {
-      ws = (int32_t) remc;
-    }
-    
-    /* Second, determine the size of the current input window; this is
-     * the minimum of the current output window and the remaining input
-     * count; it might be zero */
-    wsi = ws;
-    if (remi < wsi) {
-      wsi = (int32_t) remi;
-    }
-    
-    /* Map the current output window */
-    pwo = (uint8_t *) mmap(
-                        NULL,
-                        (size_t) ws,
-                        PROT_READ | PROT_WRITE,
-                        MAP_SHARED,
-                        fOut,
-                        (off_t) base);
-    if ((pwo == MAP_FAILED) || (pwo == NULL)) {
+  /* Open the input, which is standard input when streaming */
+  if (strcmp(pInputPath, STREAM_PATH) == 0) {
+    fIn = STDIN_FILENO;
+  } else {
+    fIn = open(pInputPath, O_RDONLY);
+    if (fIn < 0) {
       status = 0;
-      fprintf(stderr, "%s: Failed to map output window!\n", pModule);
+      fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pInputPath);
+    } else {
+      own = 1;
     }
-    
-    /* Map the current input window if non-empty */
-    if (status && (wsi > 0)) {
-      pwi = (uint8_t *) mmap(
-                          NULL,
-                          (size_t) wsi,
-                          PROT_READ,
-                          MAP_PRIVATE,
-                          fIn,
-                          (off_t) base);
-      if ((pwi == MAP_FAILED) || (pwi == NULL)) {
-        status = 0;
-        fprintf(stderr, "%s: Failed to map input window!\n", pModule);
-      }
+  }
+  
+  /* When descrambling a file, check the trailer before anything is
+   * sent */
+  if (status && own && descramble) {
+    key = deriveKey(pKey);
+    if (key < 0) {
+      status = 0;
     }
-    
-    /* Compute all the bytes in the current output window */
     if (status) {
-      /* Start the byte dictionary index out at the proper position for
-       * the first byte of the window */
-      k = (int) (base % 3);
-      
-      /* Compute all bytes */
-      for(i = 0; i < ws; i++) {
-    
-        /* Read the current byte value from the input window, unless i
-         * is outside the range of the current input window, in which
-         * case just use a byte value of zero (for the trailer) */
-        j = 0;
-        if (i < wsi) {
-          j = (int32_t) pwi[i];
-        }
-    
-        /* Replace current byte value in output with its value from the
-         * byte dictionary */
-        j = (int32_t) ((pd[k])[j]);
-        
-        /* Increment byte dictionary index and apply mod-3 */
-        k = ((k + 1) % 3);
-    
-        /* Write the transformed byte value to output window */
-        pwo[i] = (uint8_t) j;
-      }
-    }
-    
-    /* Unmap current input window if it was mapped */
-    if (status && (wsi > 0)) {
-      if (munmap(pwi, (size_t) wsi)) {
+      ilen = (int64_t) lseek(fIn, 0, SEEK_END);
+      if (ilen < 3) {
         status = 0;
-        fprintf(stderr, "%s: Failed to unmap input window!\n",
-                pModule);
+        fprintf(stderr, "%s: Missing trailer in '%s'!\n",
+                pModule, pInputPath);
       }
-      pwi = NULL;
     }
-    
-    /* Unmap current output window */
     if (status) {
-      if (munmap(pwo, (size_t) ws)) {
+      if (!verifyTrailer(fIn, pInputPath, key, ilen - 3)) {
         status = 0;
-        fprintf(stderr, "%s: Failed to unmap output window!\n",
-                pModule);
       }
-      pwo = NULL;
     }
-    
-    /* Update base remc and remi before going around again */
     if (status) {
-      base = base + ((int64_t) ws);
-      remc = remc - ((int64_t) ws);
-      remi = remi - ((int64_t) ws);
-      if (remi < 0) {
-        remi = 0;
+      if (lseek(fIn, 0, SEEK_SET) != 0) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to rewind '%s'!\n",
+                pModule, pInputPath);
       }
     }
   }
   
-  /* If input window is mapped, unmap it */
-  if (pwi != NULL) {
-    if (munmap(pwi, (size_t) wsi)) {
-      fprintf(stderr, "%s: Failed to unmap input window!\n", pModule);
+  /* Let writes to a closed connection fail instead of killing the
+   * program */
+  if (status) {
+    signal(SIGPIPE, SIG_IGN);
+    if (sinkOpen(&sk, pUrl)) {
+      opened = 1;
+    } else {
+      status = 0;
     }
-    pwi = NULL;
   }
   
-  /* If output window is mapped, unmap it */
-  if (pwo != NULL) {
-    if (munmap(pwo, (size_t) ws)) {
-      fprintf(stderr, "%s: Failed to unmap output window!\n", pModule);
+  /* Run the stream into the sink and finish it */
+  if (status) {
+    if (!warp64Stream(fIn, sk.fd, descramble, pKey, 0,
+                      m_crc ? &crc : NULL)) {
+      status = 0;
     }
-    pwo = NULL;
   }
-  
-  /* Release byte dictionaries if allocated */
-  if (pd[0] != NULL) {
-    free(pd[0]);
-    pd[0] = NULL;
+  if (opened) {
+    if (!sinkClose(&sk, status)) {
+      status = 0;
+    }
+    opened = 0;
   }
-  if (pd[1] != NULL) {
-    free(pd[1]);
-    pd[1] = NULL;
+  if (status && m_crc) {
+    fprintf(stderr, "%s: CRC32C of plaintext is %08lx\n",
+            pModule, (unsigned long) crc);
   }
-  if (pd[2] != NULL) {
-    free(pd[2]);
-    pd[2] = NULL;
+  
+  if (own) {
+    if (close(fIn)) {
+      fprintf(stderr, "%s: Failed to close input file!\n", pModule);
+    }
+    fIn = -1;
   }
   
-  /* Return status */
   return status;
 }
 
 /*
- * Perform the main program given all the necessary parameters.
- * 
- * Parameters:
- * 
- *   pInputPath - path to the input file
- * 
- *   pOutputPath - path to the output file
- * 
- *   descramble - non-zero if descrambling, zero if scrambling
- * 
- *   pKey - the scrambling key
- * 
- * Return:
- * 
- *   non-zero if successful, zero if error
+ * Program entrypoint
+ * ==================
  */
-static int warp64(
-    const char * pInputPath,
-    const char * pOutputPath,
-          int    descramble,
-    const char * pKey) {
-  
+
+int main(int argc, char *argv[]) {
   int status = 1;
-  int i = 0;
-  int z = 0;
   
-  int32_t key = 0;
-  int32_t tk = 0;
-  int64_t ctlen = 0;
-  int64_t olen = 0;
+  int i = 0;
+  long wval = 0;
+  long wsz = 0;
+  long wtarget = WINDOW_TARGET;
+  long lval = 0;
   
-  uint8_t trailer[3];
-  uint8_t kb[3];
-  uint8_t dummy = 0;
+  int descramble = -1;
+  int check = 0;
+  int rekey = 0;
+  int threads_given = 0;
+  int inplace = 0;
+  int recover = 0;
+  int rollback = 0;
+  int resume = 0;
+  int append = 0;
+  int stream = 0;
+  int splice = 0;
+  int recursive = 0;
+  int backend_given = 0;
+  int zlevel_given = 0;
+  int npath = 0;
+  uint32_t crc = 0;
+  char **ppPath = NULL;
+  const char *pKeyFile = NULL;
+  const char *pNewKeyFile = NULL;
+  const char *pNewKey = NULL;
+  const char *pPack = NULL;
+  const char *pSink = NULL;
+  const char *pInputPath = NULL;
+  char *pOutputPath = NULL;
+  char *pJournal = NULL;
+  char *pCkpt = NULL;
+  FILE *pTty = NULL;
+  FILE *pKeyIn = NULL;
   
-  int new_file = 0;
-  int fIn = -1;
-  int fOut = -1;
+  KEY_BUFFER kb;
+  KEY_BUFFER kbnew;
+  struct stat st;
   
   /* Initialize structures */
-  memset(trailer, 0, 3);
-  memset(kb, 0, 3);
+  memset(&kb, 0, sizeof(KEY_BUFFER));
+  memset(&kbnew, 0, sizeof(KEY_BUFFER));
+  memset(&st, 0, sizeof(struct stat));
   
-  /* Check parameters */
-  if ((pInputPath == NULL) || (pOutputPath == NULL) || (pKey == NULL)) {
-    abort();
+  /* Get the module name */
+  pModule = NULL;
+  if ((argc > 0) && (argv != NULL)) {
+    pModule = argv[0];
+  }
+  if (pModule == NULL) {
+    pModule = "warp64";
   }
   
-  /* Derive the normalized key */
-  key = deriveKey(pKey);
-  if (key < 0) {
-    status = 0;
+  /* Select the fastest transform kernel for this processor */
+  warp64k_init();
+  
+  /* Figure out the system page size */
+  wval = sysconf(_SC_PAGE_SIZE);
+  if (wval < 1) {
+    fprintf(stderr, "%s: Failed to determine system page size!\n",
+            pModule);
+    abort();
   }
   
-  /* Open the input file for reading */
-  if (status) {
-    fIn = open(pInputPath, O_RDONLY);
-    if (fIn < 0) {
-      status = 0;
-      fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pInputPath);
-    }
+  /* If no parameters provided, print help screen and fail */
+  if (argc <= 1) {
+    status = 0;
+    fprintf(stderr, "Warp64 binary scrambling and descrambling\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Syntax:\n");
+    fprintf(stderr, "  warp64 [options] -s [input_path]\n");
+    fprintf(stderr, "  warp64 [options] -d [input_path]\n");
+    fprintf(stderr, "  warp64 [options] -s --append [input_path]\n");
+    fprintf(stderr, "  warp64 [options] -s|-d [path] [path] ...\n");
+    fprintf(stderr, "  warp64 [options] -s|-d --sink [url] [input_path]\n");
+    fprintf(stderr, "  warp64 [options] -c [path] [path] ...\n");
+    fprintf(stderr, "  warp64 [options] -k [path] [path] ...\n");
+    fprintf(stderr, "  warp64 [options] -s --pack [archive] [path] ...\n");
+    fprintf(stderr, "  warp64 [options] -d|-c --pack [archive] [name] ...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[input_path] is path to input file\n");
+    fprintf(stderr, "[input_path] of - streams stdin to stdout\n");
+    fprintf(stderr, "-s scrambles input file\n");
+    fprintf(stderr, "-d descrambles input file\n");
+    fprintf(stderr, "-c checks the key against scrambled files\n");
+    fprintf(stderr, "-k changes the key of scrambled files\n");
+    fprintf(stderr, "Scrambled files have .warp64 suffix\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -j [count]  worker threads (0 for one per CPU)\n");
+    fprintf(stderr, "  --pin cpu   pin worker threads to processors\n");
+    fprintf(stderr, "  --pin node  pin worker threads to NUMA nodes\n");
+    fprintf(stderr, "  -w [bytes]  window size, or auto (the default)\n");
+    fprintf(stderr, "  --hugepages  back windows with huge pages\n");
+    fprintf(stderr, "  -b [name]   window I/O: mmap, pread or uring\n");
+    fprintf(stderr, "  --nocache   drop finished windows from cache\n");
+    fprintf(stderr, "  --direct    bypass the cache with O_DIRECT\n");
+    fprintf(stderr, "  --sparse    skip holes and keep outputs sparse\n");
+    fprintf(stderr, "  --no-prefetch  don't read ahead of the windows\n");
+    fprintf(stderr, "  --sync none|final|rolling  output flushing\n");
+    fprintf(stderr, "  --crc       write or require a plaintext CRC32C\n");
+    fprintf(stderr, "  -z          compress with zstd before scrambling\n");
+    fprintf(stderr, "  --zlevel [n]  compression level, 1-19\n");
+    fprintf(stderr, "  -i          transform in place with a journal\n");
+    fprintf(stderr, "  --finish    finish an interrupted -i run\n");
+    fprintf(stderr, "  --rollback  roll back an interrupted -i run\n");
+    fprintf(stderr, "  --checkpoint [n]  checkpoint every [n] windows\n");
+    fprintf(stderr, "  --resume    continue from the last checkpoint\n");
+    fprintf(stderr, "  --append    scramble what was added to the input\n");
+    fprintf(stderr, "  --splice    stream to a pipe with vmsplice\n");
+    fprintf(stderr, "  --sink [url]  send output to tcp:// or http:// URL\n");
+    fprintf(stderr, "  -r          process directory trees\n");
+    fprintf(stderr, "  --pack [path]  pack into or extract from archive\n");
+    fprintf(stderr, "  --key-file [path]  read key from a file\n");
+    fprintf(stderr, "  --new-key-file [path]  read -k new key from a file\n");
+    fprintf(stderr, "  --stats     print run statistics when done\n");
+    fprintf(stderr, "  --stats-json [path]  write statistics as JSON\n");
   }
   
-  /* Get the length of the input file */
+  /* Check that parameters are present */
   if (status) {
-    ctlen = (int64_t) lseek(fIn, 0, SEEK_END);
-    if (ctlen < 0) {
-      status = 0;
-      fprintf(stderr, "%s: Failed to get length of '%s'!\n",
-              pModule, pInputPath);
+    if (argv == NULL) {
+      abort();
     }
-  }
-  if (status) {
-    if (lseek(fIn, 0, SEEK_SET) != 0) {
-      status = 0;
-      fprintf(stderr, "%s: Failed to rewind '%s'!\n",
-              pModule, pInputPath);
+    for(i = 0; i < argc; i++) {
+      if (argv[i] == NULL) {
+        abort();
+      }
     }
   }
   
-  /* If this is descrambling mode, then input file length must be at
-   * least three and then content length is three less than input file;
-   * else, leave content length equal to input file length */
-  if (status && descramble) {
-    if (ctlen < 3) {
-      status = 0;
-      fprintf(stderr, "%s: Missing trailer in '%s'!\n",
-              pModule, pInputPath);
-    }
-    if (status) {
-      ctlen = ctlen - 3;
+  /* Allocate the input path list */
+  if (status) {
+    ppPath = (char **) calloc((size_t) argc, sizeof(char *));
+    if (ppPath == NULL) {
+      abort();
     }
   }
   
-  /* If this is descrambling mode, then read the last three bytes and
-   * verify the descrambled trailer bytes are zero to check the key */
-  if (status && descramble) {
-    /* Read the last three bytes into trailer */
-    if (lseek(fIn, -3, SEEK_END) < 0) {
-      status = 0;
-      fprintf(stderr, "%s: Failed to seek to trailer in '%s'!\n",
-              pModule, pInputPath);
-    }
-    
-    if (status) {
-      if (read(fIn, trailer, 3) != 3) {
+  /* Parse the parameters; options may appear in any order, and exactly
+   * one mode and at least one input path must be given */
+  for(i = 1; status && (i < argc); i++) {
+    if ((strcmp(argv[i], "-s") == 0) || (strcmp(argv[i], "-d") == 0) ||
+        (strcmp(argv[i], "-c") == 0) || (strcmp(argv[i], "-k") == 0)) {
+      /* Mode selection; verification and re-keying work on scrambled
+       * files */
+      if (descramble >= 0) {
         status = 0;
-        fprintf(stderr, "%s: Failed to read trailer in '%s'!\n",
-              pModule, pInputPath);
+        fprintf(stderr, "%s: Mode may only be given once!\n", pModule);
+      } else if (strcmp(argv[i], "-s") == 0) {
+        descramble = 0;
+      } else if (strcmp(argv[i], "-c") == 0) {
+        descramble = 1;
+        check = 1;
+      } else if (strcmp(argv[i], "-k") == 0) {
+        descramble = 1;
+        rekey = 1;
+      } else {
+        descramble = 1;
       }
-    }
-    
-    if (status) {
-      if (lseek(fIn, 0, SEEK_SET) != 0) {
+      
+    } else if (strcmp(argv[i], "-j") == 0) {
+      /* Worker thread count */
+      i++;
+      if (i >= argc) {
         status = 0;
-        fprintf(stderr, "%s: Failed to rewind '%s'!\n",
-              pModule, pInputPath);
+        fprintf(stderr, "%s: -j requires a thread count!\n", pModule);
       }
-    }
-    
-    /* Figure out the index of the scrambling key to use for the first
-     * byte of the head */
-    if (status) {
-      z = (int) (3 - ((ctlen - 3) % 3));
-    }
-    
-    /* Pack the properly re-ordered trailer bytes into an integer to
-     * figure out the normalized key that must be used */
-    if (status) {
-      tk = 0;
-      for(i = 0; i < 3; i++) {
-        tk = (tk << 8) | ((int32_t) trailer[(z + i) % 3]);
+      if (status) {
+        if (!parseCount(argv[i], 0, MAX_THREADS, &lval)) {
+          status = 0;
+          fprintf(stderr, "%s: Thread count must be in range 0-%d!\n",
+                  pModule, MAX_THREADS);
+        }
       }
-    }
-    
-    /* Verify that the provided scrambling key is correct */
-    if (status) {
-      if (key != tk) {
+      if (status) {
+        if (lval == 0) {
+          lval = sysconf(_SC_NPROCESSORS_ONLN);
+          if (lval < 1) {
+            lval = 1;
+          } else if (lval > MAX_THREADS) {
+            lval = MAX_THREADS;
+          }
+        }
+        m_threads = (int) lval;
+        threads_given = 1;
+      }
+      
+    } else if (strcmp(argv[i], "-w") == 0) {
+      /* Window size */
+      i++;
+      if (i >= argc) {
         status = 0;
-        fprintf(stderr, "%s: Incorrect scrambling key!\n", pModule);
+        fprintf(stderr, "%s: -w requires a window size!\n", pModule);
+      }
+      if (status && (strcmp(argv[i], "auto") == 0)) {
+        m_winauto = 1;
+        wtarget = WINDOW_TARGET;
+        
+      } else if (status) {
+        if (!parseCount(argv[i], 1, WINDOW_MAX, &wtarget)) {
+          status = 0;
+          fprintf(stderr, "%s: Window size must be in range 1-%ld!\n",
+                  pModule, (long) WINDOW_MAX);
+        }
+        m_winauto = 0;
+      }
+      
+    } else if (strcmp(argv[i], "-b") == 0) {
+      /* I/O backend */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: -b requires a backend name!\n", pModule);
+      }
+      if (status) {
+        m_backend = warp64io_find(argv[i]);
+        if (m_backend < 0) {
+          status = 0;
+          fprintf(stderr, "%s: Unknown I/O backend '%s'\n",
+                  pModule, argv[i]);
+        }
       }
+      if (status) {
+        backend_given = 1;
+        if (!warp64io_supported(m_backend)) {
+          status = 0;
+          fprintf(stderr, "%s: I/O backend '%s' is not supported here!\n",
+                  pModule, argv[i]);
+        }
+      }
+      
+    } else if (strcmp(argv[i], "--nocache") == 0) {
+      /* Drop finished windows from the page cache */
+      m_ioflags |= WARP64IO_NOCACHE;
+      
+    } else if (strcmp(argv[i], "--direct") == 0) {
+      /* Bypass the page cache */
+      m_ioflags |= WARP64IO_DIRECT;
+      
+    } else if (strcmp(argv[i], "--sparse") == 0) {
+      /* Skip holes and punch zero blocks */
+      m_ioflags |= WARP64IO_SPARSE;
+      
+    } else if (strcmp(argv[i], "--hugepages") == 0) {
+      /* Back windows with huge pages */
+      m_huge = 1;
+      
+    } else if (strcmp(argv[i], "--no-prefetch") == 0) {
+      /* Don't read ahead or prefault windows */
+      m_ioflags &= ~WARP64IO_PREFETCH;
+      
+    } else if (strcmp(argv[i], "--crc") == 0) {
+      /* Checksum the plaintext */
+      m_crc = 1;
+      
+    } else if (strcmp(argv[i], "--sync") == 0) {
+      /* Sync policy for output files */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --sync requires a policy!\n", pModule);
+      }
+      if (status) {
+        if (strcmp(argv[i], "none") == 0) {
+          m_sync = SYNC_NONE;
+        } else if (strcmp(argv[i], "final") == 0) {
+          m_sync = SYNC_FINAL;
+        } else if (strcmp(argv[i], "rolling") == 0) {
+          m_sync = SYNC_ROLLING;
+        } else {
+          status = 0;
+          fprintf(stderr, "%s: Unknown sync policy '%s'\n",
+                  pModule, argv[i]);
+        }
+      }
+      
+    } else if (strcmp(argv[i], "--pin") == 0) {
+      /* Thread pinning */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --pin requires cpu or node!\n", pModule);
+      }
+      if (status) {
+        if (strcmp(argv[i], "cpu") == 0) {
+          m_pin = PIN_CPU;
+        } else if (strcmp(argv[i], "node") == 0) {
+          m_pin = PIN_NODE;
+        } else {
+          status = 0;
+          fprintf(stderr, "%s: Unknown pinning mode '%s'\n",
+                  pModule, argv[i]);
+        }
+      }
+#ifndef __linux__
+      if (status) {
+        status = 0;
+        fprintf(stderr, "%s: --pin is only supported on Linux!\n",
+                pModule);
+      }
+#endif
+      
+    } else if (strcmp(argv[i], "-i") == 0) {
+      /* In-place mode */
+      inplace = 1;
+      
+    } else if ((strcmp(argv[i], "--finish") == 0) ||
+                (strcmp(argv[i], "--rollback") == 0)) {
+      /* Recovery of an interrupted in-place run */
+      if (recover) {
+        status = 0;
+        fprintf(stderr, "%s: Choose only one of --finish or --rollback!\n",
+                pModule);
+      }
+      inplace = 1;
+      recover = 1;
+      if (strcmp(argv[i], "--rollback") == 0) {
+        rollback = 1;
+      }
+      
+    } else if (strcmp(argv[i], "--checkpoint") == 0) {
+      /* Checkpoint interval */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --checkpoint requires a window count!\n",
+                pModule);
+      }
+      if (status) {
+        if (!parseCount(argv[i], 1, 1000000000L, &lval)) {
+          status = 0;
+          fprintf(stderr,
+                  "%s: Checkpoint interval must be in range 1-%ld!\n",
+                  pModule, 1000000000L);
+        }
+      }
+      if (status) {
+        m_ckpt = (int64_t) lval;
+      }
+      
+    } else if (strcmp(argv[i], "--resume") == 0) {
+      /* Continue from a checkpoint */
+      resume = 1;
+      
+    } else if (strcmp(argv[i], "--append") == 0) {
+      /* Scramble what was added to the input */
+      append = 1;
+      
+    } else if (strcmp(argv[i], "-r") == 0) {
+      /* Recurse into directories */
+      recursive = 1;
+      
+    } else if (strcmp(argv[i], "--key-file") == 0) {
+      /* Read the key from a file */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --key-file requires a path!\n", pModule);
+      }
+      if (status) {
+        pKeyFile = argv[i];
+      }
+      
+    } else if (strcmp(argv[i], "--new-key-file") == 0) {
+      /* Read the new key of a re-key from a file */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --new-key-file requires a path!\n",
+                pModule);
+      }
+      if (status) {
+        pNewKeyFile = argv[i];
+      }
+      
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      /* Print statistics */
+      m_stats = 1;
+      m_stats_text = 1;
+      
+    } else if (strcmp(argv[i], "--stats-json") == 0) {
+      /* Write statistics to a file */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --stats-json requires a path!\n", pModule);
+      }
+      if (status) {
+        m_stats = 1;
+        m_pStatsJson = argv[i];
+      }
+      
+    } else if (strcmp(argv[i], "--pack") == 0) {
+      /* Pack into or extract from an archive */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --pack requires a path!\n", pModule);
+      }
+      if (status) {
+        pPack = argv[i];
+      }
+      
+    } else if (strcmp(argv[i], "--sink") == 0) {
+      /* Send output to a remote sink */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --sink requires a URL!\n", pModule);
+      }
+      if (status) {
+        pSink = argv[i];
+      }
+      
+    } else if (strcmp(argv[i], "--splice") == 0) {
+      /* Zero-copy output in streaming mode */
+      splice = 1;
+      
+    } else if (strcmp(argv[i], "-z") == 0) {
+      /* Compress before scrambling */
+#ifdef WARP64_ZSTD
+      m_zstd = 1;
+#else
+      status = 0;
+      fprintf(stderr, "%s: -z requires a build with WARP64_ZSTD!\n",
+              pModule);
+#endif
+      
+    } else if (strcmp(argv[i], "--zlevel") == 0) {
+      /* Compression level */
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --zlevel requires a level!\n", pModule);
+      }
+      if (status) {
+        if (!parseCount(argv[i], 1, 19, &lval)) {
+          status = 0;
+          fprintf(stderr, "%s: Compression level must be in range 1-19!\n",
+                  pModule);
+        }
+      }
+      if (status) {
+        m_zlevel = (int) lval;
+        zlevel_given = 1;
+      }
+      
+    } else if ((argv[i][0] == '-') && (argv[i][1] != 0)) {
+      status = 0;
+      fprintf(stderr, "%s: Unknown option '%s'\n", pModule, argv[i]);
+      
+    } else {
+      /* Input path */
+      ppPath[npath] = argv[i];
+      npath++;
     }
   }
   
-  /* Open the output file for writing; do not allow existing files to be
-   * overwritten; set new_file flag if successfully created a new 
-   * file */
+  /* The in-place journal layout depends on the window size, so
+   * in-place runs and their recovery always use the default */
+  if (status && inplace && (wtarget != WINDOW_TARGET)) {
+    status = 0;
+    fprintf(stderr, "%s: -w may not be combined with -i!\n", pModule);
+  }
+  
+  /* Figure out how many pages in desired window target */
   if (status) {
-    fOut = open(pOutputPath, O_RDWR | O_CREAT | O_EXCL,
-                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fOut < 0) {
-      status = 0;
-      fprintf(stderr, "%s: Failed to create '%s'!\n",
-              pModule, pOutputPath);
-      fprintf(stderr, "%s: Check that '%s' does not exist.\n",
-              pModule, pOutputPath);
+    wsz = wtarget / wval;
+    if ((wtarget % wval) != 0) {
+      wsz++;
     }
-
-    if (status) {
-      new_file = 1;
+    if (wsz < 1) {
+      wsz = 1;
     }
+    
+    /* Store the computed window size */
+    m_winsize = (size_t) (wsz * wval);
+    m_winmax = m_winsize;
   }
   
-  /* Compute length of output file based on content length */
-  if (status && descramble) {
-    olen = ctlen;
-    
-  } else if (status && (!descramble)) {
-    if (ctlen <= INT64_MAX - 3) {
-      olen = ctlen + 3;
-    } else {
-      status = 0;
-      fprintf(stderr, "%s: Output file length overflow!\n", pModule);
+  /* Direct I/O can't work through mappings, so it uses the pread
+   * backend unless another backend was chosen */
+  if (status && (m_ioflags & WARP64IO_DIRECT)) {
+    if (m_backend == WARP64IO_MMAP) {
+      if (backend_given) {
+        status = 0;
+        fprintf(stderr, "%s: --direct can't be used with -b mmap!\n",
+                pModule);
+      } else {
+        m_backend = WARP64IO_PREAD;
+      }
     }
-    
-  } else if (status) {
-    abort();
   }
   
-  /* Only process further if output length is non-zero */
-  if (status && (olen > 0)) {
+  /* Mode and input path are required */
+  if (status && (descramble < 0)) {
+    status = 0;
+    fprintf(stderr, "%s: Must choose -s, -d, -c or -k mode!\n",
+            pModule);
+  }
+  if (status && (pNewKeyFile != NULL) && (!rekey)) {
+    status = 0;
+    fprintf(stderr, "%s: --new-key-file requires -k!\n", pModule);
+  }
+  if (status && (npath < 1) && ((pPack == NULL) || (!descramble))) {
+    status = 0;
+    fprintf(stderr, "%s: Wrong number of parameters!\n", pModule);
+  }
+  if (status) {
+    pInputPath = ppPath[0];
+  }
   
-    /* Expand the output file to the proper length */
-    if (status && (olen > 1)) {
-      if (lseek(fOut, (off_t) (olen - 1), SEEK_SET) != olen - 1) {
-        status = 0;
-        fprintf(stderr, "%s: Failed to set output length!\n", pModule);
-      }
+  /* A pack is a single file that is written or read in one sequential
+   * pass, with paths naming the files to pack or the members to
+   * extract, so it has nothing to do with re-keying, in-place runs,
+   * streams or compression */
+  if (status && (pPack != NULL)) {
+    if (rekey || inplace || m_zstd || m_crc) {
+      status = 0;
+      fprintf(stderr,
+              "%s: --pack may not be combined with -k, -i, -z or --crc!\n",
+              pModule);
     }
-    if (status) {
-      if (write(fOut, &dummy, 1) != 1) {
-        status = 0;
-        fprintf(stderr, "%s: Failed to set output length!\n", pModule);
-      }
+    if (status && (strcmp(pPack, STREAM_PATH) == 0)) {
+      status = 0;
+      fprintf(stderr, "%s: Can't stream with --pack!\n", pModule);
     }
-    if (status) {
-      if (lseek(fOut, 0, SEEK_SET) != 0) {
+    for(i = 0; status && (i < npath); i++) {
+      if (strcmp(ppPath[i], STREAM_PATH) == 0) {
         status = 0;
-        fprintf(stderr, "%s: Failed to set output length!\n", pModule);
+        fprintf(stderr, "%s: Can't stream with --pack!\n", pModule);
       }
     }
-    
-    /* If we are descrambling, turn the scrambling key into a
-     * descrambling key */
-    if (status && descramble) {
-      
-      /* Unpack the key into a buffer */
-      kb[0] = (uint8_t) ((key >> 16) & 0xff);
-      kb[1] = (uint8_t) ((key >>  8) & 0xff);
-      kb[2] = (uint8_t) ( key        & 0xff);
-      
-      /* Invert each component byte */
-      for(i = 0; i < 3; i++) {
-        /* Component byte should not be zero */
-        if (kb[i] == 0) {
-          abort();
-        }
-        
-        /* Invert component byte */
-        kb[i] = (uint8_t) (256 - ((int) kb[i]));
-      }
-      
-      /* Pack buffer back into key */
-      key =   (((int32_t) kb[0]) << 16)
-            | (((int32_t) kb[1]) <<  8)
-            | ( (int32_t) kb[2]       );
+    if (status && recursive && descramble) {
+      status = 0;
+      fprintf(stderr, "%s: -r with --pack requires -s!\n", pModule);
+    }
+  }
+  if (status && (pPack != NULL) && (!descramble)) {
+    if ((strlen(pPack) <= strlen(FILE_SUFFIX)) ||
+        (strcmp(&(pPack[strlen(pPack) - strlen(FILE_SUFFIX)]),
+                FILE_SUFFIX) != 0)) {
+      status = 0;
+      fprintf(stderr, "%s: Pack must have .warp64 suffix!\n", pModule);
     }
+  }
   
-    /* Process the file */
-    if (status && descramble) {
-      if (!process64(fIn, fOut, key, 0, olen)) {
-        status = 0;
-      }
-      
-    } else if (status && (!descramble)) {
-      if (!process64(fIn, fOut, key, 1, olen)) {
+  /* Several paths or -r select batch mode, which can't stream or
+   * recover interrupted in-place runs */
+  if (status && ((npath > 1) || recursive)) {
+    for(i = 0; i < npath; i++) {
+      if (strcmp(ppPath[i], STREAM_PATH) == 0) {
         status = 0;
+        fprintf(stderr, "%s: Can't stream with several paths or -r!\n",
+                pModule);
+        break;
       }
-      
-    } else if (status) {
-      abort();
+    }
+    if (status && recover) {
+      status = 0;
+      fprintf(stderr, "%s: Recover one path at a time!\n", pModule);
     }
   }
   
-  /* Close open file handles */
-  if (fIn >= 0) {
-    if (close(fIn)) {
-      fprintf(stderr, "%s: Failed to close input file!\n", pModule);
-    }
-    fIn = -1;
+  /* Verification only reads trailers, so it has nothing to do in place
+   * and reads many trailers at once unless told otherwise */
+  if (status && check && inplace) {
+    status = 0;
+    fprintf(stderr, "%s: -c may not be combined with -i!\n", pModule);
   }
-  if (fOut >= 0) {
-    if (close(fOut)) {
-      fprintf(stderr, "%s: Failed to close output file!\n", pModule);
-    }
-    fOut = -1;
+  if (status && check && (!threads_given)) {
+    m_threads = CHECK_DEPTH;
   }
   
-  /* If there was a failure and new_file flag is set, remove the output
-   * file */
-  if ((!status) && new_file) {
-    if (unlink(pOutputPath)) {
-      fprintf(stderr, "%s: Failed to clean up output file!\n", pModule);
-    }
+  /* In-place runs are journaled window by window, so they are always
+   * processed on a single thread */
+  if (status && inplace && (m_threads > 1)) {
+    status = 0;
+    fprintf(stderr, "%s: -i may not be combined with -j!\n", pModule);
   }
   
-  /* If we got here successfully, remove the input file */
-  if (status) {
-    if (unlink(pInputPath)) {
-      fprintf(stderr, "%s: Failed to remove input file!\n", pModule);
-    }
+  /* Checksums are computed in the window passes and the stream, which
+   * in-place runs don't go through; re-keying and verification never
+   * see the plaintext */
+  if (status && m_crc && (inplace || rekey || check)) {
+    status = 0;
+    fprintf(stderr, "%s: --crc may not be combined with -i, -k or -c!\n",
+            pModule);
   }
   
-  /* Return status */
-  return status;
-}
-
-/*
- * Program entrypoint
- * ==================
- */
-
-int main(int argc, char *argv[]) {
-  int status = 1;
-  
-  int i = 0;
-  size_t slen = 0;
-  size_t suflen = 0;
-  long wval = 0;
-  long wsz = 0;
-  
-  int input_suffixed = 0;
-  int descramble = 0;
-  const char *pInputPath = NULL;
-  char *pOutputPath = NULL;
-  
-  KEY_BUFFER kb;
-  struct stat st;
-  
-  /* Initialize structures */
-  memset(&kb, 0, sizeof(KEY_BUFFER));
-  memset(&st, 0, sizeof(struct stat));
-  
-  /* Get the module name */
-  pModule = NULL;
-  if ((argc > 0) && (argv != NULL)) {
-    pModule = argv[0];
+  /* Check whether we are streaming; a stream is processed strictly in
+   * order on a single thread and has no file to work in place on */
+  if (status && (npath == 1) && (!recursive)) {
+    if (strcmp(pInputPath, STREAM_PATH) == 0) {
+      stream = 1;
+    }
   }
-  if (pModule == NULL) {
-    pModule = "warp64";
+  if (status && stream && check) {
+    status = 0;
+    fprintf(stderr, "%s: -c may not be used when streaming!\n", pModule);
   }
-  
-  /* Figure out the system page size */
-  wval = sysconf(_SC_PAGE_SIZE);
-  if (wval < 1) {
-    fprintf(stderr, "%s: Failed to determine system page size!\n");
-    abort();
+  if (status && stream && rekey) {
+    status = 0;
+    fprintf(stderr, "%s: -k may not be used when streaming!\n", pModule);
   }
-  
-  /* Figure out how many pages in desired window target */
-  wsz = WINDOW_TARGET / wval;
-  if ((WINDOW_TARGET % wval) != 0) {
-    wsz++;
+  if (status && stream && inplace) {
+    status = 0;
+    fprintf(stderr, "%s: -i may not be used when streaming!\n", pModule);
   }
-  if (wsz < 1) {
-    wsz = 1;
+  if (status && stream && (m_threads > 1) && (!m_zstd)) {
+    status = 0;
+    fprintf(stderr, "%s: -j may not be used when streaming!\n", pModule);
   }
-  
-  /* Store the computed window size */
-  m_winsize = (size_t) (wsz * wval);
-  
-  /* If no parameters provided, print help screen and fail */
-  if (argc <= 1) {
+  if (status && splice && (!stream)) {
     status = 0;
-    fprintf(stderr, "Warp64 binary scrambling and descrambling\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "Syntax:\n");
-    fprintf(stderr, "  warp64 -s [input_path]\n");
-    fprintf(stderr, "  warp64 -d [input_path]\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "[input_path] is path to input file\n");
-    fprintf(stderr, "-s scrambles input file\n");
-    fprintf(stderr, "-d descrambles input file\n");
-    fprintf(stderr, "Scrambled files have .warp64 suffix\n");
+    fprintf(stderr, "%s: --splice requires streaming!\n", pModule);
   }
   
-  /* Must be exactly two parameters beyond module name */
-  if (status && (argc != 3)) {
+  /* Compressed data goes through the stream pipeline, which works on
+   * one file or stream at a time, with -j setting the number of
+   * compression threads */
+  if (status && m_zstd && (check || rekey || inplace || recover)) {
     status = 0;
-    fprintf(stderr, "%s: Wrong number of parameters!\n", pModule);
+    fprintf(stderr, "%s: -z may not be combined with -c, -k or -i!\n",
+            pModule);
+  }
+  if (status && m_zstd && ((npath > 1) || recursive)) {
+    status = 0;
+    fprintf(stderr, "%s: -z works on one path at a time!\n", pModule);
+  }
+  if (status && m_zstd && splice) {
+    status = 0;
+    fprintf(stderr, "%s: -z may not be combined with --splice!\n",
+            pModule);
+  }
+  if (status && zlevel_given && ((!m_zstd) || descramble)) {
+    status = 0;
+    fprintf(stderr, "%s: --zlevel requires -z and -s!\n", pModule);
   }
   
-  /* Check that parameters are present */
-  if (status) {
-    if (argv == NULL) {
-      abort();
+  /* Checkpoints cover whole windows of a single file job, which neither
+   * streams, in-place runs, compression, packs nor batches have; a
+   * resumed run keeps checkpointing */
+  if (status && resume && (m_ckpt < 1)) {
+    m_ckpt = CKPT_WINDOWS;
+  }
+  if (status && (m_ckpt > 0)) {
+    if (stream || check || inplace || m_zstd || (pPack != NULL)) {
+      status = 0;
+      fprintf(stderr, "%s: --checkpoint and --resume may not be combined "
+              "with -c, -i, -z, --pack or streaming!\n", pModule);
+    } else if ((npath > 1) || recursive) {
+      status = 0;
+      fprintf(stderr, "%s: --checkpoint and --resume work on one path "
+              "at a time!\n", pModule);
     }
-    for(i = 0; i < argc; i++) {
-      if (argv[i] == NULL) {
-        abort();
-      }
+  }
+  
+  /* A sink takes the place of the output of a single file or stream,
+   * which goes through the stream pipeline to get there */
+  if (status && (pSink != NULL)) {
+    if (check || rekey || inplace || splice || (pPack != NULL) ||
+        (m_ckpt > 0)) {
+      status = 0;
+      fprintf(stderr, "%s: --sink may not be combined with -c, -k, -i, "
+              "--pack, --splice, --checkpoint or --resume!\n", pModule);
+    } else if ((npath > 1) || recursive) {
+      status = 0;
+      fprintf(stderr, "%s: --sink works on one path at a time!\n",
+              pModule);
+    } else if ((m_threads > 1) && (!m_zstd)) {
+      status = 0;
+      fprintf(stderr, "%s: -j may not be used with --sink!\n", pModule);
     }
   }
   
-  /* Determine whether scrambling or descrambling */
-  if (status) {
-    if (strcmp(argv[1], "-s") == 0) {
-      descramble = 0;
-      
-    } else if (strcmp(argv[1], "-d") == 0) {
-      descramble = 1;
-      
-    } else {
+  /* Appending continues the existing scrambled file of a single input
+   * a chunk at a time, so it has no windows to checkpoint and nothing
+   * to stream, compress, pack or send */
+  if (status && append) {
+    if (descramble) {
+      status = 0;
+      fprintf(stderr, "%s: --append requires -s!\n", pModule);
+    } else if (stream || inplace || m_zstd || (pPack != NULL) ||
+                (pSink != NULL) || (m_ckpt > 0)) {
+      status = 0;
+      fprintf(stderr, "%s: --append may not be combined with -i, -z, "
+              "--pack, --sink, --checkpoint, --resume or streaming!\n",
+              pModule);
+    } else if ((npath > 1) || recursive) {
+      status = 0;
+      fprintf(stderr, "%s: --append works on one path at a time!\n",
+              pModule);
+    } else if (m_threads > 1) {
       status = 0;
-      fprintf(stderr, "%s: Unknown mode '%s'\n", pModule, argv[1]);
+      fprintf(stderr, "%s: -j may not be used with --append!\n",
+              pModule);
     }
   }
   
-  /* Get length of warp64 suffix */
-  if (status) {
-    suflen = strlen(FILE_SUFFIX);
+  /* Now that the backend, the flags and the threads are settled, work
+   * out how large automatic windows may get; checkpoints need windows
+   * of the smallest size, so that a file has many */
+  if (status && m_winauto && (m_ckpt < 1)) {
+    m_winmax = autoWindowMax();
   }
   
-  /* Get the input file path and determine whether it has a .warp64
-   * suffix */
-  if (status) {
-    pInputPath = argv[2];
-    slen = strlen(pInputPath);
-    if (slen > suflen) {
-      if (strcmp(&(pInputPath[slen - suflen]), FILE_SUFFIX)
-            == 0) {
-        input_suffixed = 1;
-      } else {
-        input_suffixed = 0;
-      }
-      
-    } else {
-      input_suffixed = 0;
+  /* Check the suffix of the input path and derive the output path;
+   * there is none when streaming or sending to a sink, and paths of a
+   * batch or a pack are handled in warp64Batch() or warp64Pack() */
+  if (status && (!stream) && (!check) && (pPack == NULL) &&
+      (pSink == NULL) && (npath == 1) && (!recursive)) {
+    pOutputPath = outputPath(pInputPath, descramble, rekey);
+    if (pOutputPath == NULL) {
+      status = 0;
     }
   }
   
-  /* Make sure presence of suffix matches the mode */
-  if (status) {
-    if (descramble) {
-      if (!input_suffixed) {
-        status = 0;
-        fprintf(stderr, "%s: Input file must have .warp64 suffix!\n",
-                pModule);
-      }
-      
-    } else {
-      if (input_suffixed) {
-        status = 0;
-        fprintf(stderr, "%s: Input file may not have .warp64 suffix!\n",
-                pModule);
-      }
+  /* Unless we are recovering an interrupted in-place run, refuse to
+   * touch a file that still has an in-place journal */
+  if (status && (!recover) && (!stream) && (pOutputPath != NULL)) {
+    pJournal = journalPath(pInputPath);
+    if (access(pJournal, F_OK) == 0) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' has an interrupted in-place run!\n",
+              pModule, pInputPath);
+      fprintf(stderr, "%s: Use --finish or --rollback to recover.\n",
+              pModule);
     }
+    free(pJournal);
+    pJournal = NULL;
   }
   
-  /* Make sure the input path is for an existing regular file */
-  if (status) {
+  /* A resumed run needs the checkpoint of the interrupted run, and any
+   * other run refuses to start over on the output of one */
+  if (status && (!stream) && (pOutputPath != NULL)) {
+    pCkpt = ckptPath(pOutputPath);
+    if (resume && (access(pCkpt, F_OK) != 0)) {
+      status = 0;
+      fprintf(stderr, "%s: No checkpoint for '%s'!\n",
+              pModule, pOutputPath);
+    } else if ((!resume) && (access(pCkpt, F_OK) == 0) &&
+                (access(pOutputPath, F_OK) == 0)) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' has an interrupted run!\n",
+              pModule, pInputPath);
+      fprintf(stderr, "%s: Use --resume to continue it.\n", pModule);
+    }
+    free(pCkpt);
+    pCkpt = NULL;
+  }
+  
+  /* Make sure the input path is for an existing regular file; when
+   * recovering, the file may already have been renamed */
+  if (status && (!recover) && (!stream) && (pOutputPath != NULL)) {
     if (stat(pInputPath, &st)) {
       status = 0;
       fprintf(stderr, "%s: Failed to stat '%s'\n",
               pModule, pInputPath);
     }
   }
-  if (status) {
+  if (status && (!recover) && (!stream) && (pOutputPath != NULL)) {
     if (!(S_ISREG(st.st_mode))) {
       status = 0;
       fprintf(stderr, "%s: '%s' is not a regular file\n",
@@ -1190,65 +10680,170 @@ int main(int argc, char *argv[]) {
     }
   }
   
-  /* Derive the output file path */
-  if (status && descramble) {
-    /* We are descrambling, so we need to remove the .warp64 suffix */
-    slen = strlen(pInputPath);
-    if (slen <= suflen) {
-      /* We already checked earlier that there is a warp64 suffix
-       * present, so this shouldn't happen */
-      abort();
+  /* Read the key, unless recovering, in which case the journal holds
+   * everything needed */
+  if (status && (!recover) && (pKeyFile != NULL)) {
+    pKeyIn = fopen(pKeyFile, "r");
+    if (pKeyIn == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open key file '%s'!\n",
+              pModule, pKeyFile);
+    }
+    if (status) {
+      if (!readKey(&kb, pKeyIn, 0)) {
+        status = 0;
+      }
+    }
+    if (pKeyIn != NULL) {
+      fclose(pKeyIn);
+      pKeyIn = NULL;
     }
     
-    /* The character before the suffix must not be a separator slash */
-    if (pInputPath[slen - suflen - 1] == '/') {
+  } else if (status && (!recover) && (!stream)) {
+    if (rekey) {
+      printf("Enter current scrambling key:\n");
+    } else {
+      printf("Enter scrambling key:\n");
+    }
+    if (!readKey(&kb, stdin, 1)) {
       status = 0;
-      fprintf(stderr, "%s: Invalid .warp64 suffix position!", pModule);
     }
-    
-    /* Allocate buffer for new path */
+  }
+  
+  /* Read the new key of a re-key in the same way */
+  if (status && rekey && (!recover) && (pNewKeyFile != NULL)) {
+    pKeyIn = fopen(pNewKeyFile, "r");
+    if (pKeyIn == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open key file '%s'!\n",
+              pModule, pNewKeyFile);
+    }
     if (status) {
-      pOutputPath = (char *) calloc((slen - suflen) + 1, 1);
-      if (pOutputPath == NULL) {
-        abort();
+      if (!readKey(&kbnew, pKeyIn, 0)) {
+        status = 0;
       }
     }
+    if (pKeyIn != NULL) {
+      fclose(pKeyIn);
+      pKeyIn = NULL;
+    }
     
-    /* Copy the input path without the warp64 suffix */
+  } else if (status && rekey && (!recover)) {
+    printf("Enter new scrambling key:\n");
+    if (!readKey(&kbnew, stdin, 1)) {
+      status = 0;
+    }
+  }
+  if (rekey) {
+    pNewKey = kbnew.kbuf;
+  }
+  
+  /* Standard input and output carry the data when streaming, so the
+   * key is read from the controlling terminal instead */
+  if (status && stream && (pKeyFile == NULL)) {
+    pTty = fopen("/dev/tty", "r+");
+    if (pTty == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open terminal to read key!\n",
+              pModule);
+    }
     if (status) {
-      memcpy(pOutputPath, pInputPath, slen - suflen);
+      fprintf(pTty, "Enter scrambling key:\n");
+      fflush(pTty);
+      if (!readKey(&kb, pTty, 1)) {
+        status = 0;
+      }
+    }
+    if (pTty != NULL) {
+      fclose(pTty);
+      pTty = NULL;
+    }
+  }
+  
+  /* Start the clock for statistics now that the key is read */
+  if (status && m_stats) {
+    m_stats_start = nowSec();
+  }
+  
+  /* Call the main program function */
+  if (status && (pPack != NULL) && descramble) {
+    if (!warp64Unpack(ppPath, npath, pPack, check, kb.kbuf)) {
+      status = 0;
     }
     
-  } else if (status && (!descramble)) {
-    /* We are scrambling, so we need to add a .warp64 suffix */
-    slen = strlen(pInputPath);
+  } else if (status && (pPack != NULL)) {
+    if (!warp64Pack(ppPath, npath, recursive, pPack, kb.kbuf)) {
+      status = 0;
+    }
     
-    /* Allocate buffer for new path */
-    pOutputPath = (char *) calloc(slen + suflen + 1, 1);
-    if (pOutputPath == NULL) {
-      abort();
+  } else if (status && check) {
+    if (!warp64Check(ppPath, npath, recursive, kb.kbuf)) {
+      status = 0;
     }
     
-    /* Copy the input path and append the suffix */
-    strcpy(pOutputPath, pInputPath);
-    strcat(pOutputPath, FILE_SUFFIX);
-  }
-  
-  /* Read the key */
-  if (status) {
-    printf("Enter scrambling key:\n");
-    if (!readKey(&kb)) {
+  } else if (status && ((npath > 1) || recursive)) {
+    if (!warp64Batch(ppPath, npath, recursive, descramble, inplace,
+                      kb.kbuf, pNewKey)) {
+      status = 0;
+    }
+    
+  } else if (status && (pSink != NULL)) {
+    if (!warp64Sink(pInputPath, pSink, descramble, kb.kbuf)) {
+      status = 0;
+    }
+    
+  } else if (status && stream) {
+    if (!warp64Stream(STDIN_FILENO, STDOUT_FILENO, descramble, kb.kbuf,
+                      splice, m_crc ? &crc : NULL)) {
+      status = 0;
+    }
+    if (status && m_crc) {
+      fprintf(stderr, "%s: CRC32C of plaintext is %08lx\n",
+              pModule, (unsigned long) crc);
+    }
+    
+  } else if (status && m_zstd) {
+    if (!warp64Pipe(pInputPath, pOutputPath, descramble, kb.kbuf)) {
+      status = 0;
+    }
+    
+  } else if (status && append) {
+    if (!warp64Append(pInputPath, pOutputPath, kb.kbuf)) {
+      status = 0;
+    }
+    
+  } else if (status && recover) {
+    if (!inplaceRecover(pInputPath, pOutputPath, rollback)) {
+      status = 0;
+    }
+    
+  } else if (status && inplace) {
+    if (!inplaceStart(pInputPath, pOutputPath, descramble,
+                      kb.kbuf, pNewKey)) {
+      status = 0;
+    }
+    
+  } else if (status) {
+    if (!warp64(pInputPath, pOutputPath, descramble,
+                kb.kbuf, pNewKey, resume)) {
       status = 0;
     }
   }
   
-  /* Call the main program function */
-  if (status) {
-    if (!warp64(pInputPath, pOutputPath, descramble, kb.kbuf)) {
+  /* Report statistics if requested; a run that didn't get started has
+   * nothing to report */
+  if ((m_stats_start > 0.0) && m_stats) {
+    if (!statsReport(status)) {
       status = 0;
     }
   }
   
+  /* Free the path list */
+  if (ppPath != NULL) {
+    free(ppPath);
+    ppPath = NULL;
+  }
+  
   /* Free output path if allocated */
   if (pOutputPath != NULL) {
     free(pOutputPath);
@@ -6,20 +6,46 @@
  * 
  * Service worker for performing Warp64 scrambling and descrambling.
  * 
- * Input messages are objects containing:
+ * The page runs several of these workers side by side on one file.
+ * The file is split into chunks of CHUNK_SIZE bytes, and with n
+ * workers, worker number w handles chunks w, w + n, w + 2n and so on,
+ * which it reads itself with Blob.slice().  Each chunk is transformed
+ * at its offset in the stream, so the chunks don't depend on each
+ * other.  The chunks are sent back to the page, which writes them to
+ * the result.  The file is never loaded into memory as a whole.
+ * 
+ * The transform uses a WebAssembly kernel with 128-bit SIMD when the
+ * browser supports it, and otherwise adds four bytes at a time in
+ * 32-bit words.
+ * 
+ * The first input message starts the worker.  It is an object
+ * containing:
  * 
  *   descramble : boolean - true if descrambling, false if scrambling
  *   key : string - the scrambling key
- *   data : ArrayBuffer - the input file data
+ *   file : Blob - the input file, usually a File from the input control
+ *   lane : number(int) - the number of this worker, from zero
+ *   lanes : number(int) - the number of workers
+ * 
+ * A worker only gets MAX_INFLIGHT chunks ahead of the page.  After the
+ * page is done with a chunk, it sends a message containing:
+ * 
+ *   ack : boolean - true
  * 
- * IMPORTANT:  When you post the message, you must transfer ownership
- * of the data ArrayBuffer.
+ * Output messages are objects of one of two kinds.  Chunk messages are
+ * sent for each chunk of the lane, in order, and contain:
  * 
- * Output messages are objects containing:
+ *   off : number(int) - the offset of the chunk in the result
+ *   chunk : ArrayBuffer - the chunk of the result
+ * 
+ * The final message is sent exactly once, after the last chunk of the
+ * lane, and contains:
  * 
  *   status : boolean - true if successful, false if error
  *   errDiv : string - the DIV id of the error div to show if error
- *   data : ArrayBuffer - the transformed data if successful
+ * 
+ * Every worker checks the key, and when descrambling the trailer, so
+ * a wrong key fails before any chunk is sent.
  */
 
 /*
@@ -57,6 +83,77 @@ function fault(func_name, loc) {
   throw ("warp64js:" + func_name + ":" + String(loc));
 }
 
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of bytes read, transformed and written at a time.
+ */
+var CHUNK_SIZE = 4194304;
+
+/*
+ * The number of chunks a worker may send before the page acknowledges
+ * the first of them.
+ */
+var MAX_INFLIGHT = 2;
+
+/*
+ * The length of the key pattern of the WebAssembly kernel, and where the
+ * pattern and the chunk are placed in its memory.
+ */
+var PAT_LEN = 48;
+var PAT_ADDR = 0;
+var BUF_ADDR = 64;
+
+/*
+ * The length of the probe that the WebAssembly kernel is checked on
+ * when it is loaded, which covers its 48-byte loop and its byte tail.
+ */
+var PROBE_LEN = 1000;
+
+/*
+ * The WebAssembly kernel, assembled from warp64k.wat.
+ */
+var WARP64K_WASM = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 7, 1, 96, 3, 127, 127, 127, 0, 3, 2,
+  1, 0, 5, 3, 1, 0, 1, 7, 18, 2, 6, 109, 101, 109, 111, 114, 121, 2, 0,
+  5, 120, 102, 111, 114, 109, 0, 0, 10, 171, 1, 1, 168, 1, 2, 2, 127, 3,
+  123, 32, 0, 253, 0, 0, 0, 33, 5, 32, 0, 253, 0, 0, 16, 33, 6, 32, 0,
+  253, 0, 0, 32, 33, 7, 2, 64, 3, 64, 32, 3, 65, 48, 106, 32, 2, 75, 13,
+  1, 32, 1, 32, 3, 106, 33, 4, 32, 4, 32, 4, 253, 0, 0, 0, 32, 5, 253,
+  110, 253, 11, 0, 0, 32, 4, 32, 4, 253, 0, 0, 16, 32, 6, 253, 110, 253,
+  11, 0, 16, 32, 4, 32, 4, 253, 0, 0, 32, 32, 7, 253, 110, 253, 11, 0,
+  32, 32, 3, 65, 48, 106, 33, 3, 12, 0, 11, 11, 65, 0, 33, 4, 2, 64, 3,
+  64, 32, 3, 32, 2, 79, 13, 1, 32, 1, 32, 3, 106, 32, 1, 32, 3, 106, 45,
+  0, 0, 32, 0, 32, 4, 106, 45, 0, 0, 106, 58, 0, 0, 32, 3, 65, 1, 106,
+  33, 3, 32, 4, 65, 1, 106, 33, 4, 12, 0, 11, 11, 11
+]);
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * Flag that is set to true once the worker has started.
+ */
+var m_started = false;
+
+/*
+ * The number of chunks sent and not yet acknowledged, and the function
+ * to call when the next acknowledgement arrives, or undefined.
+ */
+var m_inflight = 0;
+var m_wake = undefined;
+
+/*
+ * The exports of the WebAssembly kernel, or undefined if the portable
+ * kernel is used.
+ */
+var m_wasm = undefined;
+
 /*
  * Local functions
  * ===============
@@ -226,7 +323,263 @@ function deriveKey(str) {
 }
 
 /*
- * Perform the actual Warp64 scrambling or descrambling operation.
+ * Read a range of bytes from a Blob.
+ * 
+ * Parameters:
+ * 
+ *   blob : Blob - the file to read
+ * 
+ *   start : number(int) - the offset of the first byte
+ * 
+ *   end : number(int) - the offset after the last byte
+ * 
+ * Return:
+ * 
+ *   a Promise of an ArrayBuffer holding the bytes
+ */
+function readSlice(blob, start, end) {
+  var func_name = "readSlice";
+  
+  // Check parameters
+  if (!(blob instanceof Blob)) {
+    fault(func_name, 100);
+  }
+  if ((typeof(start) !== "number") || (typeof(end) !== "number")) {
+    fault(func_name, 101);
+  }
+  if ((start < 0) || (end < start) || (end > blob.size)) {
+    fault(func_name, 102);
+  }
+  
+  // Blob.arrayBuffer() only reads the slice, not the whole file
+  return blob.slice(start, end).arrayBuffer();
+}
+
+/*
+ * Load the WebAssembly kernel, with room in its memory for a chunk.
+ * 
+ * The kernel is checked against the transform as the specification
+ * defines it, on a probe in a key phase other than zero, and isn't used
+ * if it gets anything wrong.
+ * 
+ * Return:
+ * 
+ *   the exports of the kernel, or undefined if the browser doesn't
+ *   support WebAssembly or its SIMD instructions, or if the kernel
+ *   failed the check
+ */
+function loadWasm() {
+  var kb = [0x9d, 0x42, 0xf1];
+  var inst, pages, mem, i;
+  
+  // Browsers without SIMD fail validation of the module
+  if ((typeof(WebAssembly) !== "object") ||
+      (!WebAssembly.validate(WARP64K_WASM))) {
+    return undefined;
+  }
+  
+  try {
+    // The module is small, so it can be compiled synchronously
+    inst = new WebAssembly.Instance(new WebAssembly.Module(WARP64K_WASM));
+    
+    // Grow the memory to hold the pattern and a chunk
+    pages = Math.ceil((BUF_ADDR + CHUNK_SIZE) / 65536);
+    if (inst.exports.memory.buffer.byteLength < pages * 65536) {
+      inst.exports.memory.grow(
+        pages - (inst.exports.memory.buffer.byteLength / 65536));
+    }
+  } catch (ex) {
+    return undefined;
+  }
+  
+  // Check the kernel on the probe
+  mem = new Uint8Array(inst.exports.memory.buffer);
+  mem.set(makePattern(kb, 1), PAT_ADDR);
+  for(i = 0; i < PROBE_LEN; i++) {
+    mem[BUF_ADDR + i] = (i * 7 + 3) & 0xff;
+  }
+  inst.exports.xform(PAT_ADDR, BUF_ADDR, PROBE_LEN);
+  for(i = 0; i < PROBE_LEN; i++) {
+    if (mem[BUF_ADDR + i] !== (((i * 7 + 3) + kb[(i + 1) % 3]) & 0xff)) {
+      return undefined;
+    }
+  }
+  
+  return inst.exports;
+}
+
+/*
+ * Build the key pattern for a stream offset.
+ * 
+ * Parameters:
+ * 
+ *   kb : Array - the three octets to add, already inverted if
+ *   descrambling
+ * 
+ *   off : number(int) - the stream offset of the first byte
+ * 
+ * Return:
+ * 
+ *   a Uint8Array of PAT_LEN bytes, where byte i is the octet to add to
+ *   the byte at offset off + i
+ */
+function makePattern(kb, off) {
+  var func_name = "makePattern";
+  var pat, i;
+  
+  // Check parameters
+  if ((!Array.isArray(kb)) || (kb.length !== 3)) {
+    fault(func_name, 100);
+  }
+  
+  // Build pattern
+  pat = new Uint8Array(PAT_LEN);
+  for(i = 0; i < PAT_LEN; i++) {
+    pat[i] = kb[(off + i) % 3];
+  }
+  
+  return pat;
+}
+
+/*
+ * Transform a chunk in place with the portable kernel.
+ * 
+ * The pattern period in words is three, so three pattern words are
+ * cycled.  Adding the low seven bits of each byte cannot carry into the
+ * neighbouring byte, and the high bit is then fixed up with XOR, as in
+ * kernSwar() of warp64k.c.
+ * 
+ * Parameters:
+ * 
+ *   pat : Uint8Array - the pattern from makePattern()
+ * 
+ *   buf : ArrayBuffer - the chunk
+ */
+function transformSwar(pat, buf) {
+  var lo = 0x7f7f7f7f;
+  var hi = 0x80808080;
+  var b, w, pw, n, i, a, p0, p1, p2;
+  
+  // Get the pattern words; the pattern bytes are in memory order, so
+  // this works whatever the byte order
+  pw = new Uint32Array(pat.buffer, 0, 3);
+  p0 = pw[0];
+  p1 = pw[1];
+  p2 = pw[2];
+  
+  // Twelve bytes at a time
+  n = Math.floor(buf.byteLength / 12) * 3;
+  w = new Uint32Array(buf, 0, n);
+  for(i = 0; i < n; i += 3) {
+    a = w[i];
+    w[i] = ((a & lo) + (p0 & lo)) ^ ((a ^ p0) & hi);
+    a = w[i + 1];
+    w[i + 1] = ((a & lo) + (p1 & lo)) ^ ((a ^ p1) & hi);
+    a = w[i + 2];
+    w[i + 2] = ((a & lo) + (p2 & lo)) ^ ((a ^ p2) & hi);
+  }
+  
+  // The offset is now a multiple of three, so the remaining bytes start
+  // at the start of the pattern
+  b = new Uint8Array(buf);
+  for(i = n * 4; i < b.length; i++) {
+    b[i] = b[i] + pat[i - (n * 4)];
+  }
+}
+
+/*
+ * Transform a chunk in place.
+ * 
+ * The key octet used for each byte is given by its offset in the whole
+ * stream, so the bytes of one chunk don't depend on any other chunk.
+ * 
+ * The chunk is transformed in the buffer it was read into, which is
+ * then transferred to the page, so apart from the copy in and out of
+ * the memory of the WebAssembly kernel, no chunk is ever copied or
+ * allocated twice.  Only the chunk that ends with the trailer when
+ * scrambling needs a new buffer, three bytes longer than the input.
+ * 
+ * A SharedArrayBuffer would not save anything here even where the page
+ * is cross-origin isolated: Blob reads always return a new ArrayBuffer,
+ * and Blob and file stream writes don't take shared memory, so it would
+ * only add a copy at each end.
+ * 
+ * Parameters:
+ * 
+ *   kb : Array - the three octets to add, already inverted if
+ *   descrambling
+ * 
+ *   off : number(int) - the stream offset of the first byte
+ * 
+ *   src : ArrayBuffer - the input bytes
+ * 
+ *   n : number(int) - the chunk size, at least the length of src; if
+ *   it is longer, the rest of the chunk is the transform of zero bytes,
+ *   which is how the trailer is produced
+ * 
+ * Return:
+ * 
+ *   the transformed chunk, which is src itself unless the chunk needed
+ *   to be longer
+ */
+function transform(kb, off, src, n) {
+  var func_name = "transform";
+  var pat, mem, buf, b;
+  
+  // Check parameters
+  if (!(src instanceof ArrayBuffer)) {
+    fault(func_name, 100);
+  }
+  if ((src.byteLength > n) || (n > CHUNK_SIZE)) {
+    fault(func_name, 101);
+  }
+  
+  // Make room for the trailer if needed
+  buf = src;
+  if (src.byteLength < n) {
+    buf = new ArrayBuffer(n);
+    (new Uint8Array(buf)).set(new Uint8Array(src));
+  }
+  b = new Uint8Array(buf);
+  
+  pat = makePattern(kb, off);
+  
+  if (m_wasm) {
+    // Copy the pattern and the chunk into the memory of the kernel,
+    // transform it there, and copy it back
+    mem = new Uint8Array(m_wasm.memory.buffer);
+    mem.set(pat, PAT_ADDR);
+    mem.set(b, BUF_ADDR);
+    m_wasm.xform(PAT_ADDR, BUF_ADDR, n);
+    b.set(mem.subarray(BUF_ADDR, BUF_ADDR + n));
+    
+  } else {
+    transformSwar(pat, buf);
+  }
+  
+  return buf;
+}
+
+/*
+ * Wait until the page has room for another chunk.
+ * 
+ * Return:
+ * 
+ *   a Promise that resolves once fewer than MAX_INFLIGHT chunks are
+ *   waiting for the page
+ */
+function waitRoom() {
+  if (m_inflight < MAX_INFLIGHT) {
+    return Promise.resolve();
+  }
+  return new Promise(function(resolve) {
+    m_wake = resolve;
+  });
+}
+
+/*
+ * Perform the actual Warp64 scrambling or descrambling operation on the
+ * chunks of one lane.
  * 
  * Parameters:
  * 
@@ -234,17 +587,21 @@ function deriveKey(str) {
  * 
  *   key : string - the scrambling key
  * 
- *   data : ArrayBuffer - the input data
+ *   file : Blob - the input file
+ * 
+ *   lane : number(int) - the number of this worker
+ * 
+ *   lanes : number(int) - the number of workers
  * 
  * Return:
  * 
- *   ArrayBuffer containing the result, or a string containing a DIV ID
- *   of an error DIV if there was an error
+ *   a Promise of an empty string if successful, or a string containing
+ *   a DIV ID of an error DIV if there was an error
  */
-function warp64(descramble, key, data) {
+async function warp64(descramble, key, file, lane, lanes) {
   var func_name = "warp64";
   var kb, trail, tk, i, z;
-  var dest, srci, src, target, db;
+  var ilen, olen, xlen, off, n, ni, src, dest;
   
   // Check parameters
   if (typeof(descramble) !== "boolean") {
@@ -253,9 +610,15 @@ function warp64(descramble, key, data) {
   if (typeof(key) !== "string") {
     fault(func_name, 101);
   }
-  if (!(data instanceof ArrayBuffer)) {
+  if (!(file instanceof Blob)) {
     fault(func_name, 102);
   }
+  if ((typeof(lane) !== "number") || (typeof(lanes) !== "number")) {
+    fault(func_name, 103);
+  }
+  if ((lanes < 1) || (lane < 0) || (lane >= lanes)) {
+    fault(func_name, 104);
+  }
   
   // Derive normalized key
   kb = deriveKey(key);
@@ -263,42 +626,28 @@ function warp64(descramble, key, data) {
     return "divKeyError";
   }
   
-  // Special cases -- if descrambling mode and length is three, or if
-  // scrambling mode and length is zero, then just return special empty
-  // states
-  if (descramble && (data.byteLength === 3)) {
-    // Descrambling file of length three, so just return empty array
-    // buffer
-    return new ArrayBuffer(0);
-    
-  } else if ((!descramble) && (data.byteLength < 1)) {
-    // Scrambling file of length zero, so return is array with just the
-    // three normalized octets
-    dest = new ArrayBuffer(3);
-    target = new Uint8Array(dest);
-    target[0] = kb[0];
-    target[1] = kb[1];
-    target[2] = kb[2];
-    return dest;
-  }
-  
   // If this is descrambling mode, we must have at least three bytes of
   // data
+  ilen = file.size;
   if (descramble) {
-    if (data.byteLength < 3) {
+    if (ilen < 3) {
       return "divBadError";
     }
   }
   
   // If this is descrambling mode, then check that the scrambling key is
-  // correct
+  // correct, reading only the trailer
   if (descramble) {
     // Get the trailer bytes
-    trail = new Uint8Array(data, data.byteLength - 3, 3);
+    try {
+      trail = new Uint8Array(await readSlice(file, ilen - 3, ilen));
+    } catch (ex) {
+      return "divReadError";
+    }
     
     // Figure out the index of the scrambling key to use for the first
     // byte of the trailer
-    z = 3 - ((data.byteLength - 3) % 3);
+    z = 3 - ((ilen - 3) % 3);
     
     // Get the properly reordered scrambling key bytes
     tk = [];
@@ -321,82 +670,53 @@ function warp64(descramble, key, data) {
     }
   }
   
-  // Define the destination array buffer with the proper length
+  // Get the output length and the number of input bytes that are
+  // transformed; in scrambling mode, the input runs out three bytes
+  // before the output and the rest is the trailer
   if (descramble) {
-    dest = new ArrayBuffer(data.byteLength - 3);
+    olen = ilen - 3;
+    xlen = olen;
   } else {
-    dest = new ArrayBuffer(data.byteLength + 3);
+    olen = ilen + 3;
+    xlen = ilen;
   }
   
-  // Define the byte value lookup tables
-  db = [ [], [], [] ];
-  for(i = 0; i < 3; i++) {
-    for(z = 0; z < 256; z++) {
-      (db[i]).push((z + kb[i]) % 256);
-    }
-  }
+  // Pick the kernel
+  m_wasm = loadWasm();
   
-  // Process according to up to two different sources
-  for(srci = 0; srci < 2; srci++) {
-    // Get the appropriate source buffer
-    if (srci === 0) {
-      // First time around is always the main data, which excludes the
-      // trailer in descrambling mode
-      if (descramble) {
-        src = new Uint8Array(data, 0, data.byteLength - 3);
-      } else {
-        src = new Uint8Array(data);
-      }
-      
-    } else if (srci === 1) {
-      // Second time around in scrambling mode is three zero bytes,
-      // second pass is skipped in descrambling mode
-      if (descramble) {
-        break;
-      } else {
-        src = new Uint8Array(3);
-      }
-      
-    } else {
-      fault(func_name, 200);
-    }
+  // Process the chunks of this lane
+  for(off = lane * CHUNK_SIZE; off < olen; off += lanes * CHUNK_SIZE) {
+    // Don't get too far ahead of the page
+    await waitRoom();
     
-    // Get the appropriate target buffer
-    if (srci === 0) {
-      // First time around always starts at beginning and runs to same
-      // length as source
-      target = new Uint8Array(dest, 0, src.length);
-      
-    } else if (srci === 1) {
-      // Second time around only occurs in scrambling mode, starts three
-      // bytes from end, and runs to end
-      if (descramble) {
-        fault(func_name, 220);
+    // Work out the chunk size and how much of it comes from the input
+    n = Math.min(CHUNK_SIZE, olen - off);
+    ni = Math.max(0, Math.min(n, xlen - off));
+    
+    // Read and transform the chunk; the last chunk may be all trailer
+    try {
+      if (ni > 0) {
+        src = await readSlice(file, off, off + ni);
       } else {
-        target = new Uint8Array(dest, dest.byteLength - 3, 3);
+        src = new ArrayBuffer(0);
       }
-      
-    } else {
-      fault(func_name, 201);
+    } catch (ex) {
+      return "divReadError";
     }
+    dest = transform(kb, off, src, n);
+    src = undefined;
     
-    // Set the opening offset z
-    if (srci === 0) {
-      z = 0;
-    } else if (srci === 1) {
-      z = data.byteLength;
-    } else {
-      fault(func_name, 202);
-    }
-    
-    // Now transform from source to target
-    for(i = 0; i < src.length; i++) {
-      target[i] = db[(z + i) % 3][src[i]];
-    }
+    // Send it to the page, transferring the buffer
+    m_inflight++;
+    postMessage({
+      "off": off,
+      "chunk": dest
+    }, [dest]);
+    dest = undefined;
   }
   
-  // If we got here, return the destination result
-  return dest;
+  // If we got here, we were successful
+  return "";
 }
 
 /*
@@ -406,7 +726,7 @@ function warp64(descramble, key, data) {
 
 onmessage = function(e) {
   var func_name = "onmessage";
-  var msg, retval;
+  var msg, wake;
   
   // Get our message
   if (typeof(e) !== "object") {
@@ -421,43 +741,72 @@ onmessage = function(e) {
   if (typeof(msg) !== "object") {
     fault(func_name, 100);
   }
-  if (!("descramble" in msg)) {
-    fault(func_name, 101);
+  
+  // Handle acknowledgements, which may let the lane continue
+  if ("ack" in msg) {
+    if (m_inflight < 1) {
+      fault(func_name, 101);
+    }
+    m_inflight--;
+    if (m_wake) {
+      wake = m_wake;
+      m_wake = undefined;
+      wake();
+    }
+    return;
   }
-  if (!("key" in msg)) {
+  
+  // Otherwise, this must be the start message, and only one is allowed
+  if (m_started) {
     fault(func_name, 102);
   }
-  if (!("data" in msg)) {
+  m_started = true;
+  
+  if (!("descramble" in msg)) {
     fault(func_name, 103);
   }
-  
-  if (typeof(msg.descramble) !== "boolean") {
+  if (!("key" in msg)) {
     fault(func_name, 104);
   }
-  if (typeof(msg.key) !== "string") {
+  if (!("file" in msg)) {
     fault(func_name, 105);
   }
-  if (!(msg.data instanceof ArrayBuffer)) {
+  if ((!("lane" in msg)) || (!("lanes" in msg))) {
     fault(func_name, 106);
   }
   
-  // Call through to processing function
-  retval = warp64(msg.descramble, msg.key, msg.data);
+  if (typeof(msg.descramble) !== "boolean") {
+    fault(func_name, 107);
+  }
+  if (typeof(msg.key) !== "string") {
+    fault(func_name, 108);
+  }
+  if (!(msg.file instanceof Blob)) {
+    fault(func_name, 109);
+  }
   
-  // Send proper response message
-  if (retval instanceof ArrayBuffer) {
-    postMessage({
-      "status": true,
-      "data": retval
-    }, [retval]);
-    
-  } else if (typeof(retval) === "string") {
-    postMessage({
-      "status": false,
-      "errDiv": retval
+  // Call through to processing function and send the final message
+  // when it is done
+  warp64(msg.descramble, msg.key, msg.file, msg.lane, msg.lanes).then(
+    function(retval) {
+      if (typeof(retval) !== "string") {
+        fault(func_name, 200);
+      }
+      if (retval.length < 1) {
+        postMessage({
+          "status": true
+        });
+      } else {
+        postMessage({
+          "status": false,
+          "errDiv": retval
+        });
+      }
+    },
+    function(ex) {
+      postMessage({
+        "status": false,
+        "errDiv": "divProcError"
+      });
     });
-    
-  } else {
-    fault(func_name, 200);
-  }
 };
@@ -0,0 +1,2816 @@
+/*
+ * warp64bench.c
+ * =============
+ *
+ * Benchmark harness for Warp64.
+ *
+ * Syntax:
+ *
+ *   ./warp64bench kernel [options]
+ *   ./warp64bench file [options]
+ *   ./warp64bench conform [options]
+ *
+ * kernel mode measures each transform kernel of warp64k.c that the
+ * processor supports, transforming an in-memory buffer in place.  The
+ * following options are supported:
+ *
+ *   -n [bytes] is the buffer size, default 64M
+ *
+ *   -r [count] is the number of repetitions, default 5
+ *
+ * file mode measures end-to-end runs of the warp64 program.  It
+ * generates a file of each requested size in a scratch directory and
+ * then scrambles and descrambles it with every combination of the
+ * requested window sizes, thread counts and I/O backends.  The key is
+ * passed with --key-file.  After each round trip, the file is checked
+ * against a hash of the generated content.  The following options are
+ * supported:
+ *
+ *   -x [path] is the warp64 program, default ./warp64
+ *
+ *   -D [dir] is the scratch directory, default the current directory
+ *
+ *   -S [list] is the list of file sizes, default 0,100,4194307,64M,
+ *   which covers an empty file, a file under a page, an odd number of
+ *   bytes over a window boundary, and a larger file; add sizes such as
+ *   4G for multi-gigabyte runs
+ *
+ *   -W [list] is the list of window sizes, default 4M
+ *
+ *   -J [list] is the list of thread counts, default 1
+ *
+ *   -B [list] is the list of I/O backends, default mmap
+ *
+ *   -r [count] is the number of repetitions, default 3
+ *
+ * conform mode checks that every transform path gives the same output
+ * as a reference transform that looks each byte up in a dictionary of
+ * the key, the way warp64.c did before it had kernels.  Random lengths,
+ * offsets, keys and contents are run through every kernel the processor
+ * supports, the streaming interface of libwarp64.c in random pieces,
+ * its trailer checks, warp64_update_at() and key recovery, starting
+ * with lengths around the vector widths and offsets in every key phase
+ * around a window boundary and past 4 GiB.  If -x is given, the warp64
+ * program is checked as well, on files whose sizes fall on either side
+ * of the window boundaries in every key phase, with every combination
+ * of the window sizes, thread counts and backends, and through
+ * streaming in both directions.  Its pack extraction is checked too,
+ * with crafted packs whose member names lead out of the directory it
+ * runs in, which must fail without writing anything.  The following
+ * options are supported:
+ *
+ *   -n [bytes] is the longest random length, default 1M
+ *
+ *   -r [count] is the number of rounds, default 1000
+ *
+ *   -s [seed] is the seed of the rounds, default 1
+ *
+ *   -x [path] is the warp64 program to check, default none
+ *
+ *   -e [path] is the browser tool to check, default warp64.js
+ *
+ *   -D, -W, -J and -B are as for file mode, with default window sizes
+ *   of 64K and 1M, thread counts of 1 and 3, and backends mmap and
+ *   pread
+ *
+ * The browser tool in warp64.js is checked as well when node is on the
+ * PATH.  It is run once with its WebAssembly kernel and once with its
+ * portable kernel, on files whose sizes fall on either side of its
+ * chunk boundaries in every key phase, with one lane and with three,
+ * in both directions.  If node or the default tool is missing, a notice
+ * is printed and the check is skipped.
+ *
+ * Kernel and file mode can compare the throughput of each measurement
+ * with a baseline, which is the output of an earlier run:
+ *
+ *   -P [path] is the baseline file
+ *
+ *   -T [percent] is how far throughput may drop below the baseline,
+ *   default 10
+ *
+ * Lists are separated by commas.  Sizes may have a K, M or G suffix for
+ * binary kilobytes, megabytes and gigabytes.
+ *
+ * Each measurement is written to standard output as one JSON object on
+ * a line of its own, so that results can be collected and compared over
+ * time.  The fastest repetition is reported.  Measurements of file mode
+ * include the page cache, because the generated file has just been
+ * written; drop the cache between runs if cold-cache numbers are
+ * needed.
+ *
+ * The exit status is zero only if every measurement succeeded, every
+ * round trip and every conformance check matched, and no throughput
+ * dropped below the baseline by more than the tolerance.
+ *
+ * Build with the library and the kernels:
+ *
+ *   cc -D_FILE_OFFSET_BITS=64 -O2 -pthread -o warp64bench warp64bench.c
+ *     libwarp64.c warp64k.c
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Transform library and kernels */
+#include "libwarp64.h"
+#include "warp64k.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+/*
+ * Make sure _FILE_OFFSET_BITS is defined to 64.
+ */
+#ifdef _FILE_OFFSET_BITS
+#if (_FILE_OFFSET_BITS != 64)
+#error _FILE_OFFSET_BITS must be set to 64
+#endif
+#else
+#error _FILE_OFFSET_BITS must be set to 64
+#endif
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The maximum number of entries in a list option.
+ */
+#define MAX_LIST (64)
+
+/*
+ * The size of the buffer used to generate and hash files.
+ */
+#define GEN_BUFFER (1048576L)
+
+/*
+ * The key used for file runs and its key file name.
+ */
+#define BENCH_KEY "Bench64"
+#define KEY_FILE "warp64bench.key"
+
+/*
+ * The name of the generated file and its scrambled form.
+ */
+#define DATA_FILE "warp64bench.dat"
+#define DATA_SCRAMBLED "warp64bench.dat.warp64"
+
+/*
+ * The scratch directory of pack checks, the pack in it, and the name
+ * and content of the member that is packed.
+ */
+#define PACK_DIR "warp64bench.pk"
+#define PACK_ARCHIVE "warp64bench.pk.warp64"
+#define PACK_MEMBER "warp64bench.esc"
+#define PACK_DATA "Warp64 pack member\n"
+
+/*
+ * The maximum number of measurements in a baseline, and the maximum
+ * length of the identity of a measurement.
+ */
+#define MAX_BASE (4096)
+#define BASE_ID (256)
+
+/*
+ * The longest key string drawn for conformance rounds.
+ */
+#define MAX_KEYGEN (16)
+
+/*
+ * The number of mismatches reported in detail.
+ */
+#define MAX_REPORTS (20)
+
+/*
+ * The browser tool checked by default, the name of the node script that
+ * drives it, and the chunk size of the tool.
+ */
+#define JS_TOOL "warp64.js"
+#define JS_DRIVER "warp64bench.cjs"
+#define JS_CHUNK (INT64_C(4194304))
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * A measurement of the baseline.
+ */
+typedef struct {
+
+  /*
+   * The identity of the measurement, as described for baseLoad().
+   */
+  char id[BASE_ID];
+
+  /*
+   * The throughput in GB/s.
+   */
+  double gbps;
+
+} BASE_ENTRY;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The name of the executable module, for use in diagnostic messages.
+ *
+ * This is set at the start of the entrypoint.
+ */
+static const char *pModule = NULL;
+
+/*
+ * The baseline measurements, and how far in percent throughput may
+ * drop below them.
+ */
+static BASE_ENTRY m_base[MAX_BASE];
+static int m_nbase = 0;
+static double m_tolerance = 10.0;
+
+/*
+ * The number of conformance mismatches found so far.
+ */
+static int m_reported = 0;
+
+/*
+ * The node script that runs warp64.js outside of a browser, one line
+ * per entry, ending with NULL.
+ *
+ * It is run as:
+ *
+ *   node warp64bench.cjs [tool] [wasm|portable] [-s|-d] [key] [in] [out]
+ *     [lanes]
+ *
+ * The tool is loaded once for each lane, the way a page starts one
+ * worker per lane, with postMessage() and onmessage as its worker
+ * globals.  If the mode is portable, the tool doesn't see WebAssembly
+ * and falls back to its portable kernel; if the mode is wasm, it fails
+ * unless the tool took its WebAssembly kernel.  Each chunk is
+ * acknowledged the way the page does and placed at its offset in the
+ * output file.  The exit status is non-zero if any lane failed.
+ */
+static const char *m_jsDriver[] = {
+  "\"use strict\";",
+  "var fs = require(\"fs\");",
+  "var a = process.argv.slice(2);",
+  "var src = fs.readFileSync(a[0], \"utf8\");",
+  "var wasm = (a[1] === \"wasm\");",
+  "var file = new Blob([fs.readFileSync(a[4])]);",
+  "var lanes = parseInt(a[6], 10);",
+  "var pending = lanes;",
+  "var chunks = [];",
+  "var olen = 0;",
+  "var failed = \"\";",
+  "function lane(w) {",
+  "  var mod = new Function(\"WebAssembly\", \"postMessage\", \"onmessage\",",
+  "    src + \"\\n;return [onmessage, function() { return m_wasm; }];\")(",
+  "    wasm ? WebAssembly : undefined, function(msg) {",
+  "      if (\"chunk\" in msg) {",
+  "        chunks.push(msg);",
+  "        olen = Math.max(olen, msg.off + msg.chunk.byteLength);",
+  "        setImmediate(function() { mod[0]({\"data\": {\"ack\": true}}); });",
+  "        return;",
+  "      }",
+  "      if (!msg.status) {",
+  "        failed = msg.errDiv;",
+  "      } else if (wasm && (file.size > 0) && (!mod[1]())) {",
+  "        failed = \"no WebAssembly kernel\";",
+  "      }",
+  "      pending--;",
+  "      if (pending === 0) {",
+  "        done();",
+  "      }",
+  "    }, undefined);",
+  "  mod[0]({\"data\": {\"descramble\": (a[2] === \"-d\"), \"key\": a[3],",
+  "                   \"file\": file, \"lane\": w, \"lanes\": lanes}});",
+  "}",
+  "function done() {",
+  "  var out = new Uint8Array(olen);",
+  "  var i;",
+  "  if (failed) {",
+  "    console.error(\"warp64.js: \" + failed);",
+  "    process.exit(1);",
+  "  }",
+  "  for(i = 0; i < chunks.length; i++) {",
+  "    out.set(new Uint8Array(chunks[i].chunk), chunks[i].off);",
+  "  }",
+  "  fs.writeFileSync(a[5], out);",
+  "}",
+  "for(var w = 0; w < lanes; w++) {",
+  "  lane(w);",
+  "}",
+  NULL
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static double nowSec(void);
+static int parseSize(const char *pStr, int64_t *pv);
+static int parseList(const char *pStr, int64_t *pList, int *pCount);
+static int splitNames(char *pStr, char **ppList, int *pCount);
+static uint64_t fnvStep(uint64_t h, const uint8_t *p, size_t len);
+static int genFile(const char *pPath, int64_t size, uint64_t *ph);
+static int hashFile(const char *pPath, int64_t *psize, uint64_t *ph);
+static int runWarp(
+          char   ** ppArgs,
+    const char    * pIn,
+    const char    * pOut,
+          double  * pSec);
+static char *joinPath(const char *pDir, const char *pName);
+static char *findPath(const char *pName);
+static int baseLoad(const char *pPath);
+static int baseCheck(const char *pId, double gbps);
+static int benchKernel(int64_t size, int reps);
+static int benchFile(
+    const char    * pExe,
+    const char    * pDir,
+    const int64_t * pSizes,
+          int       nsize,
+    const int64_t * pWins,
+          int       nwin,
+    const int64_t * pThreads,
+          int       nthread,
+          char   ** ppBack,
+          int       nback,
+          int       reps);
+static uint64_t rngNext(uint64_t *px);
+static int32_t refNormalize(const char *pKey);
+static void refDict(uint8_t pDict[3][256], int32_t key);
+static void refRun(
+    uint8_t         pDict[3][256],
+    int64_t         off,
+    const uint8_t * pIn,
+    uint8_t       * pOut,
+    size_t          len);
+static int sameAs(
+    const char    * pPath,
+    const uint8_t * pGot,
+    const uint8_t * pWant,
+          size_t    len,
+          int64_t   off,
+          int32_t   key);
+static int conformLib(int64_t maxlen, int rounds, uint64_t seed);
+static int refHash(const char *pPath, int32_t key, uint64_t *ph);
+static int conformFile(
+    const char    * pExe,
+    const char    * pDir,
+    const int64_t * pWins,
+          int       nwin,
+    const int64_t * pThreads,
+          int       nthread,
+          char   ** ppBack,
+          int       nback);
+static void putU64(uint8_t *p, uint64_t v);
+static int packCraft(const char *pPath, int32_t key, const char *pName);
+static int conformPack(const char *pExe, const char *pDir);
+static int conformJs(const char *pTool, int given, const char *pDir);
+
+/*
+ * Return a monotonic timestamp in seconds.
+ *
+ * Return:
+ *
+ *   the timestamp
+ */
+static double nowSec(void) {
+  struct timespec ts;
+
+  memset(&ts, 0, sizeof(struct timespec));
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    abort();
+  }
+  return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1.0e9);
+}
+
+/*
+ * Parse a non-negative size with an optional K, M or G suffix.
+ *
+ * Parameters:
+ *
+ *   pStr - the string to parse
+ *
+ *   pv - receives the size
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if the string is not a valid size
+ */
+static int parseSize(const char *pStr, int64_t *pv) {
+  int64_t v = 0;
+  int64_t m = 1;
+
+  if ((pStr == NULL) || (pv == NULL)) {
+    abort();
+  }
+
+  if ((*pStr < '0') || (*pStr > '9')) {
+    return 0;
+  }
+  for( ; (*pStr >= '0') && (*pStr <= '9'); pStr++) {
+    if (v > (INT64_MAX - 9) / 10) {
+      return 0;
+    }
+    v = (v * 10) + ((int64_t) (*pStr - '0'));
+  }
+
+  if ((*pStr == 'K') || (*pStr == 'k')) {
+    m = INT64_C(1024);
+    pStr++;
+  } else if ((*pStr == 'M') || (*pStr == 'm')) {
+    m = INT64_C(1048576);
+    pStr++;
+  } else if ((*pStr == 'G') || (*pStr == 'g')) {
+    m = INT64_C(1073741824);
+    pStr++;
+  }
+  if (*pStr != 0) {
+    return 0;
+  }
+  if (v > INT64_MAX / m) {
+    return 0;
+  }
+
+  *pv = v * m;
+  return 1;
+}
+
+/*
+ * Parse a comma-separated list of sizes.
+ *
+ * Parameters:
+ *
+ *   pStr - the string to parse
+ *
+ *   pList - receives up to MAX_LIST sizes
+ *
+ *   pCount - receives the number of sizes
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if the list is not valid
+ */
+static int parseList(const char *pStr, int64_t *pList, int *pCount) {
+  char buf[64];
+  size_t n = 0;
+  int count = 0;
+
+  if ((pStr == NULL) || (pList == NULL) || (pCount == NULL)) {
+    abort();
+  }
+
+  for(;;) {
+    /* Copy the next entry */
+    for(n = 0; (pStr[n] != 0) && (pStr[n] != ','); n++);
+    if ((n < 1) || (n >= sizeof(buf)) || (count >= MAX_LIST)) {
+      return 0;
+    }
+    memcpy(buf, pStr, n);
+    buf[n] = 0;
+
+    if (!parseSize(buf, &(pList[count]))) {
+      return 0;
+    }
+    count++;
+
+    if (pStr[n] == 0) {
+      break;
+    }
+    pStr += n + 1;
+  }
+
+  *pCount = count;
+  return 1;
+}
+
+/*
+ * Split a comma-separated list of names in place.
+ *
+ * Parameters:
+ *
+ *   pStr - the string to split, which is modified
+ *
+ *   ppList - receives up to MAX_LIST pointers into the string
+ *
+ *   pCount - receives the number of names
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if the list is not valid
+ */
+static int splitNames(char *pStr, char **ppList, int *pCount) {
+  int count = 0;
+  char *pc = NULL;
+
+  if ((pStr == NULL) || (ppList == NULL) || (pCount == NULL)) {
+    abort();
+  }
+
+  for(;;) {
+    if ((*pStr == 0) || (*pStr == ',') || (count >= MAX_LIST)) {
+      return 0;
+    }
+    ppList[count] = pStr;
+    count++;
+
+    pc = strchr(pStr, ',');
+    if (pc == NULL) {
+      break;
+    }
+    *pc = 0;
+    pStr = pc + 1;
+  }
+
+  *pCount = count;
+  return 1;
+}
+
+/*
+ * Continue a 64-bit FNV-1a hash over some bytes.
+ *
+ * Parameters:
+ *
+ *   h - the hash so far
+ *
+ *   p - the bytes
+ *
+ *   len - the number of bytes
+ *
+ * Return:
+ *
+ *   the updated hash
+ */
+static uint64_t fnvStep(uint64_t h, const uint8_t *p, size_t len) {
+  size_t i = 0;
+
+  for(i = 0; i < len; i++) {
+    h ^= (uint64_t) p[i];
+    h *= UINT64_C(0x100000001b3);
+  }
+  return h;
+}
+
+/*
+ * Generate a file of pseudo-random bytes and hash its content.
+ *
+ * Error messages are printed.
+ *
+ * Parameters:
+ *
+ *   pPath - the file to create or replace
+ *
+ *   size - the number of bytes
+ *
+ *   ph - receives the hash of the content
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int genFile(const char *pPath, int64_t size, uint64_t *ph) {
+  int status = 1;
+  int fd = -1;
+  size_t i = 0;
+  size_t n = 0;
+  ssize_t rv = 0;
+  uint64_t h = UINT64_C(0xcbf29ce484222325);
+  uint64_t x = UINT64_C(0x9e3779b97f4a7c15);
+  uint8_t *pBuf = NULL;
+
+  if ((pPath == NULL) || (size < 0) || (ph == NULL)) {
+    abort();
+  }
+
+  pBuf = (uint8_t *) malloc((size_t) GEN_BUFFER);
+  if (pBuf == NULL) {
+    abort();
+  }
+
+  fd = open(pPath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pPath);
+  }
+
+  while (status && (size > 0)) {
+    /* Fill the buffer with a xorshift sequence */
+    n = (size_t) GEN_BUFFER;
+    if (size < (int64_t) n) {
+      n = (size_t) size;
+    }
+    for(i = 0; i < n; i++) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      pBuf[i] = (uint8_t) (x >> 32);
+    }
+    h = fnvStep(h, pBuf, n);
+
+    for(i = 0; status && (i < n); i += (size_t) rv) {
+      rv = write(fd, pBuf + i, n - i);
+      if (rv < 1) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to write '%s'\n", pModule, pPath);
+      }
+    }
+    size -= (int64_t) n;
+  }
+
+  if (fd >= 0) {
+    if (close(fd)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to close '%s'\n", pModule, pPath);
+    }
+    fd = -1;
+  }
+
+  free(pBuf);
+  pBuf = NULL;
+
+  if (status) {
+    *ph = h;
+  }
+  return status;
+}
+
+/*
+ * Get the size and content hash of a file.
+ *
+ * Error messages are printed.
+ *
+ * Parameters:
+ *
+ *   pPath - the file
+ *
+ *   psize - receives the size
+ *
+ *   ph - receives the hash of the content
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int hashFile(const char *pPath, int64_t *psize, uint64_t *ph) {
+  int status = 1;
+  int fd = -1;
+  ssize_t rv = 0;
+  int64_t size = 0;
+  uint64_t h = UINT64_C(0xcbf29ce484222325);
+  uint8_t *pBuf = NULL;
+
+  if ((pPath == NULL) || (psize == NULL) || (ph == NULL)) {
+    abort();
+  }
+
+  pBuf = (uint8_t *) malloc((size_t) GEN_BUFFER);
+  if (pBuf == NULL) {
+    abort();
+  }
+
+  fd = open(pPath, O_RDONLY);
+  if (fd < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pPath);
+  }
+
+  while (status) {
+    rv = read(fd, pBuf, (size_t) GEN_BUFFER);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s'\n", pModule, pPath);
+    } else if (rv == 0) {
+      break;
+    } else {
+      h = fnvStep(h, pBuf, (size_t) rv);
+      size += (int64_t) rv;
+    }
+  }
+
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  free(pBuf);
+  pBuf = NULL;
+
+  if (status) {
+    *psize = size;
+    *ph = h;
+  }
+  return status;
+}
+
+/*
+ * Run the warp64 program and time it.
+ *
+ * Standard input and output of the program are redirected to the given
+ * files, or to the null device.  Its error messages still go to
+ * standard error.
+ *
+ * Error messages are printed.
+ *
+ * Parameters:
+ *
+ *   ppArgs - the NULL-terminated argument list, starting with the
+ *   program path
+ *
+ *   pIn - the file to read standard input from, or NULL
+ *
+ *   pOut - the file to write standard output to, or NULL
+ *
+ *   pSec - receives the wall time in seconds
+ *
+ * Return:
+ *
+ *   non-zero if the program ran and succeeded, zero if not
+ */
+static int runWarp(
+          char   ** ppArgs,
+    const char    * pIn,
+    const char    * pOut,
+          double  * pSec) {
+
+  int status = 1;
+  int ws = 0;
+  int fn = -1;
+  pid_t pid = 0;
+  double t0 = 0.0;
+
+  if ((ppArgs == NULL) || (ppArgs[0] == NULL) || (pSec == NULL)) {
+    abort();
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  t0 = nowSec();
+  pid = fork();
+  if (pid < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to fork!\n", pModule);
+
+  } else if (pid == 0) {
+    /* Child; redirect and run the program */
+    fn = open((pIn != NULL) ? pIn : "/dev/null", O_RDONLY);
+    if (fn >= 0) {
+      dup2(fn, STDIN_FILENO);
+      close(fn);
+    }
+    if (pOut != NULL) {
+      fn = open(pOut, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    } else {
+      fn = open("/dev/null", O_WRONLY);
+    }
+    if (fn >= 0) {
+      dup2(fn, STDOUT_FILENO);
+      close(fn);
+    }
+    execv(ppArgs[0], ppArgs);
+    fprintf(stderr, "%s: Failed to run '%s'\n", pModule, ppArgs[0]);
+    _exit(127);
+  }
+
+  /* Wait for the program */
+  if (status) {
+    while (waitpid(pid, &ws, 0) < 0) {
+      if (errno != EINTR) {
+        status = 0;
+        fprintf(stderr, "%s: Failed to wait for program!\n", pModule);
+        break;
+      }
+    }
+  }
+  if (status) {
+    *pSec = nowSec() - t0;
+    if ((!WIFEXITED(ws)) || (WEXITSTATUS(ws) != 0)) {
+      status = 0;
+    }
+  }
+
+  return status;
+}
+
+/*
+ * Join a directory and a file name into a dynamically allocated path.
+ *
+ * Parameters:
+ *
+ *   pDir - the directory
+ *
+ *   pName - the file name
+ *
+ * Return:
+ *
+ *   the path, which the caller must free
+ */
+static char *joinPath(const char *pDir, const char *pName) {
+  char *pPath = NULL;
+
+  if ((pDir == NULL) || (pName == NULL)) {
+    abort();
+  }
+
+  pPath = (char *) malloc(strlen(pDir) + strlen(pName) + 2);
+  if (pPath == NULL) {
+    abort();
+  }
+  strcpy(pPath, pDir);
+  strcat(pPath, "/");
+  strcat(pPath, pName);
+  return pPath;
+}
+
+/*
+ * Look a program up in the directories of the PATH environment
+ * variable.
+ *
+ * Parameters:
+ *
+ *   pName - the program name
+ *
+ * Return:
+ *
+ *   the path of the first executable match, which the caller must free,
+ *   or NULL if there is none
+ */
+static char *findPath(const char *pName) {
+  const char *pEnv = NULL;
+  const char *pEnd = NULL;
+  char *pDir = NULL;
+  char *pPath = NULL;
+  size_t n = 0;
+
+  if (pName == NULL) {
+    abort();
+  }
+
+  pEnv = getenv("PATH");
+  while ((pEnv != NULL) && (pPath == NULL)) {
+    pEnd = strchr(pEnv, ':');
+    n = (pEnd != NULL) ? (size_t) (pEnd - pEnv) : strlen(pEnv);
+
+    /* An empty entry stands for the current directory */
+    pDir = (char *) malloc(n + 2);
+    if (pDir == NULL) {
+      abort();
+    }
+    if (n > 0) {
+      memcpy(pDir, pEnv, n);
+      pDir[n] = 0;
+    } else {
+      strcpy(pDir, ".");
+    }
+
+    pPath = joinPath(pDir, pName);
+    if (access(pPath, X_OK) != 0) {
+      free(pPath);
+      pPath = NULL;
+    }
+    free(pDir);
+    pDir = NULL;
+
+    pEnv = (pEnd != NULL) ? (pEnd + 1) : NULL;
+  }
+
+  return pPath;
+}
+
+/*
+ * Load the measurements of an earlier run as the baseline.
+ *
+ * The file is the standard output of an earlier run.  Each line that
+ * reports a throughput is stored under its identity, which is the part
+ * of the line before the repetition count, so that a measurement is
+ * compared with the earlier measurement of the same kind, size and
+ * configuration.  Other lines are ignored.
+ *
+ * Error messages are printed.
+ *
+ * Parameters:
+ *
+ *   pPath - the file
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int baseLoad(const char *pPath) {
+  int status = 1;
+  size_t n = 0;
+  char *pReps = NULL;
+  char *pRate = NULL;
+  FILE *pf = NULL;
+  char line[1024];
+
+  if (pPath == NULL) {
+    abort();
+  }
+
+  pf = fopen(pPath, "r");
+  if (pf == NULL) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pPath);
+  }
+
+  while (status && (fgets(line, sizeof(line), pf) != NULL)) {
+    pReps = strstr(line, ",\"reps\":");
+    pRate = strstr(line, "\"gbps\":");
+    if ((pReps == NULL) || (pRate == NULL) ||
+        (((size_t) (pReps - line)) >= BASE_ID)) {
+      continue;
+    }
+    if (m_nbase >= MAX_BASE) {
+      status = 0;
+      fprintf(stderr, "%s: Too many measurements in '%s'!\n",
+              pModule, pPath);
+      break;
+    }
+
+    n = (size_t) (pReps - line);
+    memcpy(m_base[m_nbase].id, line, n);
+    m_base[m_nbase].id[n] = 0;
+    m_base[m_nbase].gbps = strtod(pRate + 7, NULL);
+    m_nbase++;
+  }
+
+  if (pf != NULL) {
+    if (ferror(pf)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s'\n", pModule, pPath);
+    }
+    fclose(pf);
+    pf = NULL;
+  }
+  return status;
+}
+
+/*
+ * Compare a measurement with the baseline.
+ *
+ * A measurement that has no counterpart in the baseline passes.  A
+ * regression is reported.
+ *
+ * Parameters:
+ *
+ *   pId - the identity of the measurement, as described for
+ *   baseLoad()
+ *
+ *   gbps - the measured throughput
+ *
+ * Return:
+ *
+ *   non-zero if the throughput is within the tolerance of the baseline,
+ *   zero if it dropped further
+ */
+static int baseCheck(const char *pId, double gbps) {
+  int i = 0;
+
+  if (pId == NULL) {
+    abort();
+  }
+
+  for(i = 0; i < m_nbase; i++) {
+    if (strcmp(m_base[i].id, pId) != 0) {
+      continue;
+    }
+    if (gbps < m_base[i].gbps * (1.0 - (m_tolerance / 100.0))) {
+      fprintf(stderr,
+              "%s: Throughput dropped from %.3f to %.3f GB/s for %s}\n",
+              pModule, m_base[i].gbps, gbps, pId);
+      return 0;
+    }
+    break;
+  }
+  return 1;
+}
+
+/*
+ * Measure each supported kernel.
+ *
+ * Each kernel transforms a buffer of size bytes in place reps times,
+ * and the fastest repetition is reported and compared with the
+ * baseline.
+ *
+ * Parameters:
+ *
+ *   size - the buffer size in bytes
+ *
+ *   reps - the number of repetitions
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error or if a kernel dropped below
+ *   the baseline
+ */
+static int benchKernel(int64_t size, int reps) {
+  int status = 1;
+  int i = 0;
+  int r = 0;
+  int def = 0;
+  double t0 = 0.0;
+  double t = 0.0;
+  double best = 0.0;
+  double gbps = 0.0;
+  void *pv = NULL;
+  uint8_t *pBuf = NULL;
+  char id[BASE_ID];
+  WARP64K_KEY kk;
+
+  memset(id, 0, BASE_ID);
+  memset(&kk, 0, sizeof(WARP64K_KEY));
+
+  if ((size < 1) || (reps < 1)) {
+    abort();
+  }
+
+  /* Allocate and fill the buffer; it is touched first so that page
+   * faults are not measured */
+  if (posix_memalign(&pv, 4096, (size_t) size)) {
+    fprintf(stderr, "%s: Failed to allocate buffer!\n", pModule);
+    return 0;
+  }
+  pBuf = (uint8_t *) pv;
+  memset(pBuf, 0x5a, (size_t) size);
+
+  warp64k_key(&kk, 0x123456L);
+  def = warp64k_current();
+
+  for(i = 0; i < warp64k_count(); i++) {
+    if (!warp64k_select(i)) {
+      continue;
+    }
+
+    best = -1.0;
+    for(r = 0; r < reps; r++) {
+      t0 = nowSec();
+      warp64k_run(&kk, 0, pBuf, pBuf, (size_t) size);
+      t = nowSec() - t0;
+      if ((best < 0.0) || (t < best)) {
+        best = t;
+      }
+    }
+
+    gbps = (best > 0.0) ? (((double) size) / best / 1.0e9) : 0.0;
+    snprintf(id, BASE_ID,
+            "{\"bench\":\"kernel\",\"kernel\":\"%s\",\"default\":%s,"
+            "\"bytes\":%ld",
+            warp64k_name(i),
+            (i == def) ? "true" : "false",
+            (long) size);
+    printf("%s,\"reps\":%d,\"seconds\":%.9f,\"gbps\":%.3f}\n",
+            id, reps, best, gbps);
+    if (!baseCheck(id, gbps)) {
+      status = 0;
+    }
+  }
+
+  /* Restore the default kernel */
+  warp64k_select(def);
+
+  free(pBuf);
+  pBuf = NULL;
+  return status;
+}
+
+/*
+ * Measure end-to-end runs of the warp64 program.
+ *
+ * See the file header for details.
+ *
+ * Parameters:
+ *
+ *   pExe - the warp64 program
+ *
+ *   pDir - the scratch directory
+ *
+ *   pSizes, nsize - the file sizes
+ *
+ *   pWins, nwin - the window sizes
+ *
+ *   pThreads, nthread - the thread counts
+ *
+ *   ppBack, nback - the backend names
+ *
+ *   reps - the number of repetitions
+ *
+ * Return:
+ *
+ *   non-zero if every run succeeded and matched and none dropped below
+ *   the baseline, zero if not
+ */
+static int benchFile(
+    const char    * pExe,
+    const char    * pDir,
+    const int64_t * pSizes,
+          int       nsize,
+    const int64_t * pWins,
+          int       nwin,
+    const int64_t * pThreads,
+          int       nthread,
+          char   ** ppBack,
+          int       nback,
+          int       reps) {
+
+  int status = 1;
+  int ok = 0;
+  int si = 0;
+  int wi = 0;
+  int ti = 0;
+  int bi = 0;
+  int r = 0;
+  int op = 0;
+  double t = 0.0;
+  double best[2];
+  int64_t got = 0;
+  uint64_t h = 0;
+  uint64_t hgot = 0;
+  double gbps = 0.0;
+  FILE *pKey = NULL;
+  char *pKeyPath = NULL;
+  char *pData = NULL;
+  char *pScr = NULL;
+  char wbuf[32];
+  char tbuf[32];
+  char id[BASE_ID];
+  char *ppArgs[16];
+
+  memset(id, 0, BASE_ID);
+  memset(ppArgs, 0, sizeof(ppArgs));
+
+  if ((pExe == NULL) || (pDir == NULL) || (reps < 1)) {
+    abort();
+  }
+
+  pKeyPath = joinPath(pDir, KEY_FILE);
+  pData = joinPath(pDir, DATA_FILE);
+  pScr = joinPath(pDir, DATA_SCRAMBLED);
+
+  /* Write the key file */
+  pKey = fopen(pKeyPath, "w");
+  if (pKey == NULL) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pKeyPath);
+  }
+  if (pKey != NULL) {
+    fprintf(pKey, "%s\n", BENCH_KEY);
+    if (fclose(pKey)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write '%s'\n", pModule, pKeyPath);
+    }
+    pKey = NULL;
+  }
+
+  for(si = 0; status && (si < nsize); si++) {
+    /* Generate the file for this size */
+    unlink(pScr);
+    if (!genFile(pData, pSizes[si], &h)) {
+      status = 0;
+      break;
+    }
+
+    for(wi = 0; wi < nwin; wi++) {
+      for(ti = 0; ti < nthread; ti++) {
+        for(bi = 0; bi < nback; bi++) {
+          sprintf(wbuf, "%ld", (long) pWins[wi]);
+          sprintf(tbuf, "%ld", (long) pThreads[ti]);
+
+          ok = 1;
+          best[0] = -1.0;
+          best[1] = -1.0;
+          for(r = 0; ok && (r < reps); r++) {
+            for(op = 0; ok && (op < 2); op++) {
+              ppArgs[0] = (char *) pExe;
+              ppArgs[1] = (op == 0) ? "-s" : "-d";
+              ppArgs[2] = "--key-file";
+              ppArgs[3] = pKeyPath;
+              ppArgs[4] = "-w";
+              ppArgs[5] = wbuf;
+              ppArgs[6] = "-j";
+              ppArgs[7] = tbuf;
+              ppArgs[8] = "-b";
+              ppArgs[9] = ppBack[bi];
+              ppArgs[10] = (op == 0) ? pData : pScr;
+              ppArgs[11] = NULL;
+
+              if (!runWarp(ppArgs, NULL, NULL, &t)) {
+                ok = 0;
+                fprintf(stderr, "%s: warp64 failed!\n", pModule);
+                break;
+              }
+              if ((best[op] < 0.0) || (t < best[op])) {
+                best[op] = t;
+              }
+            }
+          }
+
+          /* Check the round trip */
+          if (ok) {
+            if (!hashFile(pData, &got, &hgot)) {
+              ok = 0;
+            } else if ((got != pSizes[si]) || (hgot != h)) {
+              ok = 0;
+              fprintf(stderr, "%s: Round trip mismatch!\n", pModule);
+            }
+          }
+
+          for(op = 0; op < 2; op++) {
+            gbps = (ok && (best[op] > 0.0)) ?
+                      (((double) pSizes[si]) / best[op] / 1.0e9) : 0.0;
+            snprintf(id, BASE_ID,
+                    "{\"bench\":\"file\",\"op\":\"%s\",\"bytes\":%ld,"
+                    "\"window\":%ld,\"threads\":%ld,\"backend\":\"%s\"",
+                    (op == 0) ? "scramble" : "descramble",
+                    (long) pSizes[si], (long) pWins[wi],
+                    (long) pThreads[ti], ppBack[bi]);
+            printf("%s,\"reps\":%d,\"ok\":%s,\"seconds\":%.6f,"
+                    "\"gbps\":%.3f}\n",
+                    id, reps, ok ? "true" : "false",
+                    (best[op] > 0.0) ? best[op] : 0.0, gbps);
+            if (ok && (!baseCheck(id, gbps))) {
+              status = 0;
+            }
+          }
+          fflush(stdout);
+
+          if (!ok) {
+            status = 0;
+
+            /* Regenerate the file so that later runs start clean */
+            unlink(pScr);
+            if (!genFile(pData, pSizes[si], &h)) {
+              break;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  /* Clean up the scratch files */
+  unlink(pData);
+  unlink(pScr);
+  unlink(pKeyPath);
+
+  free(pKeyPath);
+  free(pData);
+  free(pScr);
+
+  return status;
+}
+
+/*
+ * Return the next value of a xorshift sequence.
+ *
+ * Parameters:
+ *
+ *   px - the state of the sequence, which must not be zero
+ *
+ * Return:
+ *
+ *   the next value
+ */
+static uint64_t rngNext(uint64_t *px) {
+  uint64_t x = 0;
+
+  if (px == NULL) {
+    abort();
+  }
+
+  x = *px;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *px = x;
+  return x;
+}
+
+/*
+ * Normalize a key string the way the README describes it.
+ *
+ * The key string must be one or more base-64 characters.
+ *
+ * Parameters:
+ *
+ *   pKey - the key string
+ *
+ * Return:
+ *
+ *   the packed normalized key
+ */
+static int32_t refNormalize(const char *pKey) {
+  static const char *pAlpha =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  size_t n = 0;
+  size_t m = 0;
+  size_t i = 0;
+  int32_t seg = 0;
+  int32_t mixed = 0;
+  char c = 0;
+
+  if (pKey == NULL) {
+    abort();
+  }
+  n = strlen(pKey);
+  if (n < 1) {
+    abort();
+  }
+
+  /* Extend the key to a multiple of four with x_i = k_(i MOD n), and
+   * XOR its segments together */
+  m = ((n + 3) / 4) * 4;
+  for(i = 0; i < m; i++) {
+    if (i < n) {
+      c = pKey[i];
+    } else {
+      c = pKey[(i - n) % n];
+    }
+    if ((c == 0) || (strchr(pAlpha, c) == NULL)) {
+      abort();
+    }
+    seg = (seg << 6) | ((int32_t) (strchr(pAlpha, c) - pAlpha));
+    if ((i % 4) == 3) {
+      mixed ^= seg;
+      seg = 0;
+    }
+  }
+
+  /* Replace zero octets */
+  if ((mixed & INT32_C(0xff0000)) == 0) {
+    mixed |= INT32_C(0x010000);
+  }
+  if ((mixed & INT32_C(0x00ff00)) == 0) {
+    mixed |= INT32_C(0x000200);
+  }
+  if ((mixed & INT32_C(0x0000ff)) == 0) {
+    mixed |= INT32_C(0x000004);
+  }
+
+  return mixed;
+}
+
+/*
+ * Build the dictionary of the reference transform for a key.
+ *
+ * Entry [k][b] is what byte value b transforms to in key phase k, which
+ * is how warp64.c transformed every byte before it had kernels.
+ *
+ * Parameters:
+ *
+ *   pDict - receives the dictionary
+ *
+ *   key - the packed key
+ */
+static void refDict(uint8_t pDict[3][256], int32_t key) {
+  int k = 0;
+  int b = 0;
+  int z = 0;
+
+  if ((pDict == NULL) || (key < 0) || (key > INT32_C(0xffffff))) {
+    abort();
+  }
+
+  for(k = 0; k < 3; k++) {
+    z = (int) ((key >> (8 * (2 - k))) & 0xff);
+    for(b = 0; b < 256; b++) {
+      pDict[k][b] = (uint8_t) ((b + z) % 256);
+    }
+  }
+}
+
+/*
+ * Transform bytes through the reference dictionary.
+ *
+ * Parameters:
+ *
+ *   pDict - the dictionary
+ *
+ *   off - the stream offset of the first byte
+ *
+ *   pIn - the input bytes, or NULL for zero bytes
+ *
+ *   pOut - receives the output bytes
+ *
+ *   len - the number of bytes
+ */
+static void refRun(
+    uint8_t         pDict[3][256],
+    int64_t         off,
+    const uint8_t * pIn,
+    uint8_t       * pOut,
+    size_t          len) {
+
+  size_t i = 0;
+  int k = 0;
+
+  if ((pDict == NULL) || (off < 0) || (pOut == NULL)) {
+    abort();
+  }
+
+  k = (int) (off % 3);
+  for(i = 0; i < len; i++) {
+    pOut[i] = pDict[k][(pIn != NULL) ? pIn[i] : 0];
+    k = ((k + 1) % 3);
+  }
+}
+
+/*
+ * Compare the output of a transform path with the reference.
+ *
+ * The first mismatch is reported along with the case it happened in,
+ * up to MAX_REPORTS mismatches in all.
+ *
+ * Parameters:
+ *
+ *   pPath - the name of the path under test
+ *
+ *   pGot - the output of the path
+ *
+ *   pWant - the reference output
+ *
+ *   len - the number of bytes
+ *
+ *   off - the stream offset of the first byte
+ *
+ *   key - the packed key
+ *
+ * Return:
+ *
+ *   non-zero if the outputs are identical, zero if not
+ */
+static int sameAs(
+    const char    * pPath,
+    const uint8_t * pGot,
+    const uint8_t * pWant,
+          size_t    len,
+          int64_t   off,
+          int32_t   key) {
+
+  size_t i = 0;
+
+  if ((pPath == NULL) ||
+      (((pGot == NULL) || (pWant == NULL)) && (len > 0))) {
+    abort();
+  }
+
+  if ((len < 1) || (memcmp(pGot, pWant, len) == 0)) {
+    return 1;
+  }
+  for(i = 0; pGot[i] == pWant[i]; i++);
+  if (m_reported < MAX_REPORTS) {
+    fprintf(stderr,
+            "%s: %s differs at byte %ld of %ld from offset %ld, key %06lx\n",
+            pModule, pPath, (long) i, (long) len, (long) off,
+            (unsigned long) key);
+  }
+  m_reported++;
+  return 0;
+}
+
+/*
+ * Check every transform path of the library against the reference.
+ *
+ * Each round draws a length, a stream offset, a key string and the
+ * input bytes.  The key is normalized by warp64_derive(), which must
+ * agree with refNormalize(), and the reference output is computed
+ * through the dictionary.
+ * The first rounds go through every pair of a length around the vector
+ * widths and their multiples of three, and an offset in each key phase,
+ * around a window boundary or past 4 GiB; later rounds are random.  Each
+ * round is then run through:
+ *
+ *   every kernel the processor supports, from a separate buffer, in
+ *   place, and on zero input
+ *
+ *   a scrambling stream fed in random pieces, and its trailer
+ *
+ *   a descrambling stream fed in random pieces from the reference
+ *   output, its trailer check, and a damaged trailer
+ *
+ *   warp64_update_at() on a random range
+ *
+ * and key recovery from the trailer and key encoding.
+ *
+ * A line is written to standard output for each path with the number
+ * of rounds and whether they all matched, and mismatches are reported.
+ *
+ * Parameters:
+ *
+ *   maxlen - the longest length to draw
+ *
+ *   rounds - the number of rounds
+ *
+ *   seed - the seed of the rounds
+ *
+ * Return:
+ *
+ *   non-zero if every path matched, zero if not
+ */
+static int conformLib(int64_t maxlen, int rounds, uint64_t seed) {
+  static const int64_t edgeLen[] = {
+    0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 48, 49,
+    63, 64, 65, 95, 96, 97, 143, 144, 145, 191, 192, 193, 251, 252,
+    253, 255, 256, 257, 4095, 4096, 4097
+  };
+  static const int64_t edgeOff[] = {
+    0, 1, 2, 4194301, 4194302, 4194303, 4194304, 4194305,
+    INT64_C(4294967295), INT64_C(4294967296), INT64_C(4294967297)
+  };
+  static const char *pAlpha =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  int status = 1;
+  int r = 0;
+  int i = 0;
+  int def = 0;
+  int nkern = 0;
+  int nedge = 0;
+  int noff = 0;
+  int64_t len = 0;
+  int64_t off = 0;
+  int64_t done = 0;
+  int64_t n = 0;
+  int64_t a = 0;
+  int32_t key = 0;
+  uint64_t x = 0;
+  WARP64_CTX *pc = NULL;
+  uint8_t *pIn = NULL;
+  uint8_t *pRef = NULL;
+  uint8_t *pOut = NULL;
+  char kstr[WARP64_KEYSTR + 1];
+  uint8_t trailer[WARP64_TRAILER];
+  uint8_t want[WARP64_TRAILER];
+  uint8_t dict[3][256];
+  char kgen[MAX_KEYGEN + 1];
+  int fails[MAX_LIST + 5];
+  WARP64K_KEY kk;
+
+  memset(kstr, 0, sizeof(kstr));
+  memset(kgen, 0, sizeof(kgen));
+  memset(trailer, 0, WARP64_TRAILER);
+  memset(want, 0, WARP64_TRAILER);
+  memset(fails, 0, sizeof(fails));
+  memset(&kk, 0, sizeof(WARP64K_KEY));
+
+  if ((maxlen < 1) || (rounds < 1)) {
+    abort();
+  }
+
+  nkern = warp64k_count();
+  if (nkern > MAX_LIST) {
+    abort();
+  }
+  def = warp64k_current();
+  nedge = (int) (sizeof(edgeLen) / sizeof(edgeLen[0]));
+  noff = (int) (sizeof(edgeOff) / sizeof(edgeOff[0]));
+
+  pIn = (uint8_t *) malloc((size_t) maxlen);
+  pRef = (uint8_t *) malloc((size_t) maxlen);
+  pOut = (uint8_t *) malloc((size_t) maxlen);
+  if ((pIn == NULL) || (pRef == NULL) || (pOut == NULL)) {
+    abort();
+  }
+
+  x = seed ^ UINT64_C(0x9e3779b97f4a7c15);
+  if (x == 0) {
+    x = 1;
+  }
+
+  for(r = 0; r < rounds; r++) {
+    /* Draw the case; the edge rounds go through every pair of an edge
+     * length and an edge offset */
+    if (r < nedge * noff) {
+      len = edgeLen[r % nedge];
+      off = edgeOff[r / nedge];
+    } else {
+      len = (int64_t) (rngNext(&x) % (uint64_t) (maxlen + 1));
+      off = (int64_t) (rngNext(&x) % UINT64_C(1099511627776));
+    }
+    if (len > maxlen) {
+      len = maxlen;
+    }
+    n = 1 + (int64_t) (rngNext(&x) % MAX_KEYGEN);
+    for(a = 0; a < n; a++) {
+      kgen[a] = pAlpha[rngNext(&x) % 64];
+    }
+    kgen[n] = 0;
+    key = warp64_derive(kgen);
+    if (key != refNormalize(kgen)) {
+      fails[nkern + 4]++;
+      fprintf(stderr, "%s: Key '%s' normalizes to %06lx, not %06lx\n",
+              pModule, kgen, (unsigned long) key,
+              (unsigned long) refNormalize(kgen));
+      key = refNormalize(kgen);
+    }
+    for(a = 0; a < len; a++) {
+      pIn[a] = (uint8_t) (rngNext(&x) >> 32);
+    }
+
+    refDict(dict, key);
+    refRun(dict, off, pIn, pRef, (size_t) len);
+
+    /* Every kernel, from a buffer, in place and on zeros */
+    warp64k_key(&kk, key);
+    for(i = 0; i < nkern; i++) {
+      if (!warp64k_select(i)) {
+        continue;
+      }
+      memset(pOut, 0, (size_t) len);
+      warp64k_run(&kk, (int) (off % 3), pIn, pOut, (size_t) len);
+      if (!sameAs(warp64k_name(i), pOut, pRef, (size_t) len, off, key)) {
+        fails[i]++;
+      }
+      memcpy(pOut, pIn, (size_t) len);
+      warp64k_run(&kk, (int) (off % 3), pOut, pOut, (size_t) len);
+      if (!sameAs(warp64k_name(i), pOut, pRef, (size_t) len, off, key)) {
+        fails[i]++;
+      }
+    }
+    warp64k_select(def);
+    refRun(dict, off, NULL, pRef, (size_t) len);
+    warp64k_run(&kk, (int) (off % 3), NULL, pOut, (size_t) len);
+    if (!sameAs("zero input", pOut, pRef, (size_t) len, off, key)) {
+      fails[nkern]++;
+    }
+    refRun(dict, off, pIn, pRef, (size_t) len);
+
+    /* A scrambling stream in random pieces, and its trailer */
+    pc = warp64_init(key, WARP64_SCRAMBLE);
+    if (pc == NULL) {
+      abort();
+    }
+    warp64_seek(pc, off);
+    for(done = 0; done < len; done += n) {
+      n = 1 + (int64_t) (rngNext(&x) % (uint64_t) (len - done));
+      warp64_update(pc, pIn + done, pOut + done, (size_t) n);
+    }
+    warp64_final(pc, trailer);
+    pc = NULL;
+    refRun(dict, off + len, NULL, want, WARP64_TRAILER);
+    if ((!sameAs("stream", pOut, pRef, (size_t) len, off, key)) ||
+        (!sameAs("stream trailer", trailer, want, WARP64_TRAILER,
+                  off + len, key))) {
+      fails[nkern + 1]++;
+    }
+
+    /* A descrambling stream in random pieces, and its trailer checks */
+    pc = warp64_init(key, WARP64_DESCRAMBLE);
+    if (pc == NULL) {
+      abort();
+    }
+    warp64_seek(pc, off);
+    memcpy(pOut, pRef, (size_t) len);
+    for(done = 0; done < len; done += n) {
+      n = 1 + (int64_t) (rngNext(&x) % (uint64_t) (len - done));
+      warp64_update(pc, pOut + done, pOut + done, (size_t) n);
+    }
+    if (warp64_offset(pc) != off + len) {
+      fails[nkern + 2]++;
+      fprintf(stderr, "%s: descramble stream is at the wrong offset\n",
+              pModule);
+    }
+    if (!sameAs("descramble", pOut, pIn, (size_t) len, off, key)) {
+      fails[nkern + 2]++;
+    }
+    if (warp64_final(pc, want) != WARP64_OK) {
+      fails[nkern + 2]++;
+      fprintf(stderr, "%s: descramble rejected a good trailer\n",
+              pModule);
+    }
+    pc = NULL;
+    pc = warp64_init(key, WARP64_DESCRAMBLE);
+    if (pc == NULL) {
+      abort();
+    }
+    warp64_seek(pc, off + len);
+    want[r % WARP64_TRAILER] ^= (uint8_t) (1 + (r % 255));
+    if (warp64_final(pc, want) != WARP64_ERR_KEY) {
+      fails[nkern + 2]++;
+      fprintf(stderr, "%s: descramble accepted a damaged trailer\n",
+              pModule);
+    }
+    want[r % WARP64_TRAILER] ^= (uint8_t) (1 + (r % 255));
+    pc = NULL;
+
+    /* A random range at its offset */
+    pc = warp64_init(key, WARP64_SCRAMBLE);
+    if (pc == NULL) {
+      abort();
+    }
+    a = 0;
+    n = 0;
+    if (len > 0) {
+      a = (int64_t) (rngNext(&x) % (uint64_t) len);
+      n = (int64_t) (rngNext(&x) % (uint64_t) (len - a + 1));
+    }
+    warp64_update_at(pc, off + a, pIn + a, pOut, (size_t) n);
+    if (!sameAs("update_at", pOut, pRef + a, (size_t) n, off + a, key)) {
+      fails[nkern + 3]++;
+    }
+    warp64_final(pc, NULL);
+    pc = NULL;
+
+    /* Key recovery and encoding */
+    warp64_encode(key, kstr);
+    if ((warp64_recover(off + len, want) != key) ||
+        (warp64_derive(kstr) != key)) {
+      fails[nkern + 4]++;
+      fprintf(stderr, "%s: Key %06lx fails recovery or encoding\n",
+              pModule, (unsigned long) key);
+    }
+  }
+
+  /* Report each path */
+  for(i = 0; i < nkern + 5; i++) {
+    if ((i < nkern) && (!warp64k_supported(i))) {
+      continue;
+    }
+    printf("{\"bench\":\"conform\",\"path\":\"%s\",\"rounds\":%d,"
+            "\"failed\":%d,\"ok\":%s}\n",
+            (i < nkern) ? warp64k_name(i) :
+              ((i == nkern) ? "zero input" :
+              ((i == nkern + 1) ? "stream" :
+              ((i == nkern + 2) ? "descramble" :
+              ((i == nkern + 3) ? "update_at" : "key")))),
+            rounds, fails[i], (fails[i] > 0) ? "false" : "true");
+    if (fails[i] > 0) {
+      status = 0;
+    }
+  }
+  fflush(stdout);
+
+  free(pIn);
+  free(pRef);
+  free(pOut);
+  pIn = NULL;
+  pRef = NULL;
+  pOut = NULL;
+
+  return status;
+}
+
+/*
+ * Hash what a file scrambles to under the reference transform.
+ *
+ * This is the hash of the reference output for the content of the file
+ * followed by the trailer.
+ *
+ * Error messages are printed.
+ *
+ * Parameters:
+ *
+ *   pPath - the file
+ *
+ *   key - the packed key
+ *
+ *   ph - receives the hash
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int refHash(const char *pPath, int32_t key, uint64_t *ph) {
+  int status = 1;
+  int fd = -1;
+  ssize_t rv = 0;
+  int64_t off = 0;
+  uint64_t h = UINT64_C(0xcbf29ce484222325);
+  uint8_t *pBuf = NULL;
+  uint8_t trailer[3];
+  uint8_t dict[3][256];
+
+  if ((pPath == NULL) || (ph == NULL)) {
+    abort();
+  }
+
+  refDict(dict, key);
+  pBuf = (uint8_t *) malloc((size_t) GEN_BUFFER);
+  if (pBuf == NULL) {
+    abort();
+  }
+
+  fd = open(pPath, O_RDONLY);
+  if (fd < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pPath);
+  }
+
+  while (status) {
+    rv = read(fd, pBuf, (size_t) GEN_BUFFER);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      status = 0;
+      fprintf(stderr, "%s: Failed to read '%s'\n", pModule, pPath);
+    } else if (rv == 0) {
+      break;
+    } else {
+      refRun(dict, off, pBuf, pBuf, (size_t) rv);
+      h = fnvStep(h, pBuf, (size_t) rv);
+      off += (int64_t) rv;
+    }
+  }
+  if (status) {
+    refRun(dict, off, NULL, trailer, 3);
+    h = fnvStep(h, trailer, 3);
+  }
+
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  free(pBuf);
+  pBuf = NULL;
+
+  if (status) {
+    *ph = h;
+  }
+  return status;
+}
+
+/*
+ * Check the file and stream paths of the warp64 program against the
+ * reference.
+ *
+ * For each window size, files are generated with sizes at the window
+ * boundaries that fall in every key phase, and each is scrambled with
+ * every combination of the thread counts and I/O backends.  The
+ * scrambled file is checked against the reference, and the descrambled
+ * file against the generated content.  Each file is then also streamed
+ * through standard input and output in both directions and checked the
+ * same way.
+ *
+ * A line is written to standard output for each run, and mismatches
+ * are reported.
+ *
+ * Parameters:
+ *
+ *   pExe - the warp64 program
+ *
+ *   pDir - the scratch directory
+ *
+ *   pWins, nwin - the window sizes
+ *
+ *   pThreads, nthread - the thread counts
+ *
+ *   ppBack, nback - the backend names
+ *
+ * Return:
+ *
+ *   non-zero if every run succeeded and matched, zero if not
+ */
+static int conformFile(
+    const char    * pExe,
+    const char    * pDir,
+    const int64_t * pWins,
+          int       nwin,
+    const int64_t * pThreads,
+          int       nthread,
+          char   ** ppBack,
+          int       nback) {
+
+  static const int64_t edgeWin[][2] = {
+    {0, 0}, {0, 1}, {0, 2}, {0, 3}, {1, -1}, {1, 0}, {1, 1}, {1, 2},
+    {2, 1}, {3, 2}, {4, -2}
+  };
+
+  int status = 1;
+  int ok = 0;
+  int wi = 0;
+  int ci = 0;
+  int ti = 0;
+  int bi = 0;
+  int nrun = 0;
+  int r = 0;
+  int32_t key = 0;
+  int64_t size = 0;
+  int64_t got = 0;
+  uint64_t h = 0;
+  uint64_t hs = 0;
+  uint64_t hgot = 0;
+  double t = 0.0;
+  FILE *pKey = NULL;
+  char *pKeyPath = NULL;
+  char *pData = NULL;
+  char *pScr = NULL;
+  char wbuf[32];
+  char tbuf[32];
+  char *ppArgs[16];
+
+  memset(ppArgs, 0, sizeof(ppArgs));
+
+  if ((pExe == NULL) || (pDir == NULL)) {
+    abort();
+  }
+
+  key = warp64_derive(BENCH_KEY);
+  pKeyPath = joinPath(pDir, KEY_FILE);
+  pData = joinPath(pDir, DATA_FILE);
+  pScr = joinPath(pDir, DATA_SCRAMBLED);
+
+  /* Write the key file */
+  pKey = fopen(pKeyPath, "w");
+  if (pKey == NULL) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pKeyPath);
+  }
+  if (pKey != NULL) {
+    fprintf(pKey, "%s\n", BENCH_KEY);
+    if (fclose(pKey)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write '%s'\n", pModule, pKeyPath);
+    }
+    pKey = NULL;
+  }
+
+  nrun = 1 + (nthread * nback);
+  for(wi = 0; status && (wi < nwin); wi++) {
+    for(ci = 0; ci < (int) (sizeof(edgeWin) / sizeof(edgeWin[0])); ci++) {
+      size = (edgeWin[ci][0] * pWins[wi]) + edgeWin[ci][1];
+      if (size < 0) {
+        continue;
+      }
+
+      /* Generate the file and work out what it scrambles to */
+      unlink(pScr);
+      if ((!genFile(pData, size, &h)) || (!refHash(pData, key, &hs))) {
+        status = 0;
+        break;
+      }
+
+      for(r = 0; r < nrun; r++) {
+        ti = (r - 1) / nback;
+        bi = (r - 1) % nback;
+        sprintf(wbuf, "%ld", (long) pWins[wi]);
+        if (r > 0) {
+          sprintf(tbuf, "%ld", (long) pThreads[ti]);
+        }
+
+        ppArgs[0] = (char *) pExe;
+        ppArgs[1] = "-s";
+        ppArgs[2] = "--key-file";
+        ppArgs[3] = pKeyPath;
+        if (r < 1) {
+          /* Stream the file both ways */
+          ppArgs[4] = "-";
+          ppArgs[5] = NULL;
+          ok = runWarp(ppArgs, pData, pScr, &t);
+          if (ok) {
+            ok = hashFile(pScr, &got, &hgot);
+          }
+          if (ok && ((got != size + 3) || (hgot != hs))) {
+            ok = 0;
+            fprintf(stderr, "%s: Scrambled stream differs!\n", pModule);
+          }
+          if (ok) {
+            ppArgs[1] = "-d";
+            ok = runWarp(ppArgs, pScr, pData, &t);
+          }
+          unlink(pScr);
+        } else {
+          /* Scramble and descramble the file */
+          ppArgs[4] = "-w";
+          ppArgs[5] = wbuf;
+          ppArgs[6] = "-j";
+          ppArgs[7] = tbuf;
+          ppArgs[8] = "-b";
+          ppArgs[9] = ppBack[bi];
+          ppArgs[10] = pData;
+          ppArgs[11] = NULL;
+          ok = runWarp(ppArgs, NULL, NULL, &t);
+          if (ok) {
+            ok = hashFile(pScr, &got, &hgot);
+          }
+          if (ok && ((got != size + 3) || (hgot != hs))) {
+            ok = 0;
+            fprintf(stderr, "%s: Scrambled file differs!\n", pModule);
+          }
+          if (ok) {
+            ppArgs[1] = "-d";
+            ppArgs[10] = pScr;
+            ok = runWarp(ppArgs, NULL, NULL, &t);
+          }
+        }
+        if (!ok) {
+          fprintf(stderr, "%s: warp64 failed!\n", pModule);
+        }
+
+        /* Check the round trip */
+        if (ok) {
+          if (!hashFile(pData, &got, &hgot)) {
+            ok = 0;
+          } else if ((got != size) || (hgot != h)) {
+            ok = 0;
+            fprintf(stderr, "%s: Round trip mismatch!\n", pModule);
+          }
+        }
+
+        if (r < 1) {
+          printf("{\"bench\":\"conform\",\"path\":\"program stream\","
+                  "\"bytes\":%ld,\"ok\":%s}\n",
+                  (long) size, ok ? "true" : "false");
+        } else {
+          printf("{\"bench\":\"conform\",\"path\":\"program file\","
+                  "\"bytes\":%ld,\"window\":%ld,\"threads\":%ld,"
+                  "\"backend\":\"%s\",\"ok\":%s}\n",
+                  (long) size, (long) pWins[wi], (long) pThreads[ti],
+                  ppBack[bi], ok ? "true" : "false");
+        }
+        fflush(stdout);
+
+        if (!ok) {
+          status = 0;
+
+          /* Regenerate the file so that later runs start clean */
+          unlink(pScr);
+          if (!genFile(pData, size, &h)) {
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  /* Clean up the scratch files */
+  unlink(pData);
+  unlink(pScr);
+  unlink(pKeyPath);
+
+  free(pKeyPath);
+  free(pData);
+  free(pScr);
+
+  return status;
+}
+
+/*
+ * Store a 64-bit integer in big-endian order.
+ *
+ * Parameters:
+ *
+ *   p - receives the eight bytes
+ *
+ *   v - the integer
+ */
+static void putU64(uint8_t *p, uint64_t v) {
+  int i = 0;
+
+  for(i = 7; i >= 0; i--) {
+    p[i] = (uint8_t) (v & 0xff);
+    v >>= 8;
+  }
+}
+
+/*
+ * Write a pack holding a single member under any name.
+ *
+ * The pack is laid out the way warp64 --pack lays it out, with a
+ * correct index hash, so that a name warp64 would never have stored
+ * only stands out by being that name.  The member holds PACK_DATA.
+ *
+ * Error messages are printed.
+ *
+ * Parameters:
+ *
+ *   pPath - the pack to create
+ *
+ *   key - the packed key
+ *
+ *   pName - the member name
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int packCraft(const char *pPath, int32_t key, const char *pName) {
+  int status = 1;
+  int fd = -1;
+  size_t dlen = 0;
+  size_t nlen = 0;
+  size_t ilen = 0;
+  size_t len = 0;
+  uint64_t h = 0;
+  uint8_t *pBuf = NULL;
+  uint8_t *p = NULL;
+  WARP64_CTX *pc = NULL;
+
+  if ((pPath == NULL) || (pName == NULL)) {
+    abort();
+  }
+
+  dlen = strlen(PACK_DATA);
+  nlen = strlen(pName);
+  ilen = 25 + nlen;
+  len = dlen + ilen + 40 + 3;
+  pBuf = (uint8_t *) calloc(len, 1);
+  if (pBuf == NULL) {
+    abort();
+  }
+
+  /* Member data, then its index entry, then the footer */
+  memcpy(pBuf, PACK_DATA, dlen);
+  p = &(pBuf[dlen]);
+  putU64(&(p[8]), (uint64_t) dlen);
+  putU64(&(p[16]), (uint64_t) nlen);
+  memcpy(&(p[25]), pName, nlen);
+  h = fnvStep(UINT64_C(0xcbf29ce484222325), p, ilen);
+  p = &(pBuf[dlen + ilen]);
+  memcpy(p, "W64PACK1", 8);
+  putU64(&(p[8]), (uint64_t) dlen);
+  putU64(&(p[16]), (uint64_t) ilen);
+  putU64(&(p[24]), 1);
+  putU64(&(p[32]), h);
+
+  /* Scramble it with its trailer */
+  pc = warp64_init(key, WARP64_SCRAMBLE);
+  if (pc == NULL) {
+    abort();
+  }
+  warp64_update(pc, pBuf, pBuf, len - 3);
+  warp64_final(pc, &(pBuf[len - 3]));
+  pc = NULL;
+
+  fd = open(pPath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pPath);
+  }
+  if (status && (write(fd, pBuf, len) != (ssize_t) len)) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to write '%s'\n", pModule, pPath);
+  }
+  if (fd >= 0) {
+    if (close(fd) && status) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write '%s'\n", pModule, pPath);
+    }
+    fd = -1;
+  }
+
+  free(pBuf);
+  pBuf = NULL;
+
+  return status;
+}
+
+/*
+ * Check that the warp64 program only extracts pack members below the
+ * directory it runs in.
+ *
+ * A scratch directory PACK_DIR is made in pDir, with a work directory
+ * in it that holds a symbolic link to its parent.  Packs are crafted
+ * with member names that lead out of the work directory, by "..", by a
+ * leading "/" or through the link, and extracting each of them in the
+ * work directory must fail without writing the member anywhere.  A
+ * pack with an ordinary name in a subdirectory is extracted as well,
+ * and must succeed, so that the crafted packs are known to be sound
+ * apart from their names.
+ *
+ * A line is written to standard output for each run, and mismatches
+ * are reported.
+ *
+ * Parameters:
+ *
+ *   pExe - the warp64 program
+ *
+ *   pDir - the scratch directory
+ *
+ * Return:
+ *
+ *   non-zero if every run behaved, zero if not
+ */
+static int conformPack(const char *pExe, const char *pDir) {
+
+  static const char *names[4] = {
+    "sub/" PACK_MEMBER,
+    "../" PACK_MEMBER,
+    "/" PACK_MEMBER,
+    "link/" PACK_MEMBER
+  };
+
+  int status = 1;
+  int ok = 0;
+  int i = 0;
+  int fHome = -1;
+  int32_t key = 0;
+  int64_t got = 0;
+  uint64_t h = 0;
+  uint64_t hgot = 0;
+  double t = 0.0;
+  FILE *pKey = NULL;
+  char *pAbsExe = NULL;
+  char *pAbsDir = NULL;
+  char *pTop = NULL;
+  char *pWork = NULL;
+  char *pKeyPath = NULL;
+  char *pArchive = NULL;
+  char *pLink = NULL;
+  char *pSub = NULL;
+  char *pEsc[3];
+  char *ppArgs[8];
+
+  memset(pEsc, 0, sizeof(pEsc));
+  memset(ppArgs, 0, sizeof(ppArgs));
+
+  if ((pExe == NULL) || (pDir == NULL)) {
+    abort();
+  }
+
+  /* The program runs in the work directory, so every path is made
+   * absolute */
+  pAbsExe = realpath(pExe, NULL);
+  pAbsDir = realpath(pDir, NULL);
+  if ((pAbsExe == NULL) || (pAbsDir == NULL)) {
+    free(pAbsExe);
+    free(pAbsDir);
+    fprintf(stderr, "%s: Failed to resolve '%s' and '%s'\n",
+            pModule, pExe, pDir);
+    return 0;
+  }
+
+  key = warp64_derive(BENCH_KEY);
+  pTop = joinPath(pAbsDir, PACK_DIR);
+  pWork = joinPath(pTop, "work");
+  pKeyPath = joinPath(pTop, KEY_FILE);
+  pArchive = joinPath(pWork, PACK_ARCHIVE);
+  pLink = joinPath(pWork, "link");
+  pSub = joinPath(pWork, "sub");
+  pEsc[0] = joinPath(pSub, PACK_MEMBER);
+  pEsc[1] = joinPath(pTop, PACK_MEMBER);
+  pEsc[2] = joinPath(pWork, PACK_MEMBER);
+  h = fnvStep(UINT64_C(0xcbf29ce484222325),
+              (const uint8_t *) PACK_DATA, strlen(PACK_DATA));
+
+  /* Make the directories, the link and the key file */
+  if (mkdir(pTop, S_IRWXU) || mkdir(pWork, S_IRWXU)) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pWork);
+  }
+  if (status && symlink("..", pLink)) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pLink);
+  }
+  if (status) {
+    pKey = fopen(pKeyPath, "w");
+    if (pKey == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pKeyPath);
+    }
+  }
+  if (pKey != NULL) {
+    fprintf(pKey, "%s\n", BENCH_KEY);
+    if (fclose(pKey)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write '%s'\n", pModule, pKeyPath);
+    }
+    pKey = NULL;
+  }
+  if (status) {
+    fHome = open(".", O_RDONLY | O_DIRECTORY);
+    if ((fHome < 0) || chdir(pWork)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to enter '%s'\n", pModule, pWork);
+    }
+  }
+
+  ppArgs[0] = pAbsExe;
+  ppArgs[1] = "-d";
+  ppArgs[2] = "--key-file";
+  ppArgs[3] = pKeyPath;
+  ppArgs[4] = "--pack";
+  ppArgs[5] = pArchive;
+  ppArgs[6] = NULL;
+
+  for(i = 0; status && (i < 4); i++) {
+    ok = packCraft(pArchive, key, names[i]);
+    if (ok && (i < 1)) {
+      /* The sound pack must extract */
+      ok = runWarp(ppArgs, NULL, NULL, &t);
+      if (ok) {
+        ok = hashFile(pEsc[0], &got, &hgot);
+      }
+      if (ok && ((got != (int64_t) strlen(PACK_DATA)) || (hgot != h))) {
+        ok = 0;
+        fprintf(stderr, "%s: Extracted member differs!\n", pModule);
+      }
+      if (!ok) {
+        fprintf(stderr, "%s: warp64 failed!\n", pModule);
+      }
+      unlink(pEsc[0]);
+      rmdir(pSub);
+
+    } else if (ok) {
+      /* The others must be refused, and nothing must be written */
+      if (runWarp(ppArgs, NULL, NULL, &t)) {
+        ok = 0;
+        fprintf(stderr, "%s: warp64 extracted '%s'!\n",
+                pModule, names[i]);
+      }
+      if ((!access(pEsc[1], F_OK)) || (!access(pEsc[2], F_OK))) {
+        ok = 0;
+        fprintf(stderr, "%s: warp64 wrote '%s' outside the work "
+                "directory!\n", pModule, names[i]);
+      }
+      unlink(pEsc[1]);
+      unlink(pEsc[2]);
+    }
+    unlink(pArchive);
+
+    printf("{\"bench\":\"conform\",\"path\":\"program pack\","
+            "\"member\":\"%s\",\"ok\":%s}\n",
+            names[i], ok ? "true" : "false");
+    fflush(stdout);
+    if (!ok) {
+      status = 0;
+    }
+  }
+
+  /* Go back and clean up the scratch files */
+  if (fHome >= 0) {
+    if (fchdir(fHome)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to return to the working directory\n",
+              pModule);
+    }
+    close(fHome);
+    fHome = -1;
+  }
+  unlink(pArchive);
+  unlink(pLink);
+  unlink(pKeyPath);
+  rmdir(pWork);
+  rmdir(pTop);
+
+  for(i = 0; i < 3; i++) {
+    free(pEsc[i]);
+  }
+  free(pSub);
+  free(pLink);
+  free(pArchive);
+  free(pKeyPath);
+  free(pWork);
+  free(pTop);
+  free(pAbsDir);
+  free(pAbsExe);
+
+  return status;
+}
+
+/*
+ * Check the browser tool in warp64.js against the reference.
+ *
+ * The tool is run under node through the script in m_jsDriver, once
+ * with its WebAssembly kernel and once with its portable kernel.  Files
+ * are generated with sizes at the chunk boundaries of the tool that
+ * fall in every key phase, and each is scrambled with one lane and with
+ * three, so that the chunks of a lane are also interleaved with the
+ * chunks of the others.  The scrambled file is checked against the
+ * reference, and the descrambled file against the generated content.
+ *
+ * If node isn't on the PATH, or the default tool isn't there, a notice
+ * is printed and the check is skipped without failing.  A tool that was
+ * given but can't be found is a failure.
+ *
+ * A line is written to standard output for each run, and mismatches
+ * are reported.
+ *
+ * Parameters:
+ *
+ *   pTool - the browser tool
+ *
+ *   given - non-zero if the tool was given on the command line
+ *
+ *   pDir - the scratch directory
+ *
+ * Return:
+ *
+ *   non-zero if every run succeeded and matched or the check was
+ *   skipped, zero if not
+ */
+static int conformJs(const char *pTool, int given, const char *pDir) {
+
+  static const int64_t edgeChunk[][2] = {
+    {0, 0}, {0, 1}, {0, 2}, {0, 3}, {1, -1}, {1, 0}, {1, 1}, {1, 2},
+    {2, 1}, {3, 2}, {4, -2}
+  };
+  static const char *modes[2] = {"wasm", "portable"};
+  static const char *lanes[2] = {"1", "3"};
+
+  int status = 1;
+  int run = 0;
+  int ok = 0;
+  int ci = 0;
+  int r = 0;
+  int i = 0;
+  int32_t key = 0;
+  int64_t size = 0;
+  int64_t got = 0;
+  uint64_t h = 0;
+  uint64_t hs = 0;
+  uint64_t hgot = 0;
+  double t = 0.0;
+  FILE *pOut = NULL;
+  char *pNode = NULL;
+  char *pDriver = NULL;
+  char *pData = NULL;
+  char *pScr = NULL;
+  const char *pSkip = NULL;
+  char *ppArgs[16];
+
+  memset(ppArgs, 0, sizeof(ppArgs));
+
+  if ((pTool == NULL) || (pDir == NULL)) {
+    abort();
+  }
+
+  /* Find node and the tool */
+  pNode = findPath("node");
+  if (pNode == NULL) {
+    pSkip = "node not found";
+  } else if (access(pTool, R_OK) != 0) {
+    if (given) {
+      status = 0;
+      fprintf(stderr, "%s: Can't read '%s'!\n", pModule, pTool);
+    } else {
+      pSkip = "tool not found";
+    }
+  }
+  if (pSkip != NULL) {
+    fprintf(stderr, "%s: Skipping %s, %s!\n", pModule, pTool, pSkip);
+    printf("{\"bench\":\"conform\",\"path\":\"js\","
+            "\"skipped\":\"%s\"}\n", pSkip);
+    fflush(stdout);
+  }
+
+  run = (status && (pSkip == NULL));
+
+  /* Write the driver script */
+  if (run) {
+    key = warp64_derive(BENCH_KEY);
+    pDriver = joinPath(pDir, JS_DRIVER);
+    pData = joinPath(pDir, DATA_FILE);
+    pScr = joinPath(pDir, DATA_SCRAMBLED);
+
+    pOut = fopen(pDriver, "w");
+    if (pOut == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create '%s'\n", pModule, pDriver);
+    }
+  }
+  if (pOut != NULL) {
+    for(i = 0; m_jsDriver[i] != NULL; i++) {
+      fprintf(pOut, "%s\n", m_jsDriver[i]);
+    }
+    if (fclose(pOut)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to write '%s'\n", pModule, pDriver);
+    }
+    pOut = NULL;
+  }
+
+  for(ci = 0; run && status &&
+        (ci < (int) (sizeof(edgeChunk) / sizeof(edgeChunk[0]))); ci++) {
+    size = (edgeChunk[ci][0] * JS_CHUNK) + edgeChunk[ci][1];
+    if (size < 0) {
+      continue;
+    }
+
+    /* Generate the file and work out what it scrambles to */
+    unlink(pScr);
+    if ((!genFile(pData, size, &h)) || (!refHash(pData, key, &hs))) {
+      status = 0;
+      break;
+    }
+
+    for(r = 0; r < 4; r++) {
+      ppArgs[0] = pNode;
+      ppArgs[1] = pDriver;
+      ppArgs[2] = (char *) pTool;
+      ppArgs[3] = (char *) modes[r / 2];
+      ppArgs[4] = "-s";
+      ppArgs[5] = BENCH_KEY;
+      ppArgs[6] = pData;
+      ppArgs[7] = pScr;
+      ppArgs[8] = (char *) lanes[r % 2];
+      ppArgs[9] = NULL;
+
+      /* Scramble and descramble the file */
+      ok = runWarp(ppArgs, NULL, NULL, &t);
+      if (ok) {
+        ok = hashFile(pScr, &got, &hgot);
+      }
+      if (ok && ((got != size + 3) || (hgot != hs))) {
+        ok = 0;
+        fprintf(stderr, "%s: Scrambled file differs!\n", pModule);
+      }
+      if (ok) {
+        ppArgs[4] = "-d";
+        ppArgs[6] = pScr;
+        ppArgs[7] = pData;
+        ok = runWarp(ppArgs, NULL, NULL, &t);
+      }
+      if (!ok) {
+        fprintf(stderr, "%s: warp64.js failed!\n", pModule);
+      }
+
+      /* Check the round trip */
+      if (ok) {
+        if (!hashFile(pData, &got, &hgot)) {
+          ok = 0;
+        } else if ((got != size) || (hgot != h)) {
+          ok = 0;
+          fprintf(stderr, "%s: Round trip mismatch!\n", pModule);
+        }
+      }
+
+      printf("{\"bench\":\"conform\",\"path\":\"js %s\","
+              "\"bytes\":%ld,\"lanes\":%s,\"ok\":%s}\n",
+              modes[r / 2], (long) size, lanes[r % 2],
+              ok ? "true" : "false");
+      fflush(stdout);
+
+      if (!ok) {
+        status = 0;
+
+        /* Regenerate the file so that later runs start clean */
+        unlink(pScr);
+        if (!genFile(pData, size, &h)) {
+          break;
+        }
+      }
+    }
+  }
+
+  /* Clean up the scratch files */
+  if (run) {
+    unlink(pData);
+    unlink(pScr);
+    unlink(pDriver);
+  }
+
+  free(pNode);
+  free(pDriver);
+  free(pData);
+  free(pScr);
+
+  return status;
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  int status = 1;
+  int kernel = 0;
+  int conform = 0;
+  int i = 0;
+  int reps = -1;
+  int nsize = 0;
+  int nwin = 0;
+  int nthread = 0;
+  int nback = 0;
+  int given = 0;
+  int64_t size = -1;
+  int64_t seed = 1;
+  int64_t v = 0;
+  const char *pExe = NULL;
+  const char *pBase = NULL;
+  const char *pTool = JS_TOOL;
+  const char *pDir = ".";
+  char *pBackStr = NULL;
+
+  int64_t sizes[MAX_LIST];
+  int64_t wins[MAX_LIST];
+  int64_t threads[MAX_LIST];
+  char *ppBack[MAX_LIST];
+  char backDefault[] = "mmap";
+  char backConform[] = "mmap,pread";
+
+  /* Get the module name */
+  pModule = NULL;
+  if ((argc > 0) && (argv != NULL)) {
+    pModule = argv[0];
+  }
+  if (pModule == NULL) {
+    pModule = "warp64bench";
+  }
+
+  /* Select the default kernel */
+  warp64k_init();
+
+  /* Default lists */
+  parseList("0,100,4194307,64M", sizes, &nsize);
+  parseList("4M", wins, &nwin);
+  parseList("1", threads, &nthread);
+  ppBack[0] = backDefault;
+  nback = 1;
+
+  /* Check the mode */
+  if (argc < 2) {
+    status = 0;
+    fprintf(stderr, "Warp64 benchmark harness\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Syntax:\n");
+    fprintf(stderr, "  warp64bench kernel [-n bytes] [-r reps]\n");
+    fprintf(stderr, "  warp64bench file [options]\n");
+    fprintf(stderr, "  warp64bench conform [options]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "File options:\n");
+    fprintf(stderr, "  -x [path]  warp64 program\n");
+    fprintf(stderr, "  -D [dir]   scratch directory\n");
+    fprintf(stderr, "  -S [list]  file sizes\n");
+    fprintf(stderr, "  -W [list]  window sizes\n");
+    fprintf(stderr, "  -J [list]  thread counts\n");
+    fprintf(stderr, "  -B [list]  I/O backends\n");
+    fprintf(stderr, "  -r [reps]  repetitions\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Kernel and file options:\n");
+    fprintf(stderr, "  -P [path]  baseline from an earlier run\n");
+    fprintf(stderr, "  -T [pct]   allowed drop below baseline\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Conform options:\n");
+    fprintf(stderr, "  -n [bytes] longest random length\n");
+    fprintf(stderr, "  -r [count] rounds\n");
+    fprintf(stderr, "  -s [seed]  seed of the rounds\n");
+    fprintf(stderr, "  -x [path]  also check this warp64 program\n");
+    fprintf(stderr, "  -e [path]  browser tool run under node\n");
+    fprintf(stderr, "  -D, -W, -J, -B as for file mode\n");
+  }
+  if (status) {
+    if (strcmp(argv[1], "kernel") == 0) {
+      kernel = 1;
+    } else if (strcmp(argv[1], "file") == 0) {
+      kernel = 0;
+    } else if (strcmp(argv[1], "conform") == 0) {
+      conform = 1;
+    } else {
+      status = 0;
+      fprintf(stderr, "%s: Unknown mode '%s'\n", pModule, argv[1]);
+    }
+  }
+
+  /* Parse the options, which all take a value */
+  for(i = 2; status && (i < argc); i += 2) {
+    if (i + 1 >= argc) {
+      status = 0;
+      fprintf(stderr, "%s: Option '%s' requires a value!\n",
+              pModule, argv[i]);
+      break;
+    }
+
+    if ((kernel || conform) && (strcmp(argv[i], "-n") == 0)) {
+      if ((!parseSize(argv[i + 1], &size)) || (size < 1)) {
+        status = 0;
+      }
+    } else if (strcmp(argv[i], "-r") == 0) {
+      if ((!parseSize(argv[i + 1], &v)) || (v < 1) || (v > 1000000)) {
+        status = 0;
+      } else {
+        reps = (int) v;
+      }
+    } else if (conform && (strcmp(argv[i], "-s") == 0)) {
+      status = parseSize(argv[i + 1], &seed);
+    } else if ((!conform) && (strcmp(argv[i], "-P") == 0)) {
+      pBase = argv[i + 1];
+    } else if ((!conform) && (strcmp(argv[i], "-T") == 0)) {
+      if ((!parseSize(argv[i + 1], &v)) || (v > 100)) {
+        status = 0;
+      } else {
+        m_tolerance = (double) v;
+      }
+    } else if ((!kernel) && (strcmp(argv[i], "-x") == 0)) {
+      pExe = argv[i + 1];
+    } else if (conform && (strcmp(argv[i], "-e") == 0)) {
+      pTool = argv[i + 1];
+      given |= 8;
+    } else if ((!kernel) && (strcmp(argv[i], "-D") == 0)) {
+      pDir = argv[i + 1];
+    } else if ((!kernel) && (!conform) && (strcmp(argv[i], "-S") == 0)) {
+      status = parseList(argv[i + 1], sizes, &nsize);
+    } else if ((!kernel) && (strcmp(argv[i], "-W") == 0)) {
+      status = parseList(argv[i + 1], wins, &nwin);
+      given |= 1;
+    } else if ((!kernel) && (strcmp(argv[i], "-J") == 0)) {
+      status = parseList(argv[i + 1], threads, &nthread);
+      given |= 2;
+    } else if ((!kernel) && (strcmp(argv[i], "-B") == 0)) {
+      pBackStr = argv[i + 1];
+      status = splitNames(pBackStr, ppBack, &nback);
+      given |= 4;
+    } else {
+      status = 0;
+      fprintf(stderr, "%s: Unknown option '%s'\n", pModule, argv[i]);
+      break;
+    }
+
+    if (!status) {
+      fprintf(stderr, "%s: Invalid value for '%s'\n", pModule, argv[i]);
+    }
+  }
+
+  /* Load the baseline */
+  if (status && (pBase != NULL)) {
+    if (!baseLoad(pBase)) {
+      status = 0;
+    }
+  }
+
+  /* Run the benchmark or the checks */
+  if (status && conform) {
+    if (reps < 1) {
+      reps = 1000;
+    }
+    if (size < 1) {
+      size = INT64_C(1048576);
+    }
+    if (!conformLib(size, reps, (uint64_t) seed)) {
+      status = 0;
+    }
+
+    /* Conformance runs of the program default to windows small enough
+     * to have many boundaries, and to several threads and backends */
+    if (!(given & 1)) {
+      parseList("64K,1M", wins, &nwin);
+    }
+    if (!(given & 2)) {
+      parseList("1,3", threads, &nthread);
+    }
+    if (!(given & 4)) {
+      splitNames(backConform, ppBack, &nback);
+    }
+    if (pExe != NULL) {
+      if (!conformFile(pExe, pDir, wins, nwin, threads, nthread,
+                        ppBack, nback)) {
+        status = 0;
+      }
+      if (!conformPack(pExe, pDir)) {
+        status = 0;
+      }
+    }
+    if (!conformJs(pTool, given & 8, pDir)) {
+      status = 0;
+    }
+
+  } else if (status && kernel) {
+    if (reps < 1) {
+      reps = 5;
+    }
+    if (size < 1) {
+      size = INT64_C(67108864);
+    }
+    if (!benchKernel(size, reps)) {
+      status = 0;
+    }
+
+  } else if (status) {
+    if (reps < 1) {
+      reps = 3;
+    }
+    if (pExe == NULL) {
+      pExe = "./warp64";
+    }
+    if (!benchFile(pExe, pDir, sizes, nsize, wins, nwin,
+                    threads, nthread, ppBack, nback, reps)) {
+      status = 0;
+    }
+  }
+
+  /* Invert status and return */
+  if (status) {
+    status = 0;
+  } else {
+    status = 1;
+  }
+  return status;
+}
@@ -0,0 +1,1496 @@
+/*
+ * warp64d.c
+ * =========
+ *
+ * Daemon that scrambles, descrambles, verifies and re-keys files for
+ * other programs over a Unix domain socket.
+ *
+ * Syntax:
+ *
+ *   ./warp64d [options] socket_path
+ *
+ * The daemon listens on a SOCK_SEQPACKET socket at socket_path, which
+ * is created with permissions for its owner only.  A stale socket left
+ * at the path by an earlier run is replaced.  The daemon runs in the
+ * foreground until it gets SIGINT or SIGTERM, at which point it stops
+ * accepting connections, finishes the jobs already queued, and removes
+ * the socket.
+ *
+ * Clients never send paths.  Each request is a single message carrying
+ * the open file descriptors of the job as SCM_RIGHTS ancillary data,
+ * and a line of text of the form:
+ *
+ *   id op priority key [newkey]
+ *
+ * id is any token of up to ID_MAX characters, which is echoed in the
+ * reply so that a client can have many requests in flight on one
+ * connection.  op is one of:
+ *
+ *   scramble - scrambles the first descriptor into the second
+ *
+ *   descramble - checks the key against the trailer of the first
+ *   descriptor and descrambles it into the second
+ *
+ *   rekey - checks the key against the trailer of the first descriptor
+ *   and writes it re-keyed to newkey into the second, in a single pass
+ *
+ *   verify - checks the key against the trailer of the only descriptor
+ *
+ * priority is 0, the most urgent, up to PRIORITY_LEVELS - 1.  The keys
+ * are scrambling keys, as typed at the warp64 prompt.  Inputs must be
+ * regular files open for reading.  Outputs must be regular files open
+ * for writing, and they are truncated to the length of the result, so
+ * they may be empty or hold anything beforehand.  The daemon doesn't
+ * flush outputs; a client that needs the result on disk calls
+ * fdatasync() on its descriptor after the reply.  The daemon closes its
+ * copies of the descriptors once the job is done.
+ *
+ * Each request gets exactly one reply message, which is one of:
+ *
+ *   id ok length - the output was written and has length bytes
+ *
+ *   id match / id mismatch - the result of verify
+ *
+ *   id error message - the job failed, and the output, if any, must be
+ *   considered garbage
+ *
+ * Replies of a connection may come in any order.  A request that can't
+ * be parsed is answered with the id "-" if it had none.
+ *
+ * Jobs from all connections go into one queue with a FIFO for each
+ * priority, and a shared pool of worker threads always takes the most
+ * urgent job first.  Each job runs on one worker, in windows through
+ * the I/O backends of warp64io.c, and small files take a single read
+ * and write.  The queue applies back-pressure: when it holds its full
+ * depth of jobs, or a connection has CONN_INFLIGHT jobs in flight, the
+ * daemon stops reading requests from that connection until there is
+ * room, so clients block in send() instead of piling up work.  Derived
+ * keys are kept in a small cache, so repeated keys are not derived
+ * again.
+ *
+ * The following options are supported:
+ *
+ *   -j [count] sets the number of worker threads.  A count of zero, the
+ *   default, uses one thread per online processor.
+ *
+ *   -q [depth] sets how many jobs may be queued and not yet started
+ *   before back-pressure applies.  The default is QUEUE_DEPTH.
+ *
+ *   -b mmap|pread|uring selects how windows are read and written, as in
+ *   warp64.  The default is pread, which works with output descriptors
+ *   that are open write-only; mmap needs outputs open for reading and
+ *   writing.
+ *
+ *   --nocache writes back each finished window and drops it from the
+ *   page cache of both files, as in warp64.
+ *
+ * The transform is performed by libwarp64.c, which uses the kernels in
+ * warp64k.c, and windows go through warp64io.c:
+ *
+ *   cc -D_FILE_OFFSET_BITS=64 -O2 -pthread -o warp64d warp64d.c
+ *     libwarp64.c warp64k.c warp64io.c
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+/* Linux extensions, needed for accept4 and MSG_CMSG_CLOEXEC */
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libwarp64.h"
+#include "warp64io.h"
+
+/*
+ * Check 64-bit file mode
+ * ======================
+ */
+
+#ifdef _FILE_OFFSET_BITS
+#if (_FILE_OFFSET_BITS != 64)
+#error Need to define _FILE_OFFSET_BITS=64
+#endif
+#else
+#error Need to define _FILE_OFFSET_BITS=64
+#endif
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The maximum number of characters in a scrambling key.
+ */
+#define MAX_KEY_LENGTH (WARP64_KEYMAX)
+
+/*
+ * The maximum number of characters in a request id.
+ */
+#define ID_MAX (64)
+
+/*
+ * The largest request message, and the largest reply message.
+ */
+#define REQUEST_MAX (ID_MAX + 2 * MAX_KEY_LENGTH + 64)
+#define REPLY_MAX (ID_MAX + 256)
+
+/*
+ * The largest number of descriptors a request carries.
+ */
+#define FD_MAX (2)
+
+/*
+ * The number of priority levels.
+ */
+#define PRIORITY_LEVELS (4)
+
+/*
+ * The default number of queued jobs before back-pressure applies, and
+ * the largest depth that may be set with -q.
+ */
+#define QUEUE_DEPTH (256)
+#define QUEUE_MAX (65536)
+
+/*
+ * The number of jobs a single connection may have in flight, queued or
+ * running, before its requests are no longer read.
+ */
+#define CONN_INFLIGHT (64)
+
+/*
+ * The window size used for jobs.
+ */
+#define WINDOW_SIZE (4194304L)
+
+/*
+ * The maximum number of worker threads.
+ */
+#define MAX_THREADS (1024)
+
+/*
+ * The number of entries in the cache of derived keys.
+ */
+#define KEY_SLOTS (256)
+
+/*
+ * The job operations.
+ */
+#define OP_SCRAMBLE   (0)
+#define OP_DESCRAMBLE (1)
+#define OP_REKEY      (2)
+#define OP_VERIFY     (3)
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * A client connection.
+ *
+ * The connection is shared by its reader thread and by the jobs it has
+ * in flight, and it is closed once all of them are done with it.
+ */
+typedef struct {
+
+  /*
+   * The socket.
+   */
+  int fd;
+
+  /*
+   * The number of holders of the connection, which are the reader and
+   * the jobs; and the number of jobs in flight.  Both are protected by
+   * the queue lock.
+   */
+  int refs;
+  int inflight;
+
+} CONN;
+
+/*
+ * A job.
+ */
+typedef struct JOB_TAG {
+
+  /*
+   * The next job of the same priority in the queue.
+   */
+  struct JOB_TAG *pNext;
+
+  /*
+   * The connection the job came from, and the id of the request.
+   */
+  CONN *pConn;
+  char id[ID_MAX + 1];
+
+  /*
+   * The OP_ operation and the priority.
+   */
+  int op;
+  int prio;
+
+  /*
+   * The normalized key, and the new normalized key of a re-key job, or
+   * -1.
+   */
+  int32_t key;
+  int32_t newkey;
+
+  /*
+   * The input and output descriptors; fOut is -1 for verify.
+   */
+  int fIn;
+  int fOut;
+
+} JOB;
+
+/*
+ * An entry of the cache of derived keys.
+ */
+typedef struct {
+
+  /*
+   * The key string, empty if the entry is unused.
+   */
+  char text[MAX_KEY_LENGTH + 1];
+
+  /*
+   * The normalized key.
+   */
+  int32_t key;
+
+} KEY_ENTRY;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The name of the executable module, for use in diagnostic messages.
+ *
+ * This is set at the start of the entrypoint.
+ */
+static const char *pModule = NULL;
+
+/*
+ * Settings from the command line.
+ */
+static int m_threads = 0;
+static int m_depth = QUEUE_DEPTH;
+static int m_backend = WARP64IO_PREAD;
+static int m_ioflags = WARP64IO_PREFETCH;
+
+/*
+ * The job queue, with a FIFO for each priority, the number of jobs
+ * queued, and whether the daemon is stopping.
+ *
+ * m_work is signalled when a job is queued or the daemon stops, and
+ * m_room when a job is taken or finished.  Everything is protected by
+ * m_lock.
+ */
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t m_room = PTHREAD_COND_INITIALIZER;
+static JOB *m_pHead[PRIORITY_LEVELS];
+static JOB *m_pTail[PRIORITY_LEVELS];
+static int m_queued = 0;
+static int m_stop = 0;
+
+/*
+ * The listening socket.
+ */
+static int m_listen = -1;
+
+/*
+ * The cache of derived keys, protected by m_key_lock.
+ */
+static pthread_mutex_t m_key_lock = PTHREAD_MUTEX_INITIALIZER;
+static KEY_ENTRY m_keys[KEY_SLOTS];
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int parseCount(const char *pStr, long lo, long hi, long *pv);
+static int32_t rekeyDelta(int32_t oldkey, int32_t newkey);
+static int32_t deriveCached(const char *pKey);
+static void sendReply(CONN *pc, const char *pId, const char *pText);
+static void connRelease(CONN *pc);
+static int parseRequest(char *pMsg, JOB *pj, const char **ppError);
+static int checkTrailer(int fd, int64_t len, int32_t key, int *pMatch);
+static const char *runJob(JOB *pj, WARP64IO *pio, int64_t *pLen);
+static void *workerMain(void *pArg);
+static void *connMain(void *pArg);
+static void *signalMain(void *pArg);
+
+/*
+ * Parse a decimal count.
+ *
+ * Parameters:
+ *
+ *   pStr - the string to parse
+ *
+ *   lo - the lowest allowed value
+ *
+ *   hi - the highest allowed value
+ *
+ *   pv - receives the value
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if the string isn't a count in range
+ */
+static int parseCount(const char *pStr, long lo, long hi, long *pv) {
+  int status = 1;
+  long v = 0;
+
+  if ((pStr == NULL) || (pv == NULL) || (lo > hi)) {
+    abort();
+  }
+
+  if (*pStr == 0) {
+    status = 0;
+  }
+  for( ; status && (*pStr != 0); pStr++) {
+    if ((*pStr < '0') || (*pStr > '9')) {
+      status = 0;
+      break;
+    }
+    v = (v * 10) + ((long) (*pStr - '0'));
+    if (v > hi) {
+      status = 0;
+    }
+  }
+  if (status && (v < lo)) {
+    status = 0;
+  }
+
+  if (status) {
+    *pv = v;
+  }
+  return status;
+}
+
+/*
+ * Compute the normalized key that re-keys scrambled data from oldkey to
+ * newkey when it is used to scramble.
+ *
+ * Each key phase adds the difference of the key octets, which may be
+ * zero, so the result is not a normalized key in the strict sense, but
+ * the transform accepts any 24-bit value.
+ *
+ * Parameters:
+ *
+ *   oldkey - the current normalized key
+ *
+ *   newkey - the new normalized key
+ *
+ * Return:
+ *
+ *   the key of the re-key transform
+ */
+static int32_t rekeyDelta(int32_t oldkey, int32_t newkey) {
+  int32_t result = 0;
+  int i = 0;
+  int a = 0;
+  int b = 0;
+
+  for(i = 2; i >= 0; i--) {
+    a = (int) ((oldkey >> (i * 8)) & 0xff);
+    b = (int) ((newkey >> (i * 8)) & 0xff);
+    result = (result << 8) | ((int32_t) ((256 + b - a) % 256));
+  }
+
+  return result;
+}
+
+/*
+ * Derive a normalized key, going through the cache of derived keys.
+ *
+ * The cache is direct-mapped on a hash of the key string, so a key
+ * replaces whatever other key was in its slot.
+ *
+ * Parameters:
+ *
+ *   pKey - the key string, at most MAX_KEY_LENGTH characters
+ *
+ * Return:
+ *
+ *   the normalized key, or -1 if the key isn't valid
+ */
+static int32_t deriveCached(const char *pKey) {
+  uint32_t h = 2166136261UL;
+  const char *p = NULL;
+  KEY_ENTRY *pe = NULL;
+  int32_t key = -1;
+
+  if (pKey == NULL) {
+    abort();
+  }
+  if (strlen(pKey) > MAX_KEY_LENGTH) {
+    return -1;
+  }
+
+  for(p = pKey; *p != 0; p++) {
+    h = (h ^ ((uint32_t) (unsigned char) *p)) * 16777619UL;
+  }
+  pe = &(m_keys[h % KEY_SLOTS]);
+
+  if (pthread_mutex_lock(&m_key_lock)) {
+    abort();
+  }
+  if ((pe->text[0] != 0) && (strcmp(pe->text, pKey) == 0)) {
+    key = pe->key;
+  }
+  if (pthread_mutex_unlock(&m_key_lock)) {
+    abort();
+  }
+  if (key >= 0) {
+    return key;
+  }
+
+  key = warp64_derive(pKey);
+  if (key < 0) {
+    return -1;
+  }
+
+  if (pthread_mutex_lock(&m_key_lock)) {
+    abort();
+  }
+  strcpy(pe->text, pKey);
+  pe->key = key;
+  if (pthread_mutex_unlock(&m_key_lock)) {
+    abort();
+  }
+  return key;
+}
+
+/*
+ * Send a reply message on a connection.
+ *
+ * Each reply is a single message of the socket, so replies from
+ * different workers never interleave.  Errors are ignored, because the
+ * client may have gone away.
+ *
+ * Parameters:
+ *
+ *   pc - the connection
+ *
+ *   pId - the request id
+ *
+ *   pText - the rest of the reply
+ */
+static void sendReply(CONN *pc, const char *pId, const char *pText) {
+  char msg[REPLY_MAX + 1];
+  ssize_t rv = 0;
+
+  memset(msg, 0, REPLY_MAX + 1);
+
+  if ((pc == NULL) || (pId == NULL) || (pText == NULL)) {
+    abort();
+  }
+
+  snprintf(msg, REPLY_MAX + 1, "%s %s\n", pId, pText);
+  do {
+    rv = send(pc->fd, msg, strlen(msg), MSG_NOSIGNAL);
+  } while ((rv < 0) && (errno == EINTR));
+}
+
+/*
+ * Drop one hold on a connection, closing it with the last one.
+ *
+ * Parameters:
+ *
+ *   pc - the connection
+ */
+static void connRelease(CONN *pc) {
+  int last = 0;
+
+  if (pc == NULL) {
+    abort();
+  }
+
+  if (pthread_mutex_lock(&m_lock)) {
+    abort();
+  }
+  (pc->refs)--;
+  if (pc->refs < 1) {
+    last = 1;
+  }
+  if (pthread_mutex_unlock(&m_lock)) {
+    abort();
+  }
+
+  if (last) {
+    close(pc->fd);
+    free(pc);
+  }
+}
+
+/*
+ * Parse the text of a request into a job.
+ *
+ * The descriptors are not touched.  The message is modified while it
+ * is split into tokens.
+ *
+ * Parameters:
+ *
+ *   pMsg - the nul-terminated message
+ *
+ *   pj - the job, whose id, op, prio, key and newkey are filled in; the
+ *   id is set to "-" if the message doesn't start with one
+ *
+ *   ppError - receives the error message if parsing fails
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int parseRequest(char *pMsg, JOB *pj, const char **ppError) {
+  char *pTok[6];
+  char *p = NULL;
+  int n = 0;
+  long prio = 0;
+
+  memset(pTok, 0, sizeof(pTok));
+
+  if ((pMsg == NULL) || (pj == NULL) || (ppError == NULL)) {
+    abort();
+  }
+  strcpy(pj->id, "-");
+
+  /* Split into whitespace-separated tokens */
+  p = pMsg;
+  for(;;) {
+    while ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n')) {
+      *p = 0;
+      p++;
+    }
+    if (*p == 0) {
+      break;
+    }
+    if (n >= 6) {
+      *ppError = "too many fields";
+      return 0;
+    }
+    pTok[n] = p;
+    n++;
+    while ((*p != 0) && (*p != ' ') && (*p != '\t') &&
+            (*p != '\r') && (*p != '\n')) {
+      p++;
+    }
+  }
+
+  if ((n < 1) || (strlen(pTok[0]) > ID_MAX)) {
+    *ppError = "bad request id";
+    return 0;
+  }
+  strcpy(pj->id, pTok[0]);
+
+  if (n < 4) {
+    *ppError = "missing fields";
+    return 0;
+  }
+
+  if (strcmp(pTok[1], "scramble") == 0) {
+    pj->op = OP_SCRAMBLE;
+  } else if (strcmp(pTok[1], "descramble") == 0) {
+    pj->op = OP_DESCRAMBLE;
+  } else if (strcmp(pTok[1], "rekey") == 0) {
+    pj->op = OP_REKEY;
+  } else if (strcmp(pTok[1], "verify") == 0) {
+    pj->op = OP_VERIFY;
+  } else {
+    *ppError = "unknown operation";
+    return 0;
+  }
+
+  if (n != ((pj->op == OP_REKEY) ? 5 : 4)) {
+    *ppError = "wrong number of fields";
+    return 0;
+  }
+
+  if (!parseCount(pTok[2], 0, PRIORITY_LEVELS - 1, &prio)) {
+    *ppError = "bad priority";
+    return 0;
+  }
+  pj->prio = (int) prio;
+
+  pj->key = deriveCached(pTok[3]);
+  if (pj->key < 0) {
+    *ppError = "bad key";
+    return 0;
+  }
+  pj->newkey = -1;
+  if (pj->op == OP_REKEY) {
+    pj->newkey = deriveCached(pTok[4]);
+    if (pj->newkey < 0) {
+      *ppError = "bad new key";
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Check the trailer of scrambled data against a key.
+ *
+ * Parameters:
+ *
+ *   fd - the scrambled file
+ *
+ *   len - the length of the file, at least WARP64_TRAILER
+ *
+ *   key - the normalized key
+ *
+ *   pMatch - receives non-zero if the trailer matches the key
+ *
+ * Return:
+ *
+ *   non-zero if the trailer was read, zero if error
+ */
+static int checkTrailer(int fd, int64_t len, int32_t key, int *pMatch) {
+  uint8_t trailer[WARP64_TRAILER];
+  ssize_t rv = 0;
+
+  memset(trailer, 0, WARP64_TRAILER);
+
+  if ((len < WARP64_TRAILER) || (pMatch == NULL)) {
+    abort();
+  }
+
+  do {
+    rv = pread(fd, trailer, WARP64_TRAILER,
+                (off_t) (len - WARP64_TRAILER));
+  } while ((rv < 0) && (errno == EINTR));
+  if (rv != WARP64_TRAILER) {
+    return 0;
+  }
+
+  *pMatch = (warp64_recover(len - WARP64_TRAILER, trailer) == key);
+  return 1;
+}
+
+/*
+ * Run a job on the calling worker.
+ *
+ * Parameters:
+ *
+ *   pj - the job
+ *
+ *   pio - the I/O backend state of the worker
+ *
+ *   pLen - receives the output length, or for verify, 1 if the trailer
+ *   matches and 0 if not
+ *
+ * Return:
+ *
+ *   NULL if successful, or the error message
+ */
+static const char *runJob(JOB *pj, WARP64IO *pio, int64_t *pLen) {
+  int match = 0;
+  int result = 0;
+  int64_t ilen = 0;
+  int64_t olen = 0;
+  int64_t xlen = 0;
+  int64_t base = 0;
+  int64_t ws = 0;
+  int64_t wsi = 0;
+  WARP64_CTX *pc = NULL;
+  const char *pError = NULL;
+  struct stat st;
+
+  memset(&st, 0, sizeof(struct stat));
+
+  if ((pj == NULL) || (pio == NULL) || (pLen == NULL)) {
+    abort();
+  }
+
+  /* Get the length of the input */
+  if (fstat(pj->fIn, &st)) {
+    return "failed to stat input";
+  }
+  if (!S_ISREG(st.st_mode)) {
+    return "input is not a regular file";
+  }
+  ilen = (int64_t) st.st_size;
+
+  /* Everything but scrambling starts from scrambled data, whose trailer
+   * must match the key */
+  if (pj->op != OP_SCRAMBLE) {
+    if (ilen < WARP64_TRAILER) {
+      return "missing trailer";
+    }
+    if (!checkTrailer(pj->fIn, ilen, pj->key, &match)) {
+      return "failed to read trailer";
+    }
+    if (pj->op == OP_VERIFY) {
+      *pLen = match ? 1 : 0;
+      return NULL;
+    }
+    if (!match) {
+      return "incorrect scrambling key";
+    }
+  }
+
+  if (fstat(pj->fOut, &st)) {
+    return "failed to stat output";
+  }
+  if (!S_ISREG(st.st_mode)) {
+    return "output is not a regular file";
+  }
+
+  /* Work out the lengths and the transform; xlen is the number of input
+   * bytes that are transformed, and everything past it in the output
+   * is transformed zero bytes, which is the trailer when scrambling */
+  if (pj->op == OP_SCRAMBLE) {
+    olen = ilen + WARP64_TRAILER;
+    xlen = ilen;
+    pc = warp64_init(pj->key, WARP64_SCRAMBLE);
+  } else if (pj->op == OP_DESCRAMBLE) {
+    olen = ilen - WARP64_TRAILER;
+    xlen = olen;
+    pc = warp64_init(pj->key, WARP64_DESCRAMBLE);
+  } else {
+    olen = ilen;
+    xlen = olen;
+    pc = warp64_init(rekeyDelta(pj->key, pj->newkey), WARP64_SCRAMBLE);
+  }
+  if (pc == NULL) {
+    abort();
+  }
+
+  /* Give the output its length */
+  if (ftruncate(pj->fOut, (off_t) olen)) {
+    pError = "failed to set output length";
+  }
+
+  /* Transform, in one go for a small file and window by window
+   * otherwise */
+  if ((pError == NULL) && (olen > 0) && (olen <= WARP64IO_SMALL) &&
+        (olen <= WINDOW_SIZE)) {
+    result = warp64io_small(pio, pj->fIn, pj->fOut, pc,
+                (size_t) olen, (size_t) xlen, WARP64IO_CRC_NONE, NULL);
+    if (result != WARP64IO_OK) {
+      pError = warp64io_errstr(result);
+    }
+
+  } else if (pError == NULL) {
+    for(base = 0; base < olen; base += ws) {
+      ws = olen - base;
+      if (ws > WINDOW_SIZE) {
+        ws = WINDOW_SIZE;
+      }
+      wsi = xlen - base;
+      if (wsi > ws) {
+        wsi = ws;
+      }
+      if (wsi < 0) {
+        wsi = 0;
+      }
+      result = warp64io_window(pio, pj->fIn, pj->fOut, pc, base,
+                  (size_t) ws, (size_t) wsi, WARP64IO_CRC_NONE, NULL);
+      if (result != WARP64IO_OK) {
+        pError = warp64io_errstr(result);
+        break;
+      }
+    }
+  }
+
+  warp64_final(pc, NULL);
+  pc = NULL;
+
+  *pLen = olen;
+  return pError;
+}
+
+/*
+ * Worker thread function.
+ *
+ * The worker takes the most urgent job from the queue, runs it, replies
+ * and closes the descriptors of the job, until the daemon stops and the
+ * queue is empty.
+ *
+ * Parameters:
+ *
+ *   pArg - ignored
+ *
+ * Return:
+ *
+ *   NULL
+ */
+static void *workerMain(void *pArg) {
+  int i = 0;
+  int result = 0;
+  int64_t len = 0;
+  JOB *pj = NULL;
+  const char *pError = NULL;
+  char text[REPLY_MAX + 1];
+  WARP64IO io;
+
+  memset(&io, 0, sizeof(WARP64IO));
+  memset(text, 0, REPLY_MAX + 1);
+  (void) pArg;
+
+  result = warp64io_begin(&io, m_backend, WINDOW_SIZE, m_ioflags);
+  if (result != WARP64IO_OK) {
+    fprintf(stderr, "%s: %s!\n", pModule, warp64io_errstr(result));
+    warp64io_end(&io);
+
+    /* Leave the queue to the other workers */
+    return NULL;
+  }
+
+  for(;;) {
+    /* Wait for a job, taking the most urgent one */
+    if (pthread_mutex_lock(&m_lock)) {
+      abort();
+    }
+    for(;;) {
+      pj = NULL;
+      for(i = 0; i < PRIORITY_LEVELS; i++) {
+        if (m_pHead[i] != NULL) {
+          pj = m_pHead[i];
+          m_pHead[i] = pj->pNext;
+          if (m_pHead[i] == NULL) {
+            m_pTail[i] = NULL;
+          }
+          pj->pNext = NULL;
+          m_queued--;
+          break;
+        }
+      }
+      if ((pj != NULL) || m_stop) {
+        break;
+      }
+      if (pthread_cond_wait(&m_work, &m_lock)) {
+        abort();
+      }
+    }
+    if (pj != NULL) {
+      if (pthread_cond_broadcast(&m_room)) {
+        abort();
+      }
+    }
+    if (pthread_mutex_unlock(&m_lock)) {
+      abort();
+    }
+    if (pj == NULL) {
+      break;
+    }
+
+    /* Run the job and reply */
+    len = 0;
+    pError = runJob(pj, &io, &len);
+    if (pError != NULL) {
+      snprintf(text, REPLY_MAX + 1, "error %s", pError);
+    } else if (pj->op == OP_VERIFY) {
+      snprintf(text, REPLY_MAX + 1, "%s", len ? "match" : "mismatch");
+    } else {
+      snprintf(text, REPLY_MAX + 1, "ok %lld", (long long) len);
+    }
+
+    /* Close the descriptors before replying, so that the client never
+     * sees a reply while the daemon still holds its files */
+    close(pj->fIn);
+    if (pj->fOut >= 0) {
+      close(pj->fOut);
+    }
+    sendReply(pj->pConn, pj->id, text);
+
+    /* Let the connection read its next request */
+    if (pthread_mutex_lock(&m_lock)) {
+      abort();
+    }
+    (pj->pConn->inflight)--;
+    if (pthread_cond_broadcast(&m_room)) {
+      abort();
+    }
+    if (pthread_mutex_unlock(&m_lock)) {
+      abort();
+    }
+    connRelease(pj->pConn);
+    free(pj);
+    pj = NULL;
+  }
+
+  warp64io_end(&io);
+  return NULL;
+}
+
+/*
+ * Connection thread function.
+ *
+ * The thread reads requests from its connection and queues them.
+ * Before it reads the next request, it waits until the queue and the
+ * connection have room, which is what pushes back on clients.  It
+ * stops when the client closes the connection or the daemon stops.
+ *
+ * Parameters:
+ *
+ *   pArg - pointer to the CONN
+ *
+ * Return:
+ *
+ *   NULL
+ */
+static void *connMain(void *pArg) {
+  CONN *pc = NULL;
+  JOB *pj = NULL;
+  struct cmsghdr *pcm = NULL;
+  const char *pError = NULL;
+  ssize_t rv = 0;
+  int fds[FD_MAX];
+  int fd = -1;
+  int nfd = 0;
+  int extra = 0;
+  int want = 0;
+  int ok = 0;
+  int i = 0;
+  int n = 0;
+
+  char msg[REQUEST_MAX + 1];
+  union {
+    char buf[CMSG_SPACE(FD_MAX * sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  struct msghdr mh;
+  struct iovec iov;
+
+  if (pArg == NULL) {
+    abort();
+  }
+  pc = (CONN *) pArg;
+
+  for(;;) {
+    /* Wait for room */
+    ok = 1;
+    if (pthread_mutex_lock(&m_lock)) {
+      abort();
+    }
+    while ((!m_stop) && ((m_queued >= m_depth) ||
+            (pc->inflight >= CONN_INFLIGHT))) {
+      if (pthread_cond_wait(&m_room, &m_lock)) {
+        abort();
+      }
+    }
+    if (m_stop) {
+      ok = 0;
+    }
+    if (pthread_mutex_unlock(&m_lock)) {
+      abort();
+    }
+    if (!ok) {
+      break;
+    }
+
+    /* Receive the next request with its descriptors */
+    memset(msg, 0, REQUEST_MAX + 1);
+    memset(&ctl, 0, sizeof(ctl));
+    memset(&mh, 0, sizeof(struct msghdr));
+    memset(&iov, 0, sizeof(struct iovec));
+    iov.iov_base = msg;
+    iov.iov_len = REQUEST_MAX;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+
+#ifdef MSG_CMSG_CLOEXEC
+    rv = recvmsg(pc->fd, &mh, MSG_CMSG_CLOEXEC);
+#else
+    rv = recvmsg(pc->fd, &mh, 0);
+#endif
+    if ((rv < 0) && (errno == EINTR)) {
+      continue;
+    }
+
+    /* An empty message looks like the end of the connection, unless it
+     * carried descriptors, in which case it is a bad request */
+    if ((rv < 0) || ((rv == 0) && (mh.msg_controllen < 1))) {
+      break;
+    }
+
+    /* Collect the descriptors; any beyond FD_MAX are closed right
+     * away, since no request takes them */
+    nfd = 0;
+    extra = 0;
+    for(pcm = CMSG_FIRSTHDR(&mh); pcm != NULL;
+        pcm = CMSG_NXTHDR(&mh, pcm)) {
+      if ((pcm->cmsg_level != SOL_SOCKET) ||
+          (pcm->cmsg_type != SCM_RIGHTS)) {
+        continue;
+      }
+      n = (int) ((pcm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+      for(i = 0; i < n; i++) {
+        memcpy(&fd, CMSG_DATA(pcm) + i * sizeof(int), sizeof(int));
+        if (nfd < FD_MAX) {
+          fds[nfd] = fd;
+          nfd++;
+        } else {
+          close(fd);
+          extra = 1;
+        }
+      }
+    }
+
+    /* Parse the request */
+    pj = (JOB *) calloc(1, sizeof(JOB));
+    if (pj == NULL) {
+      abort();
+    }
+    pj->fIn = -1;
+    pj->fOut = -1;
+    pError = NULL;
+    ok = parseRequest(msg, pj, &pError);
+
+    /* A truncated message makes any parse error meaningless, so the
+     * truncation is reported instead; the control data is only
+     * truncated when there were more descriptors than it has room for,
+     * and the kernel closes the ones that didn't fit */
+    if ((mh.msg_flags & MSG_CTRUNC) || extra) {
+      ok = 0;
+      pError = "too many descriptors";
+    } else if (mh.msg_flags & MSG_TRUNC) {
+      ok = 0;
+      pError = "request too long";
+    }
+    if (ok) {
+      want = (pj->op == OP_VERIFY) ? 1 : 2;
+      if (nfd != want) {
+        ok = 0;
+        pError = (want == 1) ? "verify takes one descriptor"
+                              : "operation takes two descriptors";
+      }
+    }
+    if (ok) {
+      pj->fIn = fds[0];
+      if (want > 1) {
+        pj->fOut = fds[1];
+      }
+    }
+
+    /* Queue the job, unless the daemon stopped in the meantime */
+    if (ok) {
+      if (pthread_mutex_lock(&m_lock)) {
+        abort();
+      }
+      if (m_stop) {
+        ok = 0;
+        pError = "daemon is stopping";
+      } else {
+        pj->pConn = pc;
+        (pc->refs)++;
+        (pc->inflight)++;
+        if (m_pTail[pj->prio] == NULL) {
+          m_pHead[pj->prio] = pj;
+        } else {
+          m_pTail[pj->prio]->pNext = pj;
+        }
+        m_pTail[pj->prio] = pj;
+        m_queued++;
+        if (pthread_cond_signal(&m_work)) {
+          abort();
+        }
+      }
+      if (pthread_mutex_unlock(&m_lock)) {
+        abort();
+      }
+    }
+
+    /* Answer a bad request right away */
+    if (!ok) {
+      for(i = 0; i < nfd; i++) {
+        close(fds[i]);
+      }
+      snprintf(msg, REQUEST_MAX + 1, "error %s", pError);
+      sendReply(pc, pj->id, msg);
+      free(pj);
+    }
+    pj = NULL;
+  }
+
+  connRelease(pc);
+  return NULL;
+}
+
+/*
+ * Signal thread function.
+ *
+ * Waits for SIGINT or SIGTERM, which are blocked in every thread, and
+ * then stops the daemon and shuts down the listening socket so that
+ * the accept loop returns.
+ *
+ * Parameters:
+ *
+ *   pArg - pointer to the sigset_t of the signals
+ *
+ * Return:
+ *
+ *   NULL
+ */
+static void *signalMain(void *pArg) {
+  int sig = 0;
+
+  if (pArg == NULL) {
+    abort();
+  }
+
+  while (sigwait((sigset_t *) pArg, &sig) != 0);
+
+  if (pthread_mutex_lock(&m_lock)) {
+    abort();
+  }
+  m_stop = 1;
+  if (pthread_cond_broadcast(&m_work)) {
+    abort();
+  }
+  if (pthread_cond_broadcast(&m_room)) {
+    abort();
+  }
+  if (pthread_mutex_unlock(&m_lock)) {
+    abort();
+  }
+  shutdown(m_listen, SHUT_RDWR);
+  return NULL;
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  int status = 1;
+  int i = 0;
+  int fd = -1;
+  int bound = 0;
+  int started = 0;
+  int stopping = 0;
+  long lval = 0;
+  mode_t oldmask = 0;
+
+  const char *pPath = NULL;
+  CONN *pc = NULL;
+  pthread_t *pWorkers = NULL;
+  pthread_t sigthread;
+  pthread_t connthread;
+  pthread_attr_t attr;
+  sigset_t sigs;
+  struct sockaddr_un addr;
+  struct stat st;
+
+  /* Initialize structures */
+  memset(&addr, 0, sizeof(struct sockaddr_un));
+  memset(&st, 0, sizeof(struct stat));
+  memset(m_keys, 0, sizeof(m_keys));
+  memset(m_pHead, 0, sizeof(m_pHead));
+  memset(m_pTail, 0, sizeof(m_pTail));
+  sigemptyset(&sigs);
+
+  /* Get the module name */
+  pModule = NULL;
+  if ((argc > 0) && (argv != NULL)) {
+    pModule = argv[0];
+  }
+  if (pModule == NULL) {
+    pModule = "warp64d";
+  }
+
+  /* If no parameters provided, print help screen and fail */
+  if (argc <= 1) {
+    status = 0;
+    fprintf(stderr, "Warp64 scrambling daemon\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Syntax:\n");
+    fprintf(stderr, "  warp64d [options] [socket_path]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[socket_path] is where to listen for jobs\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -j [count]  worker threads (0 for one per CPU)\n");
+    fprintf(stderr, "  -q [depth]  queued jobs before back-pressure\n");
+    fprintf(stderr, "  -b [name]   window I/O: mmap, pread or uring\n");
+    fprintf(stderr, "  --nocache   drop finished windows from cache\n");
+  }
+
+  /* Check that parameters are present */
+  if (status) {
+    if (argv == NULL) {
+      abort();
+    }
+    for(i = 0; i < argc; i++) {
+      if (argv[i] == NULL) {
+        abort();
+      }
+    }
+  }
+
+  /* Parse the options */
+  for(i = 1; status && (i < argc); i++) {
+    if (strcmp(argv[i], "-j") == 0) {
+      i++;
+      if ((i >= argc) || (!parseCount(argv[i], 0, MAX_THREADS, &lval))) {
+        status = 0;
+        fprintf(stderr, "%s: -j requires a count in range 0-%d!\n",
+                pModule, MAX_THREADS);
+      } else {
+        m_threads = (int) lval;
+      }
+
+    } else if (strcmp(argv[i], "-q") == 0) {
+      i++;
+      if ((i >= argc) || (!parseCount(argv[i], 1, QUEUE_MAX, &lval))) {
+        status = 0;
+        fprintf(stderr, "%s: -q requires a depth in range 1-%d!\n",
+                pModule, QUEUE_MAX);
+      } else {
+        m_depth = (int) lval;
+      }
+
+    } else if (strcmp(argv[i], "-b") == 0) {
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: -b requires a backend name!\n", pModule);
+      } else {
+        m_backend = warp64io_find(argv[i]);
+        if (m_backend < 0) {
+          status = 0;
+          fprintf(stderr, "%s: Unknown I/O backend '%s'!\n",
+                  pModule, argv[i]);
+        } else if (!warp64io_supported(m_backend)) {
+          status = 0;
+          fprintf(stderr, "%s: I/O backend '%s' is not supported here!\n",
+                  pModule, argv[i]);
+        }
+      }
+
+    } else if (strcmp(argv[i], "--nocache") == 0) {
+      m_ioflags |= WARP64IO_NOCACHE;
+
+    } else if ((pPath == NULL) && (argv[i][0] != '-')) {
+      pPath = argv[i];
+
+    } else {
+      status = 0;
+      fprintf(stderr, "%s: Unknown option '%s'\n", pModule, argv[i]);
+    }
+  }
+  if (status && (pPath == NULL)) {
+    status = 0;
+    fprintf(stderr, "%s: Wrong number of parameters!\n", pModule);
+  }
+  if (status && (strlen(pPath) >= sizeof(addr.sun_path))) {
+    status = 0;
+    fprintf(stderr, "%s: Socket path is too long!\n", pModule);
+  }
+
+  /* One worker per processor by default */
+  if (status && (m_threads < 1)) {
+    lval = sysconf(_SC_NPROCESSORS_ONLN);
+    if (lval < 1) {
+      lval = 1;
+    }
+    if (lval > MAX_THREADS) {
+      lval = MAX_THREADS;
+    }
+    m_threads = (int) lval;
+  }
+
+  /* Replace a stale socket, but nothing else */
+  if (status && (lstat(pPath, &st) == 0)) {
+    if (S_ISSOCK(st.st_mode)) {
+      unlink(pPath);
+    } else {
+      status = 0;
+      fprintf(stderr, "%s: '%s' exists and is not a socket!\n",
+              pModule, pPath);
+    }
+  }
+
+  /* Listen, with the socket only accessible to its owner, because
+   * anyone who can connect can have files transformed */
+  if (status) {
+    m_listen = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (m_listen < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to create socket!\n", pModule);
+    }
+  }
+  if (status) {
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, pPath);
+    oldmask = umask(077);
+    if (bind(m_listen, (struct sockaddr *) &addr,
+              sizeof(struct sockaddr_un))) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to bind '%s'!\n", pModule, pPath);
+    } else {
+      bound = 1;
+    }
+    umask(oldmask);
+  }
+  if (status) {
+    if (listen(m_listen, SOMAXCONN)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to listen on '%s'!\n", pModule, pPath);
+    }
+  }
+
+  /* Route the stop signals to the signal thread, and let failed sends
+   * to departed clients return errors instead of killing the daemon */
+  if (status) {
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &sigs, NULL)) {
+      abort();
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (pthread_create(&sigthread, NULL, &signalMain, &sigs)) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to start signal thread!\n", pModule);
+    }
+  }
+
+  /* Start the workers */
+  if (status) {
+    pWorkers = (pthread_t *) calloc((size_t) m_threads, sizeof(pthread_t));
+    if (pWorkers == NULL) {
+      abort();
+    }
+    for(i = 0; i < m_threads; i++) {
+      if (pthread_create(&(pWorkers[i]), NULL, &workerMain, NULL)) {
+        break;
+      }
+      started++;
+    }
+    if (started < 1) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to start worker threads!\n", pModule);
+    }
+  }
+
+  /* Accept connections until stopped; each connection gets a detached
+   * thread that reads its requests */
+  if (status) {
+    if (pthread_attr_init(&attr)) {
+      abort();
+    }
+    if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) {
+      abort();
+    }
+    for(;;) {
+#ifdef __linux__
+      fd = accept4(m_listen, NULL, NULL, SOCK_CLOEXEC);
+#else
+      fd = accept(m_listen, NULL, NULL);
+#endif
+      if (fd < 0) {
+        if (pthread_mutex_lock(&m_lock)) {
+          abort();
+        }
+        stopping = m_stop;
+        if (pthread_mutex_unlock(&m_lock)) {
+          abort();
+        }
+        if (stopping) {
+          break;
+        }
+        if ((errno == EINTR) || (errno == ECONNABORTED)) {
+          continue;
+        }
+
+        /* Out of descriptors, so wait for jobs to finish */
+        if ((errno == EMFILE) || (errno == ENFILE)) {
+          sleep(1);
+          continue;
+        }
+        status = 0;
+        fprintf(stderr, "%s: Failed to accept connection!\n", pModule);
+        break;
+      }
+
+      pc = (CONN *) calloc(1, sizeof(CONN));
+      if (pc == NULL) {
+        abort();
+      }
+      pc->fd = fd;
+      pc->refs = 1;
+      if (pthread_create(&connthread, &attr, &connMain, pc)) {
+        close(fd);
+        free(pc);
+      }
+      pc = NULL;
+      fd = -1;
+    }
+    if (pthread_attr_destroy(&attr)) {
+      abort();
+    }
+  }
+
+  /* Stop, letting the workers finish the queued jobs */
+  if (pthread_mutex_lock(&m_lock)) {
+    abort();
+  }
+  m_stop = 1;
+  if (pthread_cond_broadcast(&m_work)) {
+    abort();
+  }
+  if (pthread_cond_broadcast(&m_room)) {
+    abort();
+  }
+  if (pthread_mutex_unlock(&m_lock)) {
+    abort();
+  }
+  for(i = 0; i < started; i++) {
+    if (pthread_join(pWorkers[i], NULL)) {
+      abort();
+    }
+  }
+  if (pWorkers != NULL) {
+    free(pWorkers);
+    pWorkers = NULL;
+  }
+
+  /* Remove the socket */
+  if (m_listen >= 0) {
+    close(m_listen);
+    m_listen = -1;
+  }
+  if (bound) {
+    unlink(pPath);
+  }
+
+  /* Invert status and return */
+  if (status) {
+    status = 0;
+  } else {
+    status = 1;
+  }
+  return status;
+}
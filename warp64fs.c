@@ -0,0 +1,831 @@
+/*
+ * warp64fs.c
+ * ==========
+ *
+ * FUSE filesystem that shows a directory tree of scrambled files as
+ * their descrambled counterparts.
+ *
+ * Syntax:
+ *
+ *   ./warp64fs [--key-file path] source_dir mount_point [fuse_options]
+ *
+ * The mount shows the directory tree under source_dir.  Each regular
+ * file with the ".warp64" suffix appears with the suffix dropped and
+ * with the length of its descrambled content, which leaves out the
+ * trailer.  Other files and symbolic links are hidden, so that only the
+ * plain view of the scrambled files is visible.
+ *
+ * Reading a file reads just the requested range of the scrambled file
+ * and descrambles it in the buffer handed over by FUSE.  The transform
+ * only depends on the byte offset, so any range can be decoded on its
+ * own, and tools can seek around a large file without a descrambled
+ * copy ever being written.
+ *
+ * The mount is read-only.  The trailer of each file is checked against
+ * the key when the file is opened, and opening fails with EACCES if the
+ * key is wrong.  Because the scrambled files are expected not to change
+ * while mounted, the kernel is allowed to cache their contents.
+ *
+ * The scrambling key is read from the console before mounting, or from
+ * the first line of a file with --key-file.  Everything after the two
+ * directories is passed to FUSE, so -f keeps the filesystem in the
+ * foreground and -o passes mount options.
+ *
+ * The transform is performed by libwarp64.c, which uses the kernels in
+ * warp64k.c, and the program needs libfuse 3:
+ *
+ *   cc -D_FILE_OFFSET_BITS=64 -O2 -pthread -o warp64fs warp64fs.c
+ *     libwarp64.c warp64k.c `pkg-config --cflags --libs fuse3`
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+/* The FUSE API version this is written against */
+#define FUSE_USE_VERSION 31
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <fuse.h>
+
+#include "libwarp64.h"
+
+/*
+ * Check 64-bit file mode
+ * ======================
+ */
+
+#ifdef _FILE_OFFSET_BITS
+#if (_FILE_OFFSET_BITS != 64)
+#error Need to define _FILE_OFFSET_BITS=64
+#endif
+#else
+#error Need to define _FILE_OFFSET_BITS=64
+#endif
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The maximum number of characters in a scrambling key.
+ */
+#define MAX_KEY_LENGTH (WARP64_KEYMAX)
+
+/*
+ * The file suffix of scrambled files.
+ */
+#define FILE_SUFFIX ".warp64"
+
+/*
+ * The write permission bits, which are removed from everything shown.
+ */
+#define WRITE_BITS (S_IWUSR | S_IWGRP | S_IWOTH)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The name of the executable module, for use in diagnostic messages.
+ *
+ * This is set at the start of the entrypoint.
+ */
+static const char *pModule = NULL;
+
+/*
+ * The absolute path of the source directory, without a trailing slash
+ * unless it is the root directory.
+ *
+ * Set in the entrypoint before mounting.
+ */
+static char m_source[PATH_MAX];
+
+/*
+ * The descrambling context.  Reads only use warp64_update_at(), so the
+ * context is shared by all FUSE threads.
+ *
+ * Set in the entrypoint before mounting.
+ */
+static WARP64_CTX *m_pc = NULL;
+
+/*
+ * The normalized scrambling key.
+ *
+ * Set in the entrypoint before mounting.
+ */
+static int32_t m_key = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int readKey(char *pBuf, FILE *pIn, int console);
+static char *sourcePath(const char *pPath, int suffix);
+static int isScrambled(const char *pName);
+
+static void *fsInit(struct fuse_conn_info *pConn, struct fuse_config *pCfg);
+static int fsGetattr(
+    const char                  * pPath,
+          struct stat           * pst,
+          struct fuse_file_info * pfi);
+static int fsReaddir(
+    const char                  * pPath,
+          void                  * pBuf,
+          fuse_fill_dir_t         filler,
+          off_t                   off,
+          struct fuse_file_info * pfi,
+          enum fuse_readdir_flags flags);
+static int fsOpen(const char *pPath, struct fuse_file_info *pfi);
+static int fsRead(
+    const char                  * pPath,
+          char                  * pBuf,
+          size_t                  size,
+          off_t                   off,
+          struct fuse_file_info * pfi);
+static int fsRelease(const char *pPath, struct fuse_file_info *pfi);
+static int fsStatfs(const char *pPath, struct statvfs *psv);
+
+/*
+ * Read the scrambling key, suppressing echo if reading from a console.
+ *
+ * Reading stops at the end of the first line.  The key must have at
+ * least one and at most MAX_KEY_LENGTH characters; whether they are
+ * valid is checked when the key is derived.
+ *
+ * Error messages are printed.
+ *
+ * Parameters:
+ *
+ *   pBuf - receives the nul-terminated key, with room for
+ *   MAX_KEY_LENGTH + 1 characters
+ *
+ *   pIn - the stream to read from
+ *
+ *   console - non-zero if pIn is a console whose echo should be turned
+ *   off while reading
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int readKey(char *pBuf, FILE *pIn, int console) {
+  int status = 1;
+  int changed = 0;
+  int c = 0;
+  int n = 0;
+  struct termios old_attr;
+  struct termios new_attr;
+
+  /* Initialize structures */
+  memset(&old_attr, 0, sizeof(struct termios));
+  memset(&new_attr, 0, sizeof(struct termios));
+
+  /* Check parameters */
+  if ((pBuf == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  memset(pBuf, 0, MAX_KEY_LENGTH + 1);
+
+  /* Turn off echo if reading from a console */
+  if (console && isatty(fileno(pIn))) {
+    if (tcgetattr(fileno(pIn), &old_attr) == 0) {
+      memcpy(&new_attr, &old_attr, sizeof(struct termios));
+      new_attr.c_lflag &= ~((tcflag_t) ECHO);
+      if (tcsetattr(fileno(pIn), TCSANOW, &new_attr) == 0) {
+        changed = 1;
+      }
+    }
+  }
+
+  /* Read the first line */
+  for(c = getc(pIn); (c != EOF) && (c != '\n'); c = getc(pIn)) {
+    if (c == '\r') {
+      continue;
+    }
+    if (n >= MAX_KEY_LENGTH) {
+      status = 0;
+      fprintf(stderr, "%s: Scrambling key is too long!\n", pModule);
+      break;
+    }
+    pBuf[n] = (char) c;
+    n++;
+  }
+  if (status && (n < 1)) {
+    status = 0;
+    fprintf(stderr, "%s: Scrambling key may not be empty!\n", pModule);
+  }
+
+  /* Restore the console */
+  if (changed) {
+    tcsetattr(fileno(pIn), TCSANOW, &old_attr);
+    fprintf(stderr, "\n");
+  }
+
+  if (!status) {
+    memset(pBuf, 0, MAX_KEY_LENGTH + 1);
+  }
+  return status;
+}
+
+/*
+ * Map a path in the mount to a path in the source directory.
+ *
+ * Parameters:
+ *
+ *   pPath - the path in the mount, which starts with a slash
+ *
+ *   suffix - non-zero to append the .warp64 suffix
+ *
+ * Return:
+ *
+ *   the dynamically allocated source path, or NULL if out of memory
+ */
+static char *sourcePath(const char *pPath, int suffix) {
+  char *pResult = NULL;
+  size_t len = 0;
+
+  if (pPath == NULL) {
+    abort();
+  }
+
+  len = strlen(m_source) + strlen(pPath) + strlen(FILE_SUFFIX) + 1;
+  pResult = (char *) malloc(len);
+  if (pResult == NULL) {
+    return NULL;
+  }
+
+  strcpy(pResult, m_source);
+  if (strcmp(pPath, "/") != 0) {
+    if (strcmp(m_source, "/") == 0) {
+      pResult[0] = (char) 0;
+    }
+    strcat(pResult, pPath);
+  }
+  if (suffix) {
+    strcat(pResult, FILE_SUFFIX);
+  }
+
+  return pResult;
+}
+
+/*
+ * Check whether a directory entry name is for a scrambled file.
+ *
+ * Parameters:
+ *
+ *   pName - the entry name
+ *
+ * Return:
+ *
+ *   non-zero if the name has the .warp64 suffix after at least one
+ *   other character, zero if not
+ */
+static int isScrambled(const char *pName) {
+  size_t slen = 0;
+  size_t suflen = 0;
+
+  if (pName == NULL) {
+    abort();
+  }
+
+  slen = strlen(pName);
+  suflen = strlen(FILE_SUFFIX);
+  if (slen <= suflen) {
+    return 0;
+  }
+  return (strcmp(&(pName[slen - suflen]), FILE_SUFFIX) == 0);
+}
+
+/*
+ * FUSE init operation.
+ *
+ * The scrambled files are not expected to change while mounted, so the
+ * kernel may keep their pages cached between opens.
+ */
+static void *fsInit(struct fuse_conn_info *pConn, struct fuse_config *pCfg) {
+  (void) pConn;
+
+  if (pCfg != NULL) {
+    pCfg->kernel_cache = 1;
+  }
+  return NULL;
+}
+
+/*
+ * FUSE getattr operation.
+ *
+ * Directories are shown as they are, and a file is shown if the source
+ * has a regular file with the .warp64 suffix added to its name, with
+ * the length of its content.  Write permissions are removed.
+ */
+static int fsGetattr(
+    const char                  * pPath,
+          struct stat           * pst,
+          struct fuse_file_info * pfi) {
+
+  int result = 0;
+  char *pSrc = NULL;
+
+  (void) pfi;
+
+  /* Directories, including the root */
+  pSrc = sourcePath(pPath, 0);
+  if (pSrc == NULL) {
+    return -ENOMEM;
+  }
+  if ((lstat(pSrc, pst) == 0) && S_ISDIR(pst->st_mode)) {
+    pst->st_mode &= ~((mode_t) WRITE_BITS);
+    free(pSrc);
+    return 0;
+  }
+  free(pSrc);
+  pSrc = NULL;
+
+  /* Scrambled files */
+  pSrc = sourcePath(pPath, 1);
+  if (pSrc == NULL) {
+    return -ENOMEM;
+  }
+  if (lstat(pSrc, pst)) {
+    result = -errno;
+  } else if (!S_ISREG(pst->st_mode)) {
+    result = -ENOENT;
+  } else {
+    pst->st_mode &= ~((mode_t) WRITE_BITS);
+    if (pst->st_size >= WARP64_TRAILER) {
+      pst->st_size -= WARP64_TRAILER;
+    } else {
+      pst->st_size = 0;
+    }
+  }
+  free(pSrc);
+  pSrc = NULL;
+
+  return result;
+}
+
+/*
+ * FUSE readdir operation.
+ *
+ * Lists the subdirectories and the scrambled files of a source
+ * directory, with the suffix dropped from the file names.
+ */
+static int fsReaddir(
+    const char                  * pPath,
+          void                  * pBuf,
+          fuse_fill_dir_t         filler,
+          off_t                   off,
+          struct fuse_file_info * pfi,
+          enum fuse_readdir_flags flags) {
+
+  int result = 0;
+  size_t nlen = 0;
+  char *pSrc = NULL;
+  char *pName = NULL;
+  DIR *pd = NULL;
+  struct dirent *pe = NULL;
+  struct stat st;
+
+  (void) off;
+  (void) pfi;
+  (void) flags;
+
+  memset(&st, 0, sizeof(struct stat));
+
+  pSrc = sourcePath(pPath, 0);
+  if (pSrc == NULL) {
+    return -ENOMEM;
+  }
+  pd = opendir(pSrc);
+  if (pd == NULL) {
+    result = -errno;
+  }
+  free(pSrc);
+  pSrc = NULL;
+  if (result) {
+    return result;
+  }
+
+  filler(pBuf, ".", NULL, 0, (enum fuse_fill_dir_flags) 0);
+  filler(pBuf, "..", NULL, 0, (enum fuse_fill_dir_flags) 0);
+
+  for(pe = readdir(pd); pe != NULL; pe = readdir(pd)) {
+    if ((strcmp(pe->d_name, ".") == 0) ||
+          (strcmp(pe->d_name, "..") == 0)) {
+      continue;
+    }
+    if (fstatat(dirfd(pd), pe->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+      continue;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+      st.st_mode &= ~((mode_t) WRITE_BITS);
+      if (filler(pBuf, pe->d_name, &st, 0, (enum fuse_fill_dir_flags) 0)) {
+        break;
+      }
+
+    } else if (S_ISREG(st.st_mode) && isScrambled(pe->d_name)) {
+      nlen = strlen(pe->d_name) - strlen(FILE_SUFFIX);
+      pName = (char *) malloc(nlen + 1);
+      if (pName == NULL) {
+        result = -ENOMEM;
+        break;
+      }
+      memcpy(pName, pe->d_name, nlen);
+      pName[nlen] = (char) 0;
+
+      st.st_mode &= ~((mode_t) WRITE_BITS);
+      if (st.st_size >= WARP64_TRAILER) {
+        st.st_size -= WARP64_TRAILER;
+      } else {
+        st.st_size = 0;
+      }
+      if (filler(pBuf, pName, &st, 0, (enum fuse_fill_dir_flags) 0)) {
+        free(pName);
+        pName = NULL;
+        break;
+      }
+      free(pName);
+      pName = NULL;
+    }
+  }
+
+  closedir(pd);
+  pd = NULL;
+
+  return result;
+}
+
+/*
+ * FUSE open operation.
+ *
+ * Only read access is allowed.  The source file is opened and its
+ * trailer checked against the key, and the descriptor is kept in the
+ * file handle for reads.
+ */
+static int fsOpen(const char *pPath, struct fuse_file_info *pfi) {
+  int result = 0;
+  int fd = -1;
+  char *pSrc = NULL;
+  uint8_t trailer[WARP64_TRAILER];
+  struct stat st;
+
+  memset(trailer, 0, WARP64_TRAILER);
+  memset(&st, 0, sizeof(struct stat));
+
+  if ((pfi->flags & O_ACCMODE) != O_RDONLY) {
+    return -EACCES;
+  }
+
+  pSrc = sourcePath(pPath, 1);
+  if (pSrc == NULL) {
+    return -ENOMEM;
+  }
+  fd = open(pSrc, O_RDONLY);
+  if (fd < 0) {
+    result = -errno;
+  }
+  free(pSrc);
+  pSrc = NULL;
+
+  if ((result == 0) && fstat(fd, &st)) {
+    result = -errno;
+  }
+  if ((result == 0) && (!S_ISREG(st.st_mode))) {
+    result = -ENOENT;
+  }
+  if ((result == 0) && (st.st_size < WARP64_TRAILER)) {
+    result = -EIO;
+  }
+  if (result == 0) {
+    if (pread(fd, trailer, WARP64_TRAILER,
+                st.st_size - WARP64_TRAILER) != WARP64_TRAILER) {
+      result = -EIO;
+    }
+  }
+  if (result == 0) {
+    if (warp64_recover((int64_t) (st.st_size - WARP64_TRAILER),
+                        trailer) != m_key) {
+      result = -EACCES;
+    }
+  }
+
+  if (result) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    return result;
+  }
+
+  pfi->fh = (uint64_t) fd;
+  pfi->keep_cache = 1;
+  return 0;
+}
+
+/*
+ * FUSE read operation.
+ *
+ * Reads the range from the source file straight into the FUSE buffer
+ * and descrambles it there, stopping short of the trailer.
+ */
+static int fsRead(
+    const char                  * pPath,
+          char                  * pBuf,
+          size_t                  size,
+          off_t                   off,
+          struct fuse_file_info * pfi) {
+
+  int fd = -1;
+  int64_t clen = 0;
+  size_t done = 0;
+  ssize_t rv = 0;
+  struct stat st;
+
+  (void) pPath;
+
+  memset(&st, 0, sizeof(struct stat));
+
+  fd = (int) pfi->fh;
+  if (fstat(fd, &st)) {
+    return -errno;
+  }
+
+  /* Clip the range to the content, leaving out the trailer */
+  clen = ((int64_t) st.st_size) - WARP64_TRAILER;
+  if (((int64_t) off) >= clen) {
+    return 0;
+  }
+  if (((int64_t) size) > clen - ((int64_t) off)) {
+    size = (size_t) (clen - ((int64_t) off));
+  }
+
+  /* Read the range */
+  while (done < size) {
+    rv = pread(fd, pBuf + done, size - done, off + (off_t) done);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    if (rv == 0) {
+      break;
+    }
+    done += (size_t) rv;
+  }
+
+  /* Descramble it in place at its offset */
+  warp64_update_at(m_pc, (int64_t) off,
+                    (const uint8_t *) pBuf, (uint8_t *) pBuf, done);
+
+  return (int) done;
+}
+
+/*
+ * FUSE release operation.
+ */
+static int fsRelease(const char *pPath, struct fuse_file_info *pfi) {
+  (void) pPath;
+
+  close((int) pfi->fh);
+  pfi->fh = 0;
+  return 0;
+}
+
+/*
+ * FUSE statfs operation, which reports the source filesystem.
+ */
+static int fsStatfs(const char *pPath, struct statvfs *psv) {
+  int result = 0;
+  char *pSrc = NULL;
+
+  pSrc = sourcePath(pPath, 0);
+  if (pSrc == NULL) {
+    return -ENOMEM;
+  }
+  if (statvfs(pSrc, psv)) {
+    result = -errno;
+  }
+  free(pSrc);
+  pSrc = NULL;
+
+  return result;
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  int status = 1;
+  int i = 0;
+  int nfuse = 0;
+  int result = 0;
+
+  const char *pKeyFile = NULL;
+  const char *pSource = NULL;
+  char **ppFuse = NULL;
+  FILE *pKeyIn = NULL;
+  char kbuf[MAX_KEY_LENGTH + 1];
+  struct stat st;
+  struct fuse_operations ops;
+
+  /* Initialize structures */
+  memset(kbuf, 0, MAX_KEY_LENGTH + 1);
+  memset(&st, 0, sizeof(struct stat));
+  memset(&ops, 0, sizeof(struct fuse_operations));
+  memset(m_source, 0, PATH_MAX);
+
+  /* Get the module name */
+  pModule = NULL;
+  if ((argc > 0) && (argv != NULL)) {
+    pModule = argv[0];
+  }
+  if (pModule == NULL) {
+    pModule = "warp64fs";
+  }
+
+  /* If no parameters provided, print help screen and fail */
+  if (argc <= 1) {
+    status = 0;
+    fprintf(stderr, "Warp64 descrambling filesystem\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Syntax:\n");
+    fprintf(stderr, "  warp64fs [--key-file path] [source] [mount] "
+                    "[fuse_options]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[source] is the directory of scrambled files\n");
+    fprintf(stderr, "[mount] is where their plain view is mounted\n");
+    fprintf(stderr, "  -f          stay in the foreground\n");
+    fprintf(stderr, "  -o [opts]   pass mount options to FUSE\n");
+  }
+
+  /* Check that parameters are present */
+  if (status) {
+    if (argv == NULL) {
+      abort();
+    }
+    for(i = 0; i < argc; i++) {
+      if (argv[i] == NULL) {
+        abort();
+      }
+    }
+  }
+
+  /* Take out our own options and the source directory; everything else
+   * goes to FUSE, which gets a read-only mount */
+  if (status) {
+    ppFuse = (char **) calloc((size_t) argc + 3, sizeof(char *));
+    if (ppFuse == NULL) {
+      abort();
+    }
+    ppFuse[nfuse] = argv[0];
+    nfuse++;
+    ppFuse[nfuse] = "-o";
+    nfuse++;
+    ppFuse[nfuse] = "ro";
+    nfuse++;
+  }
+  for(i = 1; status && (i < argc); i++) {
+    if (strcmp(argv[i], "--key-file") == 0) {
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: --key-file requires a path!\n", pModule);
+      } else {
+        pKeyFile = argv[i];
+      }
+
+    } else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+      /* Mount options; the value is passed along with the option, so
+       * that it is never taken for the source directory */
+      ppFuse[nfuse] = argv[i];
+      nfuse++;
+      i++;
+      ppFuse[nfuse] = argv[i];
+      nfuse++;
+
+    } else if ((pSource == NULL) && (argv[i][0] != '-')) {
+      pSource = argv[i];
+
+    } else {
+      ppFuse[nfuse] = argv[i];
+      nfuse++;
+    }
+  }
+  if (status && (pSource == NULL)) {
+    status = 0;
+    fprintf(stderr, "%s: Wrong number of parameters!\n", pModule);
+  }
+
+  /* FUSE changes directory when it daemonizes, so the source directory
+   * is made absolute */
+  if (status) {
+    if (realpath(pSource, m_source) == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to resolve '%s'\n", pModule, pSource);
+    }
+  }
+  if (status) {
+    if (stat(m_source, &st) || (!S_ISDIR(st.st_mode))) {
+      status = 0;
+      fprintf(stderr, "%s: '%s' is not a directory\n", pModule, pSource);
+    }
+  }
+
+  /* Read the key */
+  if (status && (pKeyFile != NULL)) {
+    pKeyIn = fopen(pKeyFile, "r");
+    if (pKeyIn == NULL) {
+      status = 0;
+      fprintf(stderr, "%s: Failed to open key file '%s'!\n",
+              pModule, pKeyFile);
+    }
+    if (status) {
+      if (!readKey(kbuf, pKeyIn, 0)) {
+        status = 0;
+      }
+    }
+    if (pKeyIn != NULL) {
+      fclose(pKeyIn);
+      pKeyIn = NULL;
+    }
+
+  } else if (status) {
+    fprintf(stderr, "Enter scrambling key:\n");
+    if (!readKey(kbuf, stdin, 1)) {
+      status = 0;
+    }
+  }
+
+  /* Derive the key and set up the shared descrambling context */
+  if (status) {
+    m_key = warp64_derive(kbuf);
+    if (m_key < 0) {
+      status = 0;
+      fprintf(stderr, "%s: Key may only include A-Z a-z 0-9 + /\n",
+              pModule);
+    }
+  }
+  memset(kbuf, 0, MAX_KEY_LENGTH + 1);
+  if (status) {
+    m_pc = warp64_init(m_key, WARP64_DESCRAMBLE);
+    if (m_pc == NULL) {
+      abort();
+    }
+  }
+
+  /* Mount and serve until unmounted */
+  if (status) {
+    ops.init = &fsInit;
+    ops.getattr = &fsGetattr;
+    ops.readdir = &fsReaddir;
+    ops.open = &fsOpen;
+    ops.read = &fsRead;
+    ops.release = &fsRelease;
+    ops.statfs = &fsStatfs;
+
+    result = fuse_main(nfuse, ppFuse, &ops, NULL);
+    if (result != 0) {
+      status = 0;
+    }
+  }
+
+  /* Release everything */
+  if (m_pc != NULL) {
+    warp64_final(m_pc, NULL);
+    m_pc = NULL;
+  }
+  if (ppFuse != NULL) {
+    free(ppFuse);
+    ppFuse = NULL;
+  }
+
+  /* Invert status and return */
+  if (status) {
+    status = 0;
+  } else {
+    status = 1;
+  }
+  return status;
+}
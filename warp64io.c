@@ -0,0 +1,1498 @@
+/*
+ * warp64io.c
+ * ==========
+ *
+ * Implementation of warp64io.h
+ *
+ * See the header for further information.
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+/* Linux extensions, needed for sync_file_range and fallocate */
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "warp64io.h"
+#include "warp64k.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Platform detection
+ * ==================
+ */
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define WARP64IO_HAVE_URING
+#endif
+#endif
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE) && \
+    defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+#define WARP64IO_HAVE_SPARSE
+#endif
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of bytes that are transformed and checksummed at a time
+ * when a window CRC is requested, small enough that a block is still in
+ * the cache between the two.
+ */
+#define XFORM_BLOCK (65536L)
+
+/*
+ * The number of bytes in each chunk of the uring backend.
+ */
+#define URING_CHUNK (262144L)
+
+/*
+ * The number of chunk buffers of the uring backend, which is also the
+ * maximum number of operations in flight.
+ */
+#define URING_DEPTH (8)
+
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * Function pointer types for the operations of a backend.
+ */
+typedef int (*WARP64IO_BEGIN)(WARP64IO *pio);
+
+typedef int (*WARP64IO_WINDOW)(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi);
+
+typedef void (*WARP64IO_END)(WARP64IO *pio);
+
+/*
+ * Describes one of the backends.
+ */
+typedef struct {
+  const char      * pName;
+  WARP64IO_BEGIN    begin;
+  WARP64IO_WINDOW   window;
+  WARP64IO_END      end;
+} WARP64IO_ENTRY;
+
+#ifdef WARP64IO_HAVE_URING
+
+/*
+ * The state of one chunk buffer of the uring backend.
+ */
+typedef struct {
+
+  /*
+   * The chunk buffer.
+   */
+  uint8_t *pBuf;
+
+  /*
+   * The file offset and length of the chunk, and how many of the bytes
+   * come from the input file.
+   */
+  int64_t off;
+  size_t len;
+  size_t ilen;
+
+  /*
+   * The number of bytes read or written so far.
+   */
+  size_t pos;
+
+  /*
+   * Zero if the buffer is free, else the pending operation.
+   */
+  int op;
+
+} URING_SLOT;
+
+/*
+ * Pending operations of a chunk buffer.
+ */
+#define SLOT_FREE  (0)
+#define SLOT_READ  (1)
+#define SLOT_WRITE (2)
+
+/*
+ * A minimal io_uring instance, mapped with the raw system calls so that
+ * no library is needed.
+ */
+typedef struct {
+
+  /*
+   * The ring file descriptor.
+   */
+  int fd;
+
+  /*
+   * The mappings of the submission ring, completion ring and submission
+   * entries.  The two rings share one mapping if cq_ptr is NULL.
+   */
+  void *sq_ptr;
+  size_t sq_sz;
+  void *cq_ptr;
+  size_t cq_sz;
+  struct io_uring_sqe *sqes;
+  size_t sqes_sz;
+
+  /*
+   * Pointers into the ring mappings.
+   */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /*
+   * The number of entries queued but not yet submitted.
+   */
+  unsigned pending;
+
+  /*
+   * The chunk buffers.
+   */
+  URING_SLOT slot[URING_DEPTH];
+
+} URING;
+
+#endif
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Allocate the window buffer of the state if it isn't allocated yet.
+ *
+ * With WARP64IO_HUGE, the buffer is rounded up to whole huge pages and
+ * mapped from the reserved huge pages if possible, or else aligned to a
+ * huge page and marked for transparent huge pages.
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if error
+ */
+static int allocBuf(WARP64IO *pio, size_t len) {
+  void *p = NULL;
+  size_t align = WARP64IO_ALIGN;
+
+  if (pio->pBuf != NULL) {
+    return 1;
+  }
+
+  if (pio->flags & WARP64IO_HUGE) {
+    len = ((len + WARP64IO_HUGEPAGE - 1) / WARP64IO_HUGEPAGE) *
+            WARP64IO_HUGEPAGE;
+    align = WARP64IO_HUGEPAGE;
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      pio->pBuf = (uint8_t *) p;
+      pio->buflen = len;
+      pio->buf_mapped = 1;
+      return 1;
+    }
+    p = NULL;
+#endif
+  }
+
+  if (posix_memalign(&p, align, len)) {
+    return 0;
+  }
+#ifdef MADV_HUGEPAGE
+  if (pio->flags & WARP64IO_HUGE) {
+    madvise(p, len, MADV_HUGEPAGE);
+  }
+#endif
+  pio->pBuf = (uint8_t *) p;
+  pio->buflen = len;
+  return 1;
+}
+
+/*
+ * Return a monotonic timestamp in seconds.
+ */
+static double nowSec(void) {
+  struct timespec ts;
+
+  memset(&ts, 0, sizeof(struct timespec));
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    abort();
+  }
+  return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1.0e9);
+}
+
+/*
+ * Transform bytes at file offset off and add the CRC of their plaintext
+ * to the CRC register of the window.
+ *
+ * The bytes are done in blocks of XFORM_BLOCK, and the plaintext of
+ * each block is checksummed right before it is transformed when it is
+ * the input, or right after when it is the output.  Bytes at or past
+ * crc_end are not plaintext.  Input that is NULL is zero bytes, which
+ * leave a CRC register that starts from zero at zero, so they are
+ * skipped.  The pieces of a window may come in any order, so the CRC of
+ * the piece is shifted up to crc_end before it is added in.
+ */
+static void xformCrc(
+          WARP64IO    * pio,
+    const WARP64_CTX  * pc,
+          int64_t       off,
+    const uint8_t     * pIn,
+          uint8_t     * pOut,
+          size_t        len) {
+
+  size_t plen = 0;
+  size_t i = 0;
+  size_t c = 0;
+  size_t cp = 0;
+  uint32_t crc = 0;
+
+  /* Determine how many of the bytes are plaintext to checksum */
+  if (off < pio->crc_end) {
+    plen = len;
+    if (pio->crc_end - off < (int64_t) len) {
+      plen = (size_t) (pio->crc_end - off);
+    }
+  }
+  if ((pio->crc_mode == WARP64IO_CRC_INPUT) && (pIn == NULL)) {
+    plen = 0;
+  }
+
+  for(i = 0; i < len; i += c) {
+    c = len - i;
+    if (c > XFORM_BLOCK) {
+      c = XFORM_BLOCK;
+    }
+    cp = 0;
+    if (i < plen) {
+      cp = plen - i;
+      if (cp > c) {
+        cp = c;
+      }
+    }
+
+    if ((pio->crc_mode == WARP64IO_CRC_INPUT) && (cp > 0)) {
+      crc = warp64k_crc(crc, pIn + i, cp);
+    }
+    warp64_update_at(pc, off + (int64_t) i,
+                      (pIn != NULL) ? (pIn + i) : NULL, pOut + i, c);
+    if ((pio->crc_mode == WARP64IO_CRC_OUTPUT) && (cp > 0)) {
+      crc = warp64k_crc(crc, pOut + i, cp);
+    }
+  }
+
+  if (plen > 0) {
+    pio->crc ^= warp64k_crc_shift(crc,
+                  pio->crc_end - (off + (int64_t) plen));
+  }
+}
+
+/*
+ * Transform bytes at file offset off, timing it with WARP64IO_STATS.
+ */
+static void xformRun(
+          WARP64IO    * pio,
+    const WARP64_CTX  * pc,
+          int64_t       off,
+    const uint8_t     * pIn,
+          uint8_t     * pOut,
+          size_t        len) {
+
+  double t0 = 0.0;
+  int64_t b = 0;
+  int64_t bend = 0;
+  size_t i = 0;
+  const uint8_t *pb = NULL;
+
+  if (pio->flags & WARP64IO_STATS) {
+    t0 = nowSec();
+  }
+  if (pio->crc_mode != WARP64IO_CRC_NONE) {
+    xformCrc(pio, pc, off, pIn, pOut, len);
+  } else {
+    warp64_update_at(pc, off, pIn, pOut, len);
+  }
+  if (pio->flags & WARP64IO_STATS) {
+    pio->xform_sec += nowSec() - t0;
+  }
+
+  /* Note the whole blocks of the output that came out all zero */
+  if (pio->flags & WARP64IO_SPARSE) {
+    b = (off + WARP64IO_SPARSE_BLOCK - 1) / WARP64IO_SPARSE_BLOCK;
+    bend = (off + (int64_t) len) / WARP64IO_SPARSE_BLOCK;
+    for( ; b < bend; b++) {
+      pb = pOut + (size_t) (b * WARP64IO_SPARSE_BLOCK - off);
+      if ((pb[0] == 0) &&
+          (memcmp(pb, pb + 1, WARP64IO_SPARSE_BLOCK - 1) == 0)) {
+        i = (size_t) (b - pio->zero_base / WARP64IO_SPARSE_BLOCK);
+        (pio->pZero)[i / 8] |= (uint8_t) (1 << (i % 8));
+      }
+    }
+  }
+}
+
+/*
+ * Return the length of a transfer of len bytes.
+ *
+ * This is len rounded up to WARP64IO_ALIGN with WARP64IO_DIRECT, and
+ * len otherwise.
+ */
+static size_t xferLen(const WARP64IO *pio, size_t len) {
+  if (pio->flags & WARP64IO_DIRECT) {
+    len = ((len + WARP64IO_ALIGN - 1) / WARP64IO_ALIGN) * WARP64IO_ALIGN;
+  }
+  return len;
+}
+
+/*
+ * Check whether a transfer that stopped short at done bytes may be
+ * continued, which with WARP64IO_DIRECT requires done to be aligned.
+ */
+static int xferResume(const WARP64IO *pio, size_t done) {
+  if (pio->flags & WARP64IO_DIRECT) {
+    if ((done % WARP64IO_ALIGN) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Write back a finished window and drop it from the page cache, as
+ * requested by WARP64IO_NOCACHE.
+ *
+ * Dirty pages can't be dropped, so the output window is written back
+ * first.  This is advisory, so failures are ignored.
+ */
+static void dropWindow(
+    int     fIn,
+    int     fOut,
+    int64_t base,
+    size_t  ws,
+    size_t  wsi) {
+
+#ifdef __linux__
+  sync_file_range(fOut, (off_t) base, (off_t) ws,
+                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                  SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fOut, (off_t) base, (off_t) ws, POSIX_FADV_DONTNEED);
+  if (wsi > 0) {
+    posix_fadvise(fIn, (off_t) base, (off_t) wsi, POSIX_FADV_DONTNEED);
+  }
+#else
+  (void) fIn;
+  (void) fOut;
+  (void) base;
+  (void) ws;
+  (void) wsi;
+#endif
+}
+
+/*
+ * Start writeback of a finished window and wait for the writeback of
+ * the window before it, as requested by WARP64IO_ROLLING.
+ *
+ * The previous window is only waited for if it was in the same output
+ * file.  This is advisory, so failures are ignored; errors still show
+ * up in the final flush of the file.  Where sync_file_range() is not
+ * available, the mmap backend schedules writeback with msync() instead.
+ */
+static void flushWindow(WARP64IO *pio, int fOut, int64_t base, size_t ws) {
+#ifdef __linux__
+  sync_file_range(fOut, (off_t) base, (off_t) ws, SYNC_FILE_RANGE_WRITE);
+  if ((pio->flush_fd == fOut) && (pio->flush_len > 0)) {
+    sync_file_range(fOut, (off_t) pio->flush_off, (off_t) pio->flush_len,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+  }
+#endif
+  pio->flush_fd = fOut;
+  pio->flush_off = base;
+  pio->flush_len = ws;
+}
+
+/*
+ * Start reading the input window that follows a window into the page
+ * cache, as requested by WARP64IO_PREFETCH.
+ *
+ * A window shorter than the window size is the last of its file, so
+ * nothing follows it; this also keeps small files from paying for the
+ * call.  This is advisory, so failures are ignored.
+ */
+static void prefetchWindow(
+    WARP64IO *pio,
+    int       fIn,
+    int64_t   base,
+    size_t    ws) {
+
+#ifdef POSIX_FADV_WILLNEED
+  if ((pio->flags & WARP64IO_PREFETCH) &&
+        (!(pio->flags & WARP64IO_DIRECT)) &&
+        (fIn >= 0) && (ws >= pio->winsize)) {
+    posix_fadvise(fIn, (off_t) (base + (int64_t) ws),
+                  (off_t) pio->winsize, POSIX_FADV_WILLNEED);
+  }
+#else
+  (void) pio;
+  (void) fIn;
+  (void) base;
+  (void) ws;
+#endif
+}
+
+#ifdef WARP64IO_HAVE_SPARSE
+
+/*
+ * Process a window in pieces so that the holes of the input file are
+ * not read, as requested by WARP64IO_SPARSE.
+ *
+ * The input window is split at its hole boundaries, rounded outwards
+ * to pio->seg_align so that holes only shrink.  Data pieces are passed
+ * to the backend as they are, and hole pieces are passed with no input
+ * bytes, so the backend transforms them as zero bytes.  The last piece
+ * also covers any output bytes past the input window.  If the holes
+ * can't be found, the rest of the window is treated as data.
+ */
+static int sparseWindow(
+          WARP64IO_WINDOW   window,
+          WARP64IO        * pio,
+          int               fIn,
+          int               fOut,
+    const WARP64_CTX      * pc,
+          int64_t           base,
+          size_t            ws,
+          size_t            wsi) {
+
+  int result = WARP64IO_OK;
+  int64_t a = (int64_t) pio->seg_align;
+  int64_t pos = 0;
+  int64_t d = 0;
+  int64_t h = 0;
+
+  while ((result == WARP64IO_OK) && (pos < (int64_t) ws)) {
+    /* Once the input is used up, only zero bytes are left */
+    if (pos >= (int64_t) wsi) {
+      result = (*window)(pio, fIn, fOut, pc, base + pos,
+                          ws - (size_t) pos, 0);
+      break;
+    }
+
+    /* Find where the next data starts, rounded down */
+    d = (int64_t) lseek(fIn, (off_t) (base + pos), SEEK_DATA);
+    if (d < 0) {
+      if (errno == ENXIO) {
+        d = base + (int64_t) wsi;
+      } else {
+        d = base + pos;
+      }
+    }
+    d = ((d - base) / a) * a;
+    if (d < pos) {
+      d = pos;
+    }
+    if (d > (int64_t) wsi) {
+      d = (int64_t) wsi;
+    }
+
+    /* Pass a hole as zero bytes; a hole up to the end of the input
+     * covers the rest of the window */
+    if ((d > pos) && (d >= (int64_t) wsi)) {
+      result = (*window)(pio, fIn, fOut, pc, base + pos,
+                          ws - (size_t) pos, 0);
+      break;
+    } else if (d > pos) {
+      result = (*window)(pio, fIn, fOut, pc, base + pos,
+                          (size_t) (d - pos), 0);
+      pos = d;
+      continue;
+    }
+
+    /* Find where the data ends, rounded up */
+    h = (int64_t) lseek(fIn, (off_t) (base + pos), SEEK_HOLE);
+    if (h < 0) {
+      h = base + (int64_t) wsi;
+    }
+    h = (((h - base) + a - 1) / a) * a;
+    if ((h <= pos) || (h > (int64_t) wsi)) {
+      h = (int64_t) wsi;
+    }
+
+    /* Pass the data; data up to the end of the input covers the rest of
+     * the window */
+    if (h >= (int64_t) wsi) {
+      result = (*window)(pio, fIn, fOut, pc, base + pos,
+                          ws - (size_t) pos, wsi - (size_t) pos);
+      break;
+    }
+    result = (*window)(pio, fIn, fOut, pc, base + pos,
+                        (size_t) (h - pos), (size_t) (h - pos));
+    pos = h;
+  }
+
+  return result;
+}
+
+/*
+ * Punch the output blocks of a window that came out all zero, as noted
+ * by xformRun(), out of the output file.
+ *
+ * This is advisory, so failures are ignored; the blocks then simply
+ * stay allocated.
+ */
+static void punchZero(WARP64IO *pio, int fOut, int64_t base, size_t ws) {
+  size_t nblk = ws / WARP64IO_SPARSE_BLOCK;
+  size_t i = 0;
+  size_t j = 0;
+
+  for(i = 0; i < nblk; i = j) {
+    for(j = i; j < nblk; j++) {
+      if (!((pio->pZero)[j / 8] & (1 << (j % 8)))) {
+        break;
+      }
+    }
+    if (j > i) {
+      fallocate(fOut, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                (off_t) (base + (int64_t) (i * WARP64IO_SPARSE_BLOCK)),
+                (off_t) ((j - i) * WARP64IO_SPARSE_BLOCK));
+    } else {
+      j = i + 1;
+    }
+  }
+}
+
+#endif
+
+/*
+ * pread backend window function, which warp64io_small() uses with any
+ * backend.
+ */
+static int preadWindow(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi);
+
+/*
+ * Process one window with the given window function, around which the
+ * CRC, the sparse handling, the page cache flags and the statistics are
+ * taken care of.  The parameters have already been checked.
+ */
+static int windowRun(
+          WARP64IO         * pio,
+          WARP64IO_WINDOW    window,
+          int                fIn,
+          int                fOut,
+    const WARP64_CTX       * pc,
+          int64_t            base,
+          size_t             ws,
+          size_t             wsi,
+          int                crc,
+          uint32_t         * pCrc) {
+
+  int result = WARP64IO_OK;
+  double t0 = 0.0;
+  double x0 = 0.0;
+
+  /* Set up the CRC of the plaintext of the window */
+  pio->crc_mode = crc;
+  pio->crc = 0;
+  pio->crc_end = base + (int64_t) ((crc == WARP64IO_CRC_INPUT) ? wsi : ws);
+
+  if (pio->flags & WARP64IO_STATS) {
+    t0 = nowSec();
+    x0 = pio->xform_sec;
+  }
+
+  /* Get the next window coming in while this one is processed */
+  prefetchWindow(pio, fIn, base, ws);
+
+#ifdef WARP64IO_HAVE_SPARSE
+  if (pio->flags & WARP64IO_SPARSE) {
+    memset(pio->pZero, 0, (ws / WARP64IO_SPARSE_BLOCK) / 8 + 1);
+    pio->zero_base = base;
+    result = sparseWindow(window, pio, fIn, fOut, pc, base, ws, wsi);
+    if (result == WARP64IO_OK) {
+      punchZero(pio, fOut, base, ws);
+    }
+  } else {
+    result = (*window)(pio, fIn, fOut, pc, base, ws, wsi);
+  }
+#else
+  result = (*window)(pio, fIn, fOut, pc, base, ws, wsi);
+#endif
+
+  /* Drop the finished window from the page cache if requested */
+  if ((result == WARP64IO_OK) && (pio->flags & WARP64IO_NOCACHE)) {
+    dropWindow(fIn, fOut, base, ws, wsi);
+  }
+
+  /* Otherwise, keep writeback rolling if requested */
+  if ((result == WARP64IO_OK) && (pio->flags & WARP64IO_ROLLING) &&
+        (!(pio->flags & WARP64IO_NOCACHE))) {
+    flushWindow(pio, fOut, base, ws);
+  }
+
+  if ((result == WARP64IO_OK) && (crc != WARP64IO_CRC_NONE)) {
+    *pCrc = pio->crc;
+  }
+  pio->crc_mode = WARP64IO_CRC_NONE;
+
+  /* Everything but the transform counts as I/O time */
+  if (pio->flags & WARP64IO_STATS) {
+    pio->io_sec += (nowSec() - t0) - (pio->xform_sec - x0);
+    if (result == WARP64IO_OK) {
+      (pio->windows)++;
+      pio->bytes += (int64_t) ws;
+    }
+  }
+
+  return result;
+}
+
+/*
+ * mmap backend
+ * ------------
+ */
+
+static int mmapBegin(WARP64IO *pio) {
+  if (pio->flags & WARP64IO_DIRECT) {
+    return WARP64IO_ERR_DIRECT;
+  }
+  return WARP64IO_OK;
+}
+
+static int mmapWindow(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi) {
+
+  int result = WARP64IO_OK;
+  int populate = 0;
+  uint8_t *pwo = NULL;
+  uint8_t *pwi = NULL;
+
+  /* With prefetching, the input is mostly in the cache by now, so map
+   * it with all its pages at once */
+#ifdef MAP_POPULATE
+  if (pio->flags & WARP64IO_PREFETCH) {
+    populate = MAP_POPULATE;
+  }
+#endif
+
+  /* Map the output window */
+  pwo = (uint8_t *) mmap(NULL, ws, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fOut, (off_t) base);
+  if ((pwo == MAP_FAILED) || (pwo == NULL)) {
+    result = WARP64IO_ERR_MAPOUT;
+    pwo = NULL;
+  }
+  /* Zero blocks are punched out afterwards, which doesn't stick if the
+   * page cache holds them in a large folio that is still dirty from its
+   * other blocks, so keep fault readahead from building large folios
+   * over the output */
+#ifdef WARP64IO_HAVE_SPARSE
+  if ((result == WARP64IO_OK) && (pio->flags & WARP64IO_SPARSE)) {
+    madvise(pwo, ws, MADV_RANDOM);
+  }
+#endif
+
+  /* Ask for huge pages where the filesystem can give them */
+#ifdef MADV_HUGEPAGE
+  if ((result == WARP64IO_OK) && (pio->flags & WARP64IO_HUGE) &&
+        (!(pio->flags & WARP64IO_SPARSE))) {
+    madvise(pwo, ws, MADV_HUGEPAGE);
+  }
+#endif
+
+  /* Otherwise, with prefetching, fault the whole output window in for
+   * writing up front, which costs far less than a fault on every page;
+   * this is advisory, and older systems don't have it */
+#ifdef MADV_POPULATE_WRITE
+  if ((result == WARP64IO_OK) && (pio->flags & WARP64IO_PREFETCH) &&
+        (!(pio->flags & WARP64IO_SPARSE))) {
+    madvise(pwo, ws, MADV_POPULATE_WRITE);
+  }
+#endif
+
+  /* Map the input window if non-empty */
+  if ((result == WARP64IO_OK) && (wsi > 0)) {
+    pwi = (uint8_t *) mmap(NULL, wsi, PROT_READ, MAP_PRIVATE | populate,
+                            fIn, (off_t) base);
+    if ((pwi == MAP_FAILED) || (pwi == NULL)) {
+      result = WARP64IO_ERR_MAPIN;
+      pwi = NULL;
+    }
+  }
+#ifdef MADV_HUGEPAGE
+  if ((pwi != NULL) && (pio->flags & WARP64IO_HUGE)) {
+    madvise(pwi, wsi, MADV_HUGEPAGE);
+  }
+#endif
+
+  /* Transform from the input mapping into the output mapping */
+  if (result == WARP64IO_OK) {
+    if (wsi > 0) {
+      xformRun(pio, pc, base, pwi, pwo, wsi);
+    }
+    if (ws > wsi) {
+      xformRun(pio, pc, base + (int64_t) wsi, NULL,
+                pwo + wsi, ws - wsi);
+    }
+  }
+
+#ifndef __linux__
+  /* Schedule writeback of the output window */
+  if ((result == WARP64IO_OK) && (pio->flags & WARP64IO_ROLLING)) {
+    msync(pwo, ws, MS_ASYNC);
+  }
+#endif
+
+  /* Unmap the windows */
+  if (pwi != NULL) {
+    if (munmap(pwi, wsi) && (result == WARP64IO_OK)) {
+      result = WARP64IO_ERR_UNMAP;
+    }
+    pwi = NULL;
+  }
+  if (pwo != NULL) {
+    if (munmap(pwo, ws) && (result == WARP64IO_OK)) {
+      result = WARP64IO_ERR_UNMAP;
+    }
+    pwo = NULL;
+  }
+
+  return result;
+}
+
+static void mmapEnd(WARP64IO *pio) {
+  (void) pio;
+}
+
+/*
+ * pread backend
+ * -------------
+ */
+
+static int preadBegin(WARP64IO *pio) {
+  if (!allocBuf(pio, pio->winsize)) {
+    return WARP64IO_ERR_SETUP;
+  }
+  return WARP64IO_OK;
+}
+
+static int preadWindow(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi) {
+
+  size_t done = 0;
+  ssize_t rv = 0;
+  uint8_t *pBuf = pio->pBuf;
+
+  /* Read the input window, retrying short reads; a padded direct read
+   * may return more than wsi bytes, which are ignored */
+  for(done = 0; done < wsi; done += (size_t) rv) {
+    if (!xferResume(pio, done)) {
+      return WARP64IO_ERR_READ;
+    }
+    rv = pread(fIn, pBuf + done, xferLen(pio, wsi - done),
+                (off_t) (base + done));
+    if (rv < 0) {
+      if (errno == EINTR) {
+        rv = 0;
+        continue;
+      }
+      return WARP64IO_ERR_READ;
+    } else if (rv == 0) {
+      return WARP64IO_ERR_READ;
+    }
+  }
+
+  /* Transform in the buffer */
+  if (wsi > 0) {
+    xformRun(pio, pc, base, pBuf, pBuf, wsi);
+  }
+  if (ws > wsi) {
+    xformRun(pio, pc, base + (int64_t) wsi, NULL,
+              pBuf + wsi, ws - wsi);
+  }
+
+  /* Zero any padding of a direct write */
+  if (xferLen(pio, ws) > ws) {
+    memset(pBuf + ws, 0, xferLen(pio, ws) - ws);
+  }
+  
+  /* Write the output window, retrying short writes */
+  for(done = 0; done < ws; done += (size_t) rv) {
+    if (!xferResume(pio, done)) {
+      return WARP64IO_ERR_WRITE;
+    }
+    rv = pwrite(fOut, pBuf + done, xferLen(pio, ws - done),
+                (off_t) (base + done));
+    if (rv < 0) {
+      if (errno == EINTR) {
+        rv = 0;
+        continue;
+      }
+      return WARP64IO_ERR_WRITE;
+    } else if (rv == 0) {
+      return WARP64IO_ERR_WRITE;
+    }
+  }
+
+  return WARP64IO_OK;
+}
+
+static void preadEnd(WARP64IO *pio) {
+  (void) pio;
+}
+
+/*
+ * uring backend
+ * -------------
+ */
+
+#ifdef WARP64IO_HAVE_URING
+
+static void uringEnd(WARP64IO *pio);
+
+static int uringBegin(WARP64IO *pio) {
+  int result = WARP64IO_OK;
+  int i = 0;
+  long rv = 0;
+  URING *pr = NULL;
+  uint8_t *pm = NULL;
+  struct io_uring_params p;
+
+  /* Initialize structures */
+  memset(&p, 0, sizeof(struct io_uring_params));
+
+  /* Allocate the ring state and the chunk buffers in one buffer */
+  pr = (URING *) calloc(1, sizeof(URING));
+  if (pr == NULL) {
+    abort();
+  }
+  pr->fd = -1;
+  pio->pRing = pr;
+
+  if (!allocBuf(pio, ((size_t) URING_CHUNK) * URING_DEPTH)) {
+    result = WARP64IO_ERR_SETUP;
+  }
+  if (result == WARP64IO_OK) {
+    for(i = 0; i < URING_DEPTH; i++) {
+      (pr->slot)[i].pBuf = pio->pBuf + (((size_t) i) * URING_CHUNK);
+      (pr->slot)[i].op = SLOT_FREE;
+    }
+  }
+
+  /* Create the ring */
+  if (result == WARP64IO_OK) {
+    rv = syscall(__NR_io_uring_setup, (unsigned) URING_DEPTH, &p);
+    if (rv < 0) {
+      if ((errno == ENOSYS) || (errno == EPERM)) {
+        result = WARP64IO_ERR_NOTSUP;
+      } else {
+        result = WARP64IO_ERR_SETUP;
+      }
+    } else {
+      pr->fd = (int) rv;
+    }
+  }
+
+  /* Map the rings; newer kernels let both rings share one mapping */
+  if (result == WARP64IO_OK) {
+    pr->sq_sz = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+    pr->cq_sz = p.cq_off.cqes
+                  + (p.cq_entries * sizeof(struct io_uring_cqe));
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      if (pr->cq_sz > pr->sq_sz) {
+        pr->sq_sz = pr->cq_sz;
+      }
+    }
+    pr->sq_ptr = mmap(NULL, pr->sq_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, pr->fd,
+                      IORING_OFF_SQ_RING);
+    if (pr->sq_ptr == MAP_FAILED) {
+      pr->sq_ptr = NULL;
+      result = WARP64IO_ERR_SETUP;
+    }
+  }
+  if ((result == WARP64IO_OK) &&
+        (!(p.features & IORING_FEAT_SINGLE_MMAP))) {
+    pr->cq_ptr = mmap(NULL, pr->cq_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, pr->fd,
+                      IORING_OFF_CQ_RING);
+    if (pr->cq_ptr == MAP_FAILED) {
+      pr->cq_ptr = NULL;
+      result = WARP64IO_ERR_SETUP;
+    }
+  }
+  if (result == WARP64IO_OK) {
+    pr->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    pr->sqes = (struct io_uring_sqe *) mmap(
+                  NULL, pr->sqes_sz, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, pr->fd, IORING_OFF_SQES);
+    if (pr->sqes == MAP_FAILED) {
+      pr->sqes = NULL;
+      result = WARP64IO_ERR_SETUP;
+    }
+  }
+
+  /* Get pointers to the ring fields */
+  if (result == WARP64IO_OK) {
+    pm = (uint8_t *) pr->sq_ptr;
+    pr->sq_head = (unsigned *) (pm + p.sq_off.head);
+    pr->sq_tail = (unsigned *) (pm + p.sq_off.tail);
+    pr->sq_mask = (unsigned *) (pm + p.sq_off.ring_mask);
+    pr->sq_array = (unsigned *) (pm + p.sq_off.array);
+
+    if (pr->cq_ptr != NULL) {
+      pm = (uint8_t *) pr->cq_ptr;
+    }
+    pr->cq_head = (unsigned *) (pm + p.cq_off.head);
+    pr->cq_tail = (unsigned *) (pm + p.cq_off.tail);
+    pr->cq_mask = (unsigned *) (pm + p.cq_off.ring_mask);
+    pr->cqes = (struct io_uring_cqe *) (pm + p.cq_off.cqes);
+  }
+
+  if (result != WARP64IO_OK) {
+    uringEnd(pio);
+  }
+  return result;
+}
+
+/*
+ * Queue a read or write of the rest of a chunk.
+ */
+static void uringQueue(
+    const WARP64IO * pio,
+          URING    * pr,
+          int        s,
+          int        fd,
+          int        op) {
+  unsigned tail = 0;
+  unsigned idx = 0;
+  struct io_uring_sqe *pe = NULL;
+  URING_SLOT *ps = &((pr->slot)[s]);
+
+  tail = *(pr->sq_tail);
+  idx = tail & *(pr->sq_mask);
+  pe = &((pr->sqes)[idx]);
+  memset(pe, 0, sizeof(struct io_uring_sqe));
+
+  pe->fd = fd;
+  pe->addr = (uint64_t) (uintptr_t) (ps->pBuf + ps->pos);
+  pe->off = (uint64_t) (ps->off + (int64_t) ps->pos);
+  pe->user_data = (uint64_t) s;
+  if (op == SLOT_READ) {
+    pe->opcode = IORING_OP_READ;
+    pe->len = (unsigned) xferLen(pio, ps->ilen - ps->pos);
+  } else {
+    pe->opcode = IORING_OP_WRITE;
+    pe->len = (unsigned) xferLen(pio, ps->len - ps->pos);
+  }
+  ps->op = op;
+
+  (pr->sq_array)[idx] = idx;
+  __atomic_store_n(pr->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  (pr->pending)++;
+}
+
+/*
+ * Transform a chunk whose input has been read and queue its write.
+ */
+static void uringTransform(
+          WARP64IO    * pio,
+          URING       * pr,
+          int           s,
+          int           fOut,
+    const WARP64_CTX  * pc) {
+
+  URING_SLOT *ps = &((pr->slot)[s]);
+
+  if (ps->ilen > 0) {
+    xformRun(pio, pc, ps->off, ps->pBuf, ps->pBuf, ps->ilen);
+  }
+  if (ps->len > ps->ilen) {
+    xformRun(pio, pc, ps->off + (int64_t) ps->ilen, NULL,
+              ps->pBuf + ps->ilen, ps->len - ps->ilen);
+  }
+  if (xferLen(pio, ps->len) > ps->len) {
+    memset(ps->pBuf + ps->len, 0, xferLen(pio, ps->len) - ps->len);
+  }
+  ps->pos = 0;
+  uringQueue(pio, pr, s, fOut, SLOT_WRITE);
+}
+
+static int uringWindow(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi) {
+
+  int result = WARP64IO_OK;
+  int s = 0;
+  int inflight = 0;
+  long rv = 0;
+  size_t next = 0;
+  unsigned head = 0;
+  unsigned tail = 0;
+  URING *pr = (URING *) pio->pRing;
+  URING_SLOT *ps = NULL;
+  struct io_uring_cqe *pe = NULL;
+
+  for(;;) {
+    /* Start chunks into free buffers, unless something failed */
+    for(s = 0; (s < URING_DEPTH) && (next < ws) &&
+                (result == WARP64IO_OK); s++) {
+      ps = &((pr->slot)[s]);
+      if (ps->op != SLOT_FREE) {
+        continue;
+      }
+      ps->off = base + (int64_t) next;
+      ps->len = ws - next;
+      if (ps->len > (size_t) URING_CHUNK) {
+        ps->len = (size_t) URING_CHUNK;
+      }
+      ps->ilen = 0;
+      if (wsi > next) {
+        ps->ilen = wsi - next;
+        if (ps->ilen > ps->len) {
+          ps->ilen = ps->len;
+        }
+      }
+      ps->pos = 0;
+      next += ps->len;
+      inflight++;
+
+      /* Chunks entirely past the input go straight to the write */
+      if (ps->ilen > 0) {
+        uringQueue(pio, pr, s, fIn, SLOT_READ);
+      } else {
+        uringTransform(pio, pr, s, fOut, pc);
+      }
+    }
+
+    if (inflight < 1) {
+      break;
+    }
+
+    /* Submit queued entries and wait for at least one completion */
+    rv = syscall(__NR_io_uring_enter, pr->fd, pr->pending, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+    if (rv < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+        continue;
+      }
+      /* Nothing can be reaped if the ring itself failed, and the
+       * buffers might still be in use, so give up on the ring */
+      abort();
+    }
+    pr->pending -= (unsigned) rv;
+
+    /* Reap completions */
+    head = *(pr->cq_head);
+    tail = __atomic_load_n(pr->cq_tail, __ATOMIC_ACQUIRE);
+    for( ; head != tail; head++) {
+      pe = &((pr->cqes)[head & *(pr->cq_mask)]);
+      s = (int) pe->user_data;
+      ps = &((pr->slot)[s]);
+
+      if ((pe->res <= 0) || (result != WARP64IO_OK)) {
+        /* Failed, or draining after a failure */
+        if ((pe->res <= 0) && (result == WARP64IO_OK)) {
+          if (ps->op == SLOT_READ) {
+            result = WARP64IO_ERR_READ;
+          } else {
+            result = WARP64IO_ERR_WRITE;
+          }
+        }
+        ps->op = SLOT_FREE;
+        inflight--;
+
+      } else if (ps->op == SLOT_READ) {
+        ps->pos += (size_t) pe->res;
+        if ((ps->pos < ps->ilen) && (!xferResume(pio, ps->pos))) {
+          result = WARP64IO_ERR_READ;
+          ps->op = SLOT_FREE;
+          inflight--;
+        } else if (ps->pos < ps->ilen) {
+          uringQueue(pio, pr, s, fIn, SLOT_READ);
+        } else {
+          uringTransform(pio, pr, s, fOut, pc);
+        }
+
+      } else {
+        ps->pos += (size_t) pe->res;
+        if ((ps->pos < ps->len) && (!xferResume(pio, ps->pos))) {
+          result = WARP64IO_ERR_WRITE;
+          ps->op = SLOT_FREE;
+          inflight--;
+        } else if (ps->pos < ps->len) {
+          uringQueue(pio, pr, s, fOut, SLOT_WRITE);
+        } else {
+          ps->op = SLOT_FREE;
+          inflight--;
+        }
+      }
+    }
+    __atomic_store_n(pr->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  return result;
+}
+
+static void uringEnd(WARP64IO *pio) {
+  URING *pr = (URING *) pio->pRing;
+
+  if (pr == NULL) {
+    return;
+  }
+  if (pr->sqes != NULL) {
+    munmap(pr->sqes, pr->sqes_sz);
+  }
+  if (pr->cq_ptr != NULL) {
+    munmap(pr->cq_ptr, pr->cq_sz);
+  }
+  if (pr->sq_ptr != NULL) {
+    munmap(pr->sq_ptr, pr->sq_sz);
+  }
+  if (pr->fd >= 0) {
+    close(pr->fd);
+  }
+  free(pr);
+  pio->pRing = NULL;
+}
+
+#else
+
+static int uringBegin(WARP64IO *pio) {
+  (void) pio;
+  return WARP64IO_ERR_NOTSUP;
+}
+
+static int uringWindow(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi) {
+  (void) pio;
+  (void) fIn;
+  (void) fOut;
+  (void) pc;
+  (void) base;
+  (void) ws;
+  (void) wsi;
+  return WARP64IO_ERR_NOTSUP;
+}
+
+static void uringEnd(WARP64IO *pio) {
+  (void) pio;
+}
+
+#endif
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * Table of all backends, in the order of the WARP64IO_ constants.
+ */
+static const WARP64IO_ENTRY m_backends[] = {
+  {"mmap" , &mmapBegin , &mmapWindow , &mmapEnd },
+  {"pread", &preadBegin, &preadWindow, &preadEnd},
+  {"uring", &uringBegin, &uringWindow, &uringEnd},
+  {NULL, NULL, NULL, NULL}
+};
+
+/*
+ * Messages for the result codes.
+ */
+static const char *m_errstr[] = {
+  "Success",
+  "Failed to map output window",
+  "Failed to map input window",
+  "Failed to unmap window",
+  "Failed to read input window",
+  "Failed to write output window",
+  "Failed to set up I/O backend",
+  "I/O backend is not supported on this system",
+  "I/O backend does not support direct I/O",
+  "Sparse files are not supported on this system"
+};
+
+/*
+ * Public function implementations
+ * ===============================
+ *
+ * See the header for specifications.
+ */
+
+/*
+ * warp64io_count function.
+ */
+int warp64io_count(void) {
+  return (int) ((sizeof(m_backends) / sizeof(WARP64IO_ENTRY)) - 1);
+}
+
+/*
+ * warp64io_name function.
+ */
+const char *warp64io_name(int i) {
+  if ((i < 0) || (i >= warp64io_count())) {
+    abort();
+  }
+  return m_backends[i].pName;
+}
+
+/*
+ * warp64io_find function.
+ */
+int warp64io_find(const char *pName) {
+  int i = 0;
+
+  if (pName == NULL) {
+    abort();
+  }
+  for(i = 0; i < warp64io_count(); i++) {
+    if (strcmp(m_backends[i].pName, pName) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * warp64io_supported function.
+ */
+int warp64io_supported(int i) {
+  if ((i < 0) || (i >= warp64io_count())) {
+    abort();
+  }
+#ifndef WARP64IO_HAVE_URING
+  if (i == WARP64IO_URING) {
+    return 0;
+  }
+#endif
+  return 1;
+}
+
+/*
+ * warp64io_errstr function.
+ */
+const char *warp64io_errstr(int code) {
+  if ((code < 0) ||
+        (code >= (int) (sizeof(m_errstr) / sizeof(const char *)))) {
+    abort();
+  }
+  return m_errstr[code];
+}
+
+/*
+ * warp64io_begin function.
+ */
+int warp64io_begin(WARP64IO *pio, int backend, size_t winsize, int flags) {
+  int result = WARP64IO_OK;
+
+  /* Check parameters */
+  if ((pio == NULL) || (winsize < 1)) {
+    abort();
+  }
+  if ((backend < 0) || (backend >= warp64io_count())) {
+    abort();
+  }
+
+  /* Initialize the state and then the backend */
+  memset(pio, 0, sizeof(WARP64IO));
+  pio->backend = backend;
+  pio->winsize = winsize;
+  pio->flags = flags;
+  pio->flush_fd = -1;
+
+  /* Set up the zero block map for sparse files */
+  if (flags & WARP64IO_SPARSE) {
+#ifdef WARP64IO_HAVE_SPARSE
+    pio->pZero = (uint8_t *) calloc(
+                    (winsize / WARP64IO_SPARSE_BLOCK) / 8 + 1, 1);
+    if (pio->pZero == NULL) {
+      abort();
+    }
+    pio->seg_align = (size_t) sysconf(_SC_PAGESIZE);
+    if (pio->seg_align < WARP64IO_ALIGN) {
+      pio->seg_align = WARP64IO_ALIGN;
+    }
+#else
+    return WARP64IO_ERR_SPARSE;
+#endif
+  }
+
+  result = (*(m_backends[backend].begin))(pio);
+  return result;
+}
+
+/*
+ * warp64io_window function.
+ */
+int warp64io_window(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi,
+          int           crc,
+          uint32_t    * pCrc) {
+
+  /* Check parameters */
+  if ((pio == NULL) || (pc == NULL) || (fOut < 0) || (base < 0)) {
+    abort();
+  }
+  if ((ws < 1) || (ws > pio->winsize) || (wsi > ws)) {
+    abort();
+  }
+  if ((wsi > 0) && (fIn < 0)) {
+    abort();
+  }
+  if ((crc != WARP64IO_CRC_NONE) && (crc != WARP64IO_CRC_INPUT) &&
+        (crc != WARP64IO_CRC_OUTPUT)) {
+    abort();
+  }
+  if ((crc != WARP64IO_CRC_NONE) && (pCrc == NULL)) {
+    abort();
+  }
+
+  return windowRun(pio, m_backends[pio->backend].window,
+                    fIn, fOut, pc, base, ws, wsi, crc, pCrc);
+}
+
+/*
+ * warp64io_small function.
+ */
+int warp64io_small(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          size_t        ws,
+          size_t        wsi,
+          int           crc,
+          uint32_t    * pCrc) {
+
+  size_t len = 0;
+
+  /* Check parameters */
+  if ((pio == NULL) || (pc == NULL) || (fOut < 0)) {
+    abort();
+  }
+  if ((ws < 1) || (ws > WARP64IO_SMALL) || (ws > pio->winsize) ||
+        (wsi > ws)) {
+    abort();
+  }
+  if ((wsi > 0) && (fIn < 0)) {
+    abort();
+  }
+  if (pio->flags & (WARP64IO_DIRECT | WARP64IO_SPARSE)) {
+    abort();
+  }
+  if ((crc != WARP64IO_CRC_NONE) && (crc != WARP64IO_CRC_INPUT) &&
+        (crc != WARP64IO_CRC_OUTPUT)) {
+    abort();
+  }
+  if ((crc != WARP64IO_CRC_NONE) && (pCrc == NULL)) {
+    abort();
+  }
+
+  /* The pread backend already has a window buffer, which is at least
+   * as large; the other backends get one the first time */
+  len = pio->winsize;
+  if (len > WARP64IO_SMALL) {
+    len = WARP64IO_SMALL;
+  }
+  if (!allocBuf(pio, len)) {
+    return WARP64IO_ERR_SETUP;
+  }
+
+  return windowRun(pio, &preadWindow,
+                    fIn, fOut, pc, 0, ws, wsi, crc, pCrc);
+}
+
+/*
+ * warp64io_end function.
+ */
+void warp64io_end(WARP64IO *pio) {
+  if (pio == NULL) {
+    abort();
+  }
+  (*(m_backends[pio->backend].end))(pio);
+  if (pio->pZero != NULL) {
+    free(pio->pZero);
+    pio->pZero = NULL;
+  }
+  if (pio->pBuf != NULL) {
+    if (pio->buf_mapped) {
+      munmap(pio->pBuf, pio->buflen);
+    } else {
+      free(pio->pBuf);
+    }
+    pio->pBuf = NULL;
+    pio->buflen = 0;
+    pio->buf_mapped = 0;
+  }
+}
@@ -0,0 +1,463 @@
+#ifndef WARP64IO_H_INCLUDED
+#define WARP64IO_H_INCLUDED
+
+/*
+ * warp64io.h
+ * ==========
+ *
+ * Window I/O backends for Warp64.
+ *
+ * Files are processed in windows.  A window is a range of the output
+ * file, together with the range of the input file at the same offset.
+ * The input range may be shorter than the output range, in which case
+ * the remaining output bytes are transformed as zero bytes, which is
+ * how the trailer is written.
+ *
+ * This module holds several ways of getting the bytes of a window from
+ * the input file, through a transform context, and into the output file:
+ *
+ *   mmap maps both windows into memory and transforms from one mapping
+ *   into the other.
+ *
+ *   pread reads the input window into a buffer, transforms it there,
+ *   and writes it out with pwrite.  This avoids page faults and TLB
+ *   shootdowns on filesystems where mapping is expensive.
+ *
+ *   uring splits the window into chunks and keeps several chunk reads
+ *   and writes in flight with io_uring.  This is only available on
+ *   Linux.
+ *
+ * Two flags change how the backends treat the page cache.  With
+ * WARP64IO_NOCACHE, each window is written back and then dropped from
+ * the page cache in both files once it is done, so that a bulk run
+ * doesn't push everything else out of the cache.  With WARP64IO_DIRECT,
+ * the files are expected to be open with O_DIRECT, which bypasses the
+ * cache entirely.  Transfers then start at aligned offsets from aligned
+ * buffers and are padded to a multiple of WARP64IO_ALIGN bytes, so the
+ * output file may be left longer than it should be and must be
+ * truncated to its proper length at the end.  WARP64IO_DIRECT doesn't
+ * work with the mmap backend.
+ *
+ * With WARP64IO_ROLLING, writeback of each finished output window is
+ * started right away, while the next windows are being computed, and a
+ * thread waits for the writeback of its previous window to complete
+ * before it goes on.  This bounds the dirty data of a run to about two
+ * windows per thread, so that a final flush of the output is short and
+ * a huge run doesn't leave the system to write everything back at
+ * once.  It has no effect with WARP64IO_NOCACHE, which already writes
+ * back each window before dropping it.
+ *
+ * With WARP64IO_PREFETCH, a thread asks the system to start reading the
+ * input window that follows each full window before it processes the
+ * window, so the disk is busy with the next window while the CPU works
+ * on this one.  The mmap backend also maps the input window with all its
+ * pages at once, instead of taking a fault for each page, and prefaults
+ * the output window for writing where the system can do that.  Without
+ * the flag, a single thread alternates between waiting for the disk and
+ * transforming.  Prefetching does nothing with WARP64IO_DIRECT, which
+ * bypasses the cache that the data would be read into.
+ *
+ * With WARP64IO_HUGE, memory is asked to be backed by huge pages, so
+ * that a large window takes a few TLB entries instead of one for every
+ * page.  The buffer of the pread and uring backends is taken from the
+ * reserved huge pages of the system with MAP_HUGETLB if there are any,
+ * and otherwise from transparent huge pages.  The mmap backend asks for
+ * transparent huge pages on its mappings, which the system only gives
+ * on filesystems that cache files in huge pages.  All of this is
+ * advisory, and the flag does nothing where the system has no huge
+ * pages.
+ *
+ * With WARP64IO_SPARSE, holes in the input file are found with
+ * SEEK_DATA and SEEK_HOLE and are not read at all.  The backend gets
+ * those ranges as bytes past the input, so it transforms them as zero
+ * bytes, which writes the key pattern.  Output blocks of
+ * WARP64IO_SPARSE_BLOCK bytes that come out all zero are punched out of
+ * the output file, so descrambling a sparse image gives a sparse image
+ * back.  Hole boundaries are rounded to whole pages, so that every
+ * piece of a window still starts at an offset the backends can map.
+ * This is only available where the system has SEEK_DATA and hole
+ * punching, which is Linux.
+ *
+ * warp64io_window() can also compute the CRC32C of the plaintext of a
+ * window, which is the input when scrambling and the output when
+ * descrambling, while the window is transformed.  Each block of the
+ * window is checksummed right before or after it is transformed, while
+ * it is still in the cache, so the check costs no extra pass over the
+ * data.
+ *
+ * With WARP64IO_STATS, the state counts the windows and bytes it has
+ * processed and accumulates the time spent transforming and the time
+ * spent on everything else, which is the I/O.  With the mmap backend,
+ * page faults on the mappings are taken while transforming, so their
+ * cost shows up as transform time.
+ *
+ * Each thread that processes windows needs its own WARP64IO state,
+ * which is set up with warp64io_begin() and released with
+ * warp64io_end().
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libwarp64.h"
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The backend indices.
+ */
+#define WARP64IO_MMAP  (0)
+#define WARP64IO_PREAD (1)
+#define WARP64IO_URING (2)
+
+/*
+ * Flags for warp64io_begin().
+ */
+#define WARP64IO_NOCACHE  (1)
+#define WARP64IO_DIRECT   (2)
+#define WARP64IO_STATS    (4)
+#define WARP64IO_ROLLING  (8)
+#define WARP64IO_SPARSE   (16)
+#define WARP64IO_PREFETCH (32)
+#define WARP64IO_HUGE     (64)
+
+/*
+ * CRC modes for warp64io_window().
+ *
+ * WARP64IO_CRC_INPUT checksums the input bytes of a window, which are
+ * the plaintext when scrambling.  WARP64IO_CRC_OUTPUT checksums all the
+ * output bytes of a window, which are the plaintext when descrambling.
+ */
+#define WARP64IO_CRC_NONE   (0)
+#define WARP64IO_CRC_INPUT  (1)
+#define WARP64IO_CRC_OUTPUT (2)
+
+/*
+ * The alignment of buffers, and of offsets and lengths of transfers
+ * with WARP64IO_DIRECT.  Window sizes and offsets must be multiples of
+ * this when using WARP64IO_DIRECT, except that the last window of a
+ * file may be shorter.
+ */
+#define WARP64IO_ALIGN (4096)
+
+/*
+ * The size of the output blocks that WARP64IO_SPARSE checks for zeros
+ * and punches out.
+ */
+#define WARP64IO_SPARSE_BLOCK (4096)
+
+/*
+ * The size of a huge page, which WARP64IO_HUGE buffers are rounded up
+ * and aligned to.  Window sizes and offsets should be multiples of this
+ * for huge pages to cover whole windows.
+ */
+#define WARP64IO_HUGEPAGE (2097152L)
+
+/*
+ * The largest window that warp64io_small() takes.
+ */
+#define WARP64IO_SMALL (1048576L)
+
+/*
+ * Result codes.
+ *
+ * Use warp64io_errstr() to get a message for a code.
+ */
+#define WARP64IO_OK          (0)
+#define WARP64IO_ERR_MAPOUT  (1)
+#define WARP64IO_ERR_MAPIN   (2)
+#define WARP64IO_ERR_UNMAP   (3)
+#define WARP64IO_ERR_READ    (4)
+#define WARP64IO_ERR_WRITE   (5)
+#define WARP64IO_ERR_SETUP   (6)
+#define WARP64IO_ERR_NOTSUP  (7)
+#define WARP64IO_ERR_DIRECT  (8)
+#define WARP64IO_ERR_SPARSE  (9)
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * Per-thread state of a backend.
+ *
+ * Initialize this with warp64io_begin().  The fields are private to
+ * this module.
+ */
+typedef struct {
+
+  /*
+   * The backend index.
+   */
+  int backend;
+
+  /*
+   * The maximum window size in bytes.
+   */
+  size_t winsize;
+
+  /*
+   * The WARP64IO_ flags.
+   */
+  int flags;
+
+  /*
+   * The window buffer, or NULL if the backend doesn't need one.
+   * buf_mapped is set if the buffer was mapped from huge pages rather
+   * than allocated.
+   */
+  uint8_t *pBuf;
+  size_t buflen;
+  int buf_mapped;
+
+  /*
+   * Private state of the uring backend, or NULL.
+   */
+  void *pRing;
+
+  /*
+   * With WARP64IO_ROLLING, the output file and range of the last window
+   * whose writeback was started, or -1 if none.
+   */
+  int flush_fd;
+  int64_t flush_off;
+  size_t flush_len;
+
+  /*
+   * With WARP64IO_SPARSE, one bit for each block of the window being
+   * processed, set if the output of the block is all zero; the file
+   * offset of the window; and the alignment of the pieces a window is
+   * split into, which is the larger of the page size and the direct
+   * I/O alignment.
+   */
+  uint8_t *pZero;
+  int64_t zero_base;
+  size_t seg_align;
+
+  /*
+   * The WARP64IO_CRC_ mode of the window being processed, the file
+   * offset where the plaintext of the window ends, and the CRC register
+   * of the plaintext of the window that has been checksummed so far.
+   */
+  int crc_mode;
+  int64_t crc_end;
+  uint32_t crc;
+
+  /*
+   * Counters kept with WARP64IO_STATS: the seconds spent on I/O and on
+   * transforming, and the number of windows and output bytes.
+   */
+  double io_sec;
+  double xform_sec;
+  int64_t windows;
+  int64_t bytes;
+
+} WARP64IO;
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Return the total number of backends, including backends that are not
+ * supported on this system.
+ *
+ * Return:
+ *
+ *   the number of backends
+ */
+int warp64io_count(void);
+
+/*
+ * Return the name of a backend.
+ *
+ * Parameters:
+ *
+ *   i - the backend index, in range [0, warp64io_count() - 1]
+ *
+ * Return:
+ *
+ *   the backend name
+ */
+const char *warp64io_name(int i);
+
+/*
+ * Find a backend by name.
+ *
+ * Parameters:
+ *
+ *   pName - the backend name
+ *
+ * Return:
+ *
+ *   the backend index, or -1 if there is no backend with that name
+ */
+int warp64io_find(const char *pName);
+
+/*
+ * Check whether a backend was compiled in for this system.
+ *
+ * Parameters:
+ *
+ *   i - the backend index, in range [0, warp64io_count() - 1]
+ *
+ * Return:
+ *
+ *   non-zero if supported, zero if not
+ */
+int warp64io_supported(int i);
+
+/*
+ * Return a message for a result code.
+ *
+ * Parameters:
+ *
+ *   code - the result code
+ *
+ * Return:
+ *
+ *   the message, without final punctuation
+ */
+const char *warp64io_errstr(int code);
+
+/*
+ * Set up the per-thread state of a backend.
+ *
+ * If this fails, pio is left in a state where warp64io_end() may still
+ * be called on it.
+ *
+ * Parameters:
+ *
+ *   pio - the state to initialize
+ *
+ *   backend - the backend index
+ *
+ *   winsize - the maximum window size in bytes
+ *
+ *   flags - zero or more WARP64IO_ flags combined with OR
+ *
+ * Return:
+ *
+ *   WARP64IO_OK or an error code
+ */
+int warp64io_begin(WARP64IO *pio, int backend, size_t winsize, int flags);
+
+/*
+ * Process one window.
+ *
+ * The output window is ws bytes at byte offset base of fOut, and the
+ * input window is wsi bytes at the same offset of fIn, where wsi is at
+ * most ws.  The first wsi output bytes are the transformed input bytes,
+ * and any remaining output bytes are transformed zero bytes.  Each byte
+ * is transformed at its file offset with warp64_update_at().
+ *
+ * The output file must already have its full length.
+ *
+ * If crc is not WARP64IO_CRC_NONE, the bare CRC32C register of the
+ * plaintext of the window is computed along the way, as defined by
+ * warp64k_crc() starting from zero, and written to pCrc.  With
+ * WARP64IO_CRC_INPUT, the plaintext is the wsi input bytes, and with
+ * WARP64IO_CRC_OUTPUT, it is the ws output bytes.  The registers of the
+ * windows of a file can be combined with warp64k_crc_shift().
+ *
+ * Parameters:
+ *
+ *   pio - the per-thread state
+ *
+ *   fIn - the input file descriptor
+ *
+ *   fOut - the output file descriptor
+ *
+ *   pc - the transform context; its stream offset isn't used, so the
+ *   context may be shared with other threads
+ *
+ *   base - the file offset of the window
+ *
+ *   ws - the output window size, in range [1, winsize]
+ *
+ *   wsi - the input window size, in range [0, ws]
+ *
+ *   crc - the WARP64IO_CRC_ mode
+ *
+ *   pCrc - receives the CRC register of the window, or NULL if crc is
+ *   WARP64IO_CRC_NONE
+ *
+ * Return:
+ *
+ *   WARP64IO_OK or an error code
+ */
+int warp64io_window(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          int64_t       base,
+          size_t        ws,
+          size_t        wsi,
+          int           crc,
+          uint32_t    * pCrc);
+
+/*
+ * Process a whole small file as a single window at offset zero.
+ *
+ * This is the same as warp64io_window() with a base of zero, except
+ * that the window is always read into a buffer, transformed there and
+ * written out with one write, whatever the backend, and that the output
+ * file doesn't need to have its length yet, because the write gives it
+ * its length.  For a file much smaller than a window, this takes a
+ * fraction of the system calls of mapping or queueing it.  The buffer
+ * is kept in the state, so it is only allocated once per thread.
+ *
+ * ws must be at most WARP64IO_SMALL and the window size, and the state
+ * must not have the WARP64IO_DIRECT or WARP64IO_SPARSE flags.
+ *
+ * Parameters:
+ *
+ *   pio - the per-thread state
+ *
+ *   fIn - the input file descriptor
+ *
+ *   fOut - the output file descriptor
+ *
+ *   pc - the transform context
+ *
+ *   ws - the length of the output file
+ *
+ *   wsi - the length of the input file, in range [0, ws]
+ *
+ *   crc - the WARP64IO_CRC_ mode
+ *
+ *   pCrc - receives the CRC register of the plaintext, or NULL if crc
+ *   is WARP64IO_CRC_NONE
+ *
+ * Return:
+ *
+ *   WARP64IO_OK or an error code
+ */
+int warp64io_small(
+          WARP64IO    * pio,
+          int           fIn,
+          int           fOut,
+    const WARP64_CTX  * pc,
+          size_t        ws,
+          size_t        wsi,
+          int           crc,
+          uint32_t    * pCrc);
+
+/*
+ * Release the per-thread state of a backend.
+ *
+ * Parameters:
+ *
+ *   pio - the state to release
+ */
+void warp64io_end(WARP64IO *pio);
+
+#endif
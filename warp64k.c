@@ -0,0 +1,785 @@
+/*
+ * warp64k.c
+ * =========
+ *
+ * Implementation of warp64k.h
+ *
+ * See the header for further information.
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+#include "warp64k.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Architecture detection
+ * ======================
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WARP64K_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || (defined(__ARM_NEON) && defined(__GNUC__))
+#define WARP64K_NEON
+#include <arm_neon.h>
+#endif
+
+/* The 64-bit CRC32 instruction of SSE 4.2 is only there in 64-bit mode,
+ * and the ARMv8 CRC32 instructions are optional, so they are only used
+ * when the compiler was told the target has them */
+#if defined(WARP64K_X86) && defined(__x86_64__)
+#define WARP64K_CRC_X86
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define WARP64K_CRC_ARM
+#include <arm_acle.h>
+#endif
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The CRC32C (Castagnoli) polynomial, bit-reflected.
+ */
+#define WARP64K_CRC_POLY (UINT32_C(0x82f63b78))
+
+/*
+ * The length in bytes of each of the three lanes that the hardware CRC
+ * kernels checksum side by side.
+ *
+ * The CRC32 instruction has a latency of three cycles but can start one
+ * every cycle, so three independent lanes keep it busy.  The lanes are
+ * then joined with warp64k_crc_shift().  This must be a multiple of
+ * eight.
+ */
+#define WARP64K_CRC_LANE (8192)
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * Function pointer type for a kernel.
+ *
+ * pPat points into a key pattern at the phase of the first byte, so
+ * that pPat[i] is the key octet for input byte i.  At least
+ * WARP64K_PATLEN - 2 bytes may be read from pPat.
+ *
+ * pIn and pOut are either equal or do not overlap.  pIn is never NULL.
+ */
+typedef void (*WARP64K_FUNC)(
+    const uint8_t * pPat,
+    const uint8_t * pIn,
+          uint8_t * pOut,
+          size_t    len);
+
+/*
+ * Function pointer type for a kernel support check.
+ */
+typedef int (*WARP64K_CHECK)(void);
+
+/*
+ * Function pointer type for a CRC kernel, with the semantics of
+ * warp64k_crc().
+ */
+typedef uint32_t (*WARP64K_CRCFUNC)(
+    uint32_t        crc,
+    const uint8_t * p,
+    size_t          len);
+
+/*
+ * Describes one of the kernels.
+ */
+typedef struct {
+  const char    * pName;
+  WARP64K_CHECK   check;
+  WARP64K_FUNC    run;
+} WARP64K_ENTRY;
+
+/*
+ * Describes one of the CRC kernels.
+ */
+typedef struct {
+  const char      * pName;
+  WARP64K_CHECK     check;
+  WARP64K_CRCFUNC   run;
+} WARP64K_CRCENTRY;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The CRC of x^(2^k) modulo the polynomial, for k in [0, 31], which is
+ * what shifting a register over 2^k bits multiplies it by.  The powers
+ * repeat with a period of 31 from k = 31 on.
+ */
+static const uint32_t m_crcpow[32] = {
+  0x40000000, 0x20000000, 0x08000000, 0x00800000,
+  0x00008000, 0x82f63b78, 0x6ea2d55c, 0x18b8ea18,
+  0x510ac59a, 0xb82be955, 0xb8fdb1e7, 0x88e56f72,
+  0x74c360a4, 0xe4172b16, 0x0d65762a, 0x35d73a62,
+  0x28461564, 0xbf455269, 0xe2ea32dc, 0xfe7740e6,
+  0xf946610b, 0x3c204f8f, 0x538586e3, 0x59726915,
+  0x734d5309, 0xbc1ac763, 0x7d0722cc, 0xd289cabe,
+  0xe94ca9bc, 0x05b74f3f, 0xa51e1f42, 0x40000000
+};
+
+/*
+ * The tables of the slicing-by-8 CRC kernel, built by warp64k_init().
+ *
+ * Table 0 is the CRC of each byte value, and table k is the CRC of
+ * each byte value followed by k zero bytes.
+ */
+static uint32_t m_crctab[8][256];
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Multiply two bit-reflected polynomials modulo the CRC polynomial.
+ */
+static uint32_t crcMult(uint32_t a, uint32_t b) {
+  uint32_t m = UINT32_C(0x80000000);
+  uint32_t p = 0;
+
+  for( ; m != 0; m >>= 1) {
+    if (a & m) {
+      p ^= b;
+    }
+    b = (b & 1) ? ((b >> 1) ^ WARP64K_CRC_POLY) : (b >> 1);
+  }
+  return p;
+}
+
+/*
+ * Kernel functions
+ * ================
+ */
+
+/*
+ * Reference kernel that transforms one byte at a time directly
+ * according to the specification.
+ */
+static void kernRef(
+    const uint8_t * pPat,
+    const uint8_t * pIn,
+          uint8_t * pOut,
+          size_t    len) {
+
+  size_t i = 0;
+  int k = 0;
+
+  for(i = 0; i < len; i++) {
+    pOut[i] = (uint8_t) ((((int) pIn[i]) + ((int) pPat[k])) % 256);
+    k = ((k + 1) % 3);
+  }
+}
+
+/*
+ * Portable kernel that adds eight bytes at a time within 64-bit
+ * integers.
+ *
+ * The pattern period in words is three, so the three pattern words are
+ * loaded once and then cycled.
+ */
+static void kernSwar(
+    const uint8_t * pPat,
+    const uint8_t * pIn,
+          uint8_t * pOut,
+          size_t    len) {
+
+  const uint64_t lo = UINT64_C(0x7f7f7f7f7f7f7f7f);
+  const uint64_t hi = UINT64_C(0x8080808080808080);
+
+  size_t i = 0;
+  uint64_t p[3];
+  uint64_t a = 0;
+  int j = 0;
+
+  /* Load the three pattern words */
+  memcpy(&(p[0]), pPat     , 8);
+  memcpy(&(p[1]), pPat +  8, 8);
+  memcpy(&(p[2]), pPat + 16, 8);
+
+  /* Add 24 bytes at a time; adding the low seven bits of each byte
+   * cannot carry into the neighbouring byte, and the high bit is then
+   * fixed up with XOR */
+  for(i = 0; i + 24 <= len; i += 24) {
+    for(j = 0; j < 3; j++) {
+      memcpy(&a, pIn + i + (j * 8), 8);
+      a = ((a & lo) + (p[j] & lo)) ^ ((a ^ p[j]) & hi);
+      memcpy(pOut + i + (j * 8), &a, 8);
+    }
+  }
+
+  /* The offset is now a multiple of three, so the remaining bytes start
+   * at the same phase */
+  if (i < len) {
+    kernRef(pPat, pIn + i, pOut + i, len - i);
+  }
+}
+
+#ifdef WARP64K_X86
+
+static int checkSse2(void) {
+  __builtin_cpu_init();
+  return (__builtin_cpu_supports("sse2") ? 1 : 0);
+}
+
+static int checkAvx2(void) {
+  __builtin_cpu_init();
+  return (__builtin_cpu_supports("avx2") ? 1 : 0);
+}
+
+static int checkAvx512(void) {
+  __builtin_cpu_init();
+  return (__builtin_cpu_supports("avx512bw") ? 1 : 0);
+}
+
+/*
+ * SSE2 kernel, 48 bytes per iteration.
+ */
+__attribute__((target("sse2")))
+static void kernSse2(
+    const uint8_t * pPat,
+    const uint8_t * pIn,
+          uint8_t * pOut,
+          size_t    len) {
+
+  size_t i = 0;
+  __m128i p0, p1, p2;
+
+  p0 = _mm_loadu_si128((const __m128i *) (pPat      ));
+  p1 = _mm_loadu_si128((const __m128i *) (pPat + 16));
+  p2 = _mm_loadu_si128((const __m128i *) (pPat + 32));
+
+  for(i = 0; i + 48 <= len; i += 48) {
+    _mm_storeu_si128((__m128i *) (pOut + i),
+      _mm_add_epi8(_mm_loadu_si128((const __m128i *) (pIn + i)), p0));
+    _mm_storeu_si128((__m128i *) (pOut + i + 16),
+      _mm_add_epi8(
+        _mm_loadu_si128((const __m128i *) (pIn + i + 16)), p1));
+    _mm_storeu_si128((__m128i *) (pOut + i + 32),
+      _mm_add_epi8(
+        _mm_loadu_si128((const __m128i *) (pIn + i + 32)), p2));
+  }
+
+  if (i < len) {
+    kernSwar(pPat, pIn + i, pOut + i, len - i);
+  }
+}
+
+/*
+ * AVX2 kernel, 96 bytes per iteration.
+ */
+__attribute__((target("avx2")))
+static void kernAvx2(
+    const uint8_t * pPat,
+    const uint8_t * pIn,
+          uint8_t * pOut,
+          size_t    len) {
+
+  size_t i = 0;
+  __m256i p0, p1, p2;
+
+  p0 = _mm256_loadu_si256((const __m256i *) (pPat      ));
+  p1 = _mm256_loadu_si256((const __m256i *) (pPat + 32));
+  p2 = _mm256_loadu_si256((const __m256i *) (pPat + 64));
+
+  for(i = 0; i + 96 <= len; i += 96) {
+    _mm256_storeu_si256((__m256i *) (pOut + i),
+      _mm256_add_epi8(
+        _mm256_loadu_si256((const __m256i *) (pIn + i)), p0));
+    _mm256_storeu_si256((__m256i *) (pOut + i + 32),
+      _mm256_add_epi8(
+        _mm256_loadu_si256((const __m256i *) (pIn + i + 32)), p1));
+    _mm256_storeu_si256((__m256i *) (pOut + i + 64),
+      _mm256_add_epi8(
+        _mm256_loadu_si256((const __m256i *) (pIn + i + 64)), p2));
+  }
+
+  if (i < len) {
+    kernSse2(pPat, pIn + i, pOut + i, len - i);
+  }
+}
+
+/*
+ * AVX-512 kernel, 192 bytes per iteration.  Byte addition requires the
+ * AVX512BW extension.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void kernAvx512(
+    const uint8_t * pPat,
+    const uint8_t * pIn,
+          uint8_t * pOut,
+          size_t    len) {
+
+  size_t i = 0;
+  __m512i p0, p1, p2;
+
+  p0 = _mm512_loadu_si512((const void *) (pPat       ));
+  p1 = _mm512_loadu_si512((const void *) (pPat +  64));
+  p2 = _mm512_loadu_si512((const void *) (pPat + 128));
+
+  for(i = 0; i + 192 <= len; i += 192) {
+    _mm512_storeu_si512((void *) (pOut + i),
+      _mm512_add_epi8(
+        _mm512_loadu_si512((const void *) (pIn + i)), p0));
+    _mm512_storeu_si512((void *) (pOut + i + 64),
+      _mm512_add_epi8(
+        _mm512_loadu_si512((const void *) (pIn + i + 64)), p1));
+    _mm512_storeu_si512((void *) (pOut + i + 128),
+      _mm512_add_epi8(
+        _mm512_loadu_si512((const void *) (pIn + i + 128)), p2));
+  }
+
+  if (i < len) {
+    kernAvx2(pPat, pIn + i, pOut + i, len - i);
+  }
+}
+
+#endif
+
+#ifdef WARP64K_NEON
+
+static int checkNeon(void) {
+  return 1;
+}
+
+/*
+ * NEON kernel, 48 bytes per iteration.
+ */
+static void kernNeon(
+    const uint8_t * pPat,
+    const uint8_t * pIn,
+          uint8_t * pOut,
+          size_t    len) {
+
+  size_t i = 0;
+  uint8x16_t p0, p1, p2;
+
+  p0 = vld1q_u8(pPat     );
+  p1 = vld1q_u8(pPat + 16);
+  p2 = vld1q_u8(pPat + 32);
+
+  for(i = 0; i + 48 <= len; i += 48) {
+    vst1q_u8(pOut + i     , vaddq_u8(vld1q_u8(pIn + i     ), p0));
+    vst1q_u8(pOut + i + 16, vaddq_u8(vld1q_u8(pIn + i + 16), p1));
+    vst1q_u8(pOut + i + 32, vaddq_u8(vld1q_u8(pIn + i + 32), p2));
+  }
+
+  if (i < len) {
+    kernSwar(pPat, pIn + i, pOut + i, len - i);
+  }
+}
+
+#endif
+
+static int checkAlways(void) {
+  return 1;
+}
+
+/*
+ * CRC kernel functions
+ * ====================
+ */
+
+/*
+ * Reference CRC kernel that works one bit at a time.  This needs no
+ * tables, so it is what runs before warp64k_init() is called.
+ */
+static uint32_t crcBit(uint32_t crc, const uint8_t *p, size_t len) {
+  size_t i = 0;
+  int j = 0;
+
+  for(i = 0; i < len; i++) {
+    crc ^= (uint32_t) p[i];
+    for(j = 0; j < 8; j++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ WARP64K_CRC_POLY) : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+/*
+ * Portable CRC kernel that works eight bytes at a time with the
+ * slicing-by-8 tables.
+ */
+static uint32_t crcSlice8(uint32_t crc, const uint8_t *p, size_t len) {
+  size_t i = 0;
+
+  for(i = 0; i + 8 <= len; i += 8) {
+    crc ^=  ((uint32_t) p[i    ])        |
+           (((uint32_t) p[i + 1]) <<  8) |
+           (((uint32_t) p[i + 2]) << 16) |
+           (((uint32_t) p[i + 3]) << 24);
+    crc = m_crctab[7][ crc        & 0xff] ^
+          m_crctab[6][(crc >>  8) & 0xff] ^
+          m_crctab[5][(crc >> 16) & 0xff] ^
+          m_crctab[4][ crc >> 24        ] ^
+          m_crctab[3][p[i + 4]] ^
+          m_crctab[2][p[i + 5]] ^
+          m_crctab[1][p[i + 6]] ^
+          m_crctab[0][p[i + 7]];
+  }
+  for( ; i < len; i++) {
+    crc = (crc >> 8) ^ m_crctab[0][(crc ^ p[i]) & 0xff];
+  }
+  return crc;
+}
+
+#ifdef WARP64K_CRC_X86
+
+static int checkSse42(void) {
+  __builtin_cpu_init();
+  return (__builtin_cpu_supports("sse4.2") ? 1 : 0);
+}
+
+/*
+ * SSE 4.2 CRC kernel, checksumming three lanes side by side.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42(uint32_t crc, const uint8_t *p, size_t len) {
+  size_t i = 0;
+  uint64_t c0 = 0;
+  uint64_t c1 = 0;
+  uint64_t c2 = 0;
+  uint64_t v = 0;
+
+  while (len >= 3 * WARP64K_CRC_LANE) {
+    c0 = crc;
+    c1 = 0;
+    c2 = 0;
+    for(i = 0; i < WARP64K_CRC_LANE; i += 8) {
+      memcpy(&v, p + i, 8);
+      c0 = _mm_crc32_u64(c0, v);
+      memcpy(&v, p + WARP64K_CRC_LANE + i, 8);
+      c1 = _mm_crc32_u64(c1, v);
+      memcpy(&v, p + 2 * WARP64K_CRC_LANE + i, 8);
+      c2 = _mm_crc32_u64(c2, v);
+    }
+    crc = warp64k_crc_shift((uint32_t) c0, WARP64K_CRC_LANE) ^
+            ((uint32_t) c1);
+    crc = warp64k_crc_shift(crc, WARP64K_CRC_LANE) ^ ((uint32_t) c2);
+    p += 3 * WARP64K_CRC_LANE;
+    len -= 3 * WARP64K_CRC_LANE;
+  }
+
+  c0 = crc;
+  for(i = 0; i + 8 <= len; i += 8) {
+    memcpy(&v, p + i, 8);
+    c0 = _mm_crc32_u64(c0, v);
+  }
+  crc = (uint32_t) c0;
+  for( ; i < len; i++) {
+    crc = _mm_crc32_u8(crc, p[i]);
+  }
+  return crc;
+}
+
+#endif
+
+#ifdef WARP64K_CRC_ARM
+
+/*
+ * ARMv8 CRC kernel, checksumming three lanes side by side.
+ */
+static uint32_t crcArm(uint32_t crc, const uint8_t *p, size_t len) {
+  size_t i = 0;
+  uint32_t c0 = 0;
+  uint32_t c1 = 0;
+  uint32_t c2 = 0;
+  uint64_t v = 0;
+
+  while (len >= 3 * WARP64K_CRC_LANE) {
+    c0 = crc;
+    c1 = 0;
+    c2 = 0;
+    for(i = 0; i < WARP64K_CRC_LANE; i += 8) {
+      memcpy(&v, p + i, 8);
+      c0 = __crc32cd(c0, v);
+      memcpy(&v, p + WARP64K_CRC_LANE + i, 8);
+      c1 = __crc32cd(c1, v);
+      memcpy(&v, p + 2 * WARP64K_CRC_LANE + i, 8);
+      c2 = __crc32cd(c2, v);
+    }
+    crc = warp64k_crc_shift(c0, WARP64K_CRC_LANE) ^ c1;
+    crc = warp64k_crc_shift(crc, WARP64K_CRC_LANE) ^ c2;
+    p += 3 * WARP64K_CRC_LANE;
+    len -= 3 * WARP64K_CRC_LANE;
+  }
+
+  for(i = 0; i + 8 <= len; i += 8) {
+    memcpy(&v, p + i, 8);
+    crc = __crc32cd(crc, v);
+  }
+  for( ; i < len; i++) {
+    crc = __crc32cb(crc, p[i]);
+  }
+  return crc;
+}
+
+#endif
+
+/*
+ * Kernel tables
+ * =============
+ */
+
+/*
+ * Table of all kernels, in order of increasing preference.
+ */
+static const WARP64K_ENTRY m_kernels[] = {
+  {"ref"   , &checkAlways, &kernRef   },
+  {"swar"  , &checkAlways, &kernSwar  },
+#ifdef WARP64K_X86
+  {"sse2"  , &checkSse2  , &kernSse2  },
+  {"avx2"  , &checkAvx2  , &kernAvx2  },
+  {"avx512", &checkAvx512, &kernAvx512},
+#endif
+#ifdef WARP64K_NEON
+  {"neon"  , &checkNeon  , &kernNeon  },
+#endif
+  {NULL, NULL, NULL}
+};
+
+/*
+ * Table of all CRC kernels, in order of increasing preference.
+ */
+static const WARP64K_CRCENTRY m_crcs[] = {
+  {"bit"   , &checkAlways, &crcBit   },
+  {"slice8", &checkAlways, &crcSlice8},
+#ifdef WARP64K_CRC_X86
+  {"sse4.2", &checkSse42 , &crcSse42 },
+#endif
+#ifdef WARP64K_CRC_ARM
+  {"armv8" , &checkAlways, &crcArm   },
+#endif
+  {NULL, NULL, NULL}
+};
+
+/*
+ * The index of the selected kernel.
+ */
+static int m_sel = 0;
+
+/*
+ * The index of the selected CRC kernel.  This stays on the reference
+ * kernel until warp64k_init() has built the tables.
+ */
+static int m_crcsel = 0;
+
+/*
+ * Public function implementations
+ * ===============================
+ *
+ * See the header for specifications.
+ */
+
+/*
+ * warp64k_init function.
+ */
+void warp64k_init(void) {
+  int i = 0;
+  int k = 0;
+  int sel = 0;
+  uint32_t c = 0;
+
+  /* Only store the final choice, so that a repeated call never
+   * switches a running kernel over to another one */
+  for(i = 0; m_kernels[i].pName != NULL; i++) {
+    if ((*(m_kernels[i].check))()) {
+      sel = i;
+    }
+  }
+  m_sel = sel;
+
+  /* Build the slicing-by-8 tables before any kernel that uses them can
+   * be selected */
+  for(i = 0; i < 256; i++) {
+    c = (uint32_t) i;
+    for(k = 0; k < 8; k++) {
+      c = (c & 1) ? ((c >> 1) ^ WARP64K_CRC_POLY) : (c >> 1);
+    }
+    m_crctab[0][i] = c;
+  }
+  for(i = 0; i < 256; i++) {
+    for(k = 1; k < 8; k++) {
+      m_crctab[k][i] = (m_crctab[k - 1][i] >> 8) ^
+                        m_crctab[0][m_crctab[k - 1][i] & 0xff];
+    }
+  }
+
+  sel = 0;
+  for(i = 0; m_crcs[i].pName != NULL; i++) {
+    if ((*(m_crcs[i].check))()) {
+      sel = i;
+    }
+  }
+  m_crcsel = sel;
+}
+
+/*
+ * warp64k_count function.
+ */
+int warp64k_count(void) {
+  return (int) ((sizeof(m_kernels) / sizeof(WARP64K_ENTRY)) - 1);
+}
+
+/*
+ * warp64k_name function.
+ */
+const char *warp64k_name(int i) {
+  if ((i < 0) || (i >= warp64k_count())) {
+    abort();
+  }
+  return m_kernels[i].pName;
+}
+
+/*
+ * warp64k_supported function.
+ */
+int warp64k_supported(int i) {
+  if ((i < 0) || (i >= warp64k_count())) {
+    abort();
+  }
+  return (*(m_kernels[i].check))();
+}
+
+/*
+ * warp64k_select function.
+ */
+int warp64k_select(int i) {
+  if (!warp64k_supported(i)) {
+    return 0;
+  }
+  m_sel = i;
+  return 1;
+}
+
+/*
+ * warp64k_current function.
+ */
+int warp64k_current(void) {
+  return m_sel;
+}
+
+/*
+ * warp64k_key function.
+ */
+void warp64k_key(WARP64K_KEY *pk, int32_t key) {
+  int i = 0;
+  uint8_t kb[3];
+
+  /* Check parameters */
+  if (pk == NULL) {
+    abort();
+  }
+
+  /* Unpack key */
+  kb[0] = (uint8_t) ((key >> 16) & 0xff);
+  kb[1] = (uint8_t) ((key >>  8) & 0xff);
+  kb[2] = (uint8_t) ( key        & 0xff);
+
+  /* Fill the pattern */
+  for(i = 0; i < WARP64K_PATLEN; i++) {
+    (pk->pat)[i] = kb[i % 3];
+  }
+}
+
+/*
+ * warp64k_run function.
+ */
+void warp64k_run(
+    const WARP64K_KEY * pk,
+          int           phase,
+    const uint8_t     * pIn,
+          uint8_t     * pOut,
+          size_t        len) {
+
+  size_t c = 0;
+
+  /* Check parameters */
+  if ((pk == NULL) || (pOut == NULL) || (phase < 0) || (phase > 2)) {
+    abort();
+  }
+
+  /* If there is no input, the output is just the key pattern, which we
+   * copy in chunks that are a multiple of three so that the phase stays
+   * the same for each chunk */
+  if (pIn == NULL) {
+    while (len > 0) {
+      c = 252;
+      if (len < c) {
+        c = len;
+      }
+      memcpy(pOut, &((pk->pat)[phase]), c);
+      pOut += c;
+      len -= c;
+    }
+    return;
+  }
+
+  /* Otherwise, call through to the selected kernel */
+  if (len > 0) {
+    (*(m_kernels[m_sel].run))(&((pk->pat)[phase]), pIn, pOut, len);
+  }
+}
+
+/*
+ * warp64k_crc function.
+ */
+uint32_t warp64k_crc(uint32_t crc, const uint8_t *p, size_t len) {
+  if ((p == NULL) && (len > 0)) {
+    abort();
+  }
+  if (len < 1) {
+    return crc;
+  }
+  return (*(m_crcs[m_crcsel].run))(crc, p, len);
+}
+
+/*
+ * warp64k_crc_shift function.
+ */
+uint32_t warp64k_crc_shift(uint32_t crc, int64_t len) {
+  uint64_t n = 0;
+  int k = 3;
+
+  if (len < 0) {
+    abort();
+  }
+
+  /* Multiply by x^(8 * len), one power of two of the bit count at a
+   * time */
+  for(n = (uint64_t) len; n != 0; n >>= 1) {
+    if (n & 1) {
+      crc = crcMult(m_crcpow[k], crc);
+    }
+    k++;
+    if (k >= 32) {
+      k = 1;
+    }
+  }
+  return crc;
+}
+
+/*
+ * warp64k_crc_name function.
+ */
+const char *warp64k_crc_name(void) {
+  return m_crcs[m_crcsel].pName;
+}
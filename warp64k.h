@@ -0,0 +1,244 @@
+#ifndef WARP64K_H_INCLUDED
+#define WARP64K_H_INCLUDED
+
+/*
+ * warp64k.h
+ * =========
+ *
+ * Transform kernels for the Warp64 byte-add transform.
+ *
+ * The Warp64 transform adds a three-octet key to each octet of data,
+ * selecting the key octet by the byte offset MOD 3.  This module holds
+ * several implementations of that transform: a byte-at-a-time reference
+ * kernel, a portable 64-bit SWAR kernel, and vector kernels for SSE2,
+ * AVX2, AVX-512 and NEON where the compiler and processor support them.
+ *
+ * Every kernel produces byte-identical output.  warp64k_init() selects
+ * the fastest kernel the processor supports, and warp64k_run() then
+ * uses the selected kernel.
+ *
+ * The module also computes CRC32C checksums, with the CRC32 instruction
+ * of SSE 4.2 or ARMv8 where available and with tables otherwise, so
+ * that a checksum of the plaintext can be computed in the same pass as
+ * the transform.  warp64k_init() selects the CRC kernel as well.
+ *
+ * Must compile with _FILE_OFFSET_BITS=64
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of bytes stored in a key pattern.
+ *
+ * This must be large enough that a kernel can start reading at any
+ * phase in the range [0, 2] and read three full vectors of the widest
+ * vector width, which is 64 bytes for AVX-512.
+ */
+#define WARP64K_PATLEN (256)
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * A precomputed key pattern.
+ *
+ * Initialize this with warp64k_key().
+ */
+typedef struct {
+
+  /*
+   * The key pattern.
+   *
+   * Element i is the key octet that applies to byte offset i, so the
+   * pattern repeats with a period of three.
+   */
+  uint8_t pat[WARP64K_PATLEN];
+
+} WARP64K_KEY;
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Select the fastest kernel supported by the processor.
+ *
+ * This should be called once at the start of the program before any
+ * other function in this module is used.  If it is not called, the
+ * reference kernel is used.
+ */
+void warp64k_init(void);
+
+/*
+ * Return the total number of kernels compiled into this module,
+ * including kernels that the processor might not support.
+ *
+ * Return:
+ *
+ *   the number of kernels
+ */
+int warp64k_count(void);
+
+/*
+ * Return the name of a kernel.
+ *
+ * Parameters:
+ *
+ *   i - the kernel index, in range [0, warp64k_count() - 1]
+ *
+ * Return:
+ *
+ *   the kernel name
+ */
+const char *warp64k_name(int i);
+
+/*
+ * Check whether the processor supports a kernel.
+ *
+ * Parameters:
+ *
+ *   i - the kernel index, in range [0, warp64k_count() - 1]
+ *
+ * Return:
+ *
+ *   non-zero if supported, zero if not
+ */
+int warp64k_supported(int i);
+
+/*
+ * Select a specific kernel.
+ *
+ * This is intended for benchmarking and conformance checks.  It is not
+ * thread-safe with respect to concurrent calls of warp64k_run().
+ *
+ * Parameters:
+ *
+ *   i - the kernel index, in range [0, warp64k_count() - 1]
+ *
+ * Return:
+ *
+ *   non-zero if successful, zero if the processor does not support the
+ *   kernel
+ */
+int warp64k_select(int i);
+
+/*
+ * Return the index of the currently selected kernel.
+ *
+ * Return:
+ *
+ *   the kernel index
+ */
+int warp64k_current(void);
+
+/*
+ * Build a key pattern from a packed key.
+ *
+ * key contains the three key octets in the 24 least significant bits,
+ * with the octet for phase zero in bits 16-23 and the octet for phase
+ * two in bits 0-7.
+ *
+ * Parameters:
+ *
+ *   pk - the key pattern to initialize
+ *
+ *   key - the packed key
+ */
+void warp64k_key(WARP64K_KEY *pk, int32_t key);
+
+/*
+ * Transform bytes with the currently selected kernel.
+ *
+ * phase is the byte offset of the first byte MOD 3.  It must be in
+ * range [0, 2].
+ *
+ * pIn and pOut may be equal to transform in place, but they must not
+ * otherwise overlap.  pIn may be NULL, in which case the input is
+ * treated as len bytes of zero value.
+ *
+ * Parameters:
+ *
+ *   pk - the key pattern
+ *
+ *   phase - the key phase of the first byte
+ *
+ *   pIn - the input bytes, or NULL for zero bytes
+ *
+ *   pOut - the output bytes
+ *
+ *   len - the number of bytes to transform
+ */
+void warp64k_run(
+    const WARP64K_KEY * pk,
+          int           phase,
+    const uint8_t     * pIn,
+          uint8_t     * pOut,
+          size_t        len);
+
+/*
+ * Compute the CRC32C of bytes, continuing from a CRC register value.
+ *
+ * This works on the bare CRC register, without the inversion at the
+ * start and end that the standard CRC32C applies.  The standard CRC32C
+ * of a message is therefore:
+ *
+ *   warp64k_crc(0xffffffff, pMsg, len) ^ 0xffffffff
+ *
+ * The bare register is linear, so the register of a message that is
+ * made of a part A followed by a part B is the register of A shifted
+ * over the length of B with warp64k_crc_shift(), XOR the register of B
+ * computed from zero.  Parts of a message can then be checksummed in
+ * any order and on any thread and added up at the end.  A run of zero
+ * bytes checksummed from zero gives zero, so zero parts can be skipped.
+ *
+ * Parameters:
+ *
+ *   crc - the CRC register before the bytes, zero for a part
+ *
+ *   p - the bytes
+ *
+ *   len - the number of bytes
+ *
+ * Return:
+ *
+ *   the CRC register after the bytes
+ */
+uint32_t warp64k_crc(uint32_t crc, const uint8_t *p, size_t len);
+
+/*
+ * Shift a CRC register over len zero bytes.
+ *
+ * This is the register that warp64k_crc() would return for len zero
+ * bytes starting from crc, computed in time logarithmic in len.
+ *
+ * Parameters:
+ *
+ *   crc - the CRC register
+ *
+ *   len - the number of bytes to shift over, zero or greater
+ *
+ * Return:
+ *
+ *   the shifted CRC register
+ */
+uint32_t warp64k_crc_shift(uint32_t crc, int64_t len);
+
+/*
+ * Return the name of the selected CRC kernel.
+ *
+ * Return:
+ *
+ *   the CRC kernel name
+ */
+const char *warp64k_crc_name(void);
+
+#endif
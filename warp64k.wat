@@ -0,0 +1,70 @@
+;;
+;; warp64k.wat
+;; ===========
+;;
+;; WebAssembly kernel for the browser tool, the counterpart of the SIMD
+;; kernels in warp64k.c.
+;;
+;; The module has its own memory, which the caller grows to fit a chunk.
+;; xform(pat, buf, len) transforms len bytes at buf in place.  pat points
+;; at a 48-byte key pattern at the phase of the first byte, so that
+;; pat[i] is the key octet of byte i for i < 48, and the pattern repeats
+;; every 48 bytes because 48 is a multiple of both 16 and 3.  The bulk is
+;; done 48 bytes at a time with three 128-bit adds, as in kernSse2(), and
+;; the rest one byte at a time.
+;;
+;; warp64.js embeds the assembled module as WARP64K_WASM, so after any
+;; change here, assemble it and update the bytes there:
+;;
+;;   wat2wasm warp64k.wat -o warp64k.wasm
+;;   od -An -tu1 -v warp64k.wasm
+;;
+
+(module
+  (memory (export "memory") 1)
+
+  (func (export "xform") (param $pat i32) (param $buf i32) (param $len i32)
+    (local $i i32)
+    (local $j i32)
+    (local $p0 v128)
+    (local $p1 v128)
+    (local $p2 v128)
+
+    ;; Load the three pattern vectors
+    (local.set $p0 (v128.load offset=0 align=1 (local.get $pat)))
+    (local.set $p1 (v128.load offset=16 align=1 (local.get $pat)))
+    (local.set $p2 (v128.load offset=32 align=1 (local.get $pat)))
+
+    ;; 48 bytes at a time
+    (block $done
+      (loop $bulk
+        (br_if $done
+          (i32.gt_u (i32.add (local.get $i) (i32.const 48))
+                    (local.get $len)))
+        (local.set $j (i32.add (local.get $buf) (local.get $i)))
+        (v128.store offset=0 align=1 (local.get $j)
+          (i8x16.add (v128.load offset=0 align=1 (local.get $j))
+                     (local.get $p0)))
+        (v128.store offset=16 align=1 (local.get $j)
+          (i8x16.add (v128.load offset=16 align=1 (local.get $j))
+                     (local.get $p1)))
+        (v128.store offset=32 align=1 (local.get $j)
+          (i8x16.add (v128.load offset=32 align=1 (local.get $j))
+                     (local.get $p2)))
+        (local.set $i (i32.add (local.get $i) (i32.const 48)))
+        (br $bulk)))
+
+    ;; The offset is now a multiple of 48, so the remaining bytes start
+    ;; at the start of the pattern
+    (local.set $j (i32.const 0))
+    (block $end
+      (loop $tail
+        (br_if $end (i32.ge_u (local.get $i) (local.get $len)))
+        (i32.store8 (i32.add (local.get $buf) (local.get $i))
+          (i32.add
+            (i32.load8_u (i32.add (local.get $buf) (local.get $i)))
+            (i32.load8_u (i32.add (local.get $pat) (local.get $j)))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (local.set $j (i32.add (local.get $j) (i32.const 1)))
+        (br $tail))))
+)
@@ -8,10 +8,40 @@
  * Syntax:
  * 
  *   ./warptrail3 input.binary
+ *   ./warptrail3 [options] path1 path2 ...
  * 
  * This utility is meant for use during the key recovery procedure.  It
- * won't directly recover the scrambling key of a scrambled file, but it
- * will give you the information you need to do that.
+ * gives you the information you need to follow that procedure, and it
+ * also reports the key that the procedure arrives at, which will
+ * descramble the file if it is a scrambled Warp64 file.
+ * 
+ * Several paths, or any of the options, select batch mode, which runs
+ * the whole recovery procedure for many files and reports the files
+ * grouped by their recovered key.  The following options are supported:
+ * 
+ *   -r walks directories recursively for files with the .warp64
+ *   suffix.  Symbolic links found while walking are not followed.
+ *   Paths given on the command line are used whatever their suffix.
+ * 
+ *   -j [count] reads the trailers on [count] threads, each with one
+ *   pread() in flight, so this sets the I/O depth.  A count of zero
+ *   uses one thread per online processor.  The default is TRAIL_DEPTH.
+ * 
+ *   -f csv or -f json selects the report format.  The default is CSV.
+ * 
+ * The CSV report has a header line and then one "key,path" line per
+ * file, sorted by key so that files with the same key are together, and
+ * in listing order within each key.  Files whose trailer couldn't be
+ * read come last with an empty key.  The JSON report is a single object
+ * with a "keys" array of {"key", "files"} objects in the same order and
+ * an "errors" array of paths.  In batch mode, the exit status is only
+ * zero if every trailer was read.
+ * 
+ * The recovery is performed by libwarp64.c, which uses the kernels in
+ * warp64k.c, so those modules must be compiled and linked in:
+ * 
+ *   cc -D_FILE_OFFSET_BITS=64 -O2 -pthread -o warptrail3 warptrail3.c
+ *     libwarp64.c warp64k.c
  * 
  * Must compile with _FILE_OFFSET_BITS=64
  */
@@ -23,10 +53,14 @@
 #include <string.h>
 
 /* POSIX headers */
+#include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "libwarp64.h"
+
 /*
  * Check 64-bit file mode
  * ======================
@@ -41,68 +75,164 @@
 #endif
 
 /*
- * Program entrypoint
- * ==================
+ * Constants
+ * =========
  */
 
-int main(int argc, char *argv[]) {
+/*
+ * The file suffix of scrambled files, which -r looks for.
+ */
+#define FILE_SUFFIX ".warp64"
+
+/*
+ * The default number of trailer reads in flight in batch mode.
+ */
+#define TRAIL_DEPTH (16)
+
+/*
+ * The maximum number of threads.
+ */
+#define MAX_THREADS (1024)
+
+/*
+ * The report formats.
+ */
+#define FORMAT_CSV  (0)
+#define FORMAT_JSON (1)
+
+/*
+ * Data types
+ * ==========
+ */
+
+/*
+ * A file in batch mode.
+ */
+typedef struct {
+  
+  /*
+   * The dynamically allocated path.
+   */
+  char *pPath;
+  
+  /*
+   * The position of the file in the listing.
+   */
+  int64_t index;
+  
+  /*
+   * The length of the file when it was listed, or -1 if it couldn't be
+   * listed.
+   */
+  int64_t size;
+  
+  /*
+   * The recovered normalized key, or -1 if the trailer couldn't be
+   * read.  Only the worker that handles the file writes this.
+   */
+  int32_t key;
+  
+} TRAIL_FILE;
+
+/*
+ * Shared state of batch mode.
+ */
+typedef struct {
+  
+  /*
+   * The list of files, the number of files, and the capacity of the
+   * list.
+   */
+  TRAIL_FILE *pFiles;
+  int64_t nfile;
+  int64_t cap;
+  
+  /*
+   * Lock protecting next.
+   */
+  pthread_mutex_t lock;
+  
+  /*
+   * The index of the next file to claim.
+   */
+  int64_t next;
+  
+} TRAIL_LIST;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The name of the executable module, for use in diagnostic messages.
+ * 
+ * This is set at the start of the entrypoint.
+ */
+static const char *pModule = NULL;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int trailOne(const char *pPath);
+
+static void trailAdd(TRAIL_LIST *pl, const char *pPath, int64_t size);
+static void trailWalk(
+          TRAIL_LIST * pl,
+    const char       * pPath,
+          int          recursive,
+          int          top);
+static int32_t trailRead(const TRAIL_FILE *pf);
+static void *trailWorker(void *pArg);
+static int trailCompare(const void *pA, const void *pB);
+
+static void printCsvField(const char *pStr);
+static void printJsonString(const char *pStr);
+static void reportCsv(const TRAIL_LIST *pl);
+static void reportJson(const TRAIL_LIST *pl);
+
+static int trailBatch(
+    char ** ppPath,
+    int     npath,
+    int     recursive,
+    int     threads,
+    int     format);
+
+/*
+ * Report the trailer of a single file, along with the key it recovers.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int trailOne(const char *pPath) {
   
   int status = 1;
-  int i = 0;
-  const char *pModule = NULL;
   
   int64_t fl = 0;
   uint8_t trail[3];
+  char kstr[WARP64_KEYSTR + 1];
   
-  const char *pPath = NULL;
   struct stat st;
   int fh = -1;
   
   /* Initialize structures and arrays */
   memset(&st, 0, sizeof(struct stat));
   memset(trail, 0, 3);
+  memset(kstr, 0, WARP64_KEYSTR + 1);
   
-  /* Get the module name */
-  pModule = NULL;
-  if ((argc > 0) && (argv != NULL)) {
-    pModule = argv[0];
-  }
-  if (pModule == NULL) {
-    pModule = "warptrail3";
-  }
-  
-  /* If no parameters provided, print help screen and fail */
-  if (argc <= 1) {
-    status = 0;
-    fprintf(stderr, "Warp64 trailer examination\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "Syntax:\n");
-    fprintf(stderr, "  warptrail3 [input_path]\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "[input_path] is path to input file\n");
-  }
-  
-  /* Must be exactly one parameter beyond module name */
-  if (status && (argc != 2)) {
-    status = 0;
-    fprintf(stderr, "%s: Wrong number of parameters!\n", pModule);
-  }
-  
-  /* Check that parameters are present */
-  if (status) {
-    if (argv == NULL) {
-      abort();
-    }
-    for(i = 0; i < argc; i++) {
-      if (argv[i] == NULL) {
-        abort();
-      }
-    }
-  }
-  
-  /* Get the path to the input file */
-  if (status) {
-    pPath = argv[1];
+  /* Check parameters */
+  if (pPath == NULL) {
+    abort();
   }
   
   /* Make sure the file path is for an existing regular file */
@@ -173,6 +303,11 @@ int main(int argc, char *argv[]) {
     fh = -1;
   }
   
+  /* Recover the key from the trailer */
+  if (status) {
+    warp64_encode(warp64_recover(fl, trail), kstr);
+  }
+  
   /* Report results */
   if (status) {
     printf("Byte offset %lld decimal:\n", (long long) fl);
@@ -180,6 +315,732 @@ int main(int argc, char *argv[]) {
               (int) trail[0],
               (int) trail[1],
               (int) trail[2]);
+    printf("Recovered key: %s\n", kstr);
+  }
+  
+  return status;
+}
+
+/*
+ * Add a file to the batch list.
+ * 
+ * Parameters:
+ * 
+ *   pl - the list
+ * 
+ *   pPath - the path
+ * 
+ *   size - the length of the file, or -1 if it couldn't be listed
+ */
+static void trailAdd(TRAIL_LIST *pl, const char *pPath, int64_t size) {
+  TRAIL_FILE *pf = NULL;
+  
+  /* Check parameters */
+  if ((pl == NULL) || (pPath == NULL)) {
+    abort();
+  }
+  
+  /* Grow the file list if necessary */
+  if (pl->nfile >= pl->cap) {
+    if (pl->cap < 1) {
+      pl->cap = 64;
+    } else {
+      pl->cap = pl->cap * 2;
+    }
+    pl->pFiles = (TRAIL_FILE *) realloc(
+                    pl->pFiles,
+                    ((size_t) pl->cap) * sizeof(TRAIL_FILE));
+    if (pl->pFiles == NULL) {
+      abort();
+    }
+  }
+  
+  /* Fill in the new entry */
+  pf = &((pl->pFiles)[pl->nfile]);
+  memset(pf, 0, sizeof(TRAIL_FILE));
+  pf->pPath = (char *) malloc(strlen(pPath) + 1);
+  if (pf->pPath == NULL) {
+    abort();
+  }
+  strcpy(pf->pPath, pPath);
+  pf->index = pl->nfile;
+  pf->size = size;
+  pf->key = -1;
+  (pl->nfile)++;
+}
+
+/*
+ * Add a path to the batch list, descending into directories if
+ * requested.
+ * 
+ * top is non-zero for paths given on the command line.  Those must be
+ * regular files, or directories if recursive is set, and anything else
+ * is added as an error.  Entries found while walking a directory are
+ * silently skipped unless they are regular files with the .warp64
+ * suffix, and symbolic links found while walking are never followed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pl - the list
+ * 
+ *   pPath - the path to add
+ * 
+ *   recursive - non-zero to descend into directories
+ * 
+ *   top - non-zero if pPath was given on the command line
+ */
+static void trailWalk(
+          TRAIL_LIST * pl,
+    const char       * pPath,
+          int          recursive,
+          int          top) {
+  
+  int rv = 0;
+  size_t slen = 0;
+  size_t suflen = 0;
+  DIR *pd = NULL;
+  struct dirent *pe = NULL;
+  char *pChild = NULL;
+  struct stat st;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pl == NULL) || (pPath == NULL)) {
+    abort();
+  }
+  
+  /* Get information about the path; command-line paths may be symbolic
+   * links, but links found while walking are not followed */
+  if (top) {
+    rv = stat(pPath, &st);
+  } else {
+    rv = lstat(pPath, &st);
+  }
+  if (rv) {
+    fprintf(stderr, "%s: Failed to stat '%s'\n", pModule, pPath);
+    trailAdd(pl, pPath, -1);
+    return;
+  }
+  
+  slen = strlen(pPath);
+  if (S_ISDIR(st.st_mode)) {
+    /* Directories are only allowed when recursing */
+    if (!recursive) {
+      fprintf(stderr, "%s: '%s' is a directory; use -r\n",
+              pModule, pPath);
+      trailAdd(pl, pPath, -1);
+      return;
+    }
+  
+    pd = opendir(pPath);
+    if (pd == NULL) {
+      fprintf(stderr, "%s: Failed to open directory '%s'\n",
+              pModule, pPath);
+      trailAdd(pl, pPath, -1);
+      return;
+    }
+  
+    for(pe = readdir(pd); pe != NULL; pe = readdir(pd)) {
+      if ((strcmp(pe->d_name, ".") == 0) ||
+            (strcmp(pe->d_name, "..") == 0)) {
+        continue;
+      }
+  
+      pChild = (char *) malloc(slen + strlen(pe->d_name) + 2);
+      if (pChild == NULL) {
+        abort();
+      }
+      strcpy(pChild, pPath);
+      if ((slen < 1) || (pPath[slen - 1] != '/')) {
+        strcat(pChild, "/");
+      }
+      strcat(pChild, pe->d_name);
+  
+      trailWalk(pl, pChild, recursive, 0);
+  
+      free(pChild);
+      pChild = NULL;
+    }
+  
+    closedir(pd);
+    pd = NULL;
+  
+  } else if (S_ISREG(st.st_mode)) {
+    /* Files found while walking must be scrambled files */
+    if (!top) {
+      suflen = strlen(FILE_SUFFIX);
+      if (slen <= suflen) {
+        return;
+      }
+      if (strcmp(&(pPath[slen - suflen]), FILE_SUFFIX) != 0) {
+        return;
+      }
+    }
+    trailAdd(pl, pPath, (int64_t) st.st_size);
+  
+  } else if (top) {
+    fprintf(stderr, "%s: '%s' is not a regular file!\n", pModule, pPath);
+    trailAdd(pl, pPath, -1);
+  }
+}
+
+/*
+ * Read the trailer of a listed file and recover its key.
+ * 
+ * The length from the listing is used to locate the trailer, so only
+ * one read is needed.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   pf - the file
+ * 
+ * Return:
+ * 
+ *   the recovered normalized key, or -1 if error
+ */
+static int32_t trailRead(const TRAIL_FILE *pf) {
+  int32_t key = -1;
+  int fh = -1;
+  uint8_t trail[3];
+  
+  /* Initialize arrays */
+  memset(trail, 0, 3);
+  
+  /* Check parameters */
+  if (pf == NULL) {
+    abort();
+  }
+  
+  /* Files that failed to list have already been reported */
+  if (pf->size < 0) {
+    return -1;
+  }
+  if (pf->size < 3) {
+    fprintf(stderr, "%s: '%s' is less than three bytes long!\n",
+            pModule, pf->pPath);
+    return -1;
+  }
+  
+  fh = open(pf->pPath, O_RDONLY);
+  if (fh < 0) {
+    fprintf(stderr, "%s: Failed to open '%s'\n", pModule, pf->pPath);
+    return -1;
+  }
+  
+  if (pread(fh, trail, 3, (off_t) (pf->size - 3)) == 3) {
+    key = warp64_recover(pf->size - 3, trail);
+  } else {
+    fprintf(stderr, "%s: Failed to read from '%s'!\n",
+            pModule, pf->pPath);
+  }
+  
+  close(fh);
+  fh = -1;
+  
+  return key;
+}
+
+/*
+ * Worker thread function for batch mode.
+ * 
+ * The worker claims files one at a time until there are none left.
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to the TRAIL_LIST
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *trailWorker(void *pArg) {
+  TRAIL_LIST *pl = NULL;
+  int64_t f = 0;
+  
+  if (pArg == NULL) {
+    abort();
+  }
+  pl = (TRAIL_LIST *) pArg;
+  
+  for(;;) {
+    if (pthread_mutex_lock(&(pl->lock))) {
+      abort();
+    }
+    f = -1;
+    if (pl->next < pl->nfile) {
+      f = pl->next;
+      (pl->next)++;
+    }
+    if (pthread_mutex_unlock(&(pl->lock))) {
+      abort();
+    }
+    if (f < 0) {
+      break;
+    }
+  
+    (pl->pFiles)[f].key = trailRead(&((pl->pFiles)[f]));
+  }
+  
+  return NULL;
+}
+
+/*
+ * Comparison function for sorting the batch list by key and then by
+ * listing order, with errors last.
+ * 
+ * Parameters:
+ * 
+ *   pA - the first TRAIL_FILE
+ * 
+ *   pB - the second TRAIL_FILE
+ * 
+ * Return:
+ * 
+ *   less than, equal to, or greater than zero
+ */
+static int trailCompare(const void *pA, const void *pB) {
+  const TRAIL_FILE *pfa = NULL;
+  const TRAIL_FILE *pfb = NULL;
+  int64_t ka = 0;
+  int64_t kb = 0;
+  
+  if ((pA == NULL) || (pB == NULL)) {
+    abort();
+  }
+  pfa = (const TRAIL_FILE *) pA;
+  pfb = (const TRAIL_FILE *) pB;
+  
+  ka = (int64_t) pfa->key;
+  kb = (int64_t) pfb->key;
+  if (ka < 0) {
+    ka = INT64_MAX;
+  }
+  if (kb < 0) {
+    kb = INT64_MAX;
+  }
+  
+  if (ka != kb) {
+    return (ka < kb) ? -1 : 1;
+  }
+  if (pfa->index != pfb->index) {
+    return (pfa->index < pfb->index) ? -1 : 1;
+  }
+  return 0;
+}
+
+/*
+ * Print a string as a CSV field, quoting it if necessary.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the string
+ */
+static void printCsvField(const char *pStr) {
+  if (pStr == NULL) {
+    abort();
+  }
+  
+  if (strpbrk(pStr, ",\"\r\n") == NULL) {
+    fputs(pStr, stdout);
+    return;
+  }
+  
+  putchar('"');
+  for( ; *pStr != 0; pStr++) {
+    if (*pStr == '"') {
+      putchar('"');
+    }
+    putchar(*pStr);
+  }
+  putchar('"');
+}
+
+/*
+ * Print a string as a quoted JSON string.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the string
+ */
+static void printJsonString(const char *pStr) {
+  int c = 0;
+  
+  if (pStr == NULL) {
+    abort();
+  }
+  
+  putchar('"');
+  for( ; *pStr != 0; pStr++) {
+    c = (int) *((const unsigned char *) pStr);
+    if ((c == '"') || (c == '\\')) {
+      putchar('\\');
+      putchar(c);
+    } else if (c < 0x20) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+/*
+ * Print the CSV report of a sorted batch list.
+ * 
+ * Parameters:
+ * 
+ *   pl - the list
+ */
+static void reportCsv(const TRAIL_LIST *pl) {
+  const TRAIL_FILE *pf = NULL;
+  char kstr[WARP64_KEYSTR + 1];
+  int64_t f = 0;
+  
+  memset(kstr, 0, WARP64_KEYSTR + 1);
+  
+  if (pl == NULL) {
+    abort();
+  }
+  
+  printf("key,path\n");
+  for(f = 0; f < pl->nfile; f++) {
+    pf = &((pl->pFiles)[f]);
+    if (pf->key >= 0) {
+      warp64_encode(pf->key, kstr);
+      fputs(kstr, stdout);
+    }
+    putchar(',');
+    printCsvField(pf->pPath);
+    putchar('\n');
+  }
+}
+
+/*
+ * Print the JSON report of a sorted batch list.
+ * 
+ * Parameters:
+ * 
+ *   pl - the list
+ */
+static void reportJson(const TRAIL_LIST *pl) {
+  const TRAIL_FILE *pf = NULL;
+  char kstr[WARP64_KEYSTR + 1];
+  int64_t f = 0;
+  int32_t last = -1;
+  int first = 1;
+  
+  memset(kstr, 0, WARP64_KEYSTR + 1);
+  
+  if (pl == NULL) {
+    abort();
+  }
+  
+  /* Recovered keys, each with its files */
+  printf("{\"keys\":[");
+  for(f = 0; f < pl->nfile; f++) {
+    pf = &((pl->pFiles)[f]);
+    if (pf->key < 0) {
+      break;
+    }
+    if ((f == 0) || (pf->key != last)) {
+      if (f > 0) {
+        printf("]},");
+      }
+      warp64_encode(pf->key, kstr);
+      printf("{\"key\":\"%s\",\"files\":[", kstr);
+      last = pf->key;
+    } else {
+      putchar(',');
+    }
+    printJsonString(pf->pPath);
+  }
+  if (f > 0) {
+    printf("]}");
+  }
+  
+  /* Files whose trailer couldn't be read, which sort last */
+  printf("],\"errors\":[");
+  for( ; f < pl->nfile; f++) {
+    if (!first) {
+      putchar(',');
+    }
+    printJsonString((pl->pFiles)[f].pPath);
+    first = 0;
+  }
+  printf("]}\n");
+}
+
+/*
+ * Recover the keys of many files and report them grouped by key.
+ * 
+ * Error messages are printed.
+ * 
+ * Parameters:
+ * 
+ *   ppPath - the paths given on the command line
+ * 
+ *   npath - the number of paths
+ * 
+ *   recursive - non-zero to descend into directories
+ * 
+ *   threads - the number of reader threads
+ * 
+ *   format - FORMAT_CSV or FORMAT_JSON
+ * 
+ * Return:
+ * 
+ *   non-zero if every trailer was read, zero if not
+ */
+static int trailBatch(
+    char ** ppPath,
+    int     npath,
+    int     recursive,
+    int     threads,
+    int     format) {
+  
+  int status = 1;
+  int tc = 0;
+  int started = 0;
+  int i = 0;
+  int64_t f = 0;
+  pthread_t *pThreads = NULL;
+  TRAIL_LIST list;
+  
+  /* Initialize structures */
+  memset(&list, 0, sizeof(TRAIL_LIST));
+  
+  /* Check parameters */
+  if ((ppPath == NULL) || (npath < 1) || (threads < 1)) {
+    abort();
+  }
+  
+  if (pthread_mutex_init(&(list.lock), NULL)) {
+    abort();
+  }
+  
+  /* Build the file list */
+  for(i = 0; i < npath; i++) {
+    trailWalk(&list, ppPath[i], recursive, 1);
+  }
+  
+  /* Read the trailers */
+  tc = threads;
+  if (list.nfile < (int64_t) tc) {
+    tc = (int) list.nfile;
+  }
+  if (tc > 1) {
+    pThreads = (pthread_t *) calloc((size_t) tc, sizeof(pthread_t));
+    if (pThreads == NULL) {
+      abort();
+    }
+    for(i = 0; i < tc; i++) {
+      if (pthread_create(&(pThreads[i]), NULL, &trailWorker, &list)) {
+        fprintf(stderr, "%s: Failed to start reader thread!\n", pModule);
+        break;
+      }
+      started++;
+    }
+  }
+  if (started < 1) {
+    trailWorker(&list);
+  }
+  for(i = 0; i < started; i++) {
+    if (pthread_join(pThreads[i], NULL)) {
+      abort();
+    }
+  }
+  free(pThreads);
+  pThreads = NULL;
+  
+  /* Group the files by key and report them */
+  if (list.nfile > 1) {
+    qsort(list.pFiles, (size_t) list.nfile, sizeof(TRAIL_FILE),
+          &trailCompare);
+  }
+  if (format == FORMAT_JSON) {
+    reportJson(&list);
+  } else {
+    reportCsv(&list);
+  }
+  if (fflush(stdout)) {
+    status = 0;
+    fprintf(stderr, "%s: Failed to write report!\n", pModule);
+  }
+  
+  /* Release the list, noting any errors */
+  for(f = 0; f < list.nfile; f++) {
+    if ((list.pFiles)[f].key < 0) {
+      status = 0;
+    }
+    free((list.pFiles)[f].pPath);
+  }
+  free(list.pFiles);
+  list.pFiles = NULL;
+  if (pthread_mutex_destroy(&(list.lock))) {
+    abort();
+  }
+  
+  return status;
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  int status = 1;
+  int i = 0;
+  
+  int batch = 0;
+  int recursive = 0;
+  int threads = TRAIL_DEPTH;
+  int format = FORMAT_CSV;
+  int npath = 0;
+  long lval = 0;
+  char *pEnd = NULL;
+  char **ppPath = NULL;
+  
+  /* Get the module name */
+  pModule = NULL;
+  if ((argc > 0) && (argv != NULL)) {
+    pModule = argv[0];
+  }
+  if (pModule == NULL) {
+    pModule = "warptrail3";
+  }
+  
+  /* If no parameters provided, print help screen and fail */
+  if (argc <= 1) {
+    status = 0;
+    fprintf(stderr, "Warp64 trailer examination\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Syntax:\n");
+    fprintf(stderr, "  warptrail3 [input_path]\n");
+    fprintf(stderr, "  warptrail3 [options] [path] [path] ...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[input_path] is path to input file\n");
+    fprintf(stderr, "Several paths or options recover keys in batch\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -r          walk directories for .warp64 files\n");
+    fprintf(stderr, "  -j [count]  reads in flight (0 for one per CPU)\n");
+    fprintf(stderr, "  -f csv      report as CSV (default)\n");
+    fprintf(stderr, "  -f json     report as JSON\n");
+  }
+  
+  /* Check that parameters are present */
+  if (status) {
+    if (argv == NULL) {
+      abort();
+    }
+    for(i = 0; i < argc; i++) {
+      if (argv[i] == NULL) {
+        abort();
+      }
+    }
+  }
+  
+  /* Allocate the path list */
+  if (status) {
+    ppPath = (char **) calloc((size_t) argc, sizeof(char *));
+    if (ppPath == NULL) {
+      abort();
+    }
+  }
+  
+  /* Parse the options and paths */
+  for(i = 1; status && (i < argc); i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      recursive = 1;
+      batch = 1;
+  
+    } else if (strcmp(argv[i], "-j") == 0) {
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: -j requires a thread count!\n", pModule);
+      }
+      if (status) {
+        pEnd = NULL;
+        lval = strtol(argv[i], &pEnd, 10);
+        if ((pEnd == argv[i]) || (*pEnd != 0) ||
+            (lval < 0) || (lval > MAX_THREADS)) {
+          status = 0;
+          fprintf(stderr, "%s: Thread count must be in range 0-%d!\n",
+                  pModule, MAX_THREADS);
+        }
+      }
+      if (status) {
+        if (lval == 0) {
+          lval = sysconf(_SC_NPROCESSORS_ONLN);
+          if (lval < 1) {
+            lval = 1;
+          } else if (lval > MAX_THREADS) {
+            lval = MAX_THREADS;
+          }
+        }
+        threads = (int) lval;
+        batch = 1;
+      }
+  
+    } else if (strcmp(argv[i], "-f") == 0) {
+      i++;
+      if (i >= argc) {
+        status = 0;
+        fprintf(stderr, "%s: -f requires a format!\n", pModule);
+      } else if (strcmp(argv[i], "csv") == 0) {
+        format = FORMAT_CSV;
+      } else if (strcmp(argv[i], "json") == 0) {
+        format = FORMAT_JSON;
+      } else {
+        status = 0;
+        fprintf(stderr, "%s: Unknown format '%s'!\n", pModule, argv[i]);
+      }
+      batch = 1;
+  
+    } else if ((argv[i][0] == '-') && (argv[i][1] != 0)) {
+      status = 0;
+      fprintf(stderr, "%s: Unknown option '%s'\n", pModule, argv[i]);
+  
+    } else {
+      ppPath[npath] = argv[i];
+      npath++;
+    }
+  }
+  
+  /* Must be at least one path, and several paths select batch mode */
+  if (status && (npath < 1)) {
+    status = 0;
+    fprintf(stderr, "%s: Wrong number of parameters!\n", pModule);
+  }
+  if (npath > 1) {
+    batch = 1;
+  }
+  
+  /* Examine the files */
+  if (status && batch) {
+    if (!trailBatch(ppPath, npath, recursive, threads, format)) {
+      status = 0;
+    }
+  
+  } else if (status) {
+    if (!trailOne(ppPath[0])) {
+      status = 0;
+    }
+  }
+  
+  /* Free the path list */
+  if (ppPath != NULL) {
+    free(ppPath);
+    ppPath = NULL;
   }
   
   /* Invert status and return */